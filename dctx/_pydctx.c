@@ -131,6 +131,18 @@ static PyObject *py_dctx_close(py_dctx_t *self){
     Py_RETURN_NONE;
 }
 
+static char * const py_dctx_fileno_doc =
+    "fileno() -> int\n"
+    "a descriptor which polls readable once any operation completes; read 8\n"
+    "bytes from it to clear it.  It is closed along with the DCTX.";
+static PyObject *py_dctx_fileno(py_dctx_t *self){
+    if(!self->open){
+        PyErr_SetString(pysm_error, "DCTX is closed");
+        return NULL;
+    }
+    return PyLong_FromLong(dctx_fileno(self->dctx));
+}
+
 static PyObject *py_dctx_enter(py_dctx_t *self){
     Py_INCREF(self);
     return (PyObject*)self;
@@ -320,6 +332,12 @@ static PyMethodDef py_dctx_methods[] = {
         .ml_flags = METH_NOARGS,
         .ml_doc = py_dctx_close_doc,
     },
+    {
+        .ml_name = "fileno",
+        .ml_meth = (PyCFunction)(void*)py_dctx_fileno,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = py_dctx_fileno_doc,
+    },
     {
         .ml_name = "__enter__",
         .ml_meth = (PyCFunction)(void*)py_dctx_enter,
@@ -468,6 +486,10 @@ static int py_dc_op_init(py_dc_op_t *self, PyObject *args, PyObject *kwds){
 }
 
 
+static PyObject *py_dc_op_test(py_dc_op_t *self){
+    return PyBool_FromLong(dc_op_test(self->op));
+}
+
 static PyObject *py_dc_op_wait(py_dc_op_t *self){
     // TODO: any way to support async behavior?
     dc_result_t *r = dc_op_await(self->op);
@@ -520,6 +542,12 @@ fail:
 }
 
 static PyMethodDef py_dc_op_methods[] = {
+    {
+        .ml_name = "test",
+        .ml_meth = (PyCFunction)(void*)py_dc_op_test,
+        .ml_flags = METH_NOARGS,
+        .ml_doc = "test() -> bool\nwhether wait() would return at once",
+    },
     {
         .ml_name = "wait",
         .ml_meth = (PyCFunction)(void*)py_dc_op_wait,
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "internal.h"
+
+/* How long it takes to match one call against the inflight ops, with 10 to
+   10000 of them inflight (say, one per layer of a model).  The index keeps
+   this flat; the linear scan it replaced grows with the number of ops. */
+
+#define NLOOKUPS 200000
+
+static double now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+// what matching cost before the index: the whole inflight list, by name
+static dc_op_t *linear_find(
+    dctx_t *dctx, dc_op_type_e type, const char *series
+){
+    dc_op_t *op, *temp;
+    LINK_FOR_EACH_SAFE(op, temp, &dctx->a.inflight, dc_op_t, link){
+        if(op->type != type) continue;
+        if(!zstreq(op->series, series)) continue;
+        return op;
+    }
+    return NULL;
+}
+
+static int bench(dctx_t *dctx, size_t nops){
+    int retval = 1;
+    char (*names)[32] = malloc(nops * sizeof(*names));
+    dc_op_t **ops = calloc(nops, sizeof(*ops));
+    if(!names || !ops){
+        perror("malloc");
+        goto done;
+    }
+
+    // no loop thread may touch the ops while we hold the mutex
+    pthread_mutex_lock(&dctx->mutex);
+    for(size_t i = 0; i < nops; i++){
+        snprintf(names[i], sizeof(names[i]), "layer%zu", i);
+        ops[i] = get_op_for_call_locked(
+            dctx, DC_OP_GATHER, names[i], strlen(names[i])
+        );
+        if(!ops[i]) goto unlock;
+    }
+
+    // every lookup finds an existing op, spread over all of them
+    double t0 = now();
+    for(size_t i = 0; i < NLOOKUPS; i++){
+        size_t n = (i * 7919) % nops;
+        dc_op_t *op = get_op_for_call_locked(
+            dctx, DC_OP_GATHER, names[n], strlen(names[n])
+        );
+        if(op != ops[n]){
+            printf("matched the wrong op!\n");
+            goto unlock;
+        }
+    }
+    double t1 = now();
+    for(size_t i = 0; i < NLOOKUPS; i++){
+        size_t n = (i * 7919) % nops;
+        if(linear_find(dctx, DC_OP_GATHER, names[n]) != ops[n]){
+            printf("scanned the wrong op!\n");
+            goto unlock;
+        }
+    }
+    double t2 = now();
+
+    printf(
+        "%6zu inflight: %8.1f ns/match indexed, %10.1f ns/match scanned\n",
+        nops,
+        1e9 * (t1 - t0) / NLOOKUPS,
+        1e9 * (t2 - t1) / NLOOKUPS
+    );
+    retval = 0;
+
+unlock:
+    for(size_t i = 0; i < nops; i++){
+        if(!ops[i]) continue;
+        link_remove(&ops[i]->link);
+        op_index_remove(ops[i]);
+        dc_op_free(ops[i]);
+    }
+    pthread_mutex_unlock(&dctx->mutex);
+
+done:
+    free(names);
+    free(ops);
+    return retval;
+}
+
+int main(int argc, char **argv){
+    const char *svc = argc > 1 ? argv[1] : "1299";
+    dctx_t *dctx;
+    // a lone chief is enough to hold ops
+    int ret = dctx_open(&dctx, 0, 1, 0, 1, 0, 1, "localhost", svc);
+    if(ret){
+        printf("dctx_open failed! %d\n", ret);
+        return 1;
+    }
+
+    size_t sizes[] = {10, 100, 1000, 10000};
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++){
+        if(bench(dctx, sizes[i])) ret = 1;
+    }
+
+    dctx_close(&dctx);
+    return ret;
+}
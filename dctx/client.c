@@ -95,16 +95,24 @@ void conn_cb(uv_connect_t *req, int status){
     dctx->client.gai = NULL;
 
     // start reading
-    int ret = uv_read_start((uv_stream_t*)&dctx->tcp, allocator, read_cb);
-    if(ret < 0){
-        uv_perror("uv_read_start", ret);
-        goto fail;
-    }
+    int ret = tcp_read_start(&dctx->tcp);
+    if(ret) goto fail;
 
-    // send our rank as our first message
-    char buf[INIT_MSG_SIZE] = {0};
-    size_t buflen = marshal_init(buf, dctx->rank);
-    ret = tcp_write_copy(&dctx->tcp, buf, buflen);
+    // open a listener for our peers before the chief can tell anybody about it
+    uint16_t port;
+    ret = mesh_listen(dctx, &port);
+    if(ret) goto fail;
+
+    // say who we are and what we can take, as our first message
+    ret = tcp_hello(&dctx->tcp, port);
+    if(ret) goto fail;
+
+    // then any extra connections, which say who they are themselves
+    ret = stripe_dial(dctx);
+    if(ret) goto fail;
+
+    // we might be on the chief's host
+    ret = shm_offer(dctx, &dctx->tcp, 0);
     if(ret) goto fail;
 
     // now we should be promoted to being a peer
@@ -181,14 +189,69 @@ static void on_unmarshal(dc_unmarshal_t *u, void *arg){
     dc_op_t *op;
 
     switch(u->type){
-        case 'i':
-            rprintf("got init message on client\n");
-            goto fail;
+        case 'h':
+            // the chief's answer to our hello
+            if(u->rank != 0){
+                rprintf("got hello from rank %u on client\n", u->rank);
+                goto fail;
+            }
+            if(tcp_on_hello(&dctx->tcp, u)) goto fail;
+            break;
 
         case 'g':
             rprintf("got gather message on client\n");
             goto fail;
 
+        case 't':
+            if(mesh_on_table(dctx, u->body, u->len)) goto fail;
+            break;
+
+        case 'w':
+            // the chief released a barrier
+            op = get_op_for_recv(dctx, DC_OP_BARRIER, u->series, u->slen, 0);
+            if(!op) goto fail;
+
+            op->u.barrier.worker.released = true;
+            mark_op_completed_and_notify(op);
+            break;
+
+        case 'R':
+            // the chief is our left neighbour
+            if(ring_recv(dctx, u, 0)) goto fail;
+            break;
+
+        case 'T':
+            if(tree_recv(dctx, u, 0)) goto fail;
+            break;
+
+        case 'C':
+            if(tree_chunk_recv(dctx, u, 0)) goto fail;
+            break;
+
+        case 'A':
+            if(allgather_chunk_recv(dctx, u, 0)) goto fail;
+            break;
+
+        case 'x':
+            if(alltoall_recv(dctx, u, 0)) goto fail;
+            break;
+
+        case 'p':
+            if(p2p_recv(dctx, u, 0)) goto fail;
+            break;
+
+        case 'M':
+            if(shm_on_offer(dctx, &dctx->tcp, u->body, u->len)) goto fail;
+            break;
+
+        case 'm':
+            if(shm_on_ack(dctx, &dctx->tcp, u->kind)) goto fail;
+            break;
+
+        case 'd':
+            if(shm_on_bell(dctx, &dctx->tcp, on_unmarshal, dctx)) goto fail;
+            break;
+
         case 'b':
             // find the op or create a new one
             op = get_op_for_recv(dctx, DC_OP_BROADCAST, u->series, u->slen, 0);
@@ -204,6 +267,21 @@ static void on_unmarshal(dc_unmarshal_t *u, void *arg){
             #undef OP
             break;
 
+        case 'c':
+            // find the op or create a new one
+            op = get_op_for_recv(dctx, DC_OP_SCATTER, u->series, u->slen, 0);
+            if(!op) goto fail;
+
+            #define OP op->u.scatter.worker
+            OP.len = u->len;
+            OP.recvd = u->body;
+            u->body = NULL;
+            if(OP.called){
+                mark_op_completed_and_notify(op);
+            }
+            #undef OP
+            break;
+
         case 'a':
             // find the op for u->rank
             op = get_op_for_recv(
@@ -215,7 +293,40 @@ static void on_unmarshal(dc_unmarshal_t *u, void *arg){
             OP.len[u->rank] = u->len;
             OP.recvd[u->rank] = u->body;
             u->body = NULL;
-            if(++OP.nrecvd == (size_t)dctx->size){
+            if(++OP.nrecvd == (size_t)dctx->size && OP.nwritten){
+                mark_op_completed_and_notify(op);
+            }
+            #undef OP
+            break;
+
+        case 'r':
+        case 's':
+            // find the op for the result
+            op = get_op_for_recv(
+                dctx,
+                u->type == 'r' ? DC_OP_ALLREDUCE : DC_OP_REDUCE_SCATTER,
+                u->series,
+                u->slen,
+                0
+            );
+            if(!op) goto fail;
+
+            #define OP op->u.allreduce.worker
+            // reduce-scatter results are just our chunk
+            size_t want = OP.datalen;
+            if(u->type == 's') want /= (size_t)dctx->size;
+            if(
+                u->dtype != op->dtype
+                || u->reduce != op->reduce
+                || u->len != want
+            ){
+                rprintf("reduce result does not match our contribution\n");
+                goto fail;
+            }
+            OP.len = u->len;
+            OP.recvd = u->body;
+            u->body = NULL;
+            if(OP.written){
                 mark_op_completed_and_notify(op);
             }
             #undef OP
@@ -235,9 +346,23 @@ fail:
 static void on_read(
     dctx_t *dctx, uv_stream_t *stream, char *buf, size_t len
 ){
-    (void)stream;
+    if(stream != (uv_stream_t*)&dctx->tcp){
+        dc_conn_t *conn = stream->data;
+        if(!conn->stripe){
+            // a direct link from one of our peers
+            mesh_on_read(dctx, stream, buf, len);
+            return;
+        }
+        // slices from the chief, which a striped body may be waiting for
+        stripe_on_read(dctx, conn, buf, len);
+        if(dctx->closed) return;
+        buf = NULL;
+        len = 0;
+    }
 
-    int ret = unmarshal(&dctx->client.unmarshal, buf, len, on_unmarshal, dctx);
+    int ret = unmarshal(
+        &dctx->client.state.unmarshal, buf, len, on_unmarshal, dctx
+    );
     if(ret) goto fail;
 
     return;
@@ -258,6 +383,8 @@ int init_client(dctx_t *dctx){
     ret = uv_tcp_nodelay(&dctx->tcp, 1);
     if(ret < 0) uv_perror("warning: uv_tcp_nodelay failed", ret);
 
+    dc_link_init(&dctx->client.state);
+
     ret = uv_timer_init(&dctx->loop, &dctx->client.timer);
     if(ret < 0){
         uv_perror("uv_timer_init", ret);  // TODO
@@ -0,0 +1,63 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+static bool env_bool(const char *name, bool dflt){
+    const char *val = getenv(name);
+    if(!val || !*val) return dflt;
+    if(strcmp(val, "0") == 0) return false;
+    if(strcmp(val, "false") == 0) return false;
+    if(strcmp(val, "no") == 0) return false;
+    return true;
+}
+
+// a plain decimal no bigger than max; anything else keeps the default
+static size_t env_uint(const char *name, size_t dflt, size_t max){
+    const char *val = getenv(name);
+    if(!val || !*val) return dflt;
+    char *end;
+    errno = 0;
+    unsigned long long out = strtoull(val, &end, 10);
+    // strtoull would skip spaces, and quietly wrap a '-'
+    if(*val < '0' || *val > '9' || *end != '\0' || errno || out > max){
+        fprintf(stderr, "ignoring invalid %s=%s\n", name, val);
+        return dflt;
+    }
+    return (size_t)out;
+}
+
+static size_t env_size(const char *name, size_t dflt){
+    return env_uint(name, dflt, SIZE_MAX);
+}
+
+void dc_config_load(dc_config_t *cfg){
+    *cfg = (dc_config_t){
+        .ring = env_bool("DCTX_RING", true),
+        .ring_min_bytes = env_size("DCTX_RING_MIN_BYTES", 64 * 1024),
+        .tree = env_bool("DCTX_TREE", true),
+        .tree_min_bytes = env_size("DCTX_TREE_MIN_BYTES", 64 * 1024),
+        .hier = env_bool("DCTX_HIER", true),
+        .p2p = env_bool("DCTX_P2P", true),
+        .shm = env_bool("DCTX_SHM", true),
+        .shm_ring_bytes = env_size("DCTX_SHM_RING_BYTES", 1024 * 1024),
+        .chunk_bytes = env_size("DCTX_CHUNK_BYTES", 256 * 1024),
+        .intern = env_bool("DCTX_INTERN", true),
+        .compress = env_bool("DCTX_COMPRESS", false),
+        .compress_min_bytes = env_size("DCTX_COMPRESS_MIN_BYTES", 4096),
+        .stripes = env_size("DCTX_STRIPES", 1),
+        .stripe_min_bytes = env_size("DCTX_STRIPE_MIN_BYTES", 256 * 1024),
+        .io_uring = env_bool("DCTX_IO_URING", false),
+        .cork_bytes = env_size("DCTX_CORK_BYTES", 64 * 1024),
+        .features = (uint32_t)env_uint("DCTX_FEATURES", FEAT_ALL, UINT32_MAX)
+                    & FEAT_ALL,
+        .frame_max = env_uint("DCTX_FRAME_MAX", FRAME_MAX, FRAME_MAX),
+    };
+    // a striped len has room for only so many slices
+    if(cfg->stripes < 1) cfg->stripes = 1;
+    if(cfg->stripes > STRIPES_MAX) cfg->stripes = STRIPES_MAX;
+    // a peer would refuse a link which takes no bodies at all
+    if(cfg->frame_max == 0) cfg->frame_max = FRAME_MAX;
+}
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include "internal.h"
 
@@ -92,6 +94,8 @@ static void *dctx_thread(void *arg){
     pthread_mutex_lock(&dctx->mutex);
     dctx->status = DCTX_DONE;
     pthread_cond_broadcast(&dctx->cond);
+    // no op left will block dc_op_await now
+    completion_signal(dctx);
     pthread_mutex_unlock(&dctx->mutex);
 
     return NULL;
@@ -128,9 +132,17 @@ void advance_state(dctx_t *dctx){
         if(dctx->rank == 0){
             // chief checks all peers are connected
             if(dctx->server.npeers + 1 < (size_t)dctx->size) goto unlock;
+            // and all of their extra connections too
+            if(!stripe_ready(dctx)) goto unlock;
+            // then tells them how to reach each other
+            if(mesh_send_table(dctx)) goto fail;
         }else{
             // worker checks if it has connected to chief
             if(!dctx->client.connected) goto unlock;
+            // and to whichever peers it needs
+            if(!mesh_ready(dctx)) goto unlock;
+            // with as many connections to the chief as it wants
+            if(!stripe_ready(dctx)) goto unlock;
         }
 
         dctx->a.ready = true;
@@ -161,8 +173,11 @@ fail:
 }
 
 
+static void cork_prepare_cb(uv_prepare_t *handle);
+
 static void async_cb(uv_async_t *handle){
     dctx_t *dctx = handle->loop->data;
+    dc_write_run_done(dctx);
     advance_state(dctx);
 }
 
@@ -208,6 +223,9 @@ int dctx_open(
     const char *chief_svc
 ){
 
+    // pick reduction kernels before any thread could need them
+    dc_reduce_init();
+
     dctx_t *dctx = malloc(sizeof(*dctx));
     if(!dctx) return 1;
     *dctx = (dctx_t){
@@ -217,7 +235,10 @@ int dctx_open(
         .local_size = local_size,
         .cross_rank = cross_rank,
         .cross_size = cross_size,
+        .efd = -1,
     };
+    dc_config_load(&dctx->cfg);
+    dctx->hier = dctx->cfg.hier && hier_layout_ok(dctx);
 
     dctx->host = strdup(chief_host);
     if(!dctx->host){
@@ -252,6 +273,29 @@ int dctx_open(
         }
     }
 
+    ret = op_index_init(dctx);
+    if(ret) return 1; // TODO
+
+    ret = mesh_init(dctx);
+    if(ret) return 1; // TODO
+
+    ret = stripe_init(dctx);
+    if(ret) return 1; // TODO
+
+    ret = uring_init(dctx);
+    if(ret) return 1; // TODO
+
+    ret = uv_prepare_init(&dctx->loop, &dctx->cork_prepare);
+    if(ret < 0){
+        uv_perror("uv_prepare_init", ret); // TODO
+        return 2;
+    }
+    ret = uv_prepare_start(&dctx->cork_prepare, cork_prepare_cb);
+    if(ret < 0){
+        uv_perror("uv_prepare_start", ret); // TODO
+        return 2;
+    }
+
     ret = uv_async_init(&dctx->loop, &dctx->async, async_cb);
     if(ret < 0){
         uv_perror("uv_async_init", ret); // TODO
@@ -270,6 +314,12 @@ int dctx_open(
         return 1;
     }
 
+    dctx->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(dctx->efd < 0){
+        perror("eventfd"); // TODO
+        return 1;
+    }
+
     ret = pthread_create(&dctx->thread, NULL, dctx_thread, dctx);
     if(ret != 0){
         perror("pthread_create"); // TODO
@@ -318,6 +368,12 @@ void dctx_close2(dctx_t *dctx){
     pthread_cond_destroy(&dctx->cond);
     pthread_mutex_destroy(&dctx->mutex);
     uv_loop_close(&dctx->loop);
+    close(dctx->efd);
+
+    // queued shared-memory and io_uring writes may still point at ops
+    if(dctx->rank > 0) dc_link_free(dctx, &dctx->client.state);
+    uring_free(dctx);
+    dc_write_run_done(dctx);
 
     // free inflight and completed ops
     link_t *link;
@@ -338,13 +394,66 @@ void dctx_close2(dctx_t *dctx){
         // client
         uv_freeaddrinfo(dctx->client.gai);
         dctx->client.gai = NULL;
-        unmarshal_free(&dctx->client.unmarshal);
     }
+    mesh_free(dctx);
+    stripe_free(dctx);
+    op_index_free(dctx);
+    intern_free(&dctx->sopts.series);
+    free(dctx->sopts.opts);
+    slab_release(&dctx->slab);
     free(dctx->host);
     free(dctx->svc);
     free(dctx);
 }
 
+// the caller must hold dctx->mutex; returns NULL on error
+static dc_series_opts_t *series_opts(
+    dctx_t *dctx, const char *series, size_t slen
+){
+    if(slen > 256){
+        fprintf(stderr, "series name length must not exceed 256\n");
+        return NULL;
+    }
+    // make room first, in case series is new
+    size_t n = dctx->sopts.series.n + 1;
+    dc_series_opts_t *opts = realloc(dctx->sopts.opts, n * sizeof(*opts));
+    if(!opts){
+        perror("realloc");
+        return NULL;
+    }
+    dctx->sopts.opts = opts;
+    bool fresh;
+    uint16_t id = intern_tx(&dctx->sopts.series, series, slen, &fresh);
+    if(id == INTERN_NOID){
+        fprintf(stderr, "too many series with settings\n");
+        return NULL;
+    }
+    if(fresh) opts[id] = (dc_series_opts_t){ .compress = -1, .wire = -1 };
+    return &opts[id];
+}
+
+int dctx_compress(dctx_t *dctx, const char *series, size_t slen, bool on){
+    pthread_mutex_lock(&dctx->mutex);
+    dc_series_opts_t *opts = series_opts(dctx, series, slen);
+    if(opts) opts->compress = on;
+    pthread_mutex_unlock(&dctx->mutex);
+    return !opts;
+}
+
+int dctx_wire_dtype(
+    dctx_t *dctx, const char *series, size_t slen, dc_dtype_e wire
+){
+    if(!dc_dtype_valid((int)wire)){
+        fprintf(stderr, "invalid wire dtype: %d\n", (int)wire);
+        return 1;
+    }
+    pthread_mutex_lock(&dctx->mutex);
+    dc_series_opts_t *opts = series_opts(dctx, series, slen);
+    if(opts) opts->wire = (int)wire;
+    pthread_mutex_unlock(&dctx->mutex);
+    return !opts;
+}
+
 char *bytesdup(const char *data, size_t len){
     char *out = malloc(len);
     if(!out){
@@ -355,6 +464,17 @@ char *bytesdup(const char *data, size_t len){
     return out;
 }
 
+int dctx_fileno(dctx_t *dctx){
+    return dctx->efd;
+}
+
+void completion_signal(dctx_t *dctx){
+    uint64_t one = 1;
+    // EAGAIN means the counter is full, which is still readable
+    ssize_t n = write(dctx->efd, &one, sizeof(one));
+    (void)n;
+}
+
 void noop_handle_closer(uv_handle_t *handle){
     (void)handle;
 };
@@ -364,8 +484,13 @@ void close_everything(dctx_t *dctx){
     if(dctx->closed) return;
     // close the async
     uv_close((uv_handle_t*)&dctx->async, noop_handle_closer);
+    uv_close((uv_handle_t*)&dctx->cork_prepare, noop_handle_closer);
     // close the main tcp
     if(dctx->tcp_open){
+        if(dctx->rank > 0){
+            tcp_uncork(&dctx->tcp);
+            uring_detach(&dctx->tcp);
+        }
         uv_close((uv_handle_t*)&dctx->tcp, noop_handle_closer);
         dctx->tcp_open = false;
     }
@@ -387,7 +512,12 @@ void close_everything(dctx_t *dctx){
             uv_close((uv_handle_t*)&dctx->client.timer, noop_handle_closer);
             dctx->client.timer_open = false;
         }
+        // and its direct links
+        mesh_close(dctx);
     }
+    // either side closes its extra connections
+    stripe_close(dctx);
+    uring_close(dctx);
     dctx->closed = true;
 }
 
@@ -396,14 +526,96 @@ void uv_perror(const char *msg, int ret){
     fprintf(stderr, "%s: %s\n", msg, uv_strerror(ret));
 }
 
+void dc_link_init(dc_link_t *link){
+    link->unmarshal.names = &link->series_rx;
+}
+
+void dc_link_free(dctx_t *dctx, dc_link_t *link){
+    unmarshal_free(&link->unmarshal);
+    slab_free(&dctx->slab, link->rbuf.base);
+    link->rbuf.base = NULL;
+    intern_free(&link->series_tx);
+    intern_free(&link->series_rx);
+    shm_free(dctx, link->shm);
+    link->shm = NULL;
+}
+
+dc_link_t *tcp_link(uv_tcp_t *tcp){
+    dctx_t *dctx = tcp->loop->data;
+    // the worker's link to the chief is not a dc_conn_t
+    if(dctx->rank > 0 && tcp == &dctx->tcp) return &dctx->client.state;
+    dc_conn_t *conn = tcp->data;
+    return &conn->state;
+}
+
+int tcp_hello(uv_tcp_t *tcp, uint16_t port){
+    dctx_t *dctx = tcp->loop->data;
+    char buf[HELLO_MSG_SIZE];
+    size_t buflen = marshal_hello(
+        buf, dctx->rank, port, dctx->cfg.features, dctx->cfg.frame_max
+    );
+    // and hold the peer to it
+    tcp_link(tcp)->unmarshal.len_max = dctx->cfg.frame_max;
+    return tcp_write_copy(tcp, buf, buflen);
+}
+
+int tcp_on_hello(uv_tcp_t *tcp, dc_unmarshal_t *u){
+    dctx_t *dctx = tcp->loop->data;
+    dc_caps_t *caps = &tcp_link(tcp)->caps;
+    if(caps->frame_max){
+        rprintf("got a second hello from rank %u\n", u->rank);
+        return 1;
+    }
+    if(u->version != PROTOCOL_VERSION){
+        rprintf(
+            "rank %u speaks protocol version %u, but we speak %u\n",
+            u->rank, (unsigned)u->version, (unsigned)PROTOCOL_VERSION
+        );
+        return 1;
+    }
+    if(u->frame_max == 0){
+        rprintf("rank %u accepts no bodies at all\n", u->rank);
+        return 1;
+    }
+    // chunking is a choice for whole collectives, not for one link
+    if(dctx->cfg.chunk_bytes && !(u->features & FEAT_CHUNKS)){
+        rprintf(
+            "rank %u takes no chunks, but DCTX_CHUNK_BYTES is set\n", u->rank
+        );
+        return 1;
+    }
+    caps->features = u->features & dctx->cfg.features;
+    caps->frame_max = u->frame_max;
+    return 0;
+}
+
 void allocator(uv_handle_t *handle, size_t suggest, uv_buf_t *buf){
+    (void)suggest;
     dctx_t *dctx = handle->loop->data;
-    buf->base = malloc(suggest);
-    buf->len = suggest;
-    if(!buf->base){
-        perror("malloc");
-        goto fail;
+    dc_link_t *link = tcp_link((uv_tcp_t*)handle);
+    dc_unmarshal_t *u = &link->unmarshal;
+    dc_rbuf_t *rbuf = &link->rbuf;
+
+    // once a large body is underway, read the rest of it straight into place
+    size_t len;
+    char *space = unmarshal_body_space(u, RBUF_MIN, &len);
+    if(space){
+        buf->base = space;
+        buf->len = len;
+        return;
+    }
+
+    if(!rbuf->base){
+        if(!rbuf->cap) rbuf->cap = RBUF_MIN;
+        rbuf->base = slab_alloc(&dctx->slab, rbuf->cap);
+        if(!rbuf->base){
+            perror("malloc");
+            buf->len = 0;
+            goto fail;
+        }
     }
+    buf->base = rbuf->base;
+    buf->len = rbuf->cap;
     return;
 
 fail:
@@ -414,8 +626,8 @@ fail:
 void read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf){
     dctx_t *dctx = stream->loop->data;
     // handle error cases
+    // buffers belong to the stream's rbuf or unmarshaller, never to us
     if(nread < 1){
-        if(buf->base) free(buf->base);
         if(dctx->closed) return;
         if(nread == UV_EOF || nread == UV_ECONNRESET){
             // socket is closed
@@ -428,15 +640,31 @@ void read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf){
         }else if(nread == 0 || nread == UV_ECANCELED){
             // either EAGAIN or EWOULDBLOCK, or read was canceled
             return;
-        }else if(nread == 0){
-            return;
         }
         // any other error is fatal
         uv_perror("read_cb", (int)nread);
         goto fail;
     }
 
-    dctx->on_read(dctx, stream, buf->base, (size_t)nread);
+    dc_link_t *link = tcp_link((uv_tcp_t*)stream);
+    dc_unmarshal_t *u = &link->unmarshal;
+    dc_rbuf_t *rbuf = &link->rbuf;
+    size_t n = (size_t)nread;
+
+    if(unmarshal_landed(u, buf->base, n)){
+        // the bytes are already in the body, let the unmarshaller finish it
+        dctx->on_read(dctx, stream, buf->base + n, 0);
+        return;
+    }
+
+    dctx->on_read(dctx, stream, buf->base, n);
+
+    // a full buffer suggests a bulk transfer, so read more at a time
+    if(n == rbuf->cap && rbuf->cap < RBUF_MAX){
+        slab_free(&dctx->slab, rbuf->base);
+        rbuf->base = NULL;
+        rbuf->cap *= 2;
+    }
 
     return;
 
@@ -445,9 +673,21 @@ fail:
     close_everything(dctx);
 }
 
+int tcp_read_start(uv_tcp_t *tcp){
+    dctx_t *dctx = tcp->loop->data;
+    if(dctx->uring) return uring_read_start(tcp);
+    int ret = uv_read_start((uv_stream_t*)tcp, allocator, read_cb);
+    if(ret < 0){
+        uv_perror("uv_read_start", ret);
+        return 1;
+    }
+    return 0;
+}
+
 
 void dc_write_cb(uv_write_t *req, int status){
     dctx_t *dctx = req->handle->loop->data;
+    dc_write_t *w = (dc_write_t*)req;
     if(dctx->closed) goto handle_cb;
 
     if(status < 0){
@@ -464,49 +704,296 @@ fail:
     close_everything(dctx);
 
 handle_cb:
-    dc_write_cb_t *cb = req->data;
-    if(cb){
-        switch(cb->type){
-            case WRITE_CB_FREE:
-                free(cb->u.free);
-                free(cb);
-                break;
-            case WRITE_CB_OP:
-                dc_op_write_cb(cb->u.op);
-                break;
-        }
+    dc_write_cb_run(dctx, w->cb);
+    // then the writes which followed it into the same uv_write
+    link_t *link;
+    while((link = link_list_pop_first(&w->more))){
+        dc_write_t *more = CONTAINER_OF(link, dc_write_t, link);
+        dc_write_cb_run(dctx, more->cb);
+        dc_write_put(dctx, more);
     }
-    free(req);
+    dc_write_put(dctx, w);
     return;
 }
 
-int tcp_write_ex(uv_tcp_t *tcp, char *base, size_t len, dc_write_cb_t *cb){
-    uv_write_t *req = malloc(sizeof(*req));
-    if(!req){
+void dc_write_cb_run(dctx_t *dctx, dc_write_cb_t *cb){
+    if(!cb) return;
+    switch(cb->type){
+        case WRITE_CB_FREE: {
+            dc_write_cb_t *next = cb->next;
+            free(cb->u.free);
+            slab_free(&dctx->slab, cb);
+            dc_write_cb_run(dctx, next);
+            break;
+        }
+        case WRITE_CB_OP:
+            dc_op_write_cb(cb->u.op);
+            break;
+        case WRITE_CB_JOIN: {
+            if(--cb->u.join) break;
+            dc_write_cb_t *next = cb->next;
+            slab_free(&dctx->slab, cb);
+            dc_write_cb_run(dctx, next);
+            break;
+        }
+    }
+}
+
+dc_write_t *dc_write_get(dctx_t *dctx){
+    dc_write_t *w = slab_alloc(&dctx->slab, sizeof(*w));
+    if(!w){
         perror("malloc");
-        goto fail;
+        return NULL;
+    }
+    return w;
+}
+
+void dc_write_put(dctx_t *dctx, dc_write_t *w){
+    slab_free(&dctx->slab, w);
+}
+
+void dc_write_done(dctx_t *dctx, dc_write_t *w){
+    link_list_append(&dctx->wdone, &w->link);
+    if(!dctx->closed) uv_async_send(&dctx->async);
+}
+
+void dc_write_run_done(dctx_t *dctx){
+    link_t *link;
+    while((link = link_list_pop_first(&dctx->wdone))){
+        dc_write_t *w = CONTAINER_OF(link, dc_write_t, link);
+        dc_write_cb_run(dctx, w->cb);
+        dc_write_put(dctx, w);
+    }
+}
+
+// frames up to this size try to skip the write queue entirely
+#define TRY_WRITE_MAX 65536
+// no single uv_write carries more body than this
+#define WRITE_CHUNK_MAX ((size_t)1 << 30)
+
+int tcp_write_hdr(
+    uv_tcp_t *tcp,
+    const char *hdr,
+    size_t hdrlen,
+    char *base,
+    size_t len,
+    dc_write_cb_t *cb
+){
+    if(!shm_active(tcp)){
+        return tcp_write_raw(tcp, hdr, hdrlen, base, len, cb);
+    }
+    // links on our own host may have switched to shared memory
+    dctx_t *dctx = tcp->loop->data;
+    if(hdrlen > WRITE_HDR_MAXSIZE){
+        RBUG("message header too long");
+        return 1;
+    }
+    dc_write_t *w = dc_write_get(dctx);
+    if(!w) return 1;
+    if(hdrlen) memcpy(w->hdr, hdr, hdrlen);
+    w->hdrlen = hdrlen;
+    w->base = base;
+    w->len = len;
+    w->off = 0;
+    w->cb = cb;
+    return shm_write(tcp, w);
+}
+
+int tcp_write_ex(uv_tcp_t *tcp, char *base, size_t len, dc_write_cb_t *cb){
+    return tcp_write_hdr(tcp, NULL, 0, base, len, cb);
+}
+
+// a cork never holds more buffers than this
+#define CORK_BUFS_MAX 64
+
+// the buffers of cork's writes, after the first skip bytes
+static unsigned int cork_bufs(dc_cork_t *cork, size_t skip, uv_buf_t *bufs){
+    unsigned int nbufs = 0;
+    dc_write_t *w;
+    LINK_FOR_EACH(w, &cork->writes, dc_write_t, link){
+        if(skip < w->hdrlen){
+            bufs[nbufs++] = uv_buf_init(
+                w->hdr + skip, (unsigned int)(w->hdrlen - skip)
+            );
+            skip = 0;
+        }else{
+            skip -= w->hdrlen;
+        }
+        if(w->len > skip){
+            bufs[nbufs++] = uv_buf_init(
+                w->base + skip, (unsigned int)(w->len - skip)
+            );
+            skip = 0;
+        }else{
+            skip -= w->len;
+        }
+    }
+    return nbufs;
+}
+
+/* write out everything in cork with one uv_write, behind whatever the stream
+   already has queued.  On failure, every write is finished anyway. */
+static int cork_flush(dctx_t *dctx, uv_tcp_t *tcp, dc_cork_t *cork){
+    if(cork->tcp){
+        link_remove(&cork->link);
+        cork->tcp = NULL;
+    }
+
+    uv_buf_t bufs[CORK_BUFS_MAX];
+    unsigned int nbufs = cork_bufs(cork, 0, bufs);
+
+    // small batches usually fit in the socket buffer, with no write request
+    size_t skip = 0;
+    if(cork->nbytes <= TRY_WRITE_MAX && nbufs > 0){
+        int n = uv_try_write((uv_stream_t*)tcp, bufs, nbufs);
+        // on any error, the write request below reports it
+        if(n > 0) skip = (size_t)n;
     }
-    req->data = cb;
+    cork->nbytes = 0;
+    cork->nbufs = 0;
+
+    // writes which are written already
+    while(!link_list_isempty(&cork->writes)){
+        dc_write_t *w = CONTAINER_OF(cork->writes.next, dc_write_t, link);
+        size_t wlen = w->hdrlen + w->len;
+        if(wlen > skip) break;
+        skip -= wlen;
+        link_remove(&w->link);
+        dc_write_done(dctx, w);
+    }
+    if(link_list_isempty(&cork->writes)) return 0;
 
-    uv_buf_t buf = { .base = base, .len = len };
+    // the rest go out in the first one's uv_write
+    nbufs = cork_bufs(cork, skip, bufs);
+    dc_write_t *first = CONTAINER_OF(
+        link_list_pop_first(&cork->writes), dc_write_t, link
+    );
+    link_t *link;
+    while((link = link_list_pop_first(&cork->writes))){
+        link_list_append(&first->more, link);
+    }
 
-    int ret = uv_write(req, (uv_stream_t*)tcp, &buf, 1, dc_write_cb);
+    int ret = uv_write(
+        &first->req, (uv_stream_t*)tcp, bufs, nbufs, dc_write_cb
+    );
     if(ret < 0){
         uv_perror("uv_write", ret);
-        goto fail_req;
+        while((link = link_list_pop_first(&first->more))){
+            dc_write_done(dctx, CONTAINER_OF(link, dc_write_t, link));
+        }
+        dc_write_done(dctx, first);
+        return 1;
+    }
+    return 0;
+}
+
+static void cork_prepare_cb(uv_prepare_t *handle){
+    dctx_t *dctx = handle->loop->data;
+    link_t *link;
+    while((link = link_list_pop_first(&dctx->corked))){
+        dc_cork_t *cork = CONTAINER_OF(link, dc_cork_t, link);
+        // already out of dctx->corked
+        uv_tcp_t *tcp = cork->tcp;
+        cork->tcp = NULL;
+        if(cork_flush(dctx, tcp, cork)){
+            dctx->failed = true;
+            close_everything(dctx);
+        }
+    }
+}
+
+void tcp_uncork(uv_tcp_t *tcp){
+    dctx_t *dctx = tcp->loop->data;
+    dc_cork_t *cork = &tcp_link(tcp)->cork;
+    if(link_list_isempty(&cork->writes)) return;
+    // we are closing anyway, so a failure changes nothing
+    cork_flush(dctx, tcp, cork);
+}
+
+// one frame, for a body no bigger than WRITE_CHUNK_MAX
+static int write_frame(
+    uv_tcp_t *tcp,
+    const char *hdr,
+    size_t hdrlen,
+    char *base,
+    size_t len,
+    dc_write_cb_t *cb
+){
+    dctx_t *dctx = tcp->loop->data;
+
+    dc_write_t *w = dc_write_get(dctx);
+    if(!w) return 1;
+    if(hdrlen) memcpy(w->hdr, hdr, hdrlen);
+    w->hdrlen = hdrlen;
+    w->base = base;
+    w->len = len;
+    w->cb = cb;
+    w->more = (link_t){0};
+
+    if(uring_owns(tcp)){
+        // queued behind the socket's other writes, for the next submission
+        return uring_write(tcp, w);
     }
 
+    /* hold the frame until the end of this loop iteration, unless the cork
+       is full; either way it is ours now, like a shared-memory write */
+    dc_cork_t *cork = &tcp_link(tcp)->cork;
+    link_list_append(&cork->writes, &w->link);
+    cork->nbytes += hdrlen + len;
+    cork->nbufs += (size_t)(hdrlen > 0) + (size_t)(len > 0);
+    bool full = cork->nbytes >= dctx->cfg.cork_bytes
+                || cork->nbufs + 2 > CORK_BUFS_MAX;
+    if(!full && !dctx->closed){
+        if(!cork->tcp){
+            cork->tcp = tcp;
+            link_list_append(&dctx->corked, &cork->link);
+        }
+        return 0;
+    }
+    if(cork_flush(dctx, tcp, cork)){
+        dctx->failed = true;
+        close_everything(dctx);
+    }
     return 0;
+}
 
-fail_req:
-    free(req);
-fail:
-    return 1;
+int tcp_write_raw(
+    uv_tcp_t *tcp,
+    const char *hdr,
+    size_t hdrlen,
+    char *base,
+    size_t len,
+    dc_write_cb_t *cb
+){
+    dctx_t *dctx = tcp->loop->data;
+    if(hdrlen > WRITE_HDR_MAXSIZE){
+        RBUG("message header too long");
+        return 1;
+    }
+    /* huge bodies go out as a series of bounded writes, back to back in the
+       stream's queue, and only the last one finishes the message */
+    while(len > WRITE_CHUNK_MAX){
+        int ret = write_frame(tcp, hdr, hdrlen, base, WRITE_CHUNK_MAX, NULL);
+        if(ret) return ret;
+        hdr = NULL;
+        hdrlen = 0;
+        base += WRITE_CHUNK_MAX;
+        len -= WRITE_CHUNK_MAX;
+    }
+    return write_frame(tcp, hdr, hdrlen, base, len, cb);
 }
 
 // owns base
 int tcp_write(uv_tcp_t *tcp, char *base, size_t len){
-    dc_write_cb_t *cb = malloc(sizeof(*cb));
+    return tcp_write_hdr_free(tcp, NULL, 0, base, len);
+}
+
+// owns base
+int tcp_write_hdr_free(
+    uv_tcp_t *tcp, const char *hdr, size_t hdrlen, char *base, size_t len
+){
+    dctx_t *dctx = tcp->loop->data;
+    dc_write_cb_t *cb = slab_alloc(&dctx->slab, sizeof(*cb));
     if(!cb){
         perror("malloc");
         goto fail_base;
@@ -518,20 +1005,161 @@ int tcp_write(uv_tcp_t *tcp, char *base, size_t len){
         .u = { .free = base },
     };
 
-    int ret = tcp_write_ex(tcp, base, len, cb);
+    int ret = tcp_write_hdr(tcp, hdr, hdrlen, base, len, cb);
     if(ret) goto fail_cb;
 
     return 0;
 
 fail_cb:
-    free(cb);
+    slab_free(&dctx->slab, cb);
 fail_base:
     free(base);
     return 1;
 }
 
 
+size_t tcp_intern_hdr(
+    uv_tcp_t *tcp, const char *hdr, size_t hdrlen, char *out
+){
+    dctx_t *dctx = tcp->loop->data;
+    const unsigned char *uhdr = (const unsigned char*)hdr;
+    // marshal_*() writes names only: U, or 0xFE 0xFFFF LL for long ones
+    bool long_name = uhdr[1] == SERIES_DEF;
+    size_t spos = long_name ? 6 : 2;
+    size_t slen = long_name ? ((size_t)uhdr[4] << 8) | uhdr[5] : uhdr[1];
+    const char *series = &hdr[spos];
+    size_t restpos = spos + slen;
+    if(hdrlen + 4 > WRITE_HDR_MAXSIZE || restpos > hdrlen){
+        RBUG("bad header in tcp_intern_hdr");
+        return 0;
+    }
+
+    bool fresh = false;
+    uint16_t id = INTERN_NOID;
+    dc_link_t *link = tcp_link(tcp);
+    if(dctx->cfg.intern && (link->caps.features & FEAT_INTERN)){
+        id = intern_tx(&link->series_tx, series, slen, &fresh);
+    }
+    if(id == INTERN_NOID){
+        // by name, as it is
+        memcpy(out, hdr, hdrlen);
+        return hdrlen;
+    }
+
+    size_t n = 0;
+    out[n++] = hdr[0];
+    out[n++] = (char)(fresh ? SERIES_DEF : SERIES_REF);
+    out[n++] = (char)(0xFF & (id >> 8));
+    out[n++] = (char)(0xFF & id);
+    if(fresh){
+        out[n++] = (char)(0xFF & (slen >> 8));
+        out[n++] = (char)(0xFF & slen);
+        memcpy(&out[n], series, slen);
+        n += slen;
+    }
+    memcpy(&out[n], &hdr[restpos], hdrlen - restpos);
+    return n + hdrlen - restpos;
+}
+
+int tcp_frame_check(uv_tcp_t *tcp, size_t len){
+    dctx_t *dctx = tcp->loop->data;
+    // before its hello, all we know is that the peer speaks our version
+    dc_caps_t *caps = &tcp_link(tcp)->caps;
+    bool len64 = caps->features & FEAT_LEN64;
+    if(caps->frame_max && (
+        len > caps->frame_max || (len > UINT32_MAX && !len64)
+    )){
+        rprintf("a body of %zu bytes is too big for our peer\n", len);
+        return 1;
+    }
+    return 0;
+}
+
+int tcp_write_msg(
+    uv_tcp_t *tcp,
+    const char *hdr,
+    size_t hdrlen,
+    char *base,
+    size_t len,
+    dc_write_cb_t *cb
+){
+    if(tcp_frame_check(tcp, len)) return 1;
+    char out[WRITE_HDR_MAXSIZE];
+    size_t n = tcp_intern_hdr(tcp, hdr, hdrlen, out);
+    if(!n) return 1;
+    // big bodies may be split across the link's extra connections
+    size_t nslices = stripe_count(tcp, len);
+    if(nslices > 1){
+        return stripe_write(tcp, out, n, base, len, nslices, cb);
+    }
+    return tcp_write_hdr(tcp, out, n, base, len, cb);
+}
+
+int tcp_write_zmsg(
+    uv_tcp_t *tcp,
+    const char *hdr,
+    size_t hdrlen,
+    char *base,
+    size_t len,
+    dc_write_cb_t *cb
+){
+    dctx_t *dctx = tcp->loop->data;
+    // the peer's limit is on what it has to inflate, too
+    if(tcp_frame_check(tcp, len)) return 1;
+    // shared memory moves bytes faster than we could compress them
+    bool can = tcp_link(tcp)->caps.features & FEAT_COMPRESS;
+    if(
+        !can || len < dctx->cfg.compress_min_bytes || len < 16
+        || shm_active(tcp)
+    ){
+        return tcp_write_msg(tcp, hdr, hdrlen, base, len, cb);
+    }
+
+    // only worth sending if it saves at least an eighth
+    size_t cap = len - len / 8;
+    char *z = malloc(ZBODY_HDR_SIZE + cap);
+    if(!z){
+        perror("malloc");
+        return 1;
+    }
+    size_t zlen = lz_compress(base, len, &z[ZBODY_HDR_SIZE], cap);
+    if(!zlen){
+        free(z);
+        return tcp_write_msg(tcp, hdr, hdrlen, base, len, cb);
+    }
+
+    char buf[WRITE_HDR_MAXSIZE];
+    memcpy(buf, hdr, hdrlen);
+    marshal_compressed(buf, hdrlen, z, len, zlen);
+
+    // base is done with already, but cb still waits for the write to finish
+    dc_write_cb_t *zcb = slab_alloc(&dctx->slab, sizeof(*zcb));
+    if(!zcb){
+        perror("malloc");
+        free(z);
+        return 1;
+    }
+    *zcb = (dc_write_cb_t){
+        .type = WRITE_CB_FREE,
+        .u = { .free = z },
+        .next = cb,
+    };
+    int ret = tcp_write_msg(
+        tcp, buf, hdrlen, z, ZBODY_HDR_SIZE + zlen, zcb
+    );
+    if(ret){
+        slab_free(&dctx->slab, zcb);
+        free(z);
+        return 1;
+    }
+    return 0;
+}
+
 int tcp_write_copy(uv_tcp_t *tcp, const char *base, size_t len){
+    if(len <= WRITE_HDR_MAXSIZE){
+        // small messages are copied into the write itself
+        return tcp_write_hdr(tcp, base, len, NULL, 0, NULL);
+    }
     char *copy = bytesdup(base, len);
     if(!copy){
         perror("malloc");
@@ -552,10 +1180,6 @@ static dc_op_t *dctx_gather_ex(
         fprintf(stderr, "series name length must not exceed 256\n");
         goto fail;
     }
-    if(len > UINT32_MAX){
-        fprintf(stderr, "data length must not exceed 2**32\n");
-        goto fail;
-    }
     pthread_mutex_lock(&dctx->mutex);
     dc_op_t *op;
 
@@ -572,12 +1196,12 @@ static dc_op_t *dctx_gather_ex(
         }
         #undef OP
     }else{
-        // workers gather ops are never cretaed on recv, create a new one
-        op = dc_op_new(dctx, DC_OP_GATHER, series, slen);
+        // a leader's gather op may have been created when we received data
+        op = get_op_for_call_locked(dctx, DC_OP_GATHER, series, slen);
         if(!op) goto fail_mutex;
-        link_list_append(&dctx->a.inflight, &op->link);
 
         #define OP op->u.gather.worker
+        OP.called = true;
         OP.data = data;
         OP.nofree = nofree;
         OP.len = len;
@@ -641,10 +1265,6 @@ static dc_op_t *dctx_broadcast_ex(
         fprintf(stderr, "series name length must not exceed 256\n");
         goto fail;
     }
-    if(len > UINT32_MAX){
-        fprintf(stderr, "data length must not exceed 2**32\n");
-        goto fail;
-    }
     pthread_mutex_lock(&dctx->mutex);
     dc_op_t *op;
 
@@ -652,7 +1272,7 @@ static dc_op_t *dctx_broadcast_ex(
         // chief broadcast ops are never created on recv, create a new one
         op = dc_op_new(dctx, DC_OP_BROADCAST, series, slen);
         if(!op) goto fail_mutex;
-        link_list_append(&dctx->a.inflight, &op->link);
+        op_inflight_add(dctx, op);
 
         #define OP op->u.broadcast.chief
         OP.data = data;
@@ -667,7 +1287,10 @@ static dc_op_t *dctx_broadcast_ex(
 
         #define OP op->u.broadcast.worker
         OP.called = true;
-        if(OP.recvd){
+        if(OP.tree){
+            // tree broadcasts finish in the loop, after forwarding
+            uv_async_send(&dctx->async);
+        }else if(OP.recvd){
             // message was already received
             mark_op_completed_locked(op);
         }
@@ -709,83 +1332,416 @@ dc_op_t *dctx_broadcast_copy(
     }
 }
 
-static dc_op_t *dctx_allgather_ex(
-    dctx_t *dctx,
-    const char *series,
-    size_t slen,
-    char *data,
-    const char *nofree,
-    size_t len
-){
+dc_op_t *dctx_barrier(dctx_t *dctx, const char *series, size_t slen){
     if(zstrnlen(series, 257) > 256){
         fprintf(stderr, "series name length must not exceed 256\n");
-        goto fail;
-    }
-    if(len > UINT32_MAX){
-        fprintf(stderr, "data length must not exceed 2**32\n");
-        goto fail;
+        return &DC_OP_NOT_OK;
     }
     pthread_mutex_lock(&dctx->mutex);
     dc_op_t *op;
 
     if(dctx->rank == 0){
-        // chief op may have been created when we received a message
-        op = get_op_for_call_locked(dctx, DC_OP_ALLGATHER, series, slen);
+        // chief op may have been created when a worker arrived first
+        op = get_op_for_call_locked(dctx, DC_OP_BARRIER, series, slen);
         if(!op) goto fail_mutex;
-
-        #define OP op->u.allgather.chief
-        OP.recvd[0] = data;
-        OP.len[0] = len;
-        if(++OP.nrecvd == (size_t)dctx->size){
-            // trigger some work in the loop
-            uv_async_send(&dctx->async);
-        }
-        #undef OP
+        op->u.barrier.chief.called = true;
     }else{
-        // workers allgather ops are never created on recv, create a new one
-        op = dc_op_new(dctx, DC_OP_ALLGATHER, series, slen);
+        // worker barrier ops are never created on recv, create a new one
+        op = dc_op_new(dctx, DC_OP_BARRIER, series, slen);
         if(!op) goto fail_mutex;
-        link_list_append(&dctx->a.inflight, &op->link);
-
-        #define OP op->u.allgather.worker
-        OP.data = data;
-        OP.nofree = nofree;
-        OP.datalen = len;
-        // trigger some work in the loop
-        uv_async_send(&dctx->async);
-        #undef OP
+        op_inflight_add(dctx, op);
     }
+    // trigger some work in the loop
+    uv_async_send(&dctx->async);
 
     pthread_mutex_unlock(&dctx->mutex);
     return op;
 
 fail_mutex:
     pthread_mutex_unlock(&dctx->mutex);
-fail:
-    free(data);
     return &DC_OP_NOT_OK;
 }
 
-dc_op_t *dctx_allgather(
-    dctx_t *dctx, const char *series, size_t slen, char *data, size_t len
-){
-    // we own data
-    return dctx_allgather_ex(dctx, series, slen, data, NULL, len);
-}
-
-dc_op_t *dctx_allgather_copy(
-    dctx_t *dctx, const char *series, size_t slen, const char *data, size_t len
-){
-    char *copy = bytesdup(data, len);
-    if(!copy){
-        perror("malloc");
-        return &DC_OP_NOT_OK;
+// frees every bufs[i], but not bufs itself
+static void free_bufs(dctx_t *dctx, char **bufs){
+    if(!bufs) return;
+    for(int i = 0; i < dctx->size; i++){
+        if(bufs[i]) free(bufs[i]);
     }
-    // we own copy
-    return dctx_allgather_ex(dctx, series, slen, copy, NULL, len);
 }
 
-dc_op_t *dctx_allgather_nofree(
+static dc_op_t *dctx_scatter_ex(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    char **bufs,
+    const size_t *lens
+){
+    if(zstrnlen(series, 257) > 256){
+        fprintf(stderr, "series name length must not exceed 256\n");
+        goto fail;
+    }
+    if(dctx->rank == 0){
+        if(!bufs || !lens){
+            fprintf(stderr, "chief must pass bufs and lens to scatter\n");
+            goto fail;
+        }
+    }
+    pthread_mutex_lock(&dctx->mutex);
+    dc_op_t *op;
+
+    if(dctx->rank == 0){
+        // chief scatter ops are never created on recv, create a new one
+        op = dc_op_new(dctx, DC_OP_SCATTER, series, slen);
+        if(!op) goto fail_mutex;
+        op_inflight_add(dctx, op);
+
+        #define OP op->u.scatter.chief
+        for(int i = 0; i < dctx->size; i++){
+            OP.data[i] = bufs[i];
+            OP.len[i] = lens[i];
+        }
+        // trigger some work in the loop
+        uv_async_send(&dctx->async);
+        #undef OP
+    }else{
+        // workers have nothing to send
+        free_bufs(dctx, bufs);
+
+        // worker scatter op may have been created when we received a message
+        op = get_op_for_call_locked(dctx, DC_OP_SCATTER, series, slen);
+        if(!op) goto fail_mutex;
+
+        #define OP op->u.scatter.worker
+        OP.called = true;
+        if(OP.recvd){
+            // message was already received
+            mark_op_completed_locked(op);
+        }
+        #undef OP
+    }
+
+    pthread_mutex_unlock(&dctx->mutex);
+    return op;
+
+fail_mutex:
+    pthread_mutex_unlock(&dctx->mutex);
+fail:
+    if(dctx->rank == 0) free_bufs(dctx, bufs);
+    return &DC_OP_NOT_OK;
+}
+
+dc_op_t *dctx_scatter(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    char **bufs,
+    const size_t *lens
+){
+    // we own every bufs[i]
+    return dctx_scatter_ex(dctx, series, slen, bufs, lens);
+}
+
+dc_op_t *dctx_scatter_copy(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    const char * const *bufs,
+    const size_t *lens
+){
+    if(dctx->rank != 0 || !bufs || !lens){
+        // worker ignores bufs
+        return dctx_scatter_ex(dctx, series, slen, NULL, lens);
+    }
+
+    // chief makes copies
+    char **copies = calloc((size_t)dctx->size, sizeof(*copies));
+    if(!copies){
+        perror("calloc");
+        return &DC_OP_NOT_OK;
+    }
+    for(int i = 0; i < dctx->size; i++){
+        copies[i] = bytesdup(bufs[i], lens[i]);
+        if(!copies[i]){
+            free_bufs(dctx, copies);
+            free(copies);
+            return &DC_OP_NOT_OK;
+        }
+    }
+    // we own every copies[i]
+    dc_op_t *op = dctx_scatter_ex(dctx, series, slen, copies, lens);
+    free(copies);
+    return op;
+}
+
+static dc_op_t *dctx_alltoall_ex(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    char **bufs,
+    const size_t *lens
+){
+    if(zstrnlen(series, 257) > 256){
+        fprintf(stderr, "series name length must not exceed 256\n");
+        goto fail;
+    }
+    if(!bufs || !lens){
+        fprintf(stderr, "every rank must pass bufs and lens to alltoall\n");
+        goto fail;
+    }
+    pthread_mutex_lock(&dctx->mutex);
+
+    // other ranks may have sent to us already
+    dc_op_t *op = get_op_for_call_locked(dctx, DC_OP_ALLTOALL, series, slen);
+    if(!op) goto fail_mutex;
+
+    #define OP op->u.alltoall
+    OP.called = true;
+    for(int i = 0; i < dctx->size; i++){
+        OP.data[i] = bufs[i];
+        OP.datalen[i] = lens[i];
+    }
+    // our own buffer never leaves
+    int me = dctx->rank;
+    OP.recvd[me] = OP.data[me];
+    OP.len[me] = OP.datalen[me];
+    OP.data[me] = NULL;
+    // trigger some work in the loop
+    uv_async_send(&dctx->async);
+    #undef OP
+
+    pthread_mutex_unlock(&dctx->mutex);
+    return op;
+
+fail_mutex:
+    pthread_mutex_unlock(&dctx->mutex);
+fail:
+    free_bufs(dctx, bufs);
+    return &DC_OP_NOT_OK;
+}
+
+dc_op_t *dctx_alltoall(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    char **bufs,
+    const size_t *lens
+){
+    // we own every bufs[i]
+    return dctx_alltoall_ex(dctx, series, slen, bufs, lens);
+}
+
+dc_op_t *dctx_alltoall_copy(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    const char * const *bufs,
+    const size_t *lens
+){
+    if(!bufs || !lens){
+        return dctx_alltoall_ex(dctx, series, slen, NULL, lens);
+    }
+    char **copies = calloc((size_t)dctx->size, sizeof(*copies));
+    if(!copies){
+        perror("calloc");
+        return &DC_OP_NOT_OK;
+    }
+    for(int i = 0; i < dctx->size; i++){
+        copies[i] = bytesdup(bufs[i], lens[i]);
+        if(!copies[i]){
+            free_bufs(dctx, copies);
+            free(copies);
+            return &DC_OP_NOT_OK;
+        }
+    }
+    // we own every copies[i]
+    dc_op_t *op = dctx_alltoall_ex(dctx, series, slen, copies, lens);
+    free(copies);
+    return op;
+}
+
+static dc_op_t *dctx_send_ex(
+    dctx_t *dctx,
+    int dst,
+    const char *tag,
+    size_t tlen,
+    char *data,
+    const char *nofree,
+    size_t len
+){
+    if(zstrnlen(tag, 257) > 256){
+        fprintf(stderr, "tag length must not exceed 256\n");
+        goto fail;
+    }
+    if(dst < 0 || dst >= dctx->size || dst == dctx->rank){
+        fprintf(stderr, "invalid destination rank for send: %d\n", dst);
+        goto fail;
+    }
+    pthread_mutex_lock(&dctx->mutex);
+
+    // send ops are never created on recv, create a new one
+    dc_op_t *op = dc_op_new(dctx, DC_OP_SEND, tag, tlen);
+    if(!op) goto fail_mutex;
+    op_inflight_add(dctx, op);
+
+    #define OP op->u.send
+    OP.dst = dst;
+    OP.data = data;
+    OP.nofree = nofree;
+    OP.len = len;
+    // trigger some work in the loop
+    uv_async_send(&dctx->async);
+    #undef OP
+
+    pthread_mutex_unlock(&dctx->mutex);
+    return op;
+
+fail_mutex:
+    pthread_mutex_unlock(&dctx->mutex);
+fail:
+    free(data);
+    return &DC_OP_NOT_OK;
+}
+
+dc_op_t *dctx_send(
+    dctx_t *dctx, int dst, const char *tag, size_t tlen, char *data, size_t len
+){
+    // we own data
+    return dctx_send_ex(dctx, dst, tag, tlen, data, NULL, len);
+}
+
+dc_op_t *dctx_send_copy(
+    dctx_t *dctx,
+    int dst,
+    const char *tag,
+    size_t tlen,
+    const char *data,
+    size_t len
+){
+    char *copy = bytesdup(data, len);
+    if(!copy){
+        perror("malloc");
+        return &DC_OP_NOT_OK;
+    }
+    // we own copy
+    return dctx_send_ex(dctx, dst, tag, tlen, copy, NULL, len);
+}
+
+dc_op_t *dctx_send_nofree(
+    dctx_t *dctx,
+    int dst,
+    const char *tag,
+    size_t tlen,
+    const char *data,
+    size_t len
+){
+    // dc_op_await will block until data is not needed
+    return dctx_send_ex(dctx, dst, tag, tlen, NULL, data, len);
+}
+
+dc_op_t *dctx_recv(dctx_t *dctx, int src, const char *tag, size_t tlen){
+    if(zstrnlen(tag, 257) > 256){
+        fprintf(stderr, "tag length must not exceed 256\n");
+        return &DC_OP_NOT_OK;
+    }
+    if(src < 0 || src >= dctx->size || src == dctx->rank){
+        fprintf(stderr, "invalid source rank for recv: %d\n", src);
+        return &DC_OP_NOT_OK;
+    }
+    pthread_mutex_lock(&dctx->mutex);
+
+    // the message may have been received already
+    dc_op_t *op = get_recv_for_call_locked(dctx, src, tag, tlen);
+    if(!op){
+        pthread_mutex_unlock(&dctx->mutex);
+        return &DC_OP_NOT_OK;
+    }
+
+    #define OP op->u.recv
+    OP.called = true;
+    if(OP.recvd){
+        // message was already received
+        mark_op_completed_locked(op);
+    }
+    #undef OP
+
+    pthread_mutex_unlock(&dctx->mutex);
+    return op;
+}
+
+static dc_op_t *dctx_allgather_ex(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    char *data,
+    const char *nofree,
+    size_t len
+){
+    if(zstrnlen(series, 257) > 256){
+        fprintf(stderr, "series name length must not exceed 256\n");
+        goto fail;
+    }
+    pthread_mutex_lock(&dctx->mutex);
+    dc_op_t *op;
+
+    if(dctx->rank == 0){
+        // chief op may have been created when we received a message
+        op = get_op_for_call_locked(dctx, DC_OP_ALLGATHER, series, slen);
+        if(!op) goto fail_mutex;
+
+        #define OP op->u.allgather.chief
+        OP.recvd[0] = data;
+        OP.len[0] = len;
+        if(++OP.nrecvd == (size_t)dctx->size){
+            // trigger some work in the loop
+            uv_async_send(&dctx->async);
+        }
+        #undef OP
+    }else{
+        // a leader's allgather op may have been created when we received data
+        op = get_op_for_call_locked(dctx, DC_OP_ALLGATHER, series, slen);
+        if(!op) goto fail_mutex;
+
+        #define OP op->u.allgather.worker
+        OP.called = true;
+        OP.data = data;
+        OP.nofree = nofree;
+        OP.datalen = len;
+        // trigger some work in the loop
+        uv_async_send(&dctx->async);
+        #undef OP
+    }
+
+    pthread_mutex_unlock(&dctx->mutex);
+    return op;
+
+fail_mutex:
+    pthread_mutex_unlock(&dctx->mutex);
+fail:
+    free(data);
+    return &DC_OP_NOT_OK;
+}
+
+dc_op_t *dctx_allgather(
+    dctx_t *dctx, const char *series, size_t slen, char *data, size_t len
+){
+    // we own data
+    return dctx_allgather_ex(dctx, series, slen, data, NULL, len);
+}
+
+dc_op_t *dctx_allgather_copy(
+    dctx_t *dctx, const char *series, size_t slen, const char *data, size_t len
+){
+    char *copy = bytesdup(data, len);
+    if(!copy){
+        perror("malloc");
+        return &DC_OP_NOT_OK;
+    }
+    // we own copy
+    return dctx_allgather_ex(dctx, series, slen, copy, NULL, len);
+}
+
+dc_op_t *dctx_allgather_nofree(
     dctx_t *dctx, const char *series, size_t slen, const char *data, size_t len
 ){
     if(dctx->rank == 0){
@@ -798,3 +1754,236 @@ dc_op_t *dctx_allgather_nofree(
         return dctx_allgather_ex(dctx, series, slen, _data, _nofree, len);
     }
 }
+
+// big enough reductions go around the ring instead of through the chief
+static bool reduce_uses_ring(dctx_t *dctx, size_t len){
+    return dctx->cfg.ring && dctx->size > 1 && len >= dctx->cfg.ring_min_bytes;
+}
+
+// type is DC_OP_ALLREDUCE or DC_OP_REDUCE_SCATTER
+static dc_op_t *dctx_reduce_ex(
+    dctx_t *dctx,
+    dc_op_type_e type,
+    const char *series,
+    size_t slen,
+    char *data,
+    const char *nofree,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+){
+    const char *name = type == DC_OP_ALLREDUCE ? "allreduce" : "reduce_scatter";
+    if(zstrnlen(series, 257) > 256){
+        fprintf(stderr, "series name length must not exceed 256\n");
+        goto fail;
+    }
+    if(!dc_dtype_valid((int)dtype)){
+        fprintf(stderr, "invalid %s dtype: %d\n", name, (int)dtype);
+        goto fail;
+    }
+    if(!dc_reduce_valid((int)reduce)){
+        fprintf(stderr, "invalid %s op: %d\n", name, (int)reduce);
+        goto fail;
+    }
+    // reduce-scatter also needs one whole number of elements per rank
+    size_t unit = dc_dtype_size(dtype);
+    if(type == DC_OP_REDUCE_SCATTER) unit *= (size_t)dctx->size;
+    if(len % unit != 0){
+        fprintf(stderr, "%s length must be a multiple of %zu\n", name, unit);
+        goto fail;
+    }
+    pthread_mutex_lock(&dctx->mutex);
+    dc_op_t *op;
+
+    if(reduce_uses_ring(dctx, len)){
+        if(!data){
+            RBUG("ring reduction needs a buffer of its own");
+            goto fail_mutex;
+        }
+        // our left neighbour may have already sent us something
+        dc_op_type_e ring_type = type == DC_OP_ALLREDUCE
+            ? DC_OP_RING_ALLREDUCE : DC_OP_RING_REDUCE_SCATTER;
+        op = get_op_for_call_locked(dctx, ring_type, series, slen);
+        if(!op) goto fail_mutex;
+        if(op_check_type(op, dtype, reduce)) goto fail_mutex;
+
+        #define OP op->u.ring
+        // the result is reduced in place, in data
+        OP.called = true;
+        OP.data = data;
+        OP.len = len;
+        // trigger some work in the loop
+        uv_async_send(&dctx->async);
+        #undef OP
+    }else if(dctx->rank == 0){
+        // chief op may have been created when we received a message
+        op = get_op_for_call_locked(dctx, type, series, slen);
+        if(!op) goto fail_mutex;
+        if(op_check_type(op, dtype, reduce)) goto fail_mutex;
+
+        #define OP op->u.allreduce.chief
+        // the loop thread folds data into the accumulator
+        OP.called = true;
+        OP.mine = data;
+        OP.minelen = len;
+        // trigger some work in the loop
+        uv_async_send(&dctx->async);
+        #undef OP
+    }else{
+        // workers ops are never created on recv, create a new one
+        op = dc_op_new(dctx, type, series, slen);
+        if(!op) goto fail_mutex;
+        op_inflight_add(dctx, op);
+        op_check_type(op, dtype, reduce);
+
+        #define OP op->u.allreduce.worker
+        OP.data = data;
+        OP.nofree = nofree;
+        OP.datalen = len;
+        // trigger some work in the loop
+        uv_async_send(&dctx->async);
+        #undef OP
+    }
+
+    pthread_mutex_unlock(&dctx->mutex);
+    return op;
+
+fail_mutex:
+    pthread_mutex_unlock(&dctx->mutex);
+fail:
+    free(data);
+    return &DC_OP_NOT_OK;
+}
+
+static dc_op_t *dctx_reduce_copy(
+    dctx_t *dctx,
+    dc_op_type_e type,
+    const char *series,
+    size_t slen,
+    const char *data,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+){
+    char *copy = bytesdup(data, len);
+    if(!copy){
+        perror("malloc");
+        return &DC_OP_NOT_OK;
+    }
+    // we own copy
+    return dctx_reduce_ex(
+        dctx, type, series, slen, copy, NULL, len, dtype, reduce
+    );
+}
+
+static dc_op_t *dctx_reduce_nofree(
+    dctx_t *dctx,
+    dc_op_type_e type,
+    const char *series,
+    size_t slen,
+    const char *data,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+){
+    if(dctx->rank == 0 || reduce_uses_ring(dctx, len)){
+        /* the chief's data becomes the accumulator, and the ring reduces in
+           place, so both need a copy of data */
+        return dctx_reduce_copy(
+            dctx, type, series, slen, data, len, dtype, reduce
+        );
+    }else{
+        char *_data = NULL;
+        const char *_nofree = data;
+        // worker will cause dc_op_await to block until data is not needed
+        return dctx_reduce_ex(
+            dctx, type, series, slen, _data, _nofree, len, dtype, reduce
+        );
+    }
+}
+
+dc_op_t *dctx_allreduce(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    char *data,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+){
+    // we own data
+    return dctx_reduce_ex(
+        dctx, DC_OP_ALLREDUCE, series, slen, data, NULL, len, dtype, reduce
+    );
+}
+
+dc_op_t *dctx_allreduce_copy(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    const char *data,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+){
+    return dctx_reduce_copy(
+        dctx, DC_OP_ALLREDUCE, series, slen, data, len, dtype, reduce
+    );
+}
+
+dc_op_t *dctx_allreduce_nofree(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    const char *data,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+){
+    return dctx_reduce_nofree(
+        dctx, DC_OP_ALLREDUCE, series, slen, data, len, dtype, reduce
+    );
+}
+
+dc_op_t *dctx_reduce_scatter(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    char *data,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+){
+    // we own data
+    return dctx_reduce_ex(
+        dctx, DC_OP_REDUCE_SCATTER, series, slen, data, NULL, len, dtype, reduce
+    );
+}
+
+dc_op_t *dctx_reduce_scatter_copy(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    const char *data,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+){
+    return dctx_reduce_copy(
+        dctx, DC_OP_REDUCE_SCATTER, series, slen, data, len, dtype, reduce
+    );
+}
+
+dc_op_t *dctx_reduce_scatter_nofree(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    const char *data,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+){
+    return dctx_reduce_nofree(
+        dctx, DC_OP_REDUCE_SCATTER, series, slen, data, len, dtype, reduce
+    );
+}
@@ -30,6 +30,8 @@ typedef struct dc_op dc_op_t;
 // get a dc_result after a dc_op completes
 bool dc_op_ok(dc_op_t *op);
 dc_result_t *dc_op_await(dc_op_t *op);
+// true once dc_op_await(op) would return without blocking
+bool dc_op_test(dc_op_t *op);
 
 // only support an opaque pointer
 struct dctx;
@@ -57,6 +59,12 @@ int dctx_open(
 // can tolerate *dctx=NULL, otherwise eventually sets *dctx=NULL
 void dctx_close(dctx_t **dctx);
 
+/* a file descriptor which polls readable once any op of dctx completes (or
+   dctx dies), for waiting on ops from another event loop.  Read 8 bytes from
+   it to clear it, then dc_op_test each op you wait on.  It belongs to dctx;
+   do not close it. */
+int dctx_fileno(dctx_t *dctx);
+
 dctx_t *dctx_open2(
     int rank,
     int size,
@@ -69,6 +77,10 @@ dctx_t *dctx_open2(
 );
 void dctx_close2(dctx_t *dctx);
 
+/* compress the bodies this rank sends for a series, for ops started after the
+   call, or stop; this overrides DCTX_COMPRESS for that series.  Receivers need
+   no setting.  Returns 0 on success. */
+int dctx_compress(dctx_t *dctx, const char *series, size_t slen, bool on);
 
 // guarantees an eventual call to free(data)
 // (technically the chief's data is passed back out as dc_result_take)
@@ -98,6 +110,25 @@ dc_op_t *dctx_broadcast_copy(
 /* there's no dctx_broadcast_nofree, since the chief would always make a
    copy, so just use  dctx_broadcast_copy */
 
+/* the chief passes dctx->size buffers and rank i receives bufs[i]; workers
+   pass NULL for bufs and lens.  Ownership of each bufs[i] is taken, but not
+   of the bufs or lens arrays themselves. */
+dc_op_t *dctx_scatter(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    char **bufs,
+    const size_t *lens
+);
+// copies every bufs[i] (and frees the copies later)
+dc_op_t *dctx_scatter_copy(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    const char * const *bufs,
+    const size_t *lens
+);
+
 
 dc_op_t *dctx_allgather(
     dctx_t *dctx, const char *series, size_t slen, char *data, size_t len
@@ -108,3 +139,144 @@ dc_op_t *dctx_allgather_copy(
 dc_op_t *dctx_allgather_nofree(
     dctx_t *dctx, const char *series, size_t slen, const char *data, size_t len
 );
+
+
+/* every rank passes dctx->size buffers, and rank j receives bufs[j]; the
+   result holds dctx->size buffers, where buffer i came from rank i.  Ownership
+   of each bufs[i] is taken, but not of the bufs or lens arrays themselves. */
+dc_op_t *dctx_alltoall(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    char **bufs,
+    const size_t *lens
+);
+// copies every bufs[i] (and frees the copies later)
+dc_op_t *dctx_alltoall_copy(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    const char * const *bufs,
+    const size_t *lens
+);
+
+
+/* point-to-point messages between any two ranks, matched by source and tag.
+   Messages with the same source, destination, and tag arrive in the order
+   they were sent.  A send completes once its data is written, with an empty
+   result; a recv completes with a single result, the message. */
+// guarantees an eventual call to free(data)
+dc_op_t *dctx_send(
+    dctx_t *dctx, int dst, const char *tag, size_t tlen, char *data, size_t len
+);
+dc_op_t *dctx_send_copy(
+    dctx_t *dctx,
+    int dst,
+    const char *tag,
+    size_t tlen,
+    const char *data,
+    size_t len
+);
+// caller is required to preserve data until after dc_op_await()
+dc_op_t *dctx_send_nofree(
+    dctx_t *dctx,
+    int dst,
+    const char *tag,
+    size_t tlen,
+    const char *data,
+    size_t len
+);
+dc_op_t *dctx_recv(dctx_t *dctx, int src, const char *tag, size_t tlen);
+
+
+/* returns once every rank has called dctx_barrier on this series; there is no
+   payload, and the result is always empty */
+dc_op_t *dctx_barrier(dctx_t *dctx, const char *series, size_t slen);
+
+/* element types and reduction operators understood by the reducing
+   collectives; every rank must pass the same dtype and op for a series */
+typedef enum {
+    DC_DTYPE_F32 = 0,
+    DC_DTYPE_F64,
+    DC_DTYPE_I32,
+    DC_DTYPE_I64,
+    DC_DTYPE_BF16,
+    DC_DTYPE_F16,
+} dc_dtype_e;
+
+typedef enum {
+    DC_REDUCE_SUM = 0,
+    DC_REDUCE_MIN,
+    DC_REDUCE_MAX,
+    DC_REDUCE_PROD,
+} dc_reduce_e;
+
+/* send the elements of a series' reducing collectives as wire instead, for
+   ops started after the call: f32 as bf16 or f16, or f64 as f32.  Receivers
+   widen them again and reduce at full precision, and every rank ends with the
+   same result.  Ops whose dtype does not convert to wire stay at full
+   precision, so passing their own dtype turns this off.  Returns 0 on
+   success. */
+int dctx_wire_dtype(
+    dctx_t *dctx, const char *series, size_t slen, dc_dtype_e wire
+);
+
+/* every rank contributes len bytes of dtype elements and receives a single
+   result of len bytes, the elementwise reduction of all contributions */
+dc_op_t *dctx_allreduce(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    char *data,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+);
+dc_op_t *dctx_allreduce_copy(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    const char *data,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+);
+dc_op_t *dctx_allreduce_nofree(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    const char *data,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+);
+
+/* every rank contributes len bytes, made of dctx->size equal chunks, and
+   receives len/size bytes: the reduction of every rank's chunk [rank] */
+dc_op_t *dctx_reduce_scatter(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    char *data,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+);
+dc_op_t *dctx_reduce_scatter_copy(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    const char *data,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+);
+dc_op_t *dctx_reduce_scatter_nofree(
+    dctx_t *dctx,
+    const char *series,
+    size_t slen,
+    const char *data,
+    size_t len,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce
+);
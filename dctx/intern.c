@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+/* Series interning: the first time a series crosses a link, its frame names
+   it and gives it the link's next 16-bit id.  Every later frame of that series
+   on that link carries just the id.  Each direction of each link has its own
+   ids, so no rank has to agree with any other than the one it talks to. */
+
+// FNV-1a
+uint32_t series_hash(const char *series, size_t slen){
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < slen; i++){
+        h ^= (unsigned char)series[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int names_grow(dc_intern_t *t){
+    if(t->n < t->cap) return 0;
+    size_t cap = t->cap ? t->cap * 2 : 16;
+    dc_iname_t *names = realloc(t->names, cap * sizeof(*names));
+    if(!names){
+        perror("realloc");
+        return 1;
+    }
+    t->names = names;
+    t->cap = cap;
+    return 0;
+}
+
+// keep the index at most half full
+static int slots_grow(dc_intern_t *t){
+    if((t->n + 1) * 2 <= t->nslots) return 0;
+    size_t nslots = t->nslots ? t->nslots * 2 : 64;
+    uint32_t *slots = calloc(nslots, sizeof(*slots));
+    if(!slots){
+        perror("calloc");
+        return 1;
+    }
+    for(size_t i = 0; i < t->n; i++){
+        dc_iname_t *name = &t->names[i];
+        size_t s = series_hash(name->series, name->slen) & (nslots - 1);
+        while(slots[s]) s = (s + 1) & (nslots - 1);
+        slots[s] = (uint32_t)(i + 1);
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->nslots = nslots;
+    return 0;
+}
+
+// the id of series, or INTERN_NOID; *slot is where a new one would go
+static uint16_t find(
+    const dc_intern_t *t, const char *series, size_t slen, size_t *slot
+){
+    size_t s = 0;
+    if(t->nslots){
+        s = series_hash(series, slen) & (t->nslots - 1);
+        for(; t->slots[s]; s = (s + 1) & (t->nslots - 1)){
+            dc_iname_t *name = &t->names[t->slots[s] - 1];
+            if(name->slen != slen) continue;
+            if(memcmp(name->series, series, slen) != 0) continue;
+            return (uint16_t)(t->slots[s] - 1);
+        }
+    }
+    *slot = s;
+    return INTERN_NOID;
+}
+
+uint16_t intern_find(const dc_intern_t *t, const char *series, size_t slen){
+    size_t s;
+    return find(t, series, slen, &s);
+}
+
+uint16_t intern_tx(
+    dc_intern_t *t, const char *series, size_t slen, bool *fresh
+){
+    *fresh = false;
+    size_t s = 0;
+    uint16_t id = find(t, series, slen, &s);
+    if(id != INTERN_NOID) return id;
+
+    // a new series
+    if(t->n >= INTERN_MAX) return INTERN_NOID;
+    if(names_grow(t)) return INTERN_NOID;
+    size_t nslots = t->nslots;
+    if(slots_grow(t)) return INTERN_NOID;
+    if(t->nslots != nslots){
+        // the index was rebuilt, find our slot again
+        s = series_hash(series, slen) & (t->nslots - 1);
+        while(t->slots[s]) s = (s + 1) & (t->nslots - 1);
+    }
+    dc_iname_t *name = &t->names[t->n];
+    name->slen = slen;
+    memcpy(name->series, series, slen);
+    t->slots[s] = (uint32_t)(++t->n);
+    *fresh = true;
+    return (uint16_t)(t->n - 1);
+}
+
+int intern_rx_define(
+    dc_intern_t *t, uint16_t id, const char *series, size_t slen
+){
+    if(id != t->n){
+        printf("bad message, series id %d defined out of order\n", (int)id);
+        return 1;
+    }
+    if(names_grow(t)) return 1;
+    dc_iname_t *name = &t->names[t->n++];
+    name->slen = slen;
+    memcpy(name->series, series, slen);
+    return 0;
+}
+
+const dc_iname_t *intern_rx_lookup(const dc_intern_t *t, uint16_t id){
+    if(id >= t->n) return NULL;
+    return &t->names[id];
+}
+
+void intern_free(dc_intern_t *t){
+    free(t->names);
+    free(t->slots);
+    *t = (dc_intern_t){0};
+}
@@ -0,0 +1,40 @@
+// series names interned on one direction of one link, see intern.c
+
+// a link interns at most this many series; any more go out by name
+#define INTERN_MAX 0xFFFE
+// the wire id of a series that goes out by name
+#define INTERN_NOID 0xFFFF
+
+typedef struct {
+    size_t slen;
+    char series[256];
+} dc_iname_t;
+
+typedef struct {
+    // every interned name, by id
+    dc_iname_t *names;
+    size_t n;
+    size_t cap;
+    // sending side only: an open-addressed index of names, holding id + 1
+    uint32_t *slots;
+    size_t nslots;
+} dc_intern_t;
+
+/* the id of a series we are sending, which is assigned the next id the first
+   time (and *fresh is set).  Returns INTERN_NOID when the series must go by
+   name instead, because the table is full or out of memory. */
+uint16_t intern_tx(
+    dc_intern_t *t, const char *series, size_t slen, bool *fresh
+);
+// the id series already has, or INTERN_NOID
+uint16_t intern_find(const dc_intern_t *t, const char *series, size_t slen);
+// remember the name our peer gave id; ids must arrive in order
+int intern_rx_define(
+    dc_intern_t *t, uint16_t id, const char *series, size_t slen
+);
+// the name our peer gave id, or NULL
+const dc_iname_t *intern_rx_lookup(const dc_intern_t *t, uint16_t id);
+void intern_free(dc_intern_t *t);
+
+// a hash of a series name, shared by everything that indexes series
+uint32_t series_hash(const char *series, size_t slen);
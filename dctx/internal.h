@@ -11,7 +11,11 @@
 #define BUG(msg) fprintf(stderr, "BUG: " msg "\n")
 
 #include "link.h"
+#include "slab.h"
+#include "intern.h"
+#include "lz.h"
 #include "msg.h"
+#include "reduce.h"
 #include "zstring.h"
 
 struct dc_result {
@@ -25,14 +29,78 @@ struct dc_result {
 extern dc_result_t DC_RESULT_NOT_OK;
 extern dc_result_t DC_RESULT_EMPTY;
 
+// shared-memory rings for a link, see shm.c
+typedef struct dc_shm dc_shm_t;
+// the io_uring which moves socket bytes, and one socket on it; see uring.c
+typedef struct dc_uring dc_uring_t;
+typedef struct dc_usock dc_usock_t;
+
+// a socket's read buffer, reused for every read and doubled whenever a read
+// fills it, up to RBUF_MAX
+#define RBUF_MIN (64 * 1024)
+#define RBUF_MAX (1024 * 1024)
+typedef struct {
+    char *base;
+    size_t cap;
+} dc_rbuf_t;
+
+// what a link's peer said in its hello, narrowed to what we do too
+typedef struct {
+    // FEAT_* bits, 0 until the hello arrives
+    uint32_t features;
+    // the biggest body len the peer accepts, 0 until the hello arrives
+    uint64_t frame_max;
+} dc_caps_t;
+
+/* writes to one socket which wait for the end of the loop iteration, so they
+   go out together in one writev */
+typedef struct {
+    link_t writes;  // dc_write_t->link
+    size_t nbytes;
+    size_t nbufs;
+    // set while in dctx->corked
+    uv_tcp_t *tcp;
+    link_t link;  // dctx->corked
+} dc_cork_t;
+DEF_CONTAINER_OF(dc_cork_t, link, link_t)
+
+/* what every connection keeps about its link, whether it is a dc_conn_t or
+   the worker's link to the chief; see tcp_link */
+typedef struct {
+    dc_unmarshal_t unmarshal;
+    dc_rbuf_t rbuf;
+    // series ids for each direction of this link
+    dc_intern_t series_tx;
+    dc_intern_t series_rx;
+    dc_caps_t caps;
+    // set once the link may carry its bytes through shared memory
+    dc_shm_t *shm;
+    // set while the socket reads and writes through dctx->uring
+    dc_usock_t *usock;
+    dc_cork_t cork;
+} dc_link_t;
+
 typedef struct {
     int rank;
     uv_tcp_t tcp;
-    dc_unmarshal_t unmarshal;
+    dc_link_t state;
+    // an extra connection of the link to rank, for slice k of its bodies
+    size_t stripe;
     link_t link;
+    // only for direct links that we dial ourselves
+    uv_connect_t connect_req;
 } dc_conn_t;
 DEF_CONTAINER_OF(dc_conn_t, link, link_t)
 
+// a link between the chief and a worker, and its extra connections
+typedef struct {
+    // conns[k] carries slice k of each striped body; conns[0] is unused
+    dc_conn_t *conns[STRIPES_MAX];
+    size_t nconns;
+    // slices which arrived on conns, for the main connection's unmarshaller
+    dc_slices_t slices;
+} dc_stripes_t;
+
 enum dc_status {
     // before the thread has begun
     DCTX_PRESTART=0,
@@ -47,22 +115,102 @@ enum dc_status {
 
 // dc_write_cb is the .data we assign to every uv_write_t
 typedef enum {
-    // just free a buffer
+    // just free a buffer (the dc_write_cb_t itself is from dctx->slab)
     WRITE_CB_FREE,
     // pass u.op to dc_op_write_cb
     WRITE_CB_OP,
+    // wait for u.join writes which share it, then free it
+    WRITE_CB_JOIN,
 } dc_write_cb_e;
 
-typedef struct {
+typedef struct dc_write_cb {
     dc_write_cb_e type;
     union {
         void *free;
         dc_op_t *op;
+        size_t join;
     } u;
+    // WRITE_CB_FREE and WRITE_CB_JOIN: run this one afterwards
+    struct dc_write_cb *next;
 } dc_write_cb_t;
 
 #include "op.h"
 
+// big enough for every message header in msg.h
+#define WRITE_HDR_MAXSIZE 296
+
+/* every write we make: a copy of the message header, then a body that belongs
+   to cb.  These are pooled per dctx, so a write costs no mallocs once the
+   pool is warm. */
+typedef struct {
+    // first, so a uv_write_t* is also a dc_write_t*
+    uv_write_t req;
+    /* dctx->wpool, dctx->wdone, a shared-memory link's pending list, a cork,
+       an io_uring socket's queue, or another write's more */
+    link_t link;
+    // writes which went out in the same uv_write as this one
+    link_t more;  // dc_write_t->link
+    dc_write_cb_t *cb;
+    char hdr[WRITE_HDR_MAXSIZE];
+    size_t hdrlen;
+    char *base;
+    size_t len;
+    // shared-memory and io_uring writes only: how much has been written
+    size_t off;
+} dc_write_t;
+DEF_CONTAINER_OF(dc_write_t, link, link_t)
+
+/* settings read from the environment in dctx_open.  Collectives only work if
+   every rank agrees, so every rank should see the same DCTX_* variables. */
+typedef struct {
+    // use ring collectives over direct worker-to-worker links (DCTX_RING)
+    bool ring;
+    // smallest allreduce that goes around the ring (DCTX_RING_MIN_BYTES)
+    size_t ring_min_bytes;
+    // let workers forward broadcasts down a binomial tree (DCTX_TREE)
+    bool tree;
+    // smallest broadcast that goes down the tree (DCTX_TREE_MIN_BYTES)
+    size_t tree_min_bytes;
+    // aggregate within each node before crossing nodes (DCTX_HIER)
+    bool hier;
+    // link every pair of workers, for routed messages (DCTX_P2P)
+    bool p2p;
+    // offer shared-memory rings to every peer on our host (DCTX_SHM)
+    bool shm;
+    // bytes in each direction of each shared-memory link
+    // (DCTX_SHM_RING_BYTES)
+    size_t shm_ring_bytes;
+    // forward big bodies a chunk at a time, or 0 (DCTX_CHUNK_BYTES)
+    size_t chunk_bytes;
+    // send each series by name once per link, then by id (DCTX_INTERN)
+    bool intern;
+    // compress bodies of every series not set by dctx_compress (DCTX_COMPRESS)
+    bool compress;
+    // smallest body worth compressing (DCTX_COMPRESS_MIN_BYTES)
+    size_t compress_min_bytes;
+    // connections per link between the chief and a worker (DCTX_STRIPES)
+    size_t stripes;
+    // smallest body split across them (DCTX_STRIPE_MIN_BYTES)
+    size_t stripe_min_bytes;
+    // move socket bytes through an io_uring, if we can (DCTX_IO_URING)
+    bool io_uring;
+    // hold small writes until the end of the loop iteration, up to this many
+    // bytes per socket, or 0 (DCTX_CORK_BYTES)
+    size_t cork_bytes;
+    // the FEAT_* bits we offer in our hellos (DCTX_FEATURES)
+    uint32_t features;
+    // the biggest body we accept, also offered in our hellos (DCTX_FRAME_MAX)
+    uint64_t frame_max;
+} dc_config_t;
+
+// what one series does differently from the defaults
+typedef struct {
+    // 0 or 1 from dctx_compress, or -1 to follow cfg.compress
+    int compress;
+    // from dctx_wire_dtype, or -1 for full precision
+    int wire;
+} dc_series_opts_t;
+
 struct dctx {
     int rank;
     int size;
@@ -74,6 +222,16 @@ struct dctx {
     char *host;
     char *svc;
 
+    dc_config_t cfg;
+    // cfg.hier, and the ranks are laid out so that we can use it
+    bool hier;
+
+    // series given settings of their own, and those settings; under mutex
+    struct {
+        dc_intern_t series;
+        dc_series_opts_t *opts;
+    } sopts;
+
     uv_loop_t loop;
     uv_async_t async;
     uv_tcp_t tcp;
@@ -91,6 +249,11 @@ struct dctx {
         // lists of ops
         link_t inflight;  // dc_op_t->link
         link_t complete;  // dc_op_t->link
+        /* inflight ops again, hashed by (type, series); each bucket keeps
+           the order of inflight, so the first match is the oldest */
+        link_t *index;  // dc_op_t->ilink
+        size_t nindex;
+        size_t nindexed;
     } a;
 
     struct {
@@ -109,9 +272,48 @@ struct dctx {
         uv_timer_t timer;
         bool timer_open;
         bool connected;
-        dc_unmarshal_t unmarshal;
+        dc_link_t state;
     } client;
 
+    // dc_write_t's, callbacks and read buffers, only touched by the loop thread
+    dc_slab_t slab;
+    /* writes that finished right away, by uv_try_write or into a ring, but
+       whose callbacks have not run yet.  Like a uv_write_t, a finished write
+       calls back from the loop, never from the writer, who may hold
+       dctx->mutex. */
+    link_t wdone;  // dc_write_t->link
+    // sockets with corked writes, flushed by cork_prepare before the loop
+    // waits for more events
+    link_t corked;  // dc_cork_t->link
+    uv_prepare_t cork_prepare;
+
+    // direct links between ranks, set up from a table the chief hands out
+    struct {
+        // where every rank listens for direct links (port 0 means nowhere)
+        struct sockaddr_storage *addrs;
+        // worker-only fields
+        uv_tcp_t tcp;
+        bool tcp_open;
+        bool have_table;
+        // links which have not identified themselves yet
+        link_t preinit;  // dc_conn_t->link
+        // links of known rank; the link to the chief is always dctx->tcp
+        dc_conn_t **conns;
+        size_t nwanted;
+        size_t nlinked;
+    } mesh;
+
+    // extra connections between the chief and the workers, when cfg.stripes
+    struct {
+        // the chief has one per rank, a worker only one, for the chief
+        dc_stripes_t *links;
+        size_t nwanted;
+        size_t nlinked;
+    } stripe;
+
+    // socket IO goes through this when set, otherwise through libuv
+    dc_uring_t *uring;
+
     // called on failed read or failed write
     void (*on_broken_connection)(struct dctx*, uv_stream_t*);
 
@@ -123,12 +325,16 @@ struct dctx {
     pthread_cond_t cond;
     int status;
     bool failed;
+    // an eventfd, bumped whenever an op completes; see dctx_fileno
+    int efd;
 };
 
 dc_result_t *dc_result_new(size_t ndata);
 void dc_result_set(dc_result_t *r, size_t i, char *data, size_t len);
 
 void advance_state(struct dctx *dctx);
+// make dctx_fileno readable; call with dctx->mutex held
+void completion_signal(struct dctx *dctx);
 
 void noop_handle_closer(uv_handle_t *handle);
 void close_everything(struct dctx *dctx);
@@ -137,19 +343,96 @@ void uv_perror(const char *msg, int ret);
 
 void allocator(uv_handle_t *handle, size_t suggest, uv_buf_t *buf);
 void read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf);
+// start reading an established socket, through dctx->uring or libuv
+int tcp_read_start(uv_tcp_t *tcp);
 
 char *bytesdup(const char *data, size_t len);
 
 // our generic dc_write_cb reads a dc_write_cb_t* from req->data
 void dc_write_cb(uv_write_t *req, int status);
 
+// run a dc_write_cb_t once its write is done with its buffer
+void dc_write_cb_run(struct dctx *dctx, dc_write_cb_t *cb);
+
+// a dc_write_t from dctx->slab, or NULL
+dc_write_t *dc_write_get(struct dctx *dctx);
+// the caller has already run w->cb
+void dc_write_put(struct dctx *dctx, dc_write_t *w);
+// defer w->cb to the next async_cb
+void dc_write_done(struct dctx *dctx, dc_write_t *w);
+// run the callbacks of every finished write
+void dc_write_run_done(struct dctx *dctx);
+// write out any corked writes of a socket, before closing it
+void tcp_uncork(uv_tcp_t *tcp);
+
+/* write a copy of hdr, then let *cb handle *base however it chooses, all as a
+   single write.  cb (which may be NULL) is called when the whole message is
+   written, even if len is 0. */
+int tcp_write_hdr(
+    uv_tcp_t *tcp,
+    const char *hdr,
+    size_t hdrlen,
+    char *base,
+    size_t len,
+    dc_write_cb_t *cb
+);
 // let *cb handle *base however it chooses
 int tcp_write_ex(uv_tcp_t *tcp, char *base, size_t len, dc_write_cb_t *cb);
+// like tcp_write_hdr, but always on the socket, even for shared-memory links
+int tcp_write_raw(
+    uv_tcp_t *tcp,
+    const char *hdr,
+    size_t hdrlen,
+    char *base,
+    size_t len,
+    dc_write_cb_t *cb
+);
 // will call free(base)
 int tcp_write(uv_tcp_t *tcp, char *base, size_t len);
-// will copy base first, then call tcp_write
+// like tcp_write, with a copy of hdr in front of base
+int tcp_write_hdr_free(
+    uv_tcp_t *tcp, const char *hdr, size_t hdrlen, char *base, size_t len
+);
+// will copy base first (as a header, if it is small enough)
 int tcp_write_copy(uv_tcp_t *tcp, const char *base, size_t len);
 
+/* rewrite a header from one of the series-bearing marshal_*() functions for
+   this link, swapping the series name for its id if the link interns series.
+   out must hold WRITE_HDR_MAXSIZE; returns the new length, or 0 on error */
+size_t tcp_intern_hdr(
+    uv_tcp_t *tcp, const char *hdr, size_t hdrlen, char *out
+);
+// 1, and a message, if the peer behind tcp refuses a body of len bytes
+int tcp_frame_check(uv_tcp_t *tcp, size_t len);
+// tcp_write_hdr, after tcp_frame_check and tcp_intern_hdr
+int tcp_write_msg(
+    uv_tcp_t *tcp,
+    const char *hdr,
+    size_t hdrlen,
+    char *base,
+    size_t len,
+    dc_write_cb_t *cb
+);
+// tcp_write_msg, but with the body compressed if that is worthwhile
+int tcp_write_zmsg(
+    uv_tcp_t *tcp,
+    const char *hdr,
+    size_t hdrlen,
+    char *base,
+    size_t len,
+    dc_write_cb_t *cb
+);
+// ready a zeroed dc_link_t for use
+void dc_link_init(dc_link_t *link);
+// release what dc_link_t holds, but not the link itself
+void dc_link_free(struct dctx *dctx, dc_link_t *link);
+// the state of the link behind any of our sockets
+dc_link_t *tcp_link(uv_tcp_t *tcp);
+// send our hello on a link's main connection
+int tcp_hello(uv_tcp_t *tcp, uint16_t port);
+// check the peer's hello, and settle what the link may use
+int tcp_on_hello(uv_tcp_t *tcp, dc_unmarshal_t *u);
+
 // server.c
 
 dc_conn_t *dc_conn_new(void);
@@ -178,5 +461,131 @@ void retry_cb(uv_timer_t *handle);
 
 int init_client(struct dctx *dctx);
 
+// mesh.c
+
+int mesh_init(struct dctx *dctx);
+void mesh_free(struct dctx *dctx);
+void mesh_close(struct dctx *dctx);
+
+// worker: listen for peers on the interface we reached the chief through
+int mesh_listen(struct dctx *dctx, uint16_t *port);
+// chief: remember where a newly-identified worker is listening
+int mesh_note_peer(struct dctx *dctx, dc_conn_t *conn, uint16_t port);
+// chief: tell every worker where every other worker listens
+int mesh_send_table(struct dctx *dctx);
+// worker: dial the peers we need, from the chief's table
+int mesh_on_table(struct dctx *dctx, const char *body, size_t len);
+// worker: all wanted links are established (always true for the chief)
+bool mesh_ready(struct dctx *dctx);
+void mesh_on_read(
+    struct dctx *dctx, uv_stream_t *stream, char *buf, size_t len
+);
+
+int ring_left(struct dctx *dctx);
+int ring_right(struct dctx *dctx);
+
+/* hierarchical collectives need ranks laid out node by node, so that
+   rank == cross_rank * local_size + local_rank; the leader of each node is its
+   local_rank 0, and the chief is the leader of node 0 */
+bool hier_layout_ok(struct dctx *dctx);
+// where a worker sends gather and allgather data: its leader, or the chief
+int hier_leader(struct dctx *dctx);
+// a worker that collects its node's data before the chief sees it
+bool hier_is_leader(struct dctx *dctx);
+
+/* binomial tree rooted at the chief: rank r's parent is r without its highest
+   set bit, and its children are r + 2**k for every 2**k > r.  With hier
+   enabled it is two trees: one over the node leaders, then one in each node */
+#define TREE_MAX_CHILDREN 64
+int tree_parent(struct dctx *dctx);
+// fills children (if not NULL) and returns how many there are
+size_t tree_children(struct dctx *dctx, int *children);
+// the stream to write to in order to reach a given rank
+uv_tcp_t *peer_tcp(struct dctx *dctx, int rank);
+// where to send a routed message: a direct link, or else the chief
+uv_tcp_t *route_tcp(struct dctx *dctx, int dst);
+// chief: pass on a routed message meant for somebody else
+int route_relay(struct dctx *dctx, dc_unmarshal_t *u, int from);
+
+// shm.c
+
+/* links between ranks on the same host can move their bytes through a pair of
+   shared-memory rings, so the socket only carries doorbells.  Either side
+   offers its send ring to the other, and writes switch over to the ring once
+   the peer has mapped it. */
+int shm_offer(struct dctx *dctx, uv_tcp_t *tcp, int peer);
+int shm_on_offer(
+    struct dctx *dctx, uv_tcp_t *tcp, const char *body, size_t len
+);
+int shm_on_ack(struct dctx *dctx, uv_tcp_t *tcp, char ok);
+// drain the peer's ring into on_unmarshal, and retry any blocked writes
+int shm_on_bell(
+    struct dctx *dctx,
+    uv_tcp_t *tcp,
+    void (*on_unmarshal)(dc_unmarshal_t*, void*),
+    void *arg
+);
+// should tcp_write_ex write to the ring instead of the socket?
+bool shm_active(uv_tcp_t *tcp);
+// w is filled in like for tcp_write_raw, and always taken
+int shm_write(uv_tcp_t *tcp, dc_write_t *w);
+// safe to call with NULL
+void shm_free(struct dctx *dctx, dc_shm_t *shm);
+
+// stripe.c
+
+/* with cfg.stripes > 1, every worker makes that many connections to the
+   chief, and bodies of at least cfg.stripe_min_bytes are split across them
+   (see LEN_STRIPED), so one link is not bound by one TCP stream */
+int stripe_init(struct dctx *dctx);
+void stripe_free(struct dctx *dctx);
+void stripe_close(struct dctx *dctx);
+// worker: dial the extra connections, once the main one is up
+int stripe_dial(struct dctx *dctx);
+// chief: a preinit connection says it is an extra one
+int stripe_attach(struct dctx *dctx, dc_conn_t *conn, int rank, size_t k);
+// forget an extra connection which is being closed
+void stripe_forget(struct dctx *dctx, dc_conn_t *conn);
+// every extra connection is established
+bool stripe_ready(struct dctx *dctx);
+// where slices for the link to rank land (NULL when not striping)
+dc_slices_t *stripe_slices(struct dctx *dctx, int rank);
+// file a slice msg from an extra connection
+int stripe_on_slice(struct dctx *dctx, dc_conn_t *conn, dc_unmarshal_t *u);
+// worker: read from an extra connection
+void stripe_on_read(
+    struct dctx *dctx, dc_conn_t *conn, char *buf, size_t len
+);
+// how many ways to split a body of len bytes on tcp (1 for not at all)
+size_t stripe_count(uv_tcp_t *tcp, size_t len);
+// like tcp_write_hdr, but split n ways; hdr is rewritten
+int stripe_write(
+    uv_tcp_t *tcp,
+    char *hdr,
+    size_t hdrlen,
+    char *base,
+    size_t len,
+    size_t n,
+    dc_write_cb_t *cb
+);
+
+// uring.c
+
+/* with cfg.io_uring, established sockets read and write through an io_uring
+   which is driven from the libuv loop, and libuv does everything else */
+int uring_init(struct dctx *dctx);
+void uring_close(struct dctx *dctx);
+void uring_free(struct dctx *dctx);
+// is tcp reading and writing through the ring?
+bool uring_owns(uv_tcp_t *tcp);
+int uring_read_start(uv_tcp_t *tcp);
+// w is filled in like for tcp_write_raw, and always taken
+int uring_write(uv_tcp_t *tcp, dc_write_t *w);
+// before tcp is closed; cancels whatever it has in flight
+void uring_detach(uv_tcp_t *tcp);
+
+// config.c
+void dc_config_load(dc_config_t *cfg);
+
 // const.c
 char *i_promise_i_wont_touch(const char *data);
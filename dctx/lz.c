@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+/* The block format is LZ4's: a run of sequences, each a token byte (high
+   nibble: literal count, low nibble: match length - 4, where 15 means more
+   length bytes follow, each adding up to 255), the literals, then a 2-byte
+   little-endian match offset and the extra match length bytes.  The last
+   sequence is only literals.  Compression is the simple greedy kind, which
+   trades ratio for speed. */
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+// matches stop this far from the end, which is always literals
+#define LZ_LAST_LITERALS 5
+// and never start in the last LZ_MF_LIMIT bytes
+#define LZ_MF_LIMIT 12
+#define LZ_HASH_BITS 12
+
+static uint32_t read32(const unsigned char *p){
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz_hash(uint32_t v){
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// a length of 15 or more continues in extra bytes
+static unsigned char *put_len(unsigned char *op, size_t len){
+    for(; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+// one sequence, or 0 if it does not fit before oend
+static unsigned char *put_sequence(
+    unsigned char *op,
+    unsigned char *oend,
+    const unsigned char *lit,
+    size_t nlit,
+    size_t offset,
+    size_t mlen
+){
+    // worst case: token, literal len bytes, literals, offset, match len bytes
+    size_t need = 1 + nlit / 255 + 1 + nlit + (offset ? 2 + mlen / 255 + 1 : 0);
+    if(need > (size_t)(oend - op)) return NULL;
+
+    unsigned char *token = op++;
+    *token = (unsigned char)((nlit < 15 ? nlit : 15) << 4);
+    if(nlit >= 15) op = put_len(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if(!offset) return op;
+
+    *op++ = (unsigned char)(offset & 0xFF);
+    *op++ = (unsigned char)(offset >> 8);
+    mlen -= LZ_MIN_MATCH;
+    *token = (unsigned char)(*token | (mlen < 15 ? mlen : 15));
+    if(mlen >= 15) op = put_len(op, mlen - 15);
+    return op;
+}
+
+size_t lz_compress(const char *src_, size_t n, char *dst_, size_t cap){
+    const unsigned char *src = (const unsigned char*)src_;
+    unsigned char *op = (unsigned char*)dst_;
+    unsigned char *oend = op + cap;
+    // positions mod 2**32; every candidate is checked before it is used
+    uint32_t table[1 << LZ_HASH_BITS] = {0};
+
+    size_t anchor = 0;
+    if(n > LZ_MF_LIMIT){
+        size_t limit = n - LZ_MF_LIMIT;
+        size_t match_end = n - LZ_LAST_LITERALS;
+        size_t ip = 0;
+        size_t misses = 0;
+        while(ip < limit){
+            uint32_t seq = read32(&src[ip]);
+            uint32_t h = lz_hash(seq);
+            size_t dist = (uint32_t)ip - table[h];
+            table[h] = (uint32_t)ip;
+            if(
+                dist == 0
+                || dist > LZ_MAX_OFFSET
+                || dist > ip
+                || read32(&src[ip - dist]) != seq
+            ){
+                // skip faster through data that keeps not matching
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            size_t ref = ip - dist;
+            size_t mlen = LZ_MIN_MATCH;
+            while(ip + mlen < match_end && src[ref + mlen] == src[ip + mlen]){
+                mlen++;
+            }
+            op = put_sequence(op, oend, &src[anchor], ip - anchor, dist, mlen);
+            if(!op) return 0;
+            ip += mlen;
+            anchor = ip;
+        }
+    }
+
+    op = put_sequence(op, oend, &src[anchor], n - anchor, 0, 0);
+    if(!op) return 0;
+    return (size_t)(op - (unsigned char*)dst_);
+}
+
+// read the extra bytes of a length; returns 1 on a truncated or silly block
+static int get_len(
+    const unsigned char **ip, const unsigned char *iend, size_t *len
+){
+    unsigned char b;
+    do{
+        if(*ip >= iend) return 1;
+        b = *(*ip)++;
+        if(*len > SIZE_MAX - b) return 1;
+        *len += b;
+    }while(b == 255);
+    return 0;
+}
+
+int lz_decompress(const char *src, size_t n, char *dst_, size_t rawlen){
+    const unsigned char *ip = (const unsigned char*)src;
+    const unsigned char *iend = ip + n;
+    unsigned char *dst = (unsigned char*)dst_;
+    unsigned char *op = dst;
+    unsigned char *oend = dst + rawlen;
+
+    while(true){
+        if(ip >= iend) return 1;
+        unsigned char token = *ip++;
+
+        size_t nlit = token >> 4;
+        if(nlit == 15 && get_len(&ip, iend, &nlit)) return 1;
+        if(nlit > (size_t)(iend - ip) || nlit > (size_t)(oend - op)) return 1;
+        memcpy(op, ip, nlit);
+        ip += nlit;
+        op += nlit;
+        // the last sequence has no match
+        if(ip == iend) break;
+
+        if(iend - ip < 2) return 1;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if(offset == 0 || offset > (size_t)(op - dst)) return 1;
+
+        size_t mlen = token & 15;
+        if(mlen == 15 && get_len(&ip, iend, &mlen)) return 1;
+        mlen += LZ_MIN_MATCH;
+        if(mlen > (size_t)(oend - op)) return 1;
+        // a match may overlap what it is writing, which repeats it
+        const unsigned char *ref = op - offset;
+        if(offset >= mlen){
+            memcpy(op, ref, mlen);
+            op += mlen;
+        }else{
+            for(size_t i = 0; i < mlen; i++) *op++ = ref[i];
+        }
+    }
+
+    return op == oend ? 0 : 1;
+}
@@ -0,0 +1,8 @@
+// a small LZ77 block codec for message bodies, see lz.c
+
+/* compress n bytes of src into at most cap bytes of dst.  Returns the
+   compressed size, or 0 if it would not fit, so a cap below n also says
+   "only if it actually helps" */
+size_t lz_compress(const char *src, size_t n, char *dst, size_t cap);
+// returns 0 if src is a block that decompresses to exactly rawlen bytes
+int lz_decompress(const char *src, size_t n, char *dst, size_t rawlen);
@@ -0,0 +1,624 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+/* The mesh is the set of direct links between workers, for ring collectives,
+   tree broadcasts, and routed messages.  Every worker listens
+   on the interface it used to reach the chief and reports the port in its
+   init message.  Once everybody has checked in, the chief sends a table of
+   all the listeners, and each worker dials the peers it needs with a lower
+   rank than its own, so every link is dialed exactly once.  Links to the
+   chief are just the ordinary chief connections. */
+
+int ring_left(dctx_t *dctx){
+    return (dctx->rank + dctx->size - 1) % dctx->size;
+}
+
+int ring_right(dctx_t *dctx){
+    return (dctx->rank + 1) % dctx->size;
+}
+
+bool hier_layout_ok(dctx_t *dctx){
+    int ls = dctx->local_size;
+    int cs = dctx->cross_size;
+    // with only one node or one rank per node there is nothing to gain
+    if(ls < 2 || cs < 2) return false;
+    if(dctx->size / ls != cs || dctx->size % ls != 0) return false;
+    if(dctx->local_rank < 0 || dctx->local_rank >= ls) return false;
+    if(dctx->cross_rank < 0 || dctx->cross_rank >= cs) return false;
+    return dctx->rank == dctx->cross_rank * ls + dctx->local_rank;
+}
+
+int hier_leader(dctx_t *dctx){
+    if(!dctx->hier) return 0;
+    return dctx->rank - dctx->local_rank;
+}
+
+bool hier_is_leader(dctx_t *dctx){
+    return dctx->hier && dctx->rank > 0 && dctx->local_rank == 0;
+}
+
+// parent of i in a binomial tree over [0, n)
+static int binomial_parent(int i){
+    int mask = 1;
+    while(mask <= i / 2) mask <<= 1;
+    return i - mask;
+}
+
+// children of i in a binomial tree over [0, n), as base + child * stride
+static size_t binomial_children(int i, int n, int base, int stride, int *out){
+    size_t count = 0;
+    for(int mask = 1; mask < n && mask > 0; mask <<= 1){
+        if(mask <= i) continue;
+        int child = i + mask;
+        if(child >= n) break;
+        if(out) out[count] = base + child * stride;
+        count++;
+    }
+    return count;
+}
+
+int tree_parent(dctx_t *dctx){
+    if(!dctx->hier) return binomial_parent(dctx->rank);
+    int ls = dctx->local_size;
+    int node = dctx->cross_rank;
+    if(dctx->local_rank > 0){
+        return node * ls + binomial_parent(dctx->local_rank);
+    }
+    return binomial_parent(node) * ls;
+}
+
+size_t tree_children(dctx_t *dctx, int *children){
+    if(!dctx->hier){
+        return binomial_children(dctx->rank, dctx->size, 0, 1, children);
+    }
+    int ls = dctx->local_size;
+    int node = dctx->cross_rank;
+    size_t n = 0;
+    if(dctx->local_rank == 0){
+        // leaders hand off to other nodes first, they have the most to do
+        n = binomial_children(node, dctx->cross_size, 0, ls, children);
+    }
+    n += binomial_children(
+        dctx->local_rank, ls, node * ls, 1, children ? &children[n] : NULL
+    );
+    return n;
+}
+
+static bool mesh_enabled(dctx_t *dctx){
+    return dctx->cfg.ring || dctx->cfg.tree || dctx->hier || dctx->cfg.p2p;
+}
+
+// do we need a direct link to this peer?
+static bool mesh_wants(dctx_t *dctx, int peer){
+    if(peer == 0 || peer == dctx->rank) return false;
+    // routed messages can go anywhere
+    if(dctx->cfg.p2p) return true;
+    if(dctx->cfg.ring){
+        if(peer == ring_left(dctx) || peer == ring_right(dctx)) return true;
+    }
+    if(dctx->hier){
+        // members talk to their leader, and leaders to all their members
+        if(peer == hier_leader(dctx)) return true;
+        int end = dctx->rank + dctx->local_size;
+        if(hier_is_leader(dctx) && peer > dctx->rank && peer < end){
+            return true;
+        }
+    }
+    if(dctx->cfg.tree || dctx->hier){
+        if(peer == tree_parent(dctx)) return true;
+        int children[TREE_MAX_CHILDREN];
+        size_t n = tree_children(dctx, children);
+        for(size_t i = 0; i < n; i++){
+            if(peer == children[i]) return true;
+        }
+    }
+    return false;
+}
+
+int mesh_init(dctx_t *dctx){
+    size_t size = (size_t)dctx->size;
+    dctx->mesh.addrs = calloc(size, sizeof(*dctx->mesh.addrs));
+    if(!dctx->mesh.addrs){
+        perror("calloc");
+        return 1;
+    }
+    if(dctx->rank == 0) return 0;
+
+    dctx->mesh.conns = calloc(size, sizeof(*dctx->mesh.conns));
+    if(!dctx->mesh.conns){
+        perror("calloc");
+        return 1;
+    }
+    for(int i = 0; i < dctx->size; i++){
+        if(mesh_wants(dctx, i)) dctx->mesh.nwanted++;
+    }
+    return 0;
+}
+
+// after mesh_close and after the loop has stopped
+void mesh_free(dctx_t *dctx){
+    if(dctx->mesh.addrs) free(dctx->mesh.addrs);
+    if(dctx->mesh.conns) free(dctx->mesh.conns);
+}
+
+void mesh_close(dctx_t *dctx){
+    if(dctx->rank == 0) return;
+    if(dctx->mesh.tcp_open){
+        uv_close((uv_handle_t*)&dctx->mesh.tcp, noop_handle_closer);
+        dctx->mesh.tcp_open = false;
+    }
+    link_t *link;
+    while((link = link_list_pop_first(&dctx->mesh.preinit))){
+        dc_conn_t *conn = CONTAINER_OF(link, dc_conn_t, link);
+        dc_conn_close(conn);
+    }
+    if(dctx->mesh.conns){
+        for(int i = 0; i < dctx->size; i++){
+            dc_conn_close(dctx->mesh.conns[i]);
+        }
+    }
+}
+
+uv_tcp_t *peer_tcp(dctx_t *dctx, int rank){
+    dc_conn_t *conn;
+    if(dctx->rank == 0){
+        conn = dctx->server.peers[rank];
+    }else if(rank == 0){
+        return &dctx->tcp;
+    }else{
+        conn = dctx->mesh.conns ? dctx->mesh.conns[rank] : NULL;
+    }
+    return conn ? &conn->tcp : NULL;
+}
+
+uv_tcp_t *route_tcp(dctx_t *dctx, int dst){
+    uv_tcp_t *tcp = peer_tcp(dctx, dst);
+    if(tcp) return tcp;
+    // without a direct link, the chief passes it on
+    if(dctx->rank > 0) return &dctx->tcp;
+    return NULL;
+}
+
+// only called from the loop thread; always takes u->body
+int route_relay(dctx_t *dctx, dc_unmarshal_t *u, int from){
+    int dst = (int)u->dst;
+    if((int)u->rank != from){
+        rprintf("rank %d sent a message as rank %u\n", from, u->rank);
+        return 1;
+    }
+    uv_tcp_t *tcp = dctx->rank == 0 ? peer_tcp(dctx, dst) : NULL;
+    if(!tcp){
+        rprintf("cannot pass a message on to rank %d\n", dst);
+        return 1;
+    }
+    char hdr[ROUTED_MSG_HDR_MAXSIZE];
+    size_t buflen = marshal_routed(
+        hdr, u->type, u->series, u->slen, u->rank, u->dst, u->len
+    );
+    if(tcp_frame_check(tcp, u->len)) return 1;
+    // the name may only have reached us as an id on the sender's link
+    char out[WRITE_HDR_MAXSIZE];
+    buflen = tcp_intern_hdr(tcp, hdr, buflen, out);
+    if(!buflen) return 1;
+    char *body = u->body;
+    u->body = NULL;
+    return tcp_write_hdr_free(tcp, out, buflen, body, u->len);
+}
+
+bool mesh_ready(dctx_t *dctx){
+    if(dctx->rank == 0 || !mesh_enabled(dctx)) return true;
+    return dctx->mesh.have_table && dctx->mesh.nlinked == dctx->mesh.nwanted;
+}
+
+static void mesh_listener_cb(uv_stream_t *srv, int status){
+    dctx_t *dctx = srv->loop->data;
+    if(dctx->closed) return;
+    if(status < 0){
+        uv_perror("uv_listen(cb)", status);
+        goto fail;
+    }
+
+    dc_conn_t *conn = dc_conn_new();
+    if(!conn){
+        perror("malloc");
+        goto fail;
+    }
+
+    int ret = uv_tcp_init(&dctx->loop, &conn->tcp);
+    if(ret < 0){
+        uv_perror("uv_tcp_init", ret);
+        free(conn);
+        goto fail;
+    }
+
+    // remember this connection as a preinit until it says who it is
+    link_list_append(&dctx->mesh.preinit, &conn->link);
+
+    ret = uv_tcp_nodelay(&conn->tcp, 1);
+    if(ret < 0) uv_perror("warning: uv_tcp_nodelay failed", ret);
+
+    ret = uv_accept(srv, (uv_stream_t*)&conn->tcp);
+    if(ret < 0){
+        uv_perror("uv_accept", ret);
+        goto fail;
+    }
+
+    ret = tcp_read_start(&conn->tcp);
+    if(ret) goto fail;
+
+    return;
+
+fail:
+    dctx->failed = true;
+    close_everything(dctx);
+}
+
+int mesh_listen(dctx_t *dctx, uint16_t *port){
+    *port = 0;
+    if(!mesh_enabled(dctx) || dctx->mesh.tcp_open) return 0;
+
+    // listen on whichever local address reached the chief
+    struct sockaddr_storage ss;
+    int namelen = sizeof(ss);
+    int ret = uv_tcp_getsockname(&dctx->tcp, (struct sockaddr*)&ss, &namelen);
+    if(ret < 0){
+        uv_perror("uv_tcp_getsockname", ret);
+        return 1;
+    }
+    if(ss.ss_family == AF_INET){
+        ((struct sockaddr_in*)&ss)->sin_port = 0;
+    }else if(ss.ss_family == AF_INET6){
+        ((struct sockaddr_in6*)&ss)->sin6_port = 0;
+    }else{
+        rprintf("unknown address family for mesh: %d\n", (int)ss.ss_family);
+        return 1;
+    }
+
+    ret = uv_tcp_init(&dctx->loop, &dctx->mesh.tcp);
+    if(ret < 0){
+        uv_perror("uv_tcp_init", ret);
+        return 1;
+    }
+    dctx->mesh.tcp_open = true;
+
+    ret = uv_tcp_bind(&dctx->mesh.tcp, (struct sockaddr*)&ss, 0);
+    if(ret < 0){
+        uv_perror("uv_tcp_bind", ret);
+        return 1;
+    }
+
+    ret = uv_listen((uv_stream_t*)&dctx->mesh.tcp, 128, mesh_listener_cb);
+    if(ret < 0){
+        uv_perror("uv_listen", ret);
+        return 1;
+    }
+
+    // find out which port we got
+    namelen = sizeof(ss);
+    ret = uv_tcp_getsockname(
+        &dctx->mesh.tcp, (struct sockaddr*)&ss, &namelen
+    );
+    if(ret < 0){
+        uv_perror("uv_tcp_getsockname", ret);
+        return 1;
+    }
+    if(ss.ss_family == AF_INET){
+        *port = ntohs(((struct sockaddr_in*)&ss)->sin_port);
+    }else{
+        *port = ntohs(((struct sockaddr_in6*)&ss)->sin6_port);
+    }
+    return 0;
+}
+
+int mesh_note_peer(dctx_t *dctx, dc_conn_t *conn, uint16_t port){
+    struct sockaddr_storage *ss = &dctx->mesh.addrs[conn->rank];
+    memset(ss, 0, sizeof(*ss));
+    // port 0 means the worker isn't listening
+    if(port == 0) return 0;
+
+    // the worker listens on the address it connected to us from
+    int namelen = sizeof(*ss);
+    int ret = uv_tcp_getpeername(&conn->tcp, (struct sockaddr*)ss, &namelen);
+    if(ret < 0){
+        uv_perror("uv_tcp_getpeername", ret);
+        return 1;
+    }
+    if(ss->ss_family == AF_INET){
+        ((struct sockaddr_in*)ss)->sin_port = htons(port);
+    }else if(ss->ss_family == AF_INET6){
+        ((struct sockaddr_in6*)ss)->sin6_port = htons(port);
+    }else{
+        memset(ss, 0, sizeof(*ss));
+    }
+    return 0;
+}
+
+static void put_entry(char *buf, const struct sockaddr_storage *ss){
+    memset(buf, 0, TABLE_ENTRY_SIZE);
+    uint16_t port;
+    if(ss->ss_family == AF_INET){
+        const struct sockaddr_in *sin = (const struct sockaddr_in*)ss;
+        buf[0] = 4;
+        memcpy(&buf[1], &sin->sin_addr, 4);
+        port = ntohs(sin->sin_port);
+    }else if(ss->ss_family == AF_INET6){
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6*)ss;
+        buf[0] = 6;
+        memcpy(&buf[1], &sin6->sin6_addr, 16);
+        port = ntohs(sin6->sin6_port);
+    }else{
+        return;
+    }
+    buf[17] = (char)(0xFF & (port >> 8));
+    buf[18] = (char)(0xFF & (port >> 0));
+}
+
+static int get_entry(const char *buf, struct sockaddr_storage *ss){
+    const unsigned char *ubuf = (const unsigned char*)buf;
+    memset(ss, 0, sizeof(*ss));
+    uint16_t port = (uint16_t)((ubuf[17] << 8) | ubuf[18]);
+    switch(ubuf[0]){
+        case 0:
+            return 0;
+        case 4: {
+            struct sockaddr_in *sin = (struct sockaddr_in*)ss;
+            sin->sin_family = AF_INET;
+            memcpy(&sin->sin_addr, &buf[1], 4);
+            sin->sin_port = htons(port);
+            return 0;
+        }
+        case 6: {
+            struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)ss;
+            sin6->sin6_family = AF_INET6;
+            memcpy(&sin6->sin6_addr, &buf[1], 16);
+            sin6->sin6_port = htons(port);
+            return 0;
+        }
+    }
+    // unknown address family
+    return 1;
+}
+
+int mesh_send_table(dctx_t *dctx){
+    if(!mesh_enabled(dctx)) return 0;
+
+    // table is only sent once, at startup, so just copy it to every peer
+    size_t body_len = (size_t)dctx->size * TABLE_ENTRY_SIZE;
+    char *buf = malloc(TABLE_MSG_HDR_SIZE + body_len);
+    if(!buf){
+        perror("malloc");
+        return 1;
+    }
+    size_t n = marshal_table(buf, body_len);
+    for(int i = 0; i < dctx->size; i++){
+        put_entry(&buf[n + (size_t)i * TABLE_ENTRY_SIZE], &dctx->mesh.addrs[i]);
+    }
+    n += body_len;
+
+    int retval = 0;
+    for(int i = 1; i < dctx->size; i++){
+        dc_conn_t *conn = dctx->server.peers[i];
+        if(!conn) continue;
+        int ret = tcp_write_copy(&conn->tcp, buf, n);
+        if(ret){
+            retval = 1;
+            break;
+        }
+    }
+    free(buf);
+    return retval;
+}
+
+static void mesh_conn_cb(uv_connect_t *req, int status){
+    dc_conn_t *conn = req->data;
+    dctx_t *dctx = conn->tcp.loop->data;
+    if(dctx->closed) return;
+
+    if(status < 0){
+        uv_perror("uv_tcp_connect(mesh)", status);
+        goto fail;
+    }
+
+    int ret = tcp_read_start(&conn->tcp);
+    if(ret) goto fail;
+
+    // say who we are
+    ret = tcp_hello(&conn->tcp, 0);
+    if(ret) goto fail;
+
+    // we might be on the same host
+    ret = shm_offer(dctx, &conn->tcp, conn->rank);
+    if(ret) goto fail;
+
+    dctx->mesh.nlinked++;
+    advance_state(dctx);
+    return;
+
+fail:
+    dctx->failed = true;
+    close_everything(dctx);
+}
+
+static int mesh_connect(dctx_t *dctx, int peer){
+    if(dctx->mesh.addrs[peer].ss_family == 0){
+        rprintf("rank %d is not listening for peers\n", peer);
+        return 1;
+    }
+
+    dc_conn_t *conn = dc_conn_new();
+    if(!conn){
+        perror("malloc");
+        return 1;
+    }
+
+    int ret = uv_tcp_init(&dctx->loop, &conn->tcp);
+    if(ret < 0){
+        uv_perror("uv_tcp_init", ret);
+        free(conn);
+        return 1;
+    }
+    conn->rank = peer;
+    dctx->mesh.conns[peer] = conn;
+
+    ret = uv_tcp_nodelay(&conn->tcp, 1);
+    if(ret < 0) uv_perror("warning: uv_tcp_nodelay failed", ret);
+
+    conn->connect_req.data = conn;
+    ret = uv_tcp_connect(
+        &conn->connect_req,
+        &conn->tcp,
+        (struct sockaddr*)&dctx->mesh.addrs[peer],
+        mesh_conn_cb
+    );
+    if(ret < 0){
+        uv_perror("uv_tcp_connect", ret);
+        return 1;
+    }
+    return 0;
+}
+
+int mesh_on_table(dctx_t *dctx, const char *body, size_t len){
+    if(dctx->mesh.have_table){
+        rprintf("got a second peer table\n");
+        return 1;
+    }
+    if(len != (size_t)dctx->size * TABLE_ENTRY_SIZE){
+        rprintf("peer table has the wrong length: %zu\n", len);
+        return 1;
+    }
+    for(int i = 0; i < dctx->size; i++){
+        int ret = get_entry(
+            &body[(size_t)i * TABLE_ENTRY_SIZE], &dctx->mesh.addrs[i]
+        );
+        if(ret){
+            rprintf("bad peer table entry for rank %d\n", i);
+            return 1;
+        }
+    }
+    dctx->mesh.have_table = true;
+
+    // dial the lower-ranked peers we want; higher-ranked ones dial us
+    for(int i = 1; i < dctx->rank; i++){
+        if(!mesh_wants(dctx, i)) continue;
+        int ret = mesh_connect(dctx, i);
+        if(ret) return 1;
+    }
+
+    advance_state(dctx);
+    return 0;
+}
+
+static void mesh_on_unmarshal(dc_unmarshal_t *u, void *arg){
+    dc_conn_t *conn = arg;
+    dctx_t *dctx = conn->tcp.loop->data;
+
+    if(conn->rank < 0){
+        // preinit connection, only "h"ello
+        if(u->type != 'h'){
+            rprintf("got non-hello message from preinit peer\n");
+            goto fail;
+        }
+        if(u->rank >= (uint32_t)dctx->size){
+            rprintf("got invalid rank in peer hello message: %u\n", u->rank);
+            goto fail;
+        }
+        int i = (int)u->rank;
+        if(i <= dctx->rank || !mesh_wants(dctx, i)){
+            rprintf("got unexpected rank in peer hello message: %d\n", i);
+            goto fail;
+        }
+        if(dctx->mesh.conns[i] != NULL){
+            rprintf("got duplicate rank in peer hello message: %d\n", i);
+            goto fail;
+        }
+        if(tcp_on_hello(&conn->tcp, u)) goto fail;
+        link_remove(&conn->link);
+        dctx->mesh.conns[i] = conn;
+        conn->rank = i;
+        // our hello answers theirs, before anything else we send
+        if(tcp_hello(&conn->tcp, 0)) goto fail;
+        if(shm_offer(dctx, &conn->tcp, i)) goto fail;
+        dctx->mesh.nlinked++;
+        advance_state(dctx);
+        return;
+    }
+
+    switch(u->type){
+        case 'h':
+            // the answer to the hello we sent when we dialed
+            if(u->rank != (uint32_t)conn->rank){
+                rprintf(
+                    "got hello from rank %u on link to rank %d\n",
+                    u->rank, conn->rank
+                );
+                goto fail;
+            }
+            if(tcp_on_hello(&conn->tcp, u)) goto fail;
+            break;
+
+        case 'R':
+            if(ring_recv(dctx, u, conn->rank)) goto fail;
+            break;
+
+        case 'T':
+            if(tree_recv(dctx, u, conn->rank)) goto fail;
+            break;
+
+        case 'C':
+            if(tree_chunk_recv(dctx, u, conn->rank)) goto fail;
+            break;
+
+        case 'g':
+        case 'a':
+            if(leader_recv(dctx, u, conn->rank)) goto fail;
+            break;
+
+        case 'x':
+            if(alltoall_recv(dctx, u, conn->rank)) goto fail;
+            break;
+
+        case 'p':
+            if(p2p_recv(dctx, u, conn->rank)) goto fail;
+            break;
+
+        case 'M':
+            if(shm_on_offer(dctx, &conn->tcp, u->body, u->len)) goto fail;
+            break;
+
+        case 'm':
+            if(shm_on_ack(dctx, &conn->tcp, u->kind)) goto fail;
+            break;
+
+        case 'd':
+            if(shm_on_bell(dctx, &conn->tcp, mesh_on_unmarshal, conn)){
+                goto fail;
+            }
+            break;
+
+        default:
+            rprintf("got unexpected message from peer: %c\n", u->type);
+            goto fail;
+    }
+    return;
+
+fail:
+    dctx->failed = true;
+    close_everything(dctx);
+}
+
+void mesh_on_read(dctx_t *dctx, uv_stream_t *stream, char *buf, size_t len){
+    dc_conn_t *conn = stream->data;
+
+    int ret = unmarshal(
+        &conn->state.unmarshal, buf, len, mesh_on_unmarshal, conn
+    );
+    if(ret) goto fail;
+
+    return;
+
+fail:
+    dctx->failed = true;
+    close_everything(dctx);
+}
@@ -3,34 +3,295 @@
 
 #include "internal.h"
 
-size_t marshal_init(char *buf, int rank){
-    buf[0] = 'i';
-    buf[1] = (char)(0xFF & (rank >> 3));
-    buf[2] = (char)(0xFF & (rank >> 2));
-    buf[3] = (char)(0xFF & (rank >> 1));
-    buf[4] = (char)(0xFF & (rank >> 0));
-    return 5;
+// every message type is a fixed sequence of header fields, then maybe a body
+typedef enum {
+    FIELD_END = 0,
+    // U + series
+    FIELD_SERIES,
+    // RRRR
+    FIELD_RANK,
+    // D
+    FIELD_DTYPE,
+    // O
+    FIELD_REDUCE,
+    // W
+    FIELD_WIRE,
+    // PP
+    FIELD_PORT,
+    // VV
+    FIELD_VERSION,
+    // FFFF
+    FIELD_FEATURES,
+    // MMMMMMMM
+    FIELD_FRAME_MAX,
+    // K
+    FIELD_KIND,
+    // SSSS
+    FIELD_STEP,
+    // DDDD
+    FIELD_DST,
+    // OOOOOOOO
+    FIELD_OFFSET,
+    // TTTTTTTT
+    FIELD_TOTAL,
+    // NNNNNNNN
+    FIELD_LEN,
+    // NNNNNNNN bytes of body
+    FIELD_BODY,
+} field_e;
+
+static const field_e HELLO_FIELDS[] = {
+    FIELD_VERSION,
+    FIELD_RANK,
+    FIELD_PORT,
+    FIELD_FEATURES,
+    FIELD_FRAME_MAX,
+    FIELD_END,
+};
+static const field_e EXTRA_FIELDS[] = {
+    FIELD_RANK, FIELD_KIND, FIELD_END
+};
+static const field_e TABLE_FIELDS[] = {
+    FIELD_LEN, FIELD_BODY, FIELD_END
+};
+static const field_e DOORBELL_FIELDS[] = {
+    FIELD_END
+};
+static const field_e SHM_ACK_FIELDS[] = {
+    FIELD_KIND, FIELD_END
+};
+static const field_e BARRIER_FIELDS[] = {
+    FIELD_SERIES, FIELD_END
+};
+static const field_e GATHER_FIELDS[] = {
+    FIELD_SERIES, FIELD_LEN, FIELD_BODY, FIELD_END
+};
+static const field_e ALLGATHER_FIELDS[] = {
+    FIELD_SERIES, FIELD_RANK, FIELD_LEN, FIELD_BODY, FIELD_END
+};
+static const field_e ALLREDUCE_FIELDS[] = {
+    FIELD_SERIES,
+    FIELD_DTYPE,
+    FIELD_REDUCE,
+    FIELD_WIRE,
+    FIELD_LEN,
+    FIELD_BODY,
+    FIELD_END,
+};
+static const field_e BUNDLE_FIELDS[] = {
+    FIELD_SERIES, FIELD_KIND, FIELD_LEN, FIELD_BODY, FIELD_END
+};
+static const field_e ROUTED_FIELDS[] = {
+    FIELD_SERIES, FIELD_RANK, FIELD_DST, FIELD_LEN, FIELD_BODY, FIELD_END
+};
+static const field_e TREE_CHUNK_FIELDS[] = {
+    FIELD_SERIES,
+    FIELD_KIND,
+    FIELD_OFFSET,
+    FIELD_TOTAL,
+    FIELD_LEN,
+    FIELD_BODY,
+    FIELD_END,
+};
+static const field_e ALLGATHER_CHUNK_FIELDS[] = {
+    FIELD_SERIES,
+    FIELD_RANK,
+    FIELD_OFFSET,
+    FIELD_TOTAL,
+    FIELD_LEN,
+    FIELD_BODY,
+    FIELD_END,
+};
+static const field_e RING_FIELDS[] = {
+    FIELD_SERIES,
+    FIELD_KIND,
+    FIELD_DTYPE,
+    FIELD_REDUCE,
+    FIELD_WIRE,
+    FIELD_STEP,
+    FIELD_LEN,
+    FIELD_BODY,
+    FIELD_END,
+};
+
+// returns NULL for unknown message types
+static const field_e *fields_for_type(char type){
+    switch(type){
+        case 'h': return HELLO_FIELDS;      // "h"ello
+        case 'g': return GATHER_FIELDS;     // "g"ather
+        case 'b': return GATHER_FIELDS;     // "b"roadcast
+        case 'c': return GATHER_FIELDS;     // s"c"atter
+        case 'a': return ALLGATHER_FIELDS;  // "a"llgather
+        case 'r': return ALLREDUCE_FIELDS;  // all"r"educe
+        case 's': return ALLREDUCE_FIELDS;  // reduce-"s"catter
+        case 'w': return BARRIER_FIELDS;    // barrier "w"ait
+        case 't': return TABLE_FIELDS;      // "t"able of peers
+        case 'R': return RING_FIELDS;       // "R"ing step
+        case 'T': return BUNDLE_FIELDS;     // "T"ree fan-out
+        case 'G': return BUNDLE_FIELDS;     // "G"athered by a leader
+        case 'M': return TABLE_FIELDS;      // shared "M"emory offer
+        case 'm': return SHM_ACK_FIELDS;    // shared "m"emory ack
+        case 'd': return DOORBELL_FIELDS;   // "d"oorbell
+        case 'x': return ROUTED_FIELDS;     // all-to-all e"x"change
+        case 'p': return ROUTED_FIELDS;     // "p"oint-to-point
+        case 'C': return TREE_CHUNK_FIELDS; // tree "C"hunk
+        case 'A': return ALLGATHER_CHUNK_FIELDS; // "A"llgather chunk
+        case 'e': return EXTRA_FIELDS;      // "e"xtra connection
+        case 'S': return TABLE_FIELDS;      // "S"lice
+    }
+    return NULL;
 }
 
-static size_t marshal_b_or_g(
-    char type, char *buf, const char *series, size_t slen, size_t body_len
-){
+static size_t put_u32(char *buf, uint32_t val){
+    buf[0] = (char)(0xFF & (val >> 24));
+    buf[1] = (char)(0xFF & (val >> 16));
+    buf[2] = (char)(0xFF & (val >> 8));
+    buf[3] = (char)(0xFF & (val >> 0));
+    return 4;
+}
+
+static size_t put_u64(char *buf, uint64_t val){
+    put_u32(&buf[0], (uint32_t)(val >> 32));
+    put_u32(&buf[4], (uint32_t)(0xFFFFFFFF & val));
+    return 8;
+}
+
+static size_t put_series(char *buf, const char *series, size_t slen){
     if(slen > 256){
         BUG("series length too long\n");
         exit(1);
     }
-    if(body_len > UINT32_MAX){
-        BUG("body_len too long\n");
-        exit(1);
+    size_t n = 0;
+    if(slen >= SERIES_DEF){
+        // too long for U, so a definition that defines nothing
+        buf[n++] = (char)SERIES_DEF;
+        buf[n++] = (char)0xFF;
+        buf[n++] = (char)0xFF;
+        // whose len has room for 256
+        buf[n++] = (char)(0xFF & (slen >> 8));
     }
-    buf[0] = type;
-    buf[1] = (char)(0xFF & slen);
-    memcpy(&buf[2], series, slen);
-    buf[slen+2] = (char)(0xFF & (body_len >> 3));
-    buf[slen+3] = (char)(0xFF & (body_len >> 2));
-    buf[slen+4] = (char)(0xFF & (body_len >> 1));
-    buf[slen+5] = (char)(0xFF & (body_len >> 0));
-    return slen + 6;
+    buf[n++] = (char)(0xFF & slen);
+    memcpy(&buf[n], series, slen);
+    return n + slen;
+}
+
+static size_t put_len(char *buf, size_t body_len){
+    return put_u64(buf, (uint64_t)body_len);
+}
+
+void marshal_compressed(
+    char *hdr, size_t hdrlen, char *zhdr, size_t rawlen, size_t zlen
+){
+    // every header with a body ends in its len
+    put_u64(&hdr[hdrlen - 8], LEN_COMPRESSED | (ZBODY_HDR_SIZE + zlen));
+    put_u64(zhdr, (uint64_t)rawlen);
+}
+
+void marshal_striped(char *hdr, size_t hdrlen, size_t nslices){
+    // every header with a body ends in its len, which may be compressed
+    const unsigned char *uhdr = (const unsigned char*)&hdr[hdrlen - 8];
+    uint64_t len = 0;
+    for(size_t i = 0; i < 8; i++) len = (len << 8) | uhdr[i];
+    len |= LEN_STRIPED | ((uint64_t)nslices << LEN_SLICES_SHIFT);
+    put_u64(&hdr[hdrlen - 8], len);
+}
+
+size_t stripe_slice(size_t total, size_t n, size_t k, size_t *off){
+    // total fits in 56 bits and n in 6, so this cannot overflow
+    uint64_t start = (uint64_t)total * k / n;
+    uint64_t end = (uint64_t)total * (k + 1) / n;
+    *off = (size_t)start;
+    return (size_t)(end - start);
+}
+
+// one slice in a dc_slices_t
+typedef struct {
+    link_t link;
+    char *base;
+    size_t len;
+} dc_slice_t;
+DEF_CONTAINER_OF(dc_slice_t, link, link_t)
+
+int slices_push(dc_slices_t *s, size_t k, char *base, size_t len){
+    dc_slice_t *slice = malloc(sizeof(*slice));
+    if(!slice){
+        perror("malloc");
+        free(base);
+        return 1;
+    }
+    *slice = (dc_slice_t){ .base = base, .len = len };
+    link_list_append(&s->q[k], &slice->link);
+    return 0;
+}
+
+void slices_free(dc_slices_t *s){
+    for(size_t k = 0; k < STRIPES_MAX; k++){
+        link_t *link;
+        while((link = link_list_pop_first(&s->q[k]))){
+            dc_slice_t *slice = CONTAINER_OF(link, dc_slice_t, link);
+            free(slice->base);
+            free(slice);
+        }
+    }
+}
+
+size_t marshal_hello(
+    char *buf, int rank, uint16_t port, uint32_t features, uint64_t frame_max
+){
+    size_t n = 0;
+    buf[n++] = 'h';
+    buf[n++] = (char)(0xFF & (PROTOCOL_VERSION >> 8));
+    buf[n++] = (char)(0xFF & (PROTOCOL_VERSION >> 0));
+    n += put_u32(&buf[n], (uint32_t)rank);
+    buf[n++] = (char)(0xFF & (port >> 8));
+    buf[n++] = (char)(0xFF & (port >> 0));
+    n += put_u32(&buf[n], features);
+    n += put_u64(&buf[n], frame_max);
+    return n;
+}
+
+size_t marshal_table(char *buf, size_t body_len){
+    buf[0] = 't';
+    return 1 + put_len(&buf[1], body_len);
+}
+
+size_t marshal_shm_offer(char *buf, size_t body_len){
+    buf[0] = 'M';
+    return 1 + put_len(&buf[1], body_len);
+}
+
+size_t marshal_extra(char *buf, int rank, size_t stripe){
+    size_t n = 0;
+    buf[n++] = 'e';
+    n += put_u32(&buf[n], (uint32_t)rank);
+    buf[n++] = (char)stripe;
+    return n;
+}
+
+size_t marshal_slice(char *buf, size_t body_len){
+    buf[0] = 'S';
+    return 1 + put_len(&buf[1], body_len);
+}
+
+size_t marshal_shm_ack(char *buf, char ok){
+    buf[0] = 'm';
+    buf[1] = ok;
+    return 2;
+}
+
+size_t marshal_barrier(char *buf, const char *series, size_t slen){
+    buf[0] = 'w';
+    return 1 + put_series(&buf[1], series, slen);
+}
+
+static size_t marshal_b_or_g(
+    char type, char *buf, const char *series, size_t slen, size_t body_len
+){
+    size_t n = 0;
+    buf[n++] = type;
+    n += put_series(&buf[n], series, slen);
+    n += put_len(&buf[n], body_len);
+    return n;
 }
 
 size_t marshal_gather(
@@ -45,37 +306,366 @@ size_t marshal_broadcast(
     return marshal_b_or_g('b', buf, series, slen, body_len);
 }
 
+static size_t marshal_t_or_g(
+    char type,
+    char *buf,
+    const char *series,
+    size_t slen,
+    char kind,
+    size_t body_len
+){
+    size_t n = 0;
+    buf[n++] = type;
+    n += put_series(&buf[n], series, slen);
+    buf[n++] = kind;
+    n += put_len(&buf[n], body_len);
+    return n;
+}
+
+size_t marshal_tree(
+    char *buf, const char *series, size_t slen, char kind, size_t body_len
+){
+    return marshal_t_or_g('T', buf, series, slen, kind, body_len);
+}
+
+size_t marshal_bundle(
+    char *buf, const char *series, size_t slen, char kind, size_t body_len
+){
+    return marshal_t_or_g('G', buf, series, slen, kind, body_len);
+}
+
+size_t marshal_bundle_record(char *buf, uint32_t rank, size_t len){
+    size_t n = 0;
+    n += put_u32(&buf[n], rank);
+    n += put_len(&buf[n], len);
+    return n;
+}
+
+static uint32_t get_u32(const char *buf){
+    const unsigned char *ubuf = (const unsigned char*)buf;
+    return ((uint32_t)ubuf[0] << 24)
+         | ((uint32_t)ubuf[1] << 16)
+         | ((uint32_t)ubuf[2] << 8)
+         | ((uint32_t)ubuf[3] << 0);
+}
+
+static uint64_t get_u64(const char *buf){
+    return ((uint64_t)get_u32(&buf[0]) << 32) | get_u32(&buf[4]);
+}
+
+size_t unmarshal_bundle_record(
+    const char *buf, size_t len, uint32_t *rank, size_t *data_len
+){
+    if(len < BUNDLE_RECORD_HDR_SIZE) return 0;
+    *rank = get_u32(&buf[0]);
+    uint64_t n = get_u64(&buf[4]);
+    if(n > len - BUNDLE_RECORD_HDR_SIZE) return 0;
+    *data_len = (size_t)n;
+    return BUNDLE_RECORD_HDR_SIZE;
+}
+
+size_t marshal_scatter(
+    char *buf, const char *series, size_t slen, size_t body_len
+){
+    return marshal_b_or_g('c', buf, series, slen, body_len);
+}
+
 size_t marshal_allgather(
     char *buf, const char *series, size_t slen, uint32_t rank, size_t body_len
 ){
-    if(slen > 256){
-        BUG("series length too long\n");
-        exit(1);
+    size_t n = 0;
+    buf[n++] = 'a';
+    n += put_series(&buf[n], series, slen);
+    n += put_u32(&buf[n], rank);
+    n += put_len(&buf[n], body_len);
+    return n;
+}
+
+static size_t marshal_r_or_s(
+    char type,
+    char *buf,
+    const char *series,
+    size_t slen,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce,
+    dc_dtype_e wire,
+    size_t body_len
+){
+    size_t n = 0;
+    buf[n++] = type;
+    n += put_series(&buf[n], series, slen);
+    buf[n++] = (char)dtype;
+    buf[n++] = (char)reduce;
+    buf[n++] = (char)wire;
+    n += put_len(&buf[n], body_len);
+    return n;
+}
+
+size_t marshal_allreduce(
+    char *buf,
+    const char *series,
+    size_t slen,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce,
+    dc_dtype_e wire,
+    size_t body_len
+){
+    return marshal_r_or_s(
+        'r', buf, series, slen, dtype, reduce, wire, body_len
+    );
+}
+
+size_t marshal_reduce_scatter(
+    char *buf,
+    const char *series,
+    size_t slen,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce,
+    dc_dtype_e wire,
+    size_t body_len
+){
+    return marshal_r_or_s(
+        's', buf, series, slen, dtype, reduce, wire, body_len
+    );
+}
+
+size_t marshal_ring(
+    char *buf,
+    const char *series,
+    size_t slen,
+    char kind,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce,
+    dc_dtype_e wire,
+    uint32_t step,
+    size_t body_len
+){
+    size_t n = 0;
+    buf[n++] = 'R';
+    n += put_series(&buf[n], series, slen);
+    buf[n++] = kind;
+    buf[n++] = (char)dtype;
+    buf[n++] = (char)reduce;
+    buf[n++] = (char)wire;
+    n += put_u32(&buf[n], step);
+    n += put_len(&buf[n], body_len);
+    return n;
+}
+
+size_t marshal_routed(
+    char *buf,
+    char type,
+    const char *series,
+    size_t slen,
+    uint32_t src,
+    uint32_t dst,
+    size_t body_len
+){
+    size_t n = 0;
+    buf[n++] = type;
+    n += put_series(&buf[n], series, slen);
+    n += put_u32(&buf[n], src);
+    n += put_u32(&buf[n], dst);
+    n += put_len(&buf[n], body_len);
+    return n;
+}
+
+size_t marshal_tree_chunk(
+    char *buf,
+    const char *series,
+    size_t slen,
+    char kind,
+    size_t off,
+    size_t total,
+    size_t body_len
+){
+    size_t n = 0;
+    buf[n++] = 'C';
+    n += put_series(&buf[n], series, slen);
+    buf[n++] = kind;
+    n += put_u64(&buf[n], (uint64_t)off);
+    n += put_u64(&buf[n], (uint64_t)total);
+    n += put_len(&buf[n], body_len);
+    return n;
+}
+
+size_t marshal_allgather_chunk(
+    char *buf,
+    const char *series,
+    size_t slen,
+    uint32_t rank,
+    size_t off,
+    size_t total,
+    size_t body_len
+){
+    size_t n = 0;
+    buf[n++] = 'A';
+    n += put_series(&buf[n], series, slen);
+    n += put_u32(&buf[n], rank);
+    n += put_u64(&buf[n], (uint64_t)off);
+    n += put_u64(&buf[n], (uint64_t)total);
+    n += put_len(&buf[n], body_len);
+    return n;
+}
+
+// turn u->zbody into u->body and u->len
+static int inflate_body(dc_unmarshal_t *u){
+    const unsigned char *z = (const unsigned char*)u->zbody;
+    uint64_t rawlen = 0;
+    for(size_t i = 0; i < ZBODY_HDR_SIZE; i++) rawlen = (rawlen << 8) | z[i];
+    size_t n = (size_t)u->zlen - ZBODY_HDR_SIZE;
+    // no lz block grows by more than 255x, so refuse to trust any more
+    if(
+        rawlen > SIZE_MAX || rawlen / 255 > n
+        || (u->len_max && rawlen > u->len_max)
+    ){
+        printf(
+            "bad message, uncompressed len = %llu\n",
+            (unsigned long long)rawlen
+        );
+        return 1;
     }
-    if(body_len > UINT32_MAX){
-        BUG("body_len too long\n");
-        exit(1);
+    u->body = malloc(rawlen ? (size_t)rawlen : 1);
+    if(!u->body){
+        perror("malloc");
+        return 1;
+    }
+    if(lz_decompress(&u->zbody[ZBODY_HDR_SIZE], n, u->body, (size_t)rawlen)){
+        printf("bad message, corrupt compressed body\n");
+        return 1;
     }
-    buf[0] = 'a';
-    buf[1] = (char)(0xFF & slen);
-    memcpy(&buf[2], series, slen);
-    buf[slen+2] = (char)(0xFF & (rank >> 3));
-    buf[slen+3] = (char)(0xFF & (rank >> 2));
-    buf[slen+4] = (char)(0xFF & (rank >> 1));
-    buf[slen+5] = (char)(0xFF & (rank >> 0));
-    buf[slen+6] = (char)(0xFF & (body_len >> 3));
-    buf[slen+7] = (char)(0xFF & (body_len >> 2));
-    buf[slen+8] = (char)(0xFF & (body_len >> 1));
-    buf[slen+9] = (char)(0xFF & (body_len >> 0));
-    return slen + 10;
+    u->len = rawlen;
+    free(u->zbody);
+    u->zbody = NULL;
+    return 0;
 }
 
-int unmarshal(
+// turn a body of wire elements back into dtype elements, if it was narrowed
+static int widen_body(dc_unmarshal_t *u){
+    if(u->wire == u->dtype) return 0;
+    size_t wsize = dc_dtype_size(u->wire);
+    size_t esize = dc_dtype_size(u->dtype);
+    size_t count = (size_t)u->len / wsize;
+    if(count * wsize != u->len || count > SIZE_MAX / esize){
+        printf(
+            "bad message, body len = %llu for wire dtype %d\n",
+            (unsigned long long)u->len, (int)u->wire
+        );
+        return 1;
+    }
+    char *wide = malloc(count ? count * esize : 1);
+    if(!wide){
+        perror("malloc");
+        return 1;
+    }
+    dc_wire_unpack(u->dtype, u->wire, wide, u->body, count);
+    free(u->body);
+    u->body = wide;
+    u->len = count * esize;
+    u->wire = u->dtype;
+    return 0;
+}
+
+// the whole body as it travels, compressed or not
+static char *wire_all(dc_unmarshal_t *u, size_t *len){
+    if(u->zlen){
+        *len = (size_t)u->zlen;
+        return u->zbody;
+    }
+    *len = (size_t)u->len;
+    return u->body;
+}
+
+// where the body's wire bytes go, and how many come on this connection
+static char *wire_body(dc_unmarshal_t *u, size_t *len){
+    size_t total;
+    char *body = wire_all(u, &total);
+    size_t off;
+    // the rest of a striped body comes by the link's other connections
+    *len = u->nslices ? stripe_slice(total, u->nslices, 0, &off) : total;
+    return body;
+}
+
+/* allocate space for the body, before any of it arrives.  Results are
+   contiguous, so this is one allocation of the whole body however big it is;
+   only u->len_max bounds it. */
+static int wire_alloc(dc_unmarshal_t *u){
+    if(u->zlen){
+        if(u->zbody) return 0;
+        u->zbody = malloc((size_t)u->zlen);
+        if(!u->zbody){
+            perror("malloc");
+            return 1;
+        }
+        return 0;
+    }
+    if(u->body) return 0;
+    u->body = malloc((size_t)u->len);
+    if(!u->body){
+        char errmsg[48];
+        snprintf(
+            errmsg,
+            sizeof(errmsg),
+            "malloc(%llu)",
+            (unsigned long long)u->len
+        );
+        perror(errmsg);
+        return 1;
+    }
+    return 0;
+}
+
+/* copy in whichever slices of a striped body the link's other connections
+   have brought; returns 1 once the body is whole, 0 while any slice has yet
+   to arrive, or -1 on error */
+static int take_slices(dc_unmarshal_t *u){
+    size_t total;
+    char *body = wire_all(u, &total);
+    bool missing = false;
+    for(size_t k = 1; k < u->nslices; k++){
+        if(u->landed & ((uint32_t)1 << k)) continue;
+        link_t *link = link_list_pop_first(&u->slices->q[k]);
+        if(!link){
+            missing = true;
+            continue;
+        }
+        dc_slice_t *slice = CONTAINER_OF(link, dc_slice_t, link);
+        size_t off;
+        size_t n = stripe_slice(total, u->nslices, k, &off);
+        bool ok = slice->len == n;
+        if(ok) memcpy(body + off, slice->base, n);
+        free(slice->base);
+        free(slice);
+        if(!ok){
+            printf("bad message, slice %zu does not have %zu bytes\n", k, n);
+            return -1;
+        }
+        u->landed |= (uint32_t)1 << k;
+    }
+    return !missing;
+}
+
+// free the message, but not what survives it
+static void unmarshal_reset(dc_unmarshal_t *u){
+    if(u->body) free(u->body);
+    if(u->zbody) free(u->zbody);
+    *u = (dc_unmarshal_t){
+        .names = u->names,
+        .slices = u->slices,
+        .held = u->held,
+        .len_max = u->len_max,
+    };
+}
+
+/* parse buf, stopping early only at a striped body that is missing slices;
+   *used says how far we got */
+static int parse(
     dc_unmarshal_t *u,
     char *base,
     size_t len,
     void (*on_unmarshal)(dc_unmarshal_t*, void*),
-    void *arg
+    void *arg,
+    size_t *used
 ){
     int retval = 0;
     size_t nread = 0;
@@ -84,199 +674,441 @@ int unmarshal(
     // type-pun base
     unsigned char *ubase = (unsigned char*)base;
 
-    // "check length"
-    #define CKLEN if(len == nread) goto done
-    // "message position"
-    #define MPOS (u->nread_before + nread - nskip)
-
-start:
-    CKLEN;
-
-    if(!u->type){
-        char c = base[nread++];
-        switch(c){
-            case 'i': // "i"nit
-            case 'g': // "g"ather
-            case 'b': // "b"roadcast
-            case 'a': // "a"llgather
-                u->type = c;
-                break;
+    #define TAKE_BYTE() ((uint32_t)ubase[nread++])
 
-            case 'k': // "k"eepalive
-                // that's it for the keepalive message, no user callback
-                unmarshal_free(u);
-                nskip = nread;
-                goto start;
+    const field_e *fields;
+    size_t have;
+    size_t want;
 
-            default:
+    while(true){
+        if(!u->type){
+            if(nread == len) goto done;
+            char c = base[nread++];
+            if(c == 'k'){
+                // "k"eepalive: that's the whole message, no user callback
+                unmarshal_reset(u);
+                nskip = nread;
+                continue;
+            }
+            if(c == 'i'){
+                // what came first on a link before PROTOCOL_VERSION 2
+                printf("bad message, peer runs an older dctx\n");
+                retval = 1;
+                goto done;
+            }
+            if(!fields_for_type(c)){
                 printf(
                     "bad message, msg type = %c (%d), len = %zu\n",
                     c, (int)c, len
                 );
                 retval = 1;
                 goto done;
+            }
+            u->type = c;
         }
-    }
 
-    CKLEN;
+        fields = fields_for_type(u->type);
+        have = len - nread;
 
-    #define TAKE_BYTE() ((uint32_t)ubase[nread++])
-
-    size_t s_pos;
-    size_t body_pos;
-    size_t have;
-    size_t want;
+        switch(fields[u->field]){
+            case FIELD_END:
+                // complete message
+                on_unmarshal(u, arg);
+                unmarshal_reset(u);
+                nskip = nread;
+                continue;
 
-    switch(u->type){
-        case 'i':
-            // fill in the rank arg
-            // XXX: triple-check for int bitshift rounding errors
-            // XXX: why even allow signed rank?
-            if(MPOS == 1){ u->rank |= TAKE_BYTE() << 3; CKLEN; }
-            if(MPOS == 2){ u->rank |= TAKE_BYTE() << 2; CKLEN; }
-            if(MPOS == 3){ u->rank |= TAKE_BYTE() << 1; CKLEN; }
-            if(MPOS == 4){ u->rank |= TAKE_BYTE() << 0; }
-            // complete message
-            on_unmarshal(u, arg);
-            unmarshal_free(u);
-            nskip = nread;
-            goto start;
-
-        case 'g':
-        case 'b':
-            // fill in the slen
-            if(MPOS == 1){ u->slen = TAKE_BYTE(); CKLEN; }
-
-            // read the series
-            if(MPOS < u->slen + 2){
-                s_pos = MPOS - 2;
-                want = u->slen - s_pos;
-                have = len - nread;
-                if(want <= have){
-                    // copy the whole series
-                    memcpy(u->series + s_pos, base + nread, want);
-                    nread += want;
-                    CKLEN;
-                }else{
+            case FIELD_SERIES:
+                // first the length byte or form, then maybe an id
+                if(u->fpos == 0){
+                    if(!have) goto done;
+                    u->sform = (uint8_t)TAKE_BYTE();
+                    u->slen = u->sform;
+                    u->fpos++;
+                    have--;
+                }
+                if(u->sform >= SERIES_DEF){
+                    while(have && u->fpos < 3){
+                        uint32_t sid = ((uint32_t)u->sid << 8) | TAKE_BYTE();
+                        u->sid = (uint16_t)sid;
+                        u->fpos++;
+                        have--;
+                    }
+                    if(u->fpos < 3) goto done;
+                    if(u->sform == SERIES_REF){
+                        // the whole name is already on our side
+                        const dc_iname_t *name = NULL;
+                        if(u->names) name = intern_rx_lookup(u->names, u->sid);
+                        if(!name){
+                            printf(
+                                "bad message, unknown series id %d\n",
+                                (int)u->sid
+                            );
+                            retval = 1;
+                            goto done;
+                        }
+                        u->slen = (uint32_t)name->slen;
+                        memcpy(u->series, name->series, name->slen);
+                        break;
+                    }
+                    if(u->fpos == 3) u->slen = 0;
+                    while(have && u->fpos < 5){
+                        u->slen = (u->slen << 8) | TAKE_BYTE();
+                        u->fpos++;
+                        have--;
+                    }
+                    if(u->fpos < 5) goto done;
+                    if(u->slen > sizeof(u->series)){
+                        printf("bad message, series len = %u\n", u->slen);
+                        retval = 1;
+                        goto done;
+                    }
+                }
+                // then the series itself
+                size_t pre = u->sform == SERIES_DEF ? 5 : 1;
+                want = u->slen - (u->fpos - pre);
+                if(want > have){
                     // copy remainder of buf
-                    memcpy(u->series + s_pos, base + nread, have);
+                    memcpy(u->series + u->fpos - pre, base + nread, have);
                     nread += have;
+                    u->fpos += have;
                     goto done;
                 }
-            }
+                memcpy(u->series + u->fpos - pre, base + nread, want);
+                nread += want;
+                if(u->sform == SERIES_DEF && u->sid != INTERN_NOID){
+                    // remember the name for later frames on this link
+                    if(!u->names){
+                        printf("bad message, series id on a plain link\n");
+                        retval = 1;
+                        goto done;
+                    }
+                    int ret = intern_rx_define(
+                        u->names, u->sid, u->series, u->slen
+                    );
+                    if(ret){
+                        retval = 1;
+                        goto done;
+                    }
+                }
+                break;
+
+            case FIELD_RANK:
+                while(have && u->fpos < 4){
+                    u->rank = (u->rank << 8) | TAKE_BYTE();
+                    u->fpos++;
+                    have--;
+                }
+                if(u->fpos < 4) goto done;
+                break;
+
+            case FIELD_PORT:
+                while(have && u->fpos < 2){
+                    uint32_t port = ((uint32_t)u->port << 8) | TAKE_BYTE();
+                    u->port = (uint16_t)port;
+                    u->fpos++;
+                    have--;
+                }
+                if(u->fpos < 2) goto done;
+                break;
 
-            // fill in the len
-            if(MPOS == u->slen+2){ u->len |= TAKE_BYTE() << 3; CKLEN; }
-            if(MPOS == u->slen+3){ u->len |= TAKE_BYTE() << 2; CKLEN; }
-            if(MPOS == u->slen+4){ u->len |= TAKE_BYTE() << 1; CKLEN; }
-            if(MPOS == u->slen+5){ u->len |= TAKE_BYTE() << 0; CKLEN; }
-
-            // allocate space for this body
-            if(u->body == NULL){
-                u->body = malloc(u->len);
-                if(!u->body){
-                    char errmsg[32];
-                    snprintf(errmsg, sizeof(errmsg), "malloc(%u)\n", u->len);
-                    perror(errmsg);
+            case FIELD_VERSION:
+                while(have && u->fpos < 2){
+                    uint32_t v = ((uint32_t)u->version << 8) | TAKE_BYTE();
+                    u->version = (uint16_t)v;
+                    u->fpos++;
+                    have--;
+                }
+                if(u->fpos < 2) goto done;
+                break;
+
+            case FIELD_FEATURES:
+                while(have && u->fpos < 4){
+                    u->features = (u->features << 8) | TAKE_BYTE();
+                    u->fpos++;
+                    have--;
+                }
+                if(u->fpos < 4) goto done;
+                break;
+
+            case FIELD_FRAME_MAX:
+                while(have && u->fpos < 8){
+                    u->frame_max = (u->frame_max << 8) | TAKE_BYTE();
+                    u->fpos++;
+                    have--;
+                }
+                if(u->fpos < 8) goto done;
+                break;
+
+            case FIELD_KIND:
+                if(!have) goto done;
+                u->kind = (char)TAKE_BYTE();
+                break;
+
+            case FIELD_STEP:
+                while(have && u->fpos < 4){
+                    u->step = (u->step << 8) | TAKE_BYTE();
+                    u->fpos++;
+                    have--;
+                }
+                if(u->fpos < 4) goto done;
+                break;
+
+            case FIELD_DST:
+                while(have && u->fpos < 4){
+                    u->dst = (u->dst << 8) | TAKE_BYTE();
+                    u->fpos++;
+                    have--;
+                }
+                if(u->fpos < 4) goto done;
+                break;
+
+            case FIELD_OFFSET:
+                while(have && u->fpos < 8){
+                    u->off = (u->off << 8) | TAKE_BYTE();
+                    u->fpos++;
+                    have--;
+                }
+                if(u->fpos < 8) goto done;
+                break;
+
+            case FIELD_TOTAL:
+                while(have && u->fpos < 8){
+                    u->total = (u->total << 8) | TAKE_BYTE();
+                    u->fpos++;
+                    have--;
+                }
+                if(u->fpos < 8) goto done;
+                break;
+
+            case FIELD_DTYPE:
+                if(!have) goto done;
+                u->dtype = (uint8_t)TAKE_BYTE();
+                // dtype and reduce index the kernel tables, so check them here
+                if(!dc_dtype_valid(u->dtype)){
+                    printf("bad message, dtype = %d\n", (int)u->dtype);
                     retval = 1;
                     goto done;
                 }
-            }
-            body_pos = MPOS - u->slen - 6;
-            want = u->len - body_pos;
-            have = len - nread;
-            if(want <= have){
-                memcpy(u->body + body_pos, base + nread, want);
-                nread += want;
-                // complete message
-                on_unmarshal(u, arg);
-                unmarshal_free(u);
-                nskip = nread;
-                goto start;
-            }else{
-                // copy remainder of buf
-                memcpy(u->body + body_pos, base + nread, have);
-                nread += have;
-                goto done;
-            }
-            break;
-
-        case 'a':
-            // fill in the slen
-            if(MPOS == 1){ u->slen = TAKE_BYTE(); CKLEN; }
-
-            // read the series
-            if(MPOS < u->slen + 2){
-                s_pos = MPOS - 2;
-                want = u->slen - s_pos;
-                have = len - nread;
-                if(want <= have){
-                    // copy the whole series
-                    memcpy(u->series + s_pos, base + nread, want);
-                    nread += want;
-                    CKLEN;
-                }else{
-                    // copy remainder of buf
-                    memcpy(u->series + s_pos, base + nread, have);
-                    nread += have;
+                break;
+
+            case FIELD_REDUCE:
+                if(!have) goto done;
+                u->reduce = (uint8_t)TAKE_BYTE();
+                if(!dc_reduce_valid(u->reduce)){
+                    printf("bad message, reduce = %d\n", (int)u->reduce);
+                    retval = 1;
                     goto done;
                 }
-            }
+                break;
 
-            // read the rank
-            if(MPOS == u->slen+2){ u->rank |= TAKE_BYTE() << 3; CKLEN; }
-            if(MPOS == u->slen+3){ u->rank |= TAKE_BYTE() << 2; CKLEN; }
-            if(MPOS == u->slen+4){ u->rank |= TAKE_BYTE() << 1; CKLEN; }
-            if(MPOS == u->slen+5){ u->rank |= TAKE_BYTE() << 0; CKLEN; }
-
-            // fill in the len
-            if(MPOS == u->slen+6){ u->len |= TAKE_BYTE() << 3; CKLEN; }
-            if(MPOS == u->slen+7){ u->len |= TAKE_BYTE() << 2; CKLEN; }
-            if(MPOS == u->slen+8){ u->len |= TAKE_BYTE() << 1; CKLEN; }
-            if(MPOS == u->slen+9){ u->len |= TAKE_BYTE() << 0; CKLEN; }
-
-            // allocate space for this body
-            if(u->body == NULL){
-                u->body = malloc(u->len);
-                if(!u->body){
-                    char errmsg[32];
-                    snprintf(errmsg, sizeof(errmsg), "malloc(%u)\n", u->len);
-                    perror(errmsg);
+            case FIELD_WIRE:
+                if(!have) goto done;
+                u->wire = (uint8_t)TAKE_BYTE();
+                if(
+                    u->wire != u->dtype
+                    && !dc_wire_valid(u->dtype, u->wire)
+                ){
+                    printf(
+                        "bad message, dtype %d as wire %d\n",
+                        (int)u->dtype, (int)u->wire
+                    );
                     retval = 1;
                     goto done;
                 }
-            }
-            body_pos = MPOS - u->slen - 10;
-            want = u->len - body_pos;
-            have = len - nread;
-            if(want <= have){
-                memcpy(u->body + body_pos, base + nread, want);
+                break;
+
+            case FIELD_LEN:
+                while(have && u->fpos < 8){
+                    u->len = (u->len << 8) | TAKE_BYTE();
+                    u->fpos++;
+                    have--;
+                }
+                if(u->fpos < 8) goto done;
+                if(u->len & LEN_STRIPED){
+                    uint64_t bits = (uint64_t)LEN_SLICES_MASK
+                                    << LEN_SLICES_SHIFT;
+                    u->nslices = (uint8_t)((u->len & bits) >> LEN_SLICES_SHIFT);
+                    u->len &= ~(LEN_STRIPED | bits);
+                    if(
+                        !u->slices
+                        || u->nslices < 2
+                        || u->nslices > STRIPES_MAX
+                    ){
+                        printf(
+                            "bad message, body striped %d ways\n",
+                            (int)u->nslices
+                        );
+                        retval = 1;
+                        goto done;
+                    }
+                }
+                if(u->len & LEN_COMPRESSED){
+                    // the real len comes with the body
+                    u->zlen = u->len & ~LEN_COMPRESSED;
+                    u->len = 0;
+                    if(u->zlen < ZBODY_HDR_SIZE || u->zlen > SIZE_MAX){
+                        printf(
+                            "bad message, compressed len = %llu\n",
+                            (unsigned long long)u->zlen
+                        );
+                        retval = 1;
+                        goto done;
+                    }
+                }
+                uint64_t wirelen = u->zlen ? u->zlen : u->len;
+                if(u->len > SIZE_MAX || (u->len_max && wirelen > u->len_max)){
+                    printf(
+                        "bad message, body len = %llu\n",
+                        (unsigned long long)wirelen
+                    );
+                    retval = 1;
+                    goto done;
+                }
+                break;
+
+            case FIELD_BODY: {
+                if(wire_alloc(u)){
+                    retval = 1;
+                    goto done;
+                }
+                size_t total;
+                char *body = wire_body(u, &total);
+                want = total - u->fpos;
+                if(want > have){
+                    // copy remainder of buf
+                    memcpy(body + u->fpos, base + nread, have);
+                    nread += have;
+                    u->fpos += have;
+                    goto done;
+                }
+                memcpy(body + u->fpos, base + nread, want);
                 nread += want;
-                // complete message
-                on_unmarshal(u, arg);
-                unmarshal_free(u);
-                nskip = nread;
-                goto start;
-            }else{
-                // copy remainder of buf
-                memcpy(u->body + body_pos, base + nread, have);
-                nread += have;
-                goto done;
+                u->fpos += want;
+                if(u->nslices){
+                    int ret = take_slices(u);
+                    if(ret < 0){
+                        retval = 1;
+                        goto done;
+                    }
+                    // nothing after this body can be handled before it
+                    if(ret == 0) goto done;
+                }
+                if(u->zlen && inflate_body(u)){
+                    retval = 1;
+                    goto done;
+                }
+                if(widen_body(u)){
+                    retval = 1;
+                    goto done;
+                }
+                break;
             }
-            break;
+        }
 
-        default:
-            BUG("type was already checked, but was not valid");
-            exit(7);
+        // field complete, move to the next one
+        u->field++;
+        u->fpos = 0;
     }
 
+    #undef TAKE_BYTE
+
 done:
-    free(base);
-    u->nread_before += len - nskip;
+    u->nread_before += nread - nskip;
+    *used = nread;
     return retval;
 }
 
+// keep bytes that must wait for a striped body to be whole
+static int hold(dc_unmarshal_t *u, const char *base, size_t len){
+    if(!len) return 0;
+    size_t have = u->held.end - u->held.start;
+    if(u->held.start){
+        memmove(u->held.base, u->held.base + u->held.start, have);
+        u->held.start = 0;
+        u->held.end = have;
+    }
+    if(have + len > u->held.cap){
+        size_t cap = u->held.cap ? u->held.cap : RBUF_MIN;
+        while(cap < have + len) cap *= 2;
+        char *grown = realloc(u->held.base, cap);
+        if(!grown){
+            perror("realloc");
+            return 1;
+        }
+        u->held.base = grown;
+        u->held.cap = cap;
+    }
+    memcpy(u->held.base + u->held.end, base, len);
+    u->held.end += len;
+    return 0;
+}
+
+int unmarshal(
+    dc_unmarshal_t *u,
+    char *base,
+    size_t len,
+    void (*on_unmarshal)(dc_unmarshal_t*, void*),
+    void *arg
+){
+    char none = 0;
+    if(!base) base = &none;
+    size_t used;
+    if(u->held.end == 0){
+        int ret = parse(u, base, len, on_unmarshal, arg, &used);
+        if(ret || used == len) return ret;
+        return hold(u, base + used, len - used);
+    }
+
+    // new bytes go after the ones which are waiting already
+    if(hold(u, base, len)) return 1;
+    int ret = parse(
+        u,
+        u->held.base + u->held.start,
+        u->held.end - u->held.start,
+        on_unmarshal,
+        arg,
+        &used
+    );
+    u->held.start += used;
+    if(u->held.start == u->held.end){
+        // caught up
+        free(u->held.base);
+        u->held.base = NULL;
+        u->held.start = 0;
+        u->held.end = 0;
+        u->held.cap = 0;
+    }
+    return ret;
+}
+
+char *unmarshal_body_space(dc_unmarshal_t *u, size_t min, size_t *len){
+    // held bytes come first, and whatever follows them is not body
+    if(u->held.end) return NULL;
+    // the body is only allocated once its header has been parsed
+    size_t total;
+    char *body = wire_body(u, &total);
+    if(!body) return NULL;
+    size_t left = total - u->fpos;
+    if(left < min) return NULL;
+    *len = left;
+    return body + u->fpos;
+}
+
+bool unmarshal_landed(dc_unmarshal_t *u, const char *base, size_t n){
+    size_t total;
+    char *body = wire_body(u, &total);
+    if(!body || base != body + u->fpos) return false;
+    u->fpos += n;
+    u->nread_before += n;
+    return true;
+}
+
 void unmarshal_free(dc_unmarshal_t *u){
-    if(u->body) free(u->body);
-    *u = (dc_unmarshal_t){0};
+    unmarshal_reset(u);
+    if(u->held.base) free(u->held.base);
+    u->held.base = NULL;
+    u->held.start = 0;
+    u->held.end = 0;
+    u->held.cap = 0;
 }
@@ -1,42 +1,341 @@
 typedef struct {
-    char type;  // "i"nit, "g"ather, "k"eepalive
+    /* "h"ello, "g"ather, "b"roadcast, s"c"atter, "a"llgather, "r"educe,
+       reduce-"s"catter, barrier "w"ait, "k"eepalive, "t"able, "R"ing,
+       "T"ree fan-out, "G"athered by a leader, shared "M"emory offer and "m"
+       ack, "d"oorbell, all-to-all e"x"change, "p"oint-to-point, tree "C"hunk,
+       "A"llgather chunk, "e"xtra connection, "S"lice */
+    char type;
     size_t nread_before;
-    // init, allgather arg
+    // which header field we are parsing, and how far into it we are
+    int field;
+    size_t fpos;
+    // hello, allgather arg
     uint32_t rank;
+    // hello args
+    uint16_t port;
+    uint16_t version;
+    uint32_t features;
+    uint64_t frame_max;
+    // ring, tree and bundle args
+    char kind;
+    uint32_t step;
+    // routed args (the source is in rank)
+    uint32_t dst;
+    // chunk args
+    uint64_t off;
+    uint64_t total;
     // gather args
     uint32_t slen;
     char series[256];
-    uint32_t len;
+    // how the series was sent (U, SERIES_DEF or SERIES_REF), and its id
+    uint8_t sform;
+    uint16_t sid;
+    // the names our peer has interned on this link; survives unmarshal_free
+    dc_intern_t *names;
+    // allreduce args
+    uint8_t dtype;
+    uint8_t reduce;
+    // the dtype the body travelled as; it is dtype again once unmarshaled
+    uint8_t wire;
+    uint64_t len;
     char *body;
+    // the biggest body we accept, or 0 for any; survives unmarshal_free
+    uint64_t len_max;
+    // a compressed body: how long it is on the wire, and where it lands
+    uint64_t zlen;
+    char *zbody;
+    // a striped body: how many slices, and which have landed (bit k)
+    uint8_t nslices;
+    uint32_t landed;
+    // where the link's other connections leave its slices; survives
+    // unmarshal_free
+    struct dc_slices *slices;
+    /* bytes that arrived after a striped body which is still missing slices,
+       in base[start:end], to be parsed once the body is whole */
+    struct {
+        char *base;
+        size_t start;
+        size_t end;
+        size_t cap;
+    } held;
 } dc_unmarshal_t;
 
-// init msg format: iNNNN (NNNN = MSB-first rank)
-#define INIT_MSG_SIZE 5
-size_t marshal_init(char *buf, int rank);
+// all integers on the wire are MSB-first
 
-// gather msg format: gUseriesNNNNbody (U = series len, NNNN = body len)
-// (1 + 1 + 256 + 4)
-#define GATHER_MSG_HDR_MAXSIZE 262 // 1 + 1 + 256 + 4
+/* every "Useries" below is one of:
+     Useries      (U < 0xFE = series len) the series by name
+     0xFE IILLseries  (II = id, LL = series len) the series by name, which
+                  also gives it id II on this link (II = 0xFFFF gives it no
+                  id, and is how names of 0xFE bytes or more are sent)
+     0xFF II      a series the sender gave id II earlier on this link
+   marshal_*() only write names; see tcp_intern_hdr() */
+#define SERIES_DEF 0xFE
+#define SERIES_REF 0xFF
+
+/* a body len (NNNNNNNN) with LEN_COMPRESSED set means the body on the wire is
+   RRRRRRRR (the uncompressed len) then an lz block (see lz.c) of the rest.
+   Receivers hand on the uncompressed body as if it had been sent that way */
+#define LEN_COMPRESSED ((uint64_t)1 << 63)
+#define ZBODY_HDR_SIZE 8
+// point a header from marshal_*() at a compressed body, and write its RRRRRRRR
+void marshal_compressed(
+    char *hdr, size_t hdrlen, char *zhdr, size_t rawlen, size_t zlen
+);
+
+/* a body len with LEN_STRIPED set was split into S slices (S is the 6 bits at
+   LEN_SLICES_SHIFT) across the connections of a striped link.  Slice 0
+   follows the header as usual, and slice k is the body of the next slice msg
+   on the link's extra connection k.  The rest is the len of the whole body,
+   which LEN_COMPRESSED describes as if it had not been striped */
+#define LEN_STRIPED ((uint64_t)1 << 62)
+#define LEN_SLICES_SHIFT 56
+#define LEN_SLICES_MASK 0x3F
+#define STRIPES_MAX 16
+// point a header from marshal_*() at a body striped nslices ways
+void marshal_striped(char *hdr, size_t hdrlen, size_t nslices);
+// how long slice k of a body striped n ways is, and where it starts
+size_t stripe_slice(size_t total, size_t n, size_t k, size_t *off);
+
+/* the slices of striped bodies which arrived on a link's extra connections,
+   for the unmarshaller of its main connection.  q[k] holds slice k of each
+   body, oldest first */
+typedef struct dc_slices {
+    link_t q[STRIPES_MAX];
+} dc_slices_t;
+// takes base, which must be from malloc
+int slices_push(dc_slices_t *s, size_t k, char *base, size_t len);
+void slices_free(dc_slices_t *s);
+
+/* hello msg format: hVVRRRRPPFFFFMMMMMMMM, the first message each way on a
+   link's main connection (VV = protocol version, RRRR = rank, PP = mesh port
+   or 0, FFFF = FEAT_* bits we can receive, MMMMMMMM = the biggest body len we
+   accept).  Peers of another version are refused, not misparsed; before 2,
+   the first message was iRRRRPP. */
+#define HELLO_MSG_SIZE 21
+#define PROTOCOL_VERSION 2
+// compressed bodies, see LEN_COMPRESSED
+#define FEAT_COMPRESS ((uint32_t)1 << 0)
+// tree and allgather chunks, C and A msgs
+#define FEAT_CHUNKS ((uint32_t)1 << 1)
+// series by id, see SERIES_DEF
+#define FEAT_INTERN ((uint32_t)1 << 2)
+// body lens of 2**32 or more
+#define FEAT_LEN64 ((uint32_t)1 << 3)
+#define FEAT_ALL (FEAT_COMPRESS | FEAT_CHUNKS | FEAT_INTERN | FEAT_LEN64)
+// the biggest body len which leaves the flag bits of a len clear
+#define FRAME_MAX (((uint64_t)1 << LEN_SLICES_SHIFT) - 1)
+size_t marshal_hello(
+    char *buf, int rank, uint16_t port, uint32_t features, uint64_t frame_max
+);
+
+// table msg format: tNNNNNNNNbody (NNNNNNNN = body len)
+// body is one TABLE_ENTRY_SIZE record per rank: F + 16 byte address + PP
+// (F = 4 or 6 for the address family, or 0 if that rank has no listener)
+#define TABLE_MSG_HDR_SIZE 9
+#define TABLE_ENTRY_SIZE 19
+size_t marshal_table(char *buf, size_t body_len);
+
+// shared memory offer msg format: MNNNNNNNNbody
+// (NNNNNNNN = body len)
+// body is an 8 byte cookie, then the name of a shm object holding a ring
+#define SHM_OFFER_MSG_HDR_SIZE 9
+size_t marshal_shm_offer(char *buf, size_t body_len);
+
+// shared memory ack msg format: mK (K = 'y' if the ring was mapped, or 'n')
+#define SHM_ACK_MSG_SIZE 2
+size_t marshal_shm_ack(char *buf, char ok);
+
+// extra connection msg format: eRRRRK (RRRR = rank, K = stripe index)
+// the first msg on each extra connection a worker makes to the chief
+#define EXTRA_MSG_SIZE 6
+size_t marshal_extra(char *buf, int rank, size_t stripe);
+
+// slice msg format: SNNNNNNNNbody (NNNNNNNN = body len)
+// one slice of a striped body, on one of the link's extra connections
+#define SLICE_MSG_HDR_SIZE 9
+size_t marshal_slice(char *buf, size_t body_len);
+
+// doorbell msg format: d
+// sent on the socket of a shared-memory link: "go check the rings"
+
+// barrier msg format: wUseries (U = series len)
+// workers send it when they arrive, the chief sends it back to release them
+// (1 + 5 + 256)
+#define BARRIER_MSG_MAXSIZE 262 // 1 + 5 + 256
+size_t marshal_barrier(char *buf, const char *series, size_t slen);
+
+// gather msg format: gUseriesNNNNNNNNbody
+// (U = series len, NNNNNNNN = body len)
+// (1 + 5 + 256 + 8)
+#define GATHER_MSG_HDR_MAXSIZE 270 // 1 + 5 + 256 + 8
 size_t marshal_gather(
     char *buf, const char *series, size_t slen, size_t body_len
 );
 
-// broadcast msg format: bUseriesNNNNbody (U = series len, NNNN = body len)
-// (1 + 1 + 256 + 4)
-#define BROADCAST_MSG_HDR_MAXSIZE 262 // 1 + 1 + 256 + 4
+// broadcast msg format: bUseriesNNNNNNNNbody
+// (U = series len, NNNNNNNN = body len)
+// (1 + 5 + 256 + 8)
+#define BROADCAST_MSG_HDR_MAXSIZE 270 // 1 + 5 + 256 + 8
 size_t marshal_broadcast(
     char *buf, const char *series, size_t slen, size_t body_len
 );
 
-// allgather msg format: aUseriesRRRRNNNNbody
-// (U = series len, RRRR = rank, NNNN = body len)
-// (1 + 1 + 256 + 4 + 4)
-#define ALLGATHER_MSG_HDR_MAXSIZE 266 // 1 + 1 + 256 + 4 + 4
+// tree msg format: TUseriesKNNNNNNNNbody
+// (U = series len, K = op kind, NNNNNNNN = body len)
+// every receiver forwards it to its own tree children.  K is 'b' for a
+// broadcast, or 'a' for an allgather result, whose body is a bundle
+// (1 + 5 + 256 + 1 + 8)
+#define TREE_MSG_HDR_MAXSIZE 271 // 1 + 5 + 256 + 1 + 8
+size_t marshal_tree(
+    char *buf, const char *series, size_t slen, char kind, size_t body_len
+);
+
+// bundle msg format: GUseriesKNNNNNNNNbody
+// (U = series len, K = op kind, NNNNNNNN = body len)
+// a node leader sends its whole node's gather ('g') or allgather ('a') data
+// to the chief in one message.  The body is a sequence of records, each with
+// a RRRRNNNNNNNN header (RRRR = rank, NNNNNNNN = data len) followed by the
+// data.
+// (1 + 5 + 256 + 1 + 8)
+#define BUNDLE_MSG_HDR_MAXSIZE 271 // 1 + 5 + 256 + 1 + 8
+#define BUNDLE_RECORD_HDR_SIZE 12
+size_t marshal_bundle(
+    char *buf, const char *series, size_t slen, char kind, size_t body_len
+);
+size_t marshal_bundle_record(char *buf, uint32_t rank, size_t len);
+// returns the header size, or 0 if buf does not hold a whole record
+size_t unmarshal_bundle_record(
+    const char *buf, size_t len, uint32_t *rank, size_t *data_len
+);
+
+// scatter msg format: cUseriesNNNNNNNNbody
+// (U = series len, NNNNNNNN = body len)
+// the chief sends each worker only its own slice
+// (1 + 5 + 256 + 8)
+#define SCATTER_MSG_HDR_MAXSIZE 270 // 1 + 5 + 256 + 8
+size_t marshal_scatter(
+    char *buf, const char *series, size_t slen, size_t body_len
+);
+
+// allgather msg format: aUseriesRRRRNNNNNNNNbody
+// (U = series len, RRRR = rank, NNNNNNNN = body len)
+// (1 + 5 + 256 + 4 + 8)
+#define ALLGATHER_MSG_HDR_MAXSIZE 274 // 1 + 5 + 256 + 4 + 8
 size_t marshal_allgather(
     char *buf, const char *series, size_t slen, uint32_t rank, size_t body_len
 );
 
-// calls on_unmarshal once for every message found
+/* in every reducing msg below, W is the dtype of the body's elements on the
+   wire: either D, or a narrower dtype that D converts to (see dc_wire_valid),
+   which receivers widen back to D before reducing anything.  NNNNNNNN is the
+   len on the wire. */
+
+// allreduce msg format: rUseriesDOWNNNNNNNNbody
+// (U = series len, D = dtype, O = reduce op, W = wire dtype,
+//  NNNNNNNN = body len)
+// workers send their contribution, the chief replies with the result
+// (1 + 5 + 256 + 1 + 1 + 1 + 8)
+#define ALLREDUCE_MSG_HDR_MAXSIZE 273 // 1 + 5 + 256 + 1 + 1 + 1 + 8
+size_t marshal_allreduce(
+    char *buf,
+    const char *series,
+    size_t slen,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce,
+    dc_dtype_e wire,
+    size_t body_len
+);
+
+// reduce-scatter msg format: sUseriesDOWNNNNNNNNbody
+// (U = series len, D = dtype, O = reduce op, W = wire dtype,
+//  NNNNNNNN = body len)
+// workers send their whole buffer, the chief replies with just their chunk
+// (1 + 5 + 256 + 1 + 1 + 1 + 8)
+#define REDUCE_SCATTER_MSG_HDR_MAXSIZE 273 // 1 + 5 + 256 + 1 + 1 + 1 + 8
+size_t marshal_reduce_scatter(
+    char *buf,
+    const char *series,
+    size_t slen,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce,
+    dc_dtype_e wire,
+    size_t body_len
+);
+
+// ring msg format: RUseriesKDOWSSSSNNNNNNNNbody
+// (U = series len, K = op kind, D = dtype, O = reduce op, W = wire dtype,
+//  SSSS = step, NNNNNNNN = body len; K is the type of the equivalent chief
+//  message, 'r' or 's')
+// sent to the right-hand neighbour for each step of a ring collective
+// (1 + 5 + 256 + 1 + 1 + 1 + 1 + 4 + 8)
+#define RING_MSG_HDR_MAXSIZE 278 // 1 + 5 + 256 + 1 + 1 + 1 + 1 + 4 + 8
+size_t marshal_ring(
+    char *buf,
+    const char *series,
+    size_t slen,
+    char kind,
+    dc_dtype_e dtype,
+    dc_reduce_e reduce,
+    dc_dtype_e wire,
+    uint32_t step,
+    size_t body_len
+);
+
+// routed msg format: TUseriesSSSSDDDDNNNNNNNNbody
+// (T = type, U = series len, SSSS = source rank, DDDD = destination rank,
+//  NNNNNNNN = body len)
+// sent straight to DDDD over a direct link if there is one, otherwise to the
+// chief, which passes it on unchanged.  Types: 'x' (alltoall), 'p' (send,
+// where the series is the tag)
+// (1 + 5 + 256 + 4 + 4 + 8)
+#define ROUTED_MSG_HDR_MAXSIZE 278 // 1 + 5 + 256 + 4 + 4 + 8
+size_t marshal_routed(
+    char *buf,
+    char type,
+    const char *series,
+    size_t slen,
+    uint32_t src,
+    uint32_t dst,
+    size_t body_len
+);
+
+// tree chunk msg format: CUseriesKOOOOOOOOTTTTTTTTNNNNNNNNbody
+// (U = series len, K = tree kind, OOOOOOOO = offset, TTTTTTTT = total len,
+//  NNNNNNNN = body len)
+// a tree message too big to send whole goes out as a run of chunks, in order,
+// and every receiver forwards each chunk to its children as soon as it lands
+// (1 + 5 + 256 + 1 + 8 + 8 + 8)
+#define TREE_CHUNK_MSG_HDR_MAXSIZE 287 // 1 + 5 + 256 + 1 + 8 + 8 + 8
+size_t marshal_tree_chunk(
+    char *buf,
+    const char *series,
+    size_t slen,
+    char kind,
+    size_t off,
+    size_t total,
+    size_t body_len
+);
+
+// allgather chunk msg format: AUseriesRRRROOOOOOOOTTTTTTTTNNNNNNNNbody
+// (U = series len, RRRR = rank, OOOOOOOO = offset, TTTTTTTT = total len,
+//  NNNNNNNN = body len)
+// a large allgather contribution, in order; the chief passes each chunk on
+// to the other workers as soon as it lands
+// (1 + 5 + 256 + 4 + 8 + 8 + 8)
+#define ALLGATHER_CHUNK_MSG_HDR_MAXSIZE 290 // 1 + 5 + 256 + 4 + 8 + 8 + 8
+size_t marshal_allgather_chunk(
+    char *buf,
+    const char *series,
+    size_t slen,
+    uint32_t rank,
+    size_t off,
+    size_t total,
+    size_t body_len
+);
+
+/* calls on_unmarshal once for every message found; buf still belongs to the
+   caller afterwards.  A striped body waits for its slices, and so does
+   everything after it; an empty call once they arrive carries on */
 int unmarshal(
     dc_unmarshal_t *unmarshal,
     char *buf,
@@ -44,4 +343,11 @@ int unmarshal(
     void (*on_unmarshal)(dc_unmarshal_t*, void*),
     void *arg
 );
+// if a body of at least min more bytes is pending, returns where the next
+// bytes of it belong, and sets *len to how many are still missing
+char *unmarshal_body_space(dc_unmarshal_t *unmarshal, size_t min, size_t *len);
+// after a read into the space from unmarshal_body_space, account for the n
+// bytes that landed there; returns false if base was some other buffer.  An
+// empty unmarshal() call afterwards completes the message if it is whole.
+bool unmarshal_landed(dc_unmarshal_t *unmarshal, const char *base, size_t n);
 void unmarshal_free(dc_unmarshal_t *unmarshal);
@@ -36,6 +36,20 @@ static void free_op_recvd_and_len(int n, char** recvd, size_t *len){
     if(len) free(len);
 }
 
+// reduce-scatter takes N-1 steps, and allreduce is that plus an allgather
+static void free_op_chunks(int n, dc_chunked_t *chunks){
+    if(!chunks) return;
+    for(int i = 0; i < n; i++){
+        if(chunks[i].buf) free(chunks[i].buf);
+    }
+    free(chunks);
+}
+
+static size_t ring_nsteps(dctx_t *dctx, dc_op_type_e type){
+    size_t n = (size_t)(dctx->size - 1);
+    return type == DC_OP_RING_ALLREDUCE ? 2 * n : n;
+}
+
 dc_op_t *dc_op_new(
     dctx_t *dctx, dc_op_type_e type, const char *series, size_t slen
 ){
@@ -56,6 +70,16 @@ dc_op_t *dc_op_new(
     };
     memcpy(op->series, series, slen);
 
+    // settings for just this series, or else the defaults
+    op->compress = dctx->cfg.compress;
+    op->wire = -1;
+    uint16_t id = intern_find(&dctx->sopts.series, series, slen);
+    if(id != INTERN_NOID){
+        dc_series_opts_t *opts = &dctx->sopts.opts[id];
+        if(opts->compress >= 0) op->compress = opts->compress;
+        op->wire = opts->wire;
+    }
+
     switch(type){
         case DC_OP_GATHER:
             if(dctx->rank == 0){
@@ -65,6 +89,14 @@ dc_op_t *dc_op_new(
                 );
                 if(ret) goto fail;
                 #undef OP
+            }else if(hier_is_leader(dctx)){
+                #define OP op->u.gather.worker
+                // leader gather: somewhere to keep our members' data
+                int ret = malloc_op_recvd_and_len(
+                    dctx->size, &OP.local, &OP.locallen
+                );
+                if(ret) goto fail;
+                #undef OP
             }else{
                 // worker gather: nothing to allocate
             }
@@ -74,6 +106,19 @@ dc_op_t *dc_op_new(
             // nothing to allocate
             break;
 
+        case DC_OP_SCATTER:
+            if(dctx->rank == 0){
+                #define OP op->u.scatter.chief
+                int ret = malloc_op_recvd_and_len(
+                    dctx->size, &OP.data, &OP.len
+                );
+                if(ret) goto fail;
+                #undef OP
+            }else{
+                // worker scatter: nothing to allocate
+            }
+            break;
+
         case DC_OP_ALLGATHER:
             if(dctx->rank == 0){
                 #define OP op->u.allgather.chief
@@ -91,6 +136,64 @@ dc_op_t *dc_op_new(
                 #undef OP
             }
             break;
+
+        case DC_OP_ALLREDUCE:
+        case DC_OP_REDUCE_SCATTER:
+            if(dctx->rank == 0){
+                #define OP op->u.allreduce.chief
+                OP.recvd = calloc((size_t)dctx->size, sizeof(*OP.recvd));
+                if(!OP.recvd){
+                    perror("calloc");
+                    goto fail;
+                }
+                #undef OP
+            }else{
+                // worker allreduce: nothing to allocate
+            }
+            break;
+
+        case DC_OP_BARRIER:
+            if(dctx->rank == 0){
+                #define OP op->u.barrier.chief
+                OP.recvd = calloc((size_t)dctx->size, sizeof(*OP.recvd));
+                if(!OP.recvd){
+                    perror("calloc");
+                    goto fail;
+                }
+                #undef OP
+            }else{
+                // worker barrier: nothing to allocate
+            }
+            break;
+
+        case DC_OP_RING_ALLREDUCE:
+        case DC_OP_RING_REDUCE_SCATTER:
+            #define OP op->u.ring
+            OP.nsteps = ring_nsteps(dctx, type);
+            if(OP.nsteps){
+                int ret = malloc_op_recvd_and_len(
+                    (int)OP.nsteps, &OP.rx, &OP.rxlen
+                );
+                if(ret) goto fail;
+            }
+            #undef OP
+            break;
+
+        case DC_OP_ALLTOALL:
+            #define OP op->u.alltoall
+            if(malloc_op_recvd_and_len(dctx->size, &OP.data, &OP.datalen)){
+                goto fail;
+            }
+            if(malloc_op_recvd_and_len(dctx->size, &OP.recvd, &OP.len)){
+                goto fail;
+            }
+            #undef OP
+            break;
+
+        case DC_OP_SEND:
+        case DC_OP_RECV:
+            // nothing to allocate
+            break;
     }
 
     return op;
@@ -112,6 +215,8 @@ void dc_op_free(dc_op_t *op){
             }else{
                 #define OP op->u.gather.worker
                 if(OP.data) free(OP.data);
+                free_op_recvd_and_len(dctx->size, OP.local, OP.locallen);
+                if(OP.bundle) free(OP.bundle);
                 #undef OP
             }
             break;
@@ -124,6 +229,19 @@ void dc_op_free(dc_op_t *op){
             }else{
                 #define OP op->u.broadcast.worker
                 if(OP.recvd) free(OP.recvd);
+                if(OP.chunks.buf) free(OP.chunks.buf);
+                #undef OP
+            }
+            break;
+
+        case DC_OP_SCATTER:
+            if(dctx->rank == 0){
+                #define OP op->u.scatter.chief
+                free_op_recvd_and_len(dctx->size, OP.data, OP.len);
+                #undef OP
+            }else{
+                #define OP op->u.scatter.worker
+                if(OP.recvd) free(OP.recvd);
                 #undef OP
             }
             break;
@@ -132,25 +250,151 @@ void dc_op_free(dc_op_t *op){
             if(dctx->rank == 0){
                 #define OP op->u.allgather.chief
                 free_op_recvd_and_len(dctx->size, OP.recvd, OP.len);
+                free_op_chunks(dctx->size, OP.chunks);
+                if(OP.frames) free(OP.frames);
+                if(OP.frameoff) free(OP.frameoff);
+                if(OP.bundle) free(OP.bundle);
                 #undef OP
             }else{
                 #define OP op->u.allgather.worker
+                if(OP.data) free(OP.data);
                 free_op_recvd_and_len(dctx->size, OP.recvd, OP.len);
+                free_op_chunks(dctx->size, OP.chunks);
+                if(OP.bundle) free(OP.bundle);
+                if(OP.results) free(OP.results);
+                if(OP.resultchunks.buf) free(OP.resultchunks.buf);
+                #undef OP
+            }
+            break;
+
+        case DC_OP_ALLREDUCE:
+        case DC_OP_REDUCE_SCATTER:
+            if(dctx->rank == 0){
+                #define OP op->u.allreduce.chief
+                if(OP.mine) free(OP.mine);
+                if(OP.accum) free(OP.accum);
+                if(OP.recvd) free(OP.recvd);
+                #undef OP
+            }else{
+                #define OP op->u.allreduce.worker
+                if(OP.data) free(OP.data);
+                if(OP.recvd) free(OP.recvd);
+                #undef OP
+            }
+            break;
+
+        case DC_OP_BARRIER:
+            if(dctx->rank == 0){
+                #define OP op->u.barrier.chief
+                if(OP.recvd) free(OP.recvd);
                 #undef OP
             }
             break;
+
+        case DC_OP_RING_ALLREDUCE:
+        case DC_OP_RING_REDUCE_SCATTER:
+            #define OP op->u.ring
+            if(OP.data) free(OP.data);
+            free_op_recvd_and_len((int)OP.nsteps, OP.rx, OP.rxlen);
+            #undef OP
+            break;
+
+        case DC_OP_ALLTOALL:
+            #define OP op->u.alltoall
+            free_op_recvd_and_len(dctx->size, OP.data, OP.datalen);
+            free_op_recvd_and_len(dctx->size, OP.recvd, OP.len);
+            #undef OP
+            break;
+
+        case DC_OP_SEND:
+            if(op->u.send.data) free(op->u.send.data);
+            break;
+
+        case DC_OP_RECV:
+            if(op->u.recv.recvd) free(op->u.recv.recvd);
+            break;
     }
     free(op);
 }
 
+static uint32_t op_hash(
+    dc_op_type_e type, const char *series, size_t slen
+){
+    return series_hash(series, slen) ^ ((uint32_t)type * 0x9E3779B9u);
+}
+
+static bool op_is(
+    dc_op_t *op,
+    dc_op_type_e type,
+    uint32_t hash,
+    const char *series,
+    size_t slen
+){
+    if(op->hash != hash || op->type != type || op->slen != slen) return false;
+    return memcmp(op->series, series, slen) == 0;
+}
+
+static link_t *op_bucket(dctx_t *dctx, uint32_t hash){
+    return &dctx->a.index[hash & (dctx->a.nindex - 1)];
+}
+
+#define OP_INDEX_MIN 64
+
+int op_index_init(dctx_t *dctx){
+    dctx->a.index = calloc(OP_INDEX_MIN, sizeof(*dctx->a.index));
+    if(!dctx->a.index){
+        perror("calloc");
+        return 1;
+    }
+    dctx->a.nindex = OP_INDEX_MIN;
+    return 0;
+}
+
+void op_index_free(dctx_t *dctx){
+    free(dctx->a.index);
+    dctx->a.index = NULL;
+    dctx->a.nindex = 0;
+}
+
+// double the buckets, rebuilding each one in inflight order
+static void op_index_grow(dctx_t *dctx){
+    size_t nindex = dctx->a.nindex * 2;
+    link_t *index = calloc(nindex, sizeof(*index));
+    // without memory we just keep longer buckets
+    if(!index) return;
+    dc_op_t *op, *temp;
+    LINK_FOR_EACH_SAFE(op, temp, &dctx->a.inflight, dc_op_t, link){
+        if(!op->ilink.next) continue;
+        link_list_append(&index[op->hash & (nindex - 1)], &op->ilink);
+    }
+    free(dctx->a.index);
+    dctx->a.index = index;
+    dctx->a.nindex = nindex;
+}
+
+void op_inflight_add(dctx_t *dctx, dc_op_t *op){
+    link_list_append(&dctx->a.inflight, &op->link);
+    op->hash = op_hash(op->type, op->series, op->slen);
+    link_list_append(op_bucket(dctx, op->hash), &op->ilink);
+    if(++dctx->a.nindexed > dctx->a.nindex) op_index_grow(dctx);
+}
+
+void op_index_remove(dc_op_t *op){
+    if(!op->ilink.next) return;
+    link_remove(&op->ilink);
+    op->dctx->a.nindexed--;
+}
+
 void mark_op_completed_locked(dc_op_t *op){
     dctx_t *dctx = op->dctx;
     // remove op from inflight ops
     link_remove(&op->link);
+    op_index_remove(op);
     // insert into complete ops
     link_list_append(&dctx->a.complete, &op->link);
     // mark the op ready for the user
     op->ready = true;
+    completion_signal(dctx);
 }
 
 
@@ -186,14 +430,37 @@ void dc_op_write_cb(dc_op_t *op){
         case DC_OP_BROADCAST:
             if(dctx->rank == 0){
                 #define OP op->u.broadcast.chief
-                if(++OP.nsent == dctx->server.npeers){
+                if(++OP.nsent == OP.nwrites){
                     // leave OP.data for dc_op_await
                     // operation is now complete
                     mark_op_completed_and_notify(op);
                 }
                 #undef OP
             }else{
-                RBUG("worker doesn't send anything for broadcast");
+                #define OP op->u.broadcast.worker
+                if(!OP.tree){
+                    RBUG("worker only sends for a tree broadcast");
+                    goto fail;
+                }
+                // let dc_op_advance decide if we are done
+                OP.nforwarded++;
+                uv_async_send(&dctx->async);
+                #undef OP
+            }
+            break;
+
+        case DC_OP_SCATTER:
+            if(dctx->rank == 0){
+                #define OP op->u.scatter.chief
+                // one write per peer, each of a different slice
+                if(++OP.nsent == dctx->server.npeers){
+                    // leave OP.data[0] for dc_op_await
+                    // operation is now complete
+                    mark_op_completed_and_notify(op);
+                }
+                #undef OP
+            }else{
+                RBUG("worker doesn't send anything for scatter");
                 goto fail;
             }
             break;
@@ -201,7 +468,8 @@ void dc_op_write_cb(dc_op_t *op){
         case DC_OP_ALLGATHER:
             if(dctx->rank == 0){
                 #define OP op->u.allgather.chief
-                if(++OP.nsent == dctx->server.npeers){
+                // chunks passed on early count too, but can't finish us
+                if(++OP.nsent == OP.nwrites && OP.write_started){
                     // leave recvd for dc_op_await
                     // operation is now complete
                     mark_op_completed_and_notify(op);
@@ -209,14 +477,89 @@ void dc_op_write_cb(dc_op_t *op){
                 #undef OP
             }else{
                 #define OP op->u.allgather.worker
+                OP.nwritten++;
+                if(dctx->hier){
+                    // let dc_op_advance decide if we are done
+                    uv_async_send(&dctx->async);
+                    break;
+                }
+                // the chief doesn't echo our data, so it is our own result
+                if(OP.data){
+                    OP.recvd[dctx->rank] = OP.data;
+                    OP.data = NULL;
+                }else{
+                    OP.recvd[dctx->rank] = bytesdup(
+                        OP.nofree, OP.datalen
+                    );
+                    if(!OP.recvd[dctx->rank]) goto fail;
+                }
+                OP.len[dctx->rank] = OP.datalen;
+                if(++OP.nrecvd == (size_t)dctx->size){
+                    // the results beat our write_cb
+                    mark_op_completed_and_notify(op);
+                }
+                #undef OP
+            }
+            break;
+
+        case DC_OP_ALLREDUCE:
+        case DC_OP_REDUCE_SCATTER:
+            if(dctx->rank == 0){
+                #define OP op->u.allreduce.chief
+                if(++OP.nsent == dctx->server.npeers){
+                    // leave accum for dc_op_await
+                    // operation is now complete
+                    mark_op_completed_and_notify(op);
+                }
+                #undef OP
+            }else{
+                #define OP op->u.allreduce.worker
                 // free OP.data if present, but don't touch OP.nofree
                 if(OP.data){
                     free(OP.data);
                     OP.data = NULL;
                 }
+                OP.written = true;
+                if(OP.recvd){
+                    // the result beat our write_cb
+                    mark_op_completed_and_notify(op);
+                }
                 #undef OP
             }
             break;
+
+        case DC_OP_BARRIER:
+            RBUG("barrier messages have no body to write");
+            goto fail;
+
+        case DC_OP_RING_ALLREDUCE:
+        case DC_OP_RING_REDUCE_SCATTER:
+            // the chunk we sent may now be overwritten; let advance_state look
+            op->u.ring.nwritten++;
+            uv_async_send(&dctx->async);
+            break;
+
+        case DC_OP_ALLTOALL:
+            // let dc_op_advance decide if we are done
+            op->u.alltoall.nwritten++;
+            uv_async_send(&dctx->async);
+            break;
+
+        case DC_OP_SEND:
+            #define OP op->u.send
+            // free OP.data if present, but don't touch OP.nofree
+            if(OP.data){
+                free(OP.data);
+                OP.data = NULL;
+            }
+            // operation is now complete
+            mark_op_completed_and_notify(op);
+            #undef OP
+            break;
+
+        case DC_OP_RECV:
+            RBUG("recv doesn't send anything");
+            goto fail;
     }
     return;
 
@@ -225,170 +568,1585 @@ fail:
     close_everything(dctx);
 }
 
-// may do work, and returns if the op is complete
-bool dc_op_advance(dc_op_t *op){
-    dctx_t *dctx = op->dctx;
-    int ret;
-    switch(op->type){
-        case DC_OP_GATHER:
-            if(dctx->rank == 0){
-                // op only receives; never any work to do
-                return false;
-            }else{
-                #define OP op->u.gather.worker
-                // worker gather
-                if(OP.sent) return false;
-                OP.sent = true;
+// every body an op sends goes through here, so dctx_compress covers them all
+static int op_write(
+    dc_op_t *op,
+    uv_tcp_t *tcp,
+    const char *hdr,
+    size_t hdrlen,
+    char *base,
+    size_t len,
+    dc_write_cb_t *cb
+){
+    if(op->compress){
+        return tcp_write_zmsg(tcp, hdr, hdrlen, base, len, cb);
+    }
+    return tcp_write_msg(tcp, hdr, hdrlen, base, len, cb);
+}
 
-                // write header
-                char hdr[GATHER_MSG_HDR_MAXSIZE];
-                size_t buflen = marshal_gather(
-                    hdr, op->series, op->slen, OP.len
-                );
-                ret = tcp_write_copy(&dctx->tcp, hdr, buflen);
-                if(ret) goto fail;
+// the dtype a reducing op's elements travel as
+static dc_dtype_e op_wire(dc_op_t *op){
+    if(op->wire >= 0 && dc_wire_valid(op->dtype, (dc_dtype_e)op->wire)){
+        return (dc_dtype_e)op->wire;
+    }
+    return op->dtype;
+}
 
-                // configure our write_cb
-                OP.cb = (dc_write_cb_t){
-                    .type = WRITE_CB_OP,
-                    .u = { .op = op },
-                };
+// how many bytes len bytes of a reducing op's elements take on the wire
+static size_t op_wire_len(dc_op_t *op, size_t len){
+    size_t count = len / dc_dtype_size(op->dtype);
+    return count * dc_dtype_size(op_wire(op));
+}
 
-                // choose which data to send
-                char *data;
-                if(OP.data){
-                    data = OP.data;
-                }else{
-                    data = i_promise_i_wont_touch(OP.nofree);
-                }
+/* op_write for len bytes of a reducing op's elements, which go out as
+   op_wire(op); hdr must already say op_wire_len(op, len) */
+static int op_write_wire(
+    dc_op_t *op,
+    uv_tcp_t *tcp,
+    const char *hdr,
+    size_t hdrlen,
+    char *base,
+    size_t len,
+    dc_write_cb_t *cb
+){
+    dctx_t *dctx = op->dctx;
+    dc_dtype_e wire = op_wire(op);
+    if(wire == op->dtype){
+        return op_write(op, tcp, hdr, hdrlen, base, len, cb);
+    }
 
-                ret = tcp_write_ex(&dctx->tcp, data, OP.len, &OP.cb);
-                if(ret) goto fail;
-                return false;
-                #undef OP
-            }
-            break;
+    size_t wlen = op_wire_len(op, len);
+    char *packed = malloc(wlen ? wlen : 1);
+    if(!packed){
+        perror("malloc");
+        return 1;
+    }
+    dc_wire_pack(
+        op->dtype, wire, packed, base, len / dc_dtype_size(op->dtype)
+    );
+    // free the packed copy once it is written, then carry on to cb
+    dc_write_cb_t *pcb = slab_alloc(&dctx->slab, sizeof(*pcb));
+    if(!pcb){
+        perror("malloc");
+        free(packed);
+        return 1;
+    }
+    *pcb = (dc_write_cb_t){
+        .type = WRITE_CB_FREE,
+        .u = { .free = packed },
+        .next = cb,
+    };
+    int ret = op_write(op, tcp, hdr, hdrlen, packed, wlen, pcb);
+    if(ret){
+        slab_free(&dctx->slab, pcb);
+        free(packed);
+        return 1;
+    }
+    return 0;
+}
 
-        case DC_OP_BROADCAST:
-            if(dctx->rank == 0){
-                #define OP op->u.broadcast.chief
-                if(OP.write_started) return false;
-                OP.write_started = true;
+/* Ring chunk c of the buffer covers elements [count*c/N, count*(c+1)/N).
 
-                // configure our write_cb
-                OP.cb = (dc_write_cb_t){
-                    .type = WRITE_CB_OP,
-                    .u = { .op = op },
-                };
+   During reduce-scatter step s (s < N-1), rank r sends chunk (r-s-1) and
+   reduces chunk (r-s-2) from its left-hand neighbour, so after N-1 steps it
+   owns the fully-reduced chunk r.  During allgather step s (s >= N-1), rank
+   r forwards chunk (r-t) and overwrites chunk (r-t-1), where t = s-(N-1). */
+static size_t ring_chunk(dc_op_t *op, size_t step, bool send){
+    dctx_t *dctx = op->dctx;
+    size_t n = (size_t)dctx->size;
+    size_t r = (size_t)dctx->rank;
+    size_t back;
+    if(step < n - 1){
+        back = step + 1;
+    }else{
+        back = step - (n - 1);
+    }
+    if(!send) back++;
+    return (r + n - (back % n)) % n;
+}
 
-                // write to every peer
-                for(size_t i = 0; i < dctx->server.npeers; i++){
-                    // write header
-                    dc_conn_t *conn = dctx->server.peers[i+1];
-                    char hdr[BROADCAST_MSG_HDR_MAXSIZE];
-                    size_t buflen = marshal_broadcast(
-                        hdr, op->series, op->slen, OP.len
-                    );
-                    ret = tcp_write_copy(&conn->tcp, hdr, buflen);
-                    if(ret) goto fail;
+// ring messages name the op by the type letter of its chief equivalent
+static char ring_kind(dc_op_type_e type){
+    return type == DC_OP_RING_ALLREDUCE ? 'r' : 's';
+}
 
-                    ret = tcp_write_ex(&conn->tcp, OP.data, OP.len, &OP.cb);
-                    if(ret) goto fail;
-                }
-                return false;
-                #undef OP
-            }else{
-                // op only receives; never any work to do
-                return false;
-            }
-            break;
+static void ring_chunk_bounds(
+    dc_op_t *op, size_t chunk, size_t *off, size_t *len
+){
+    dctx_t *dctx = op->dctx;
+    size_t n = (size_t)dctx->size;
+    size_t esize = dc_dtype_size(op->dtype);
+    size_t count = op->u.ring.len / esize;
+    size_t start = count * chunk / n;
+    size_t end = count * (chunk + 1) / n;
+    *off = start * esize;
+    *len = (end - start) * esize;
+}
 
-        case DC_OP_ALLGATHER:
-            if(dctx->rank == 0){
-                #define OP op->u.allgather.chief
-                // chief allgather
-                if(OP.nrecvd != (size_t)dctx->size) return false;
-                if(OP.write_started) return false;
-                OP.write_started = true;
+static int ring_send(dc_op_t *op, size_t step){
+    dctx_t *dctx = op->dctx;
+    #define OP op->u.ring
+    size_t off, len;
+    ring_chunk_bounds(op, ring_chunk(op, step, true), &off, &len);
 
-                // configure our write_cb
-                OP.cb = (dc_write_cb_t){
-                    .type = WRITE_CB_OP,
-                    .u = { .op = op },
-                };
+    uv_tcp_t *tcp = peer_tcp(dctx, ring_right(dctx));
+    if(!tcp){
+        rprintf("no link to rank %d for ring\n", ring_right(dctx));
+        return 1;
+    }
+
+    dc_dtype_e wire = op_wire(op);
+    size_t esize = dc_dtype_size(op->dtype);
+    if(wire != op->dtype && step == (size_t)dctx->size - 1){
+        /* the chunk we own is about to go round in wire form, so keep what
+           everybody else will get, or the ranks would disagree */
+        dc_wire_round(op->dtype, wire, OP.data + off, len / esize);
+    }
+
+    char hdr[RING_MSG_HDR_MAXSIZE];
+    size_t buflen = marshal_ring(
+        hdr,
+        op->series,
+        op->slen,
+        ring_kind(op->type),
+        op->dtype,
+        op->reduce,
+        wire,
+        (uint32_t)step,
+        op_wire_len(op, len)
+    );
+    OP.cb = (dc_write_cb_t){
+        .type = WRITE_CB_OP,
+        .u = { .op = op },
+    };
+    return op_write_wire(op, tcp, hdr, buflen, OP.data + off, len, &OP.cb);
+    #undef OP
+}
+
+static int ring_consume(dc_op_t *op, size_t step){
+    dctx_t *dctx = op->dctx;
+    #define OP op->u.ring
+    size_t off, len;
+    ring_chunk_bounds(op, ring_chunk(op, step, false), &off, &len);
+    if(OP.rxlen[step] != len){
+        rprintf(
+            "ring length mismatch on series %.*s: %zu vs %zu\n",
+            (int)op->slen, op->series, OP.rxlen[step], len
+        );
+        return 1;
+    }
+    if(step < (size_t)dctx->size - 1){
+        dc_reduce(
+            op->dtype,
+            op->reduce,
+            OP.data + off,
+            OP.rx[step],
+            len / dc_dtype_size(op->dtype)
+        );
+    }else{
+        memcpy(OP.data + off, OP.rx[step], len);
+    }
+    free(OP.rx[step]);
+    OP.rx[step] = NULL;
+    OP.nconsumed++;
+    return 0;
+    #undef OP
+}
+
+static int alltoall_send(dc_op_t *op, int dst){
+    dctx_t *dctx = op->dctx;
+    #define OP op->u.alltoall
+    uv_tcp_t *tcp = route_tcp(dctx, dst);
+    if(!tcp){
+        rprintf("no route to rank %d for alltoall\n", dst);
+        return 1;
+    }
+
+    size_t len = OP.datalen[dst];
+    char hdr[ROUTED_MSG_HDR_MAXSIZE];
+    size_t buflen = marshal_routed(
+        hdr,
+        'x',
+        op->series,
+        op->slen,
+        (uint32_t)dctx->rank,
+        (uint32_t)dst,
+        len
+    );
+    return op_write(op, tcp, hdr, buflen, OP.data[dst], len, &OP.cb);
+    #undef OP
+}
+
+/* allreduce and reduce-scatter messages only differ in their type letter;
+   len is the body's len before it goes on the wire */
+static size_t marshal_reducing(dc_op_t *op, char *hdr, size_t len){
+    dc_dtype_e wire = op_wire(op);
+    size_t wlen = op_wire_len(op, len);
+    if(op->type == DC_OP_REDUCE_SCATTER){
+        return marshal_reduce_scatter(
+            hdr, op->series, op->slen, op->dtype, op->reduce, wire, wlen
+        );
+    }
+    return marshal_allreduce(
+        hdr, op->series, op->slen, op->dtype, op->reduce, wire, wlen
+    );
+}
+
+/* packs ranks [lo, hi) into a bundle body; rank "self" comes from mine, the
+   rest from recvd.  Returns NULL on error. */
+static char *bundle_pack(
+    int lo,
+    int hi,
+    char **recvd,
+    const size_t *lens,
+    int self,
+    const char *mine,
+    size_t minelen,
+    size_t *out_len
+){
+    size_t total = 0;
+    for(int i = lo; i < hi; i++){
+        total += BUNDLE_RECORD_HDR_SIZE + (i == self ? minelen : lens[i]);
+    }
+    char *out = malloc(total);
+    if(!out){
+        perror("malloc");
+        return NULL;
+    }
+    size_t n = 0;
+    for(int i = lo; i < hi; i++){
+        const char *data = i == self ? mine : recvd[i];
+        size_t len = i == self ? minelen : lens[i];
+        n += marshal_bundle_record(&out[n], (uint32_t)i, len);
+        if(len) memcpy(&out[n], data, len);
+        n += len;
+    }
+    *out_len = total;
+    return out;
+}
+
+/* copies every record of a bundle into recvd, which must not already be set,
+   unless skip_dups is set.  Only ranks [lo, hi) are allowed. */
+static int bundle_unpack(
+    dctx_t *dctx,
+    const char *body,
+    size_t len,
+    int lo,
+    int hi,
+    bool skip_dups,
+    char **recvd,
+    size_t *lens,
+    size_t *nrecvd
+){
+    size_t n = 0;
+    while(n < len){
+        uint32_t rank;
+        size_t datalen;
+        size_t hdr = unmarshal_bundle_record(
+            &body[n], len - n, &rank, &datalen
+        );
+        if(!hdr){
+            rprintf("truncated bundle record\n");
+            return 1;
+        }
+        n += hdr;
+        if(rank < (uint32_t)lo || rank >= (uint32_t)hi){
+            rprintf("bundle record for rank %u out of range\n", rank);
+            return 1;
+        }
+        if(recvd[rank]){
+            if(!skip_dups){
+                rprintf("duplicate bundle record for rank %u\n", rank);
+                return 1;
+            }
+        }else{
+            recvd[rank] = bytesdup(&body[n], datalen);
+            if(!recvd[rank]) return 1;
+            lens[rank] = datalen;
+            (*nrecvd)++;
+        }
+        n += datalen;
+    }
+    return 0;
+}
+
+// sends one chunk of a tree message, data[off:off+n], to each tree child
+static int tree_send_chunk(
+    dc_op_t *op,
+    char kind,
+    char *data,
+    size_t off,
+    size_t n,
+    size_t total,
+    dc_write_cb_t *cb
+){
+    dctx_t *dctx = op->dctx;
+    int children[TREE_MAX_CHILDREN];
+    size_t nchildren = tree_children(dctx, children);
+    for(size_t i = 0; i < nchildren; i++){
+        uv_tcp_t *tcp = peer_tcp(dctx, children[i]);
+        if(!tcp){
+            rprintf("no link to tree child %d\n", children[i]);
+            return 1;
+        }
+        char hdr[TREE_CHUNK_MSG_HDR_MAXSIZE];
+        size_t buflen = marshal_tree_chunk(
+            hdr, op->series, op->slen, kind, off, total, n
+        );
+        int ret = op_write(op, tcp, hdr, buflen, data + off, n, cb);
+        if(ret) return 1;
+    }
+    return 0;
+}
+
+// sends the same tree message to each of our tree children
+static int tree_send(
+    dc_op_t *op,
+    char kind,
+    char *data,
+    size_t len,
+    dc_write_cb_t *cb,
+    size_t *nchildren
+){
+    dctx_t *dctx = op->dctx;
+    size_t chunk = dctx->cfg.chunk_bytes;
+    if(chunk && len > chunk){
+        // big messages go chunk by chunk, so our children can start forwarding
+        *nchildren = tree_children(dctx, NULL);
+        for(size_t off = 0; off < len; off += chunk){
+            size_t n = len - off < chunk ? len - off : chunk;
+            bool last = off + n == len;
+            int ret = tree_send_chunk(
+                op, kind, data, off, n, len, last ? cb : NULL
+            );
+            if(ret) return 1;
+        }
+        return 0;
+    }
+    int children[TREE_MAX_CHILDREN];
+    *nchildren = tree_children(dctx, children);
+    for(size_t i = 0; i < *nchildren; i++){
+        uv_tcp_t *tcp = peer_tcp(dctx, children[i]);
+        if(!tcp){
+            rprintf("no link to tree child %d\n", children[i]);
+            return 1;
+        }
+        char hdr[TREE_MSG_HDR_MAXSIZE];
+        size_t buflen = marshal_tree(
+            hdr, op->series, op->slen, kind, len
+        );
+        int ret = op_write(op, tcp, hdr, buflen, data, len, cb);
+        if(ret) return 1;
+    }
+    return 0;
+}
+
+// did the chief get rank r's allgather data in chunks?
+static bool allgather_streamed(dc_op_t *op, size_t r){
+    dc_chunked_t *chunks = op->u.allgather.chief.chunks;
+    return chunks && chunks[r].len > 0;
+}
+
+// sends one rank's allgather data, data[0:len], as a run of chunks
+static int allgather_send_chunks(
+    dc_op_t *op,
+    uv_tcp_t *tcp,
+    int rank,
+    char *data,
+    size_t len,
+    dc_write_cb_t *cb
+){
+    size_t chunk = op->dctx->cfg.chunk_bytes;
+    for(size_t off = 0; off < len; off += chunk){
+        size_t n = len - off < chunk ? len - off : chunk;
+        char hdr[ALLGATHER_CHUNK_MSG_HDR_MAXSIZE];
+        size_t buflen = marshal_allgather_chunk(
+            hdr, op->series, op->slen, (uint32_t)rank, off, len, n
+        );
+        // only the last chunk finishes the message
+        dc_write_cb_t *thiscb = off + n == len ? cb : NULL;
+        int ret = op_write(op, tcp, hdr, buflen, data + off, n, thiscb);
+        if(ret) return 1;
+    }
+    return 0;
+}
+
+// the chief marshals the allgather header of every rank once
+static int allgather_frames(dc_op_t *op){
+    dctx_t *dctx = op->dctx;
+    #define OP op->u.allgather.chief
+    size_t size = (size_t)dctx->size;
+    OP.frameoff = malloc((size + 1) * sizeof(*OP.frameoff));
+    if(!OP.frameoff){
+        perror("malloc");
+        return 1;
+    }
+    char hdr[ALLGATHER_MSG_HDR_MAXSIZE];
+    size_t hdrlen = marshal_allgather(hdr, op->series, op->slen, 0, 0);
+    OP.frames = malloc(size * hdrlen);
+    if(!OP.frames){
+        perror("malloc");
+        return 1;
+    }
+    for(size_t r = 0; r < size; r++){
+        OP.frameoff[r] = r * hdrlen;
+        marshal_allgather(
+            OP.frames + r * hdrlen, op->series, op->slen, (uint32_t)r, OP.len[r]
+        );
+    }
+    OP.frameoff[size] = size * hdrlen;
+    return 0;
+    #undef OP
+}
+
+// may do work, and returns if the op is complete
+bool dc_op_advance(dc_op_t *op){
+    dctx_t *dctx = op->dctx;
+    int ret;
+    switch(op->type){
+        case DC_OP_GATHER:
+            if(dctx->rank == 0){
+                // op only receives; never any work to do
+                return false;
+            }else{
+                #define OP op->u.gather.worker
+                // worker gather
+                if(OP.sent || !OP.called) return false;
+
+                // configure our write_cb
+                OP.cb = (dc_write_cb_t){
+                    .type = WRITE_CB_OP,
+                    .u = { .op = op },
+                };
+
+                if(hier_is_leader(dctx)){
+                    // leader gather: wait for every member of our node
+                    if(OP.nlocal + 1 < (size_t)dctx->local_size) return false;
+                    OP.sent = true;
+
+                    const char *mine = OP.data ? OP.data : OP.nofree;
+                    size_t bundlelen;
+                    OP.bundle = bundle_pack(
+                        dctx->rank,
+                        dctx->rank + dctx->local_size,
+                        OP.local,
+                        OP.locallen,
+                        dctx->rank,
+                        mine,
+                        OP.len,
+                        &bundlelen
+                    );
+                    if(!OP.bundle) goto fail;
+                    if(OP.data){
+                        free(OP.data);
+                        OP.data = NULL;
+                    }
+
+                    char hdr[BUNDLE_MSG_HDR_MAXSIZE];
+                    size_t buflen = marshal_bundle(
+                        hdr, op->series, op->slen, 'g', bundlelen
+                    );
+                    ret = op_write(
+                        op,
+                        &dctx->tcp,
+                        hdr,
+                        buflen,
+                        OP.bundle,
+                        bundlelen,
+                        &OP.cb
+                    );
+                    if(ret) goto fail;
+                    return false;
+                }
+                OP.sent = true;
+
+                // write header, to our leader if we have one
+                uv_tcp_t *tcp = peer_tcp(dctx, hier_leader(dctx));
+                if(!tcp){
+                    rprintf("no link to leader %d\n", hier_leader(dctx));
+                    goto fail;
+                }
+                char hdr[GATHER_MSG_HDR_MAXSIZE];
+                size_t buflen = marshal_gather(
+                    hdr, op->series, op->slen, OP.len
+                );
+                // choose which data to send
+                char *data;
+                if(OP.data){
+                    data = OP.data;
+                }else{
+                    data = i_promise_i_wont_touch(OP.nofree);
+                }
+
+                ret = op_write(op, tcp, hdr, buflen, data, OP.len, &OP.cb);
+                if(ret) goto fail;
+                return false;
+                #undef OP
+            }
+            break;
+
+        case DC_OP_BROADCAST:
+            if(dctx->rank == 0){
+                #define OP op->u.broadcast.chief
+                if(OP.write_started) return false;
+                OP.write_started = true;
+
+                // configure our write_cb
+                OP.cb = (dc_write_cb_t){
+                    .type = WRITE_CB_OP,
+                    .u = { .op = op },
+                };
+
+                /* large payloads go down a binomial tree, where every rank
+                   forwards to its children, instead of out of our one link;
+                   with hier, everything does, so each node gets one copy */
+                OP.tree = dctx->hier || (
+                    dctx->cfg.tree
+                    && dctx->size > 2
+                    && OP.len >= dctx->cfg.tree_min_bytes
+                );
+                if(OP.tree){
+                    ret = tree_send(
+                        op, 'b', OP.data, OP.len, &OP.cb, &OP.nwrites
+                    );
+                    if(ret) goto fail;
+                    return false;
+                }
 
                 // write to every peer
+                OP.nwrites = dctx->server.npeers;
                 for(size_t i = 0; i < dctx->server.npeers; i++){
+                    // write header
                     dc_conn_t *conn = dctx->server.peers[i+1];
-                    // write each recvd to each peer
-                    for(int j = 0; j < dctx->size; j++){
-                        char *data = OP.recvd[j];
-                        size_t len = OP.len[j];
+                    char hdr[BROADCAST_MSG_HDR_MAXSIZE];
+                    size_t buflen = marshal_broadcast(
+                        hdr, op->series, op->slen, OP.len
+                    );
+                    ret = op_write(
+                        op, &conn->tcp, hdr, buflen, OP.data, OP.len, &OP.cb
+                    );
+                    if(ret) goto fail;
+                }
+                return false;
+                #undef OP
+            }else{
+                #define OP op->u.broadcast.worker
+                // a plain broadcast only receives; never any work to do
+                if(!OP.tree) return false;
+                if(!OP.forward_started){
+                    OP.forward_started = true;
+
+                    // configure our write_cb
+                    OP.cb = (dc_write_cb_t){
+                        .type = WRITE_CB_OP,
+                        .u = { .op = op },
+                    };
+
+                    // forward what we received to our own children
+                    ret = tree_send(
+                        op, 'b', OP.recvd, OP.len, &OP.cb, &OP.nforward
+                    );
+                    if(ret) goto fail;
+                }
+                // OP.recvd must outlive our forwards
+                return OP.called && OP.nforwarded == OP.nforward;
+                #undef OP
+            }
+            break;
+
+        case DC_OP_SCATTER:
+            if(dctx->rank == 0){
+                #define OP op->u.scatter.chief
+                if(OP.write_started) return false;
+                OP.write_started = true;
+
+                // with no peers there is nobody to send to
+                if(dctx->server.npeers == 0) return true;
+
+                // configure our write_cb
+                OP.cb = (dc_write_cb_t){
+                    .type = WRITE_CB_OP,
+                    .u = { .op = op },
+                };
+
+                // write each peer its own slice
+                for(size_t i = 0; i < dctx->server.npeers; i++){
+                    dc_conn_t *conn = dctx->server.peers[i+1];
+                    char *data = OP.data[i+1];
+                    size_t len = OP.len[i+1];
+                    char hdr[SCATTER_MSG_HDR_MAXSIZE];
+                    size_t buflen = marshal_scatter(
+                        hdr, op->series, op->slen, len
+                    );
+                    ret = op_write(
+                        op, &conn->tcp, hdr, buflen, data, len, &OP.cb
+                    );
+                    if(ret) goto fail;
+                }
+                return false;
+                #undef OP
+            }else{
+                // op only receives; never any work to do
+                return false;
+            }
+            break;
+
+        case DC_OP_ALLGATHER:
+            if(dctx->rank == 0){
+                #define OP op->u.allgather.chief
+                // chief allgather
+                if(OP.nrecvd != (size_t)dctx->size) return false;
+                if(OP.write_started) return false;
+                OP.write_started = true;
+                if(dctx->server.npeers == 0) return true;
+
+                // configure our write_cb
+                OP.cb = (dc_write_cb_t){
+                    .type = WRITE_CB_OP,
+                    .u = { .op = op },
+                };
+
+                if(dctx->hier){
+                    // one bundle of everything goes down the tree
+                    size_t bundlelen;
+                    OP.bundle = bundle_pack(
+                        0, dctx->size, OP.recvd, OP.len, -1, NULL, 0,
+                        &bundlelen
+                    );
+                    if(!OP.bundle) goto fail;
+                    ret = tree_send(
+                        op, 'a', OP.bundle, bundlelen, &OP.cb, &OP.nwrites
+                    );
+                    if(ret) goto fail;
+                    return false;
+                }
+
+                // marshal one header per rank
+                ret = allgather_frames(op);
+                if(ret) goto fail;
+
+                /* every peer gets every rank's message but its own, each one
+                   a shared header and body, so only the writes are per peer.
+                   Chunked contributions were passed on as they arrived. */
+                size_t size = (size_t)dctx->size;
+                for(size_t p = 1; p < size; p++){
+                    for(size_t r = 0; r < size; r++){
+                        if(r == p || allgather_streamed(op, r)) continue;
+                        OP.nwrites++;
+                    }
+                }
+                if(OP.nwrites == 0) return true;
+                for(size_t p = 1; p < size; p++){
+                    uv_tcp_t *tcp = &dctx->server.peers[p]->tcp;
+                    for(size_t r = 0; r < size; r++){
+                        if(r == p || allgather_streamed(op, r)) continue;
+                        ret = op_write(
+                            op,
+                            tcp,
+                            OP.frames + OP.frameoff[r],
+                            OP.frameoff[r+1] - OP.frameoff[r],
+                            OP.recvd[r],
+                            OP.len[r],
+                            &OP.cb
+                        );
+                        if(ret) goto fail;
+                    }
+                }
+                return false;
+                #undef OP
+            }else{
+                #define OP op->u.allgather.worker
+                // worker allgather
+                if(!OP.called) return false;
+                if(!OP.sent){
+                    // configure our write_cb
+                    OP.cb = (dc_write_cb_t){
+                        .type = WRITE_CB_OP,
+                        .u = { .op = op },
+                    };
+
+                    // choose which data to send
+                    char *data;
+                    if(OP.data){
+                        data = OP.data;
+                    }else{
+                        data = i_promise_i_wont_touch(OP.nofree);
+                    }
+
+                    if(hier_is_leader(dctx)){
+                        // leader: wait for every member of our node
+                        size_t nmembers = (size_t)dctx->local_size - 1;
+                        if(OP.nrecvd < nmembers) return false;
+                        OP.sent = true;
+
+                        size_t bundlelen;
+                        OP.bundle = bundle_pack(
+                            dctx->rank,
+                            dctx->rank + dctx->local_size,
+                            OP.recvd,
+                            OP.len,
+                            dctx->rank,
+                            data,
+                            OP.datalen,
+                            &bundlelen
+                        );
+                        if(!OP.bundle) goto fail;
+
+                        char hdr[BUNDLE_MSG_HDR_MAXSIZE];
+                        size_t buflen = marshal_bundle(
+                            hdr, op->series, op->slen, 'a', bundlelen
+                        );
+                        ret = op_write(
+                            op,
+                            &dctx->tcp,
+                            hdr,
+                            buflen,
+                            OP.bundle,
+                            bundlelen,
+                            &OP.cb
+                        );
+                        if(ret) goto fail;
+                    }else{
+                        OP.sent = true;
+
+                        // write header, to our leader if we have one
+                        uv_tcp_t *tcp = peer_tcp(dctx, hier_leader(dctx));
+                        if(!tcp){
+                            rprintf(
+                                "no link to leader %d\n", hier_leader(dctx)
+                            );
+                            goto fail;
+                        }
+                        size_t chunk = dctx->cfg.chunk_bytes;
+                        if(!dctx->hier && chunk && OP.datalen > chunk){
+                            // so the chief can pass it on as it arrives
+                            ret = allgather_send_chunks(
+                                op, tcp, dctx->rank, data, OP.datalen, &OP.cb
+                            );
+                            if(ret) goto fail;
+                            return false;
+                        }
                         char hdr[ALLGATHER_MSG_HDR_MAXSIZE];
                         size_t buflen = marshal_allgather(
-                            hdr, op->series, op->slen, (uint32_t)j, len
+                            hdr,
+                            op->series,
+                            op->slen,
+                            (uint32_t)dctx->rank,
+                            (size_t)OP.datalen
+                        );
+                        ret = op_write(
+                            op, tcp, hdr, buflen, data, OP.datalen, &OP.cb
                         );
-                        ret = tcp_write_copy(&conn->tcp, hdr, buflen);
                         if(ret) goto fail;
+                    }
+                }
+
+                // without hier, the results complete us in client.c
+                if(!dctx->hier || !OP.results) return false;
+                if(!OP.forward_started){
+                    OP.forward_started = true;
+                    // forward the results to our own children
+                    ret = tree_send(
+                        op, 'a', OP.results, OP.resultslen, &OP.cb,
+                        &OP.nforward
+                    );
+                    if(ret) goto fail;
+                }
+                // our own send, plus every forward
+                return OP.nwritten == 1 + OP.nforward;
+                #undef OP
+            }
+            break;
+
+        case DC_OP_ALLREDUCE:
+        case DC_OP_REDUCE_SCATTER:
+            if(dctx->rank == 0){
+                #define OP op->u.allreduce.chief
+                // chief allreduce, fold in our own contribution first
+                if(OP.called && !OP.recvd[0]){
+                    ret = allreduce_contribute(op, 0, OP.mine, OP.minelen);
+                    OP.mine = NULL;
+                    if(ret) goto fail;
+                }
+                if(OP.nrecvd != (size_t)dctx->size) return false;
+                if(OP.write_started) return false;
+                OP.write_started = true;
+
+                // with no peers there is nobody to send to
+                if(dctx->server.npeers == 0) return true;
+
+                dc_dtype_e wire = op_wire(op);
+                if(op->type == DC_OP_ALLREDUCE && wire != op->dtype){
+                    // keep the result the workers will get
+                    size_t count = OP.len / dc_dtype_size(op->dtype);
+                    dc_wire_round(op->dtype, wire, OP.accum, count);
+                }
+
+                // configure our write_cb
+                OP.cb = (dc_write_cb_t){
+                    .type = WRITE_CB_OP,
+                    .u = { .op = op },
+                };
+
+                // write the result to every peer
+                for(size_t i = 0; i < dctx->server.npeers; i++){
+                    dc_conn_t *conn = dctx->server.peers[i+1];
+                    // reduce-scatter peers only get their own chunk
+                    size_t off = 0;
+                    size_t len = OP.len;
+                    if(op->type == DC_OP_REDUCE_SCATTER){
+                        len = OP.len / (size_t)dctx->size;
+                        off = len * (i + 1);
+                    }
+                    char hdr[ALLREDUCE_MSG_HDR_MAXSIZE];
+                    size_t buflen = marshal_reducing(op, hdr, len);
+                    ret = op_write_wire(
+                        op,
+                        &conn->tcp,
+                        hdr,
+                        buflen,
+                        OP.accum + off,
+                        len,
+                        &OP.cb
+                    );
+                    if(ret) goto fail;
+                }
+                return false;
+                #undef OP
+            }else{
+                #define OP op->u.allreduce.worker
+                // worker allreduce
+                if(OP.sent) return false;
+                OP.sent = true;
+
+                // write header
+                char hdr[ALLREDUCE_MSG_HDR_MAXSIZE];
+                size_t buflen = marshal_reducing(op, hdr, OP.datalen);
+
+                // configure our write_cb
+                OP.cb = (dc_write_cb_t){
+                    .type = WRITE_CB_OP,
+                    .u = { .op = op },
+                };
+
+                // choose which data to send
+                char *data;
+                if(OP.data){
+                    data = OP.data;
+                }else{
+                    data = i_promise_i_wont_touch(OP.nofree);
+                }
+
+                ret = op_write_wire(
+                    op, &dctx->tcp, hdr, buflen, data, OP.datalen, &OP.cb
+                );
+                if(ret) goto fail;
+                return false;
+                #undef OP
+            }
+            break;
+
+        case DC_OP_BARRIER:
+            if(dctx->rank == 0){
+                #define OP op->u.barrier.chief
+                if(!OP.called) return false;
+                if(OP.nrecvd != dctx->server.npeers) return false;
+
+                // release every peer; nothing to wait for afterwards
+                char hdr[BARRIER_MSG_MAXSIZE];
+                size_t buflen = marshal_barrier(hdr, op->series, op->slen);
+                for(size_t i = 0; i < dctx->server.npeers; i++){
+                    dc_conn_t *conn = dctx->server.peers[i+1];
+                    ret = tcp_write_msg(
+                        &conn->tcp, hdr, buflen, NULL, 0, NULL
+                    );
+                    if(ret) goto fail;
+                }
+                return true;
+                #undef OP
+            }else{
+                #define OP op->u.barrier.worker
+                // worker barrier
+                if(OP.sent) return false;
+                OP.sent = true;
+
+                char hdr[BARRIER_MSG_MAXSIZE];
+                size_t buflen = marshal_barrier(hdr, op->series, op->slen);
+                ret = tcp_write_msg(&dctx->tcp, hdr, buflen, NULL, 0, NULL);
+                if(ret) goto fail;
+                return false;
+                #undef OP
+            }
+            break;
+
+        case DC_OP_RING_ALLREDUCE:
+        case DC_OP_RING_REDUCE_SCATTER:
+            #define OP op->u.ring
+            if(!OP.called) return false;
+            while(OP.nconsumed < OP.nsteps){
+                size_t step = OP.nconsumed;
+                if(OP.nsent == step){
+                    ret = ring_send(op, step);
+                    if(ret) goto fail;
+                    OP.nsent++;
+                }
+                /* the chunk consumed at a step is never the one sent at that
+                   step, but with two ranks it is the one sent at the step
+                   before, so earlier writes must have finished */
+                if(OP.nwritten < step) return false;
+                if(!OP.rx[step]) return false;
+                ret = ring_consume(op, step);
+                if(ret) goto fail;
+            }
+            // our last chunk must be written before the caller gets data
+            return OP.nwritten == OP.nsteps;
+            #undef OP
+
+        case DC_OP_ALLTOALL:
+            #define OP op->u.alltoall
+            if(!OP.called) return false;
+            if(!OP.write_started){
+                OP.write_started = true;
+                OP.cb = (dc_write_cb_t){
+                    .type = WRITE_CB_OP,
+                    .u = { .op = op },
+                };
+                // start at our right, so no rank gets everybody's data first
+                for(int i = 1; i < dctx->size; i++){
+                    ret = alltoall_send(op, (dctx->rank + i) % dctx->size);
+                    if(ret) goto fail;
+                }
+            }
+            size_t others = (size_t)dctx->size - 1;
+            return OP.nwritten == others && OP.nrecvd == others;
+            #undef OP
+
+        case DC_OP_SEND:
+            #define OP op->u.send
+            if(OP.sent) return false;
+            OP.sent = true;
+
+            uv_tcp_t *tcp = route_tcp(dctx, OP.dst);
+            if(!tcp){
+                rprintf("no route to rank %d for send\n", OP.dst);
+                goto fail;
+            }
+            char hdr[ROUTED_MSG_HDR_MAXSIZE];
+            size_t buflen = marshal_routed(
+                hdr,
+                'p',
+                op->series,
+                op->slen,
+                (uint32_t)dctx->rank,
+                (uint32_t)OP.dst,
+                OP.len
+            );
+            OP.cb = (dc_write_cb_t){
+                .type = WRITE_CB_OP,
+                .u = { .op = op },
+            };
+            char *data;
+            if(OP.data){
+                data = OP.data;
+            }else{
+                data = i_promise_i_wont_touch(OP.nofree);
+            }
+            ret = op_write(op, tcp, hdr, buflen, data, OP.len, &OP.cb);
+            if(ret) goto fail;
+            return false;
+            #undef OP
+
+        case DC_OP_RECV:
+            // op only receives; never any work to do
+            return false;
+    }
+    return false;
+
+fail:
+    dctx->failed = true;
+    close_everything(dctx);
+    return false;
+}
+
+// the caller must hold dctx->mutex
+int op_check_type(dc_op_t *op, dc_dtype_e dtype, dc_reduce_e reduce){
+    dctx_t *dctx = op->dctx;
+    if(!op->typed){
+        // whoever touches the op first decides its type
+        op->typed = true;
+        op->dtype = dtype;
+        op->reduce = reduce;
+        return 0;
+    }
+    if(op->dtype != dtype || op->reduce != reduce){
+        rprintf(
+            "type mismatch on series %.*s: dtype %d/%d, op %d/%d\n",
+            (int)op->slen, op->series,
+            (int)op->dtype, (int)dtype,
+            (int)op->reduce, (int)reduce
+        );
+        return 1;
+    }
+    return 0;
+}
+
+// only called from the loop thread; always takes ownership of data
+int allreduce_contribute(dc_op_t *op, int rank, char *data, size_t len){
+    dctx_t *dctx = op->dctx;
+    #define OP op->u.allreduce.chief
+    if(OP.recvd[rank]){
+        RBUG("duplicate allreduce contribution");
+        free(data);
+        return 1;
+    }
+    if(!OP.accum){
+        // the first contribution becomes the accumulator
+        OP.accum = data;
+        OP.len = len;
+    }else{
+        if(len != OP.len){
+            rprintf(
+                "allreduce length mismatch on series %.*s: %zu vs %zu\n",
+                (int)op->slen, op->series, OP.len, len
+            );
+            free(data);
+            return 1;
+        }
+        dc_reduce(
+            op->dtype,
+            op->reduce,
+            OP.accum,
+            data,
+            len / dc_dtype_size(op->dtype)
+        );
+        free(data);
+    }
+    OP.recvd[rank] = true;
+    OP.nrecvd++;
+    return 0;
+    #undef OP
+}
+
+// only called from the loop thread; always takes u->body
+int ring_recv(dctx_t *dctx, dc_unmarshal_t *u, int from){
+    if(from != ring_left(dctx)){
+        rprintf("ring message from rank %d, not our left neighbour\n", from);
+        return 1;
+    }
+    dc_op_type_e type;
+    switch(u->kind){
+        case 'r': type = DC_OP_RING_ALLREDUCE; break;
+        case 's': type = DC_OP_RING_REDUCE_SCATTER; break;
+        default:
+            rprintf("unknown ring op kind %d\n", (int)u->kind);
+            return 1;
+    }
+    if(u->step >= ring_nsteps(dctx, type)){
+        rprintf("ring step %u out of range\n", u->step);
+        return 1;
+    }
+    if(!dc_dtype_valid(u->dtype) || !dc_reduce_valid(u->reduce)){
+        rprintf("invalid ring dtype/op: %d/%d\n", u->dtype, u->reduce);
+        return 1;
+    }
+
+    dc_op_t *op = get_op_for_recv(
+        dctx, type, u->series, u->slen, (int)u->step
+    );
+    if(!op) return 1;
+
+    pthread_mutex_lock(&dctx->mutex);
+    int ret = op_check_type(op, u->dtype, u->reduce);
+    pthread_mutex_unlock(&dctx->mutex);
+    if(ret) return 1;
+
+    op->u.ring.rx[u->step] = u->body;
+    op->u.ring.rxlen[u->step] = u->len;
+    u->body = NULL;
+
+    // we might be able to take another step now
+    uv_async_send(&dctx->async);
+    return 0;
+}
+
+// only called from the loop thread; always takes u->body
+// finds the op that a tree message of this kind is for
+static dc_op_t *tree_op(
+    dctx_t *dctx, char kind, const char *series, size_t slen
+){
+    switch(kind){
+        case 'b':
+            return get_op_for_recv(dctx, DC_OP_BROADCAST, series, slen, 0);
+
+        case 'a':
+            if(!dctx->hier){
+                rprintf("got tree allgather without hier\n");
+                return NULL;
+            }
+            // find the op still waiting on our own result
+            return get_op_for_recv(
+                dctx, DC_OP_ALLGATHER, series, slen, dctx->rank
+            );
+    }
+    rprintf("unknown tree op kind %d\n", (int)kind);
+    return NULL;
+}
+
+// a whole tree message for op has arrived; always takes body
+static int tree_deliver(dc_op_t *op, char kind, char *body, size_t len){
+    dctx_t *dctx = op->dctx;
+    if(kind == 'b'){
+        // dctx_broadcast_ex must not see recvd without tree
+        pthread_mutex_lock(&dctx->mutex);
+        #define OP op->u.broadcast.worker
+        OP.len = len;
+        OP.recvd = body;
+        OP.tree = true;
+        #undef OP
+        pthread_mutex_unlock(&dctx->mutex);
+        return 0;
+    }
+
+    #define OP op->u.allgather.worker
+    // a leader already has its own members' data
+    int ret = bundle_unpack(
+        dctx,
+        body,
+        len,
+        0,
+        dctx->size,
+        true,
+        OP.recvd,
+        OP.len,
+        &OP.nrecvd
+    );
+    if(ret) goto fail;
+    if(OP.nrecvd != (size_t)dctx->size){
+        rprintf("allgather results are missing ranks\n");
+        goto fail;
+    }
+    OP.results = body;
+    OP.resultslen = len;
+    return 0;
+    #undef OP
+
+fail:
+    free(body);
+    return 1;
+}
+
+// only called from the loop thread; always takes u->body
+int tree_recv(dctx_t *dctx, dc_unmarshal_t *u, int from){
+    if(dctx->rank == 0 || from != tree_parent(dctx)){
+        rprintf("tree message from rank %d, not our parent\n", from);
+        return 1;
+    }
+
+    dc_op_t *op = tree_op(dctx, u->kind, u->series, u->slen);
+    if(!op) return 1;
+
+    char *body = u->body;
+    u->body = NULL;
+    if(tree_deliver(op, u->kind, body, u->len)) return 1;
+
+    // start forwarding to our children
+    uv_async_send(&dctx->async);
+    return 0;
+}
+
+// copies one chunk into c; chunks of a message must arrive in order
+static int chunk_land(dctx_t *dctx, dc_chunked_t *c, dc_unmarshal_t *u){
+    if(
+        u->total == 0
+        || u->off > u->total
+        || u->len > u->total - u->off
+    ){
+        rprintf("chunk does not fit its message\n");
+        return 1;
+    }
+    if(u->off == 0){
+        if(c->buf){
+            rprintf("chunked message started over\n");
+            return 1;
+        }
+        c->buf = malloc((size_t)u->total);
+        if(!c->buf){
+            perror("malloc");
+            return 1;
+        }
+        c->len = (size_t)u->total;
+        c->got = 0;
+    }else if(!c->buf || u->off != c->got || u->total != c->len){
+        rprintf("chunk arrived out of order\n");
+        return 1;
+    }
+    memcpy(c->buf + c->got, u->body, (size_t)u->len);
+    c->got += (size_t)u->len;
+    return 0;
+}
+
+// only called from the loop thread
+int tree_chunk_recv(dctx_t *dctx, dc_unmarshal_t *u, int from){
+    if(dctx->rank == 0 || from != tree_parent(dctx)){
+        rprintf("tree chunk from rank %d, not our parent\n", from);
+        return 1;
+    }
+
+    dc_op_t *op = tree_op(dctx, u->kind, u->series, u->slen);
+    if(!op) return 1;
+
+    dc_chunked_t *c;
+    dc_write_cb_t *cb;
+    bool *forward_started;
+    size_t *nforward;
+    if(u->kind == 'b'){
+        #define OP op->u.broadcast.worker
+        c = &OP.chunks;
+        cb = &OP.cb;
+        forward_started = &OP.forward_started;
+        nforward = &OP.nforward;
+        #undef OP
+    }else{
+        #define OP op->u.allgather.worker
+        c = &OP.resultchunks;
+        cb = &OP.cb;
+        forward_started = &OP.forward_started;
+        nforward = &OP.nforward;
+        #undef OP
+    }
+
+    if(chunk_land(dctx, c, u)) return 1;
+    if(u->off == 0 && dctx->a.ready){
+        // we forward as chunks arrive, so dc_op_advance must not
+        *cb = (dc_write_cb_t){
+            .type = WRITE_CB_OP,
+            .u = { .op = op },
+        };
+        *forward_started = true;
+        *nforward = tree_children(dctx, NULL);
+    }
+
+    /* pass this chunk on before the next one arrives, unless our links to
+       our children were not up yet; then dc_op_advance forwards it whole */
+    bool last = c->got == c->len;
+    if(*forward_started){
+        int ret = tree_send_chunk(
+            op, u->kind, c->buf, (size_t)u->off, (size_t)u->len, c->len,
+            last ? cb : NULL
+        );
+        if(ret) return 1;
+    }
+    if(!last) return 0;
+
+    char *body = c->buf;
+    size_t len = c->len;
+    *c = (dc_chunked_t){0};
+    if(tree_deliver(op, u->kind, body, len)) return 1;
+
+    // maybe we are done
+    uv_async_send(&dctx->async);
+    return 0;
+}
+
+// only called from the loop thread
+int allgather_chunk_recv(dctx_t *dctx, dc_unmarshal_t *u, int from){
+    int size = dctx->size;
+    int rank = (int)u->rank;
+    if(dctx->hier || u->rank >= (uint32_t)size){
+        rprintf("unexpected allgather chunk for rank %u\n", u->rank);
+        return 1;
+    }
+    if(dctx->rank == 0 ? rank != from : (from != 0 || rank == dctx->rank)){
+        rprintf("rank %d sent allgather chunk for rank %d\n", from, rank);
+        return 1;
+    }
+
+    dc_op_t *op = get_op_for_recv(
+        dctx, DC_OP_ALLGATHER, u->series, u->slen, rank
+    );
+    if(!op) return 1;
+
+    // chunks is only ever touched from the loop thread
+    dc_chunked_t **chunks;
+    if(dctx->rank == 0){
+        chunks = &op->u.allgather.chief.chunks;
+    }else{
+        chunks = &op->u.allgather.worker.chunks;
+    }
+    if(!*chunks){
+        *chunks = calloc((size_t)size, sizeof(**chunks));
+        if(!*chunks){
+            perror("calloc");
+            return 1;
+        }
+    }
+    dc_chunked_t *c = &(*chunks)[rank];
+    if(chunk_land(dctx, c, u)) return 1;
+
+    if(dctx->rank == 0){
+        #define OP op->u.allgather.chief
+        // pass the chunk on right away, to every worker but its owner
+        OP.cb = (dc_write_cb_t){
+            .type = WRITE_CB_OP,
+            .u = { .op = op },
+        };
+        for(int p = 1; p < size; p++){
+            if(p == rank) continue;
+            dc_conn_t *conn = dctx->server.peers[p];
+            char hdr[ALLGATHER_CHUNK_MSG_HDR_MAXSIZE];
+            size_t buflen = marshal_allgather_chunk(
+                hdr,
+                op->series,
+                op->slen,
+                u->rank,
+                (size_t)u->off,
+                c->len,
+                (size_t)u->len
+            );
+            int ret = op_write(
+                op,
+                &conn->tcp,
+                hdr,
+                buflen,
+                c->buf + u->off,
+                (size_t)u->len,
+                &OP.cb
+            );
+            if(ret) return 1;
+            OP.nwrites++;
+        }
+        if(c->got < c->len) return 0;
 
-                        ret = tcp_write_ex(&conn->tcp, data, len, &OP.cb);
-                        if(ret) goto fail;
-                    }
-                }
-                return false;
-                #undef OP
-            }else{
-                #define OP op->u.allgather.worker
-                // worker allgather
-                if(OP.sent) return false;
-                OP.sent = true;
+        // c->len stays, so allgather_frames knows to skip this rank
+        pthread_mutex_lock(&dctx->mutex);
+        OP.recvd[rank] = c->buf;
+        OP.len[rank] = c->len;
+        c->buf = NULL;
+        if(++OP.nrecvd == (size_t)size){
+            // trigger the broadcast
+            uv_async_send(&dctx->async);
+        }
+        pthread_mutex_unlock(&dctx->mutex);
+        #undef OP
+        return 0;
+    }
 
-                // write header
-                char hdr[ALLGATHER_MSG_HDR_MAXSIZE];
-                size_t buflen = marshal_allgather(
-                    hdr,
-                    op->series,
-                    op->slen,
-                    (uint32_t)dctx->rank,
-                    (size_t)OP.datalen
-                );
-                ret = tcp_write_copy(&dctx->tcp, hdr, buflen);
-                if(ret) goto fail;
+    #define OP op->u.allgather.worker
+    if(c->got < c->len) return 0;
+    OP.recvd[rank] = c->buf;
+    OP.len[rank] = c->len;
+    *c = (dc_chunked_t){0};
+    if(++OP.nrecvd == (size_t)size && OP.nwritten){
+        mark_op_completed_and_notify(op);
+    }
+    #undef OP
+    return 0;
+}
 
-                // configure our write_cb
-                OP.cb = (dc_write_cb_t){
-                    .type = WRITE_CB_OP,
-                    .u = { .op = op },
-                };
+// only called from the loop thread; always takes u->body
+int leader_recv(dctx_t *dctx, dc_unmarshal_t *u, int from){
+    if(!hier_is_leader(dctx)
+            || from <= dctx->rank
+            || from >= dctx->rank + dctx->local_size){
+        rprintf("got member data from rank %d, not our member\n", from);
+        return 1;
+    }
 
-                // choose which data to send
-                char *data;
-                if(OP.data){
-                    data = OP.data;
-                }else{
-                    data = i_promise_i_wont_touch(OP.nofree);
-                }
+    dc_op_t *op;
+    switch(u->type){
+        case 'g':
+            op = get_op_for_recv(dctx, DC_OP_GATHER, u->series, u->slen, from);
+            if(!op) return 1;
 
-                ret = tcp_write_ex(&dctx->tcp, data, OP.datalen, &OP.cb);
-                if(ret) goto fail;
-                return false;
-                #undef OP
+            #define OP op->u.gather.worker
+            OP.local[from] = u->body;
+            OP.locallen[from] = u->len;
+            OP.nlocal++;
+            #undef OP
+            break;
+
+        case 'a':
+            if(u->rank != (uint32_t)from){
+                rprintf("rank %d sent allgather for rank %u\n", from, u->rank);
+                return 1;
             }
+            op = get_op_for_recv(
+                dctx, DC_OP_ALLGATHER, u->series, u->slen, from
+            );
+            if(!op) return 1;
+
+            #define OP op->u.allgather.worker
+            OP.recvd[from] = u->body;
+            OP.len[from] = u->len;
+            OP.nrecvd++;
+            #undef OP
             break;
+
+        default:
+            rprintf("got unexpected message from member: %c\n", u->type);
+            return 1;
     }
-    return false;
+    u->body = NULL;
 
-fail:
-    dctx->failed = true;
-    close_everything(dctx);
-    return false;
+    // maybe we have the whole node now
+    uv_async_send(&dctx->async);
+    return 0;
+}
+
+// only called from the loop thread; always takes u->body
+int bundle_recv(dctx_t *dctx, dc_unmarshal_t *u, int from){
+    if(!dctx->hier || from % dctx->local_size != 0){
+        rprintf("got bundle from rank %d, which is not a leader\n", from);
+        return 1;
+    }
+    dc_op_type_e type;
+    switch(u->kind){
+        case 'g': type = DC_OP_GATHER; break;
+        case 'a': type = DC_OP_ALLGATHER; break;
+        default:
+            rprintf("unknown bundle op kind %d\n", (int)u->kind);
+            return 1;
+    }
+
+    // the leader's own slot tells us which op this is
+    dc_op_t *op = get_op_for_recv(dctx, type, u->series, u->slen, from);
+    if(!op) return 1;
+
+    // both chief ops keep recvd, len, and nrecvd
+    char **recvd;
+    size_t *lens;
+    size_t *nrecvd;
+    if(type == DC_OP_GATHER){
+        recvd = op->u.gather.chief.recvd;
+        lens = op->u.gather.chief.len;
+        nrecvd = &op->u.gather.chief.nrecvd;
+    }else{
+        recvd = op->u.allgather.chief.recvd;
+        lens = op->u.allgather.chief.len;
+        nrecvd = &op->u.allgather.chief.nrecvd;
+    }
+
+    pthread_mutex_lock(&dctx->mutex);
+    size_t before = *nrecvd;
+    int ret = bundle_unpack(
+        dctx,
+        u->body,
+        u->len,
+        from,
+        from + dctx->local_size,
+        false,
+        recvd,
+        lens,
+        nrecvd
+    );
+    if(!ret && *nrecvd - before != (size_t)dctx->local_size){
+        rprintf("bundle from rank %d is missing ranks\n", from);
+        ret = 1;
+    }
+    bool done = *nrecvd == (size_t)dctx->size;
+    if(!ret && done && type == DC_OP_GATHER){
+        mark_op_completed_locked(op);
+        pthread_cond_broadcast(&dctx->cond);
+    }
+    pthread_mutex_unlock(&dctx->mutex);
+    if(ret) return 1;
+
+    if(done && type == DC_OP_ALLGATHER){
+        // trigger the fan-out
+        uv_async_send(&dctx->async);
+    }
+    return 0;
+}
+
+// only called from the loop thread; always takes u->body
+int alltoall_recv(dctx_t *dctx, dc_unmarshal_t *u, int from){
+    int src = (int)u->rank;
+    if((int)u->dst != dctx->rank){
+        rprintf("got alltoall data for rank %u\n", u->dst);
+        return 1;
+    }
+    if(src < 0 || src >= dctx->size || src == dctx->rank){
+        rprintf("got alltoall data from invalid rank %d\n", src);
+        return 1;
+    }
+    // either straight from the source, or passed on by the chief
+    if(from != src && from != 0){
+        rprintf("rank %d sent alltoall data from rank %d\n", from, src);
+        return 1;
+    }
+
+    dc_op_t *op = get_op_for_recv(
+        dctx, DC_OP_ALLTOALL, u->series, u->slen, src
+    );
+    if(!op) return 1;
+
+    #define OP op->u.alltoall
+    OP.recvd[src] = u->body;
+    OP.len[src] = u->len;
+    u->body = NULL;
+    OP.nrecvd++;
+    #undef OP
+
+    // we might be complete now
+    uv_async_send(&dctx->async);
+    return 0;
 }
+// only called from the loop thread; always takes u->body
+int p2p_recv(dctx_t *dctx, dc_unmarshal_t *u, int from){
+    int src = (int)u->rank;
+    if((int)u->dst != dctx->rank){
+        rprintf("got a message for rank %u\n", u->dst);
+        return 1;
+    }
+    if(src < 0 || src >= dctx->size || src == dctx->rank){
+        rprintf("got a message from invalid rank %d\n", src);
+        return 1;
+    }
+    // either straight from the source, or passed on by the chief
+    if(from != src && from != 0){
+        rprintf("rank %d sent a message from rank %d\n", from, src);
+        return 1;
+    }
+
+    dc_op_t *op = get_op_for_recv(dctx, DC_OP_RECV, u->series, u->slen, src);
+    if(!op) return 1;
 
+    pthread_mutex_lock(&dctx->mutex);
+    #define OP op->u.recv
+    OP.recvd = u->body;
+    OP.len = u->len;
+    u->body = NULL;
+    if(OP.called){
+        mark_op_completed_locked(op);
+        pthread_cond_broadcast(&dctx->cond);
+    }
+    #undef OP
+    pthread_mutex_unlock(&dctx->mutex);
+    return 0;
+}
 
 bool dc_op_ok(dc_op_t *op){
     return op->ok;
 }
 
+bool dc_op_test(dc_op_t *op){
+    // a failed op has nothing to wait for
+    if(!op->ok) return true;
+    dctx_t *dctx = op->dctx;
+    pthread_mutex_lock(&dctx->mutex);
+    bool done = op->ready || dctx->status != DCTX_RUNNING;
+    pthread_mutex_unlock(&dctx->mutex);
+    return done;
+}
+
+
+// keep only buf[off:off+len]; never fails, at worst buf stays big
+static char *shrink_to(char *buf, size_t off, size_t len){
+    if(off) memmove(buf, buf + off, len);
+    if(len == 0) return buf;
+    char *out = realloc(buf, len);
+    return out ? out : buf;
+}
 
 dc_result_t *dc_op_await(dc_op_t *op){
     dctx_t *dctx = op->dctx;
@@ -402,6 +2160,7 @@ dc_result_t *dc_op_await(dc_op_t *op){
 
     // remove the op from the linked list
     link_remove(&op->link);
+    op_index_remove(op);
 
     pthread_mutex_unlock(&dctx->mutex);
 
@@ -452,6 +2211,26 @@ dc_result_t *dc_op_await(dc_op_t *op){
             }
             break;
 
+        case DC_OP_SCATTER:
+            if(dctx->rank == 0){
+                // chief scatter, chief returns its own slice
+                #define OP op->u.scatter.chief
+                result = dc_result_new(1);
+                if(!result) goto done;
+                dc_result_set(result, 0, OP.data[0], OP.len[0]);
+                OP.data[0] = NULL;
+                #undef OP
+            }else{
+                #define OP op->u.scatter.worker
+                // worker scatter, return what the chief sent us
+                result = dc_result_new(1);
+                if(!result) goto done;
+                dc_result_set(result, 0, OP.recvd, OP.len);
+                OP.recvd = NULL;
+                #undef OP
+            }
+            break;
+
         case DC_OP_ALLGATHER:
             if(dctx->rank == 0){
                 // chief allgather, return all recvd
@@ -479,6 +2258,80 @@ dc_result_t *dc_op_await(dc_op_t *op){
                 #undef OP
             }
             break;
+
+        case DC_OP_ALLREDUCE:
+        case DC_OP_REDUCE_SCATTER:
+            if(dctx->rank == 0){
+                // chief allreduce, return the accumulator
+                #define OP op->u.allreduce.chief
+                result = dc_result_new(1);
+                if(!result) goto done;
+                if(op->type == DC_OP_REDUCE_SCATTER){
+                    // we keep chunk 0, which is already at the front
+                    OP.len /= (size_t)dctx->size;
+                    OP.accum = shrink_to(OP.accum, 0, OP.len);
+                }
+                dc_result_set(result, 0, OP.accum, OP.len);
+                OP.accum = NULL;
+                #undef OP
+            }else{
+                // worker allreduce, return what the chief sent
+                #define OP op->u.allreduce.worker
+                result = dc_result_new(1);
+                if(!result) goto done;
+                dc_result_set(result, 0, OP.recvd, OP.len);
+                OP.recvd = NULL;
+                #undef OP
+            }
+            break;
+
+        case DC_OP_BARRIER:
+            // barriers never have anything to return
+            result = &DC_RESULT_EMPTY;
+            break;
+
+        case DC_OP_RING_ALLREDUCE:
+        case DC_OP_RING_REDUCE_SCATTER:
+            // the caller's buffer now holds the result
+            #define OP op->u.ring
+            result = dc_result_new(1);
+            if(!result) goto done;
+            if(op->type == DC_OP_RING_REDUCE_SCATTER){
+                // our own chunk is the only one fully reduced
+                size_t off;
+                ring_chunk_bounds(op, (size_t)dctx->rank, &off, &OP.len);
+                OP.data = shrink_to(OP.data, off, OP.len);
+            }
+            dc_result_set(result, 0, OP.data, OP.len);
+            OP.data = NULL;
+            #undef OP
+            break;
+
+        case DC_OP_ALLTOALL:
+            // one buffer from every rank, including ourselves
+            #define OP op->u.alltoall
+            result = dc_result_new((size_t)dctx->size);
+            if(!result) goto done;
+            for(int i = 0; i < dctx->size; i++){
+                dc_result_set(result, (size_t)i, OP.recvd[i], OP.len[i]);
+                OP.recvd[i] = NULL;
+            }
+            #undef OP
+            break;
+
+        case DC_OP_SEND:
+            // nothing comes back from a send
+            result = &DC_RESULT_EMPTY;
+            break;
+
+        case DC_OP_RECV:
+            #define OP op->u.recv
+            result = dc_result_new(1);
+            if(!result) goto done;
+            dc_result_set(result, 0, OP.recvd, OP.len);
+            OP.recvd = NULL;
+            #undef OP
+            break;
     }
 
 done:
@@ -495,9 +2348,9 @@ dc_op_t *get_op_for_recv(
 
     dc_op_t *out = NULL;
     dc_op_t *op, *temp;
-    LINK_FOR_EACH_SAFE(op, temp, &dctx->a.inflight, dc_op_t, link){
-        if(op->type != type) continue;
-        if(!zstreq(op->series, series)) continue;
+    uint32_t hash = op_hash(type, series, slen);
+    LINK_FOR_EACH_SAFE(op, temp, op_bucket(dctx, hash), dc_op_t, ilink){
+        if(!op_is(op, type, hash, series, slen)) continue;
         switch(op->type){
             case DC_OP_GATHER:
                 if(dctx->rank == 0){
@@ -509,9 +2362,17 @@ dc_op_t *get_op_for_recv(
                     }
                     #undef OP
                 }else{
-                    // worker gather
-                    RBUG("worker received a GATHER message");
-                    goto done;
+                    #define OP op->u.gather.worker
+                    // leader gather, data from one of our members
+                    if(!OP.local){
+                        RBUG("non-leader worker received a GATHER message");
+                        goto done;
+                    }
+                    if(OP.local[rank] == NULL){
+                        out = op;
+                        goto done;
+                    }
+                    #undef OP
                 }
                 break;
 
@@ -530,6 +2391,21 @@ dc_op_t *get_op_for_recv(
                 }
                 break;
 
+            case DC_OP_SCATTER:
+                if(dctx->rank == 0){
+                    RBUG("chief received a SCATTER message");
+                    goto done;
+                }else{
+                    #define OP op->u.scatter.worker
+                    // worker scatter
+                    if(OP.recvd == NULL){
+                        out = op;
+                        goto done;
+                    }
+                    #undef OP
+                }
+                break;
+
             case DC_OP_ALLGATHER:
                 if(dctx->rank == 0){
                     #define OP op->u.allgather.chief
@@ -549,18 +2425,112 @@ dc_op_t *get_op_for_recv(
                     #undef OP
                 }
                 break;
+
+            case DC_OP_ALLREDUCE:
+            case DC_OP_REDUCE_SCATTER:
+                if(dctx->rank == 0){
+                    #define OP op->u.allreduce.chief
+                    // chief allreduce
+                    if(!OP.recvd[rank]){
+                        out = op;
+                        goto done;
+                    }
+                    #undef OP
+                }else{
+                    #define OP op->u.allreduce.worker
+                    // worker allreduce
+                    if(OP.recvd == NULL){
+                        out = op;
+                        goto done;
+                    }
+                    #undef OP
+                }
+                break;
+
+            case DC_OP_BARRIER:
+                if(dctx->rank == 0){
+                    #define OP op->u.barrier.chief
+                    // chief barrier
+                    if(!OP.recvd[rank]){
+                        out = op;
+                        goto done;
+                    }
+                    #undef OP
+                }else{
+                    #define OP op->u.barrier.worker
+                    // worker barrier
+                    if(!OP.released){
+                        out = op;
+                        goto done;
+                    }
+                    #undef OP
+                }
+                break;
+
+            case DC_OP_RING_ALLREDUCE:
+            case DC_OP_RING_REDUCE_SCATTER:
+                #define OP op->u.ring
+                // "rank" is the step; match the first op still waiting on it
+                if((size_t)rank >= OP.nconsumed && !OP.rx[rank]){
+                    out = op;
+                    goto done;
+                }
+                #undef OP
+                break;
+
+            case DC_OP_ALLTOALL:
+                // match the first op still waiting on this rank
+                if(op->u.alltoall.recvd[rank] == NULL){
+                    out = op;
+                    goto done;
+                }
+                break;
+
+            case DC_OP_SEND:
+                RBUG("received a SEND message");
+                goto done;
+
+            case DC_OP_RECV:
+                #define OP op->u.recv
+                // match the first recv from this rank still waiting
+                if(OP.src == rank && OP.recvd == NULL){
+                    out = op;
+                    goto done;
+                }
+                #undef OP
+                break;
         }
     }
     // didn't find the op, create a new one
-    if(dctx->rank > 0 && type == DC_OP_ALLGATHER){
+    if(dctx->rank > 0 && type == DC_OP_GATHER && !hier_is_leader(dctx)){
+        RBUG("non-leader worker received a GATHER message\n");
+    }
+    if(
+        dctx->rank > 0
+        && type == DC_OP_ALLGATHER
+        && !hier_is_leader(dctx)
+        // without hier, the chief passes on chunks before we might call
+        && (dctx->hier || !dctx->cfg.chunk_bytes)
+    ){
         RBUG("worker did not find matching ALLGATHER on recv\n");
     }
+    if(dctx->rank > 0 && type == DC_OP_ALLREDUCE){
+        RBUG("worker did not find matching ALLREDUCE on recv\n");
+    }
+    if(dctx->rank > 0 && type == DC_OP_REDUCE_SCATTER){
+        RBUG("worker did not find matching REDUCE_SCATTER on recv\n");
+    }
+    if(dctx->rank > 0 && type == DC_OP_BARRIER){
+        RBUG("worker did not find matching BARRIER on recv\n");
+    }
     out = dc_op_new(dctx, type, series, slen);
     if(!out){
         perror("malloc");
         goto done;
     }
-    link_list_append(&dctx->a.inflight, &out->link);
+    // a recv created here must only match calls for the same source
+    if(type == DC_OP_RECV) out->u.recv.src = rank;
+    op_inflight_add(dctx, out);
 
 done:
     pthread_mutex_unlock(&dctx->mutex);
@@ -572,9 +2542,9 @@ dc_op_t *get_op_for_call_locked(
 ){
     dc_op_t *out = NULL;
     dc_op_t *op, *temp;
-    LINK_FOR_EACH_SAFE(op, temp, &dctx->a.inflight, dc_op_t, link){
-        if(op->type != type) continue;
-        if(!zstreq(op->series, series)) continue;
+    uint32_t hash = op_hash(type, series, slen);
+    LINK_FOR_EACH_SAFE(op, temp, op_bucket(dctx, hash), dc_op_t, ilink){
+        if(!op_is(op, type, hash, series, slen)) continue;
         switch(op->type){
             case DC_OP_GATHER:
                 if(dctx->rank == 0){
@@ -587,7 +2557,13 @@ dc_op_t *get_op_for_call_locked(
                     }
                     #undef OP
                 }else{
-                    // worker gathers are not created on recv, make a new one
+                    #define OP op->u.gather.worker
+                    // only a leader's gathers are created on recv
+                    if(!OP.called){
+                        out = op;
+                        goto done;
+                    }
+                    #undef OP
                 }
                 break;
 
@@ -596,9 +2572,26 @@ dc_op_t *get_op_for_call_locked(
                     // chief broadcasts are not created on recv, make a new one
                 }else{
                     #define OP op->u.broadcast.worker
-                    // worker broadcast, match the first inflight in-series op
-                    out = op;
-                    goto done;
+                    /* worker broadcast, match the first op we haven't called;
+                       a tree broadcast may linger to finish forwarding */
+                    if(!OP.called){
+                        out = op;
+                        goto done;
+                    }
+                    #undef OP
+                }
+                break;
+
+            case DC_OP_SCATTER:
+                if(dctx->rank == 0){
+                    // chief scatters are not created on recv, make a new one
+                }else{
+                    #define OP op->u.scatter.worker
+                    // worker scatter, match the first op we haven't called
+                    if(!OP.called){
+                        out = op;
+                        goto done;
+                    }
                     #undef OP
                 }
                 break;
@@ -615,10 +2608,70 @@ dc_op_t *get_op_for_call_locked(
                     #undef OP
                 }else{
                     #define OP op->u.allgather.worker
-                    // worker allgathers are not created on recv
+                    // only a leader's allgathers are created on recv
+                    if(!OP.called){
+                        out = op;
+                        goto done;
+                    }
+                    #undef OP
+                }
+                break;
+
+            case DC_OP_ALLREDUCE:
+            case DC_OP_REDUCE_SCATTER:
+                if(dctx->rank == 0){
+                    #define OP op->u.allreduce.chief
+                    // chief allreduce
+                    if(!OP.called){
+                        // here's an allreduce without its chief data yet
+                        out = op;
+                        goto done;
+                    }
+                    #undef OP
+                }else{
+                    // worker allreduces are not created on recv
+                }
+                break;
+
+            case DC_OP_BARRIER:
+                if(dctx->rank == 0){
+                    #define OP op->u.barrier.chief
+                    // chief barrier
+                    if(!OP.called){
+                        // here's a barrier the chief hasn't reached yet
+                        out = op;
+                        goto done;
+                    }
                     #undef OP
+                }else{
+                    // worker barriers are not created on recv
+                }
+                break;
+
+            case DC_OP_RING_ALLREDUCE:
+            case DC_OP_RING_REDUCE_SCATTER:
+                // our left neighbour may be a step ahead of us
+                if(!op->u.ring.called){
+                    out = op;
+                    goto done;
+                }
+                break;
+
+            case DC_OP_ALLTOALL:
+                // other ranks may have sent to us before we called
+                if(!op->u.alltoall.called){
+                    out = op;
+                    goto done;
                 }
                 break;
+
+            case DC_OP_SEND:
+                // sends are not created on recv, make a new one
+                break;
+
+            case DC_OP_RECV:
+                RBUG("recvs are matched by get_recv_for_call_locked");
+                goto done;
         }
     }
 
@@ -628,8 +2681,30 @@ dc_op_t *get_op_for_call_locked(
         perror("malloc");
         goto done;
     }
-    link_list_append(&dctx->a.inflight, &out->link);
+    op_inflight_add(dctx, out);
 
 done:
     return out;
 }
+
+dc_op_t *get_recv_for_call_locked(
+    dctx_t *dctx, int src, const char *series, size_t slen
+){
+    dc_op_t *op, *temp;
+    uint32_t hash = op_hash(DC_OP_RECV, series, slen);
+    LINK_FOR_EACH_SAFE(op, temp, op_bucket(dctx, hash), dc_op_t, ilink){
+        if(!op_is(op, DC_OP_RECV, hash, series, slen)) continue;
+        // the message may have arrived before we called
+        if(op->u.recv.src == src && !op->u.recv.called) return op;
+    }
+
+    // didn't find the op, create a new one
+    dc_op_t *out = dc_op_new(dctx, DC_OP_RECV, series, slen);
+    if(!out){
+        perror("malloc");
+        return NULL;
+    }
+    out->u.recv.src = src;
+    op_inflight_add(dctx, out);
+    return out;
+}
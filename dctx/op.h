@@ -1,12 +1,31 @@
 typedef enum {
     DC_OP_GATHER,
     DC_OP_BROADCAST,
+    DC_OP_SCATTER,
     DC_OP_ALLGATHER,
+    DC_OP_ALLREDUCE,
+    DC_OP_REDUCE_SCATTER,
+    DC_OP_BARRIER,
+    DC_OP_RING_ALLREDUCE,
+    DC_OP_RING_REDUCE_SCATTER,
+    DC_OP_ALLTOALL,
+    DC_OP_SEND,
+    DC_OP_RECV,
 } dc_op_type_e;
 
+// a body arriving as a run of chunks, which must land in order
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t got;
+} dc_chunked_t;
+
 struct dc_op {
     struct dctx *dctx;
     link_t link;  // dctx->a.inflight or dctx->a.completed
+    // while inflight, dctx->a.index[hash % dctx->a.nindex]
+    link_t ilink;
+    uint32_t hash;
 
     // was the op created successfully
     bool ok;
@@ -16,6 +35,16 @@ struct dc_op {
     char series[256];
     size_t slen;
 
+    // compress the bodies we send (see dctx_compress)
+    bool compress;
+    // the dtype set by dctx_wire_dtype, or -1; see op_wire()
+    int wire;
+
+    // reducing ops also have an element type, which every rank must agree on
+    bool typed;
+    dc_dtype_e dtype;
+    dc_reduce_e reduce;
+
     /* ready is set when the op is moved to completed, and only after that can
        an external thread take the operation for itself */
     bool ready;
@@ -29,8 +58,11 @@ struct dc_op {
                 size_t *len;
                 size_t nrecvd;
             } chief;
-            // a worker gather is complete when the dc_op_write_cb finishes
+            /* a worker gather is complete when the dc_op_write_cb finishes.
+               A node leader first collects its members' data, then sends
+               everything to the chief in one bundle. */
             struct {
+                bool called;
                 // either data or nofree is defined
                 char *data;
                 const char *nofree;
@@ -38,6 +70,11 @@ struct dc_op {
                 bool sent;
                 // the worker's gather finishes in dc_op_write_cb
                 dc_write_cb_t cb;
+                // leaders only: members' data by rank, and what we send
+                char **local;
+                size_t *locallen;
+                size_t nlocal;
+                char *bundle;
             } worker;
         } gather;
         union {
@@ -48,16 +85,46 @@ struct dc_op {
                 char *data;
                 size_t len;
                 dc_write_cb_t cb;
+                // either one write per peer, or one per tree child
+                bool tree;
+                size_t nwrites;
                 size_t nsent;
             } chief;
             /* a worker broadcast is complete when it receives the message and
-               has a matching broadcast call */
+               has a matching broadcast call, and for a tree broadcast, when it
+               has also forwarded the message to all its children */
             struct {
                 bool called;
                 char *recvd;
                 size_t len;
+                // tree broadcasts only
+                bool tree;
+                bool forward_started;
+                size_t nforward;
+                size_t nforwarded;
+                dc_write_cb_t cb;
+                // a chunked tree message, forwarded as it arrives
+                dc_chunked_t chunks;
             } worker;
         } broadcast;
+        union {
+            // a chief scatter is complete when all dc_op_write_cbs finish
+            struct {
+                // one slice per rank; the chief keeps slice 0
+                char **data;
+                size_t *len;
+                bool write_started;
+                dc_write_cb_t cb;
+                size_t nsent;
+            } chief;
+            /* a worker scatter is complete when it receives its slice and
+               has a matching scatter call */
+            struct {
+                bool called;
+                char *recvd;
+                size_t len;
+            } worker;
+        } scatter;
         union {
             // a chief allgather is complete when all dc_op_write_cbs finish
             // (allgather call counts for one nrecvd)
@@ -67,37 +134,179 @@ struct dc_op {
                 char **recvd;
                 size_t *len;
                 size_t nrecvd;
+                // chunked contributions, passed on as they arrive, or NULL
+                dc_chunked_t *chunks;
                 // what we send to workers
                 bool write_started;
                 dc_write_cb_t cb;
+                /* every rank's message header, marshaled once; each peer
+                   gets every message but its own, which it already has */
+                char *frames;
+                // where each rank's header starts, plus the total length
+                size_t *frameoff;
+                // or with hier, one bundle per tree child
+                char *bundle;
+                size_t nwrites;
                 size_t nsent;
             } chief;
-            // a worker allgather is complete when it receives the all messages
+            /* a worker allgather is complete when its message is written and
+               it receives everyone else's messages; its own data becomes its
+               own slot of the result.  With hier enabled, leaders
+               collect their members' data before sending, and the results
+               come down the tree as a bundle, which we forward before we are
+               complete. */
             struct {
-                // what we send to the chief
+                bool called;
+                // what we send to the chief, or to our leader
                 char *data;
                 const char *nofree;
                 size_t datalen;
                 bool sent;
+                // counts our own send and every forward
+                size_t nwritten;
                 dc_write_cb_t cb;
-                // what the chief sends back
+                // what the chief sends back (or a leader's members send us)
                 char **recvd;
                 size_t *len;
                 size_t nrecvd;
+                // chunked messages from the chief, or NULL
+                dc_chunked_t *chunks;
+                // hier only: a leader's bundle, and the results we forward
+                char *bundle;
+                char *results;
+                size_t resultslen;
+                bool forward_started;
+                size_t nforward;
+                // hier only: chunked results, forwarded as they arrive
+                dc_chunked_t resultchunks;
             } worker;
         } allgather;
+        /* reduce-scatter through the chief is just an allreduce where the
+           chief only sends each worker its own chunk of the result */
+        union {
+            /* a chief allreduce is complete when all dc_op_write_cbs
+               finish.  Contributions are reduced into accum as they
+               arrive, so the chief only ever holds one extra buffer. */
+            struct {
+                // the chief's own contribution, set by the allreduce call
+                bool called;
+                char *mine;
+                size_t minelen;
+                // running reduction, and which ranks are already in it
+                char *accum;
+                size_t len;
+                bool *recvd;
+                size_t nrecvd;
+                // what we send to workers
+                bool write_started;
+                dc_write_cb_t cb;
+                size_t nsent;
+            } chief;
+            /* a worker allreduce is complete when its contribution is
+               written and it has received the result */
+            struct {
+                // what we send to the chief
+                char *data;
+                const char *nofree;
+                size_t datalen;
+                bool sent;
+                bool written;
+                dc_write_cb_t cb;
+                // what the chief sends back
+                char *recvd;
+                size_t len;
+            } worker;
+        } allreduce;
+        union {
+            /* a chief barrier is complete once it has been called and every
+               worker has arrived; the release is queued right away */
+            struct {
+                bool called;
+                bool *recvd;
+                size_t nrecvd;
+            } chief;
+            // a worker barrier is complete when the chief releases it
+            struct {
+                bool sent;
+                bool released;
+            } worker;
+        } barrier;
+        /* ring ops look the same on every rank: each step sends one chunk to
+           the right-hand neighbour and consumes one chunk from the left-hand
+           neighbour.  The op is complete once every step is consumed.  A ring
+           reduce-scatter is just the first half of a ring allreduce. */
+        struct {
+            bool called;
+            // the caller's buffer, which becomes the result in place
+            char *data;
+            size_t len;
+            // what the left-hand neighbour sent, by step
+            char **rx;
+            size_t *rxlen;
+            size_t nsteps;
+            size_t nsent;
+            size_t nwritten;
+            size_t nconsumed;
+            dc_write_cb_t cb;
+        } ring;
+        /* alltoall also looks the same on every rank: bufs[j] goes to rank
+           j, over a direct link or through the chief, and we keep our own.
+           The op is complete once every write finishes and every other
+           rank's buffer for us has arrived. */
+        struct {
+            bool called;
+            // what we send, by destination
+            char **data;
+            size_t *datalen;
+            bool write_started;
+            size_t nwritten;
+            dc_write_cb_t cb;
+            // what we receive, by source
+            char **recvd;
+            size_t *len;
+            size_t nrecvd;
+        } alltoall;
+        /* point-to-point ops use the series as their tag.  A send is
+           complete when its write finishes. */
+        struct {
+            int dst;
+            // either data or nofree is defined
+            char *data;
+            const char *nofree;
+            size_t len;
+            bool sent;
+            dc_write_cb_t cb;
+        } send;
+        /* a recv is complete when it has been called and a message with its
+           tag has arrived from its source; messages and calls for one source
+           and tag are matched in order */
+        struct {
+            int src;
+            bool called;
+            char *recvd;
+            size_t len;
+        } recv;
     } u;
 };
 DEF_CONTAINER_OF(dc_op_t, link, link_t)
+DEF_CONTAINER_OF(dc_op_t, ilink, link_t)
 
 extern dc_op_t DC_OP_NOT_OK;
 
-// the caller must insert into inflight in a thread-safe way
+// the caller must insert into inflight with op_inflight_add
 dc_op_t *dc_op_new(
     dctx_t *dctx, dc_op_type_e type, const char *series, size_t slen
 );
 // the caller must have removed from the linked list in a thread-safe way
 void dc_op_free(dc_op_t *op);
+/* inflight ops are also indexed by (type, series), so matching an incoming
+   message or an api call only looks at ops of its own series */
+int op_index_init(dctx_t *dctx);
+void op_index_free(dctx_t *dctx);
+// append to dctx->a.inflight and the index; hold dctx->mutex
+void op_inflight_add(dctx_t *dctx, dc_op_t *op);
+// remove from the index, if it is there; hold dctx->mutex
+void op_index_remove(dc_op_t *op);
 void mark_op_completed_locked(dc_op_t *op);
 void mark_op_completed_and_notify(dc_op_t *op);
 void dc_op_write_cb(dc_op_t *op);
@@ -105,6 +314,30 @@ bool dc_op_advance(dc_op_t *op);
 dc_op_t *get_op_for_recv(
     dctx_t *dctx, dc_op_type_e type, const char *series, size_t slen, int rank
 );
+// the first caller sets the type, later callers must match; hold dctx->mutex
+int op_check_type(dc_op_t *op, dc_dtype_e dtype, dc_reduce_e reduce);
+// fold one rank's contribution into a chief allreduce; always takes data
+int allreduce_contribute(dc_op_t *op, int rank, char *data, size_t len);
+// a ring message arrived from rank "from"; always takes u->body
+int ring_recv(dctx_t *dctx, dc_unmarshal_t *u, int from);
+// a tree message arrived from rank "from"; always takes u->body
+int tree_recv(dctx_t *dctx, dc_unmarshal_t *u, int from);
+// a chunk of a tree message arrived from rank "from"
+int tree_chunk_recv(dctx_t *dctx, dc_unmarshal_t *u, int from);
+// a chunk of rank u->rank's allgather data arrived from rank "from"
+int allgather_chunk_recv(dctx_t *dctx, dc_unmarshal_t *u, int from);
+// a member's gather or allgather data arrived at its leader over the mesh
+int leader_recv(dctx_t *dctx, dc_unmarshal_t *u, int from);
+// a leader's bundle arrived at the chief; always takes u->body
+int bundle_recv(dctx_t *dctx, dc_unmarshal_t *u, int from);
+// an alltoall buffer arrived from rank "from"; always takes u->body
+int alltoall_recv(dctx_t *dctx, dc_unmarshal_t *u, int from);
+// a point-to-point message arrived from rank "from"; always takes u->body
+int p2p_recv(dctx_t *dctx, dc_unmarshal_t *u, int from);
 dc_op_t *get_op_for_call_locked(
     dctx_t *dctx, dc_op_type_e type, const char *series, size_t slen
 );
+// like get_op_for_call_locked, but recvs also match on their source
+dc_op_t *get_recv_for_call_locked(
+    dctx_t *dctx, int src, const char *series, size_t slen
+);
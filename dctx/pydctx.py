@@ -7,6 +7,9 @@ class Operation:
         self._op = op
         self._extract = extract
 
+    def test(self):
+        return self._op.test()
+
     def wait(self):
         result = self._op.wait()
         if result is None:
@@ -53,6 +56,9 @@ class DistributedContext:
     def __exit__(self, *args):
         self._dctx.__exit__(*args)
 
+    def fileno(self):
+        return self._dctx.fileno()
+
     def gather(self, data, series=""):
         op = self._dctx.gather(pickle.dumps(data), series)
         return Operation(op, extract=False)
@@ -0,0 +1,710 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DC_X86
+#include <immintrin.h>
+#endif
+
+#define NDTYPES 6
+#define NREDUCES 4
+
+// the narrower dtypes that each dtype may travel on the wire as
+typedef enum {
+    WIRE_F32_BF16 = 0,
+    WIRE_F32_F16,
+    WIRE_F64_F32,
+    NWIRES,
+} wire_e;
+
+typedef void (*dc_kernel_t)(char *dst, const char *src, size_t n);
+
+static dc_kernel_t kernels[NDTYPES][NREDUCES];
+// conversions for each wire_e, to the wire and back
+static dc_kernel_t packs[NWIRES];
+static dc_kernel_t unpacks[NWIRES];
+static const char *kernels_isa = "scalar";
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+bool dc_dtype_valid(int dtype){
+    return dtype >= 0 && dtype < NDTYPES;
+}
+
+bool dc_reduce_valid(int reduce){
+    return reduce >= 0 && reduce < NREDUCES;
+}
+
+size_t dc_dtype_size(dc_dtype_e dtype){
+    switch(dtype){
+        case DC_DTYPE_F32: return 4;
+        case DC_DTYPE_F64: return 8;
+        case DC_DTYPE_I32: return 4;
+        case DC_DTYPE_I64: return 8;
+        case DC_DTYPE_BF16: return 2;
+        case DC_DTYPE_F16: return 2;
+    }
+    return 0;
+}
+
+// returns -1 if dtype has no conversion to wire
+static int wire_pair(dc_dtype_e dtype, dc_dtype_e wire){
+    if(dtype == DC_DTYPE_F32 && wire == DC_DTYPE_BF16) return WIRE_F32_BF16;
+    if(dtype == DC_DTYPE_F32 && wire == DC_DTYPE_F16) return WIRE_F32_F16;
+    if(dtype == DC_DTYPE_F64 && wire == DC_DTYPE_F32) return WIRE_F64_F32;
+    return -1;
+}
+
+bool dc_wire_valid(dc_dtype_e dtype, dc_dtype_e wire){
+    return wire_pair(dtype, wire) >= 0;
+}
+
+/* scalar expressions, in terms of a (from dst) and b (from src).  min and max
+   are written to match the sse/avx instructions, which return b when either
+   side is NaN.  Integer sum and prod wrap instead of overflowing. */
+#define S_SUM (a + b)
+#define S_PROD (a * b)
+#define S_MIN (a < b ? a : b)
+#define S_MAX (a > b ? a : b)
+#define S_SUM_I32 ((int32_t)((uint32_t)a + (uint32_t)b))
+#define S_PROD_I32 ((int32_t)((uint32_t)a * (uint32_t)b))
+#define S_SUM_I64 ((int64_t)((uint64_t)a + (uint64_t)b))
+#define S_PROD_I64 ((int64_t)((uint64_t)a * (uint64_t)b))
+
+static inline float bf16_to_f32(uint16_t h){
+    uint32_t u = (uint32_t)h << 16;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline uint16_t f32_to_bf16(float f){
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    // keep NaNs quiet, rather than letting the rounding carry into inf
+    if((u & 0x7fffffff) > 0x7f800000) return (uint16_t)((u >> 16) | 0x40);
+    // round to nearest even
+    u += 0x7fff + ((u >> 16) & 1);
+    return (uint16_t)(u >> 16);
+}
+
+static inline float f16_to_f32(uint16_t h){
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t u;
+    if(exp == 0x1f){
+        // inf, or a NaN, which comes out quiet like it does from f16c
+        u = sign | 0x7f800000 | (mant << 13) | (mant ? 0x400000 : 0);
+    }else if(exp){
+        u = sign | ((exp + 112) << 23) | (mant << 13);
+    }else if(mant){
+        // subnormal, which is normal as an f32
+        exp = 113;
+        while(!(mant & 0x400)){
+            mant <<= 1;
+            exp--;
+        }
+        u = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }else{
+        u = sign;
+    }
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline uint16_t f32_to_f16(float f){
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    uint16_t sign = (uint16_t)((u >> 16) & 0x8000);
+    uint32_t a = u & 0x7fffffff;
+    // NaNs stay quiet and keep the top of their payload, like f16c
+    if(a > 0x7f800000){
+        return (uint16_t)(sign | 0x7e00 | ((a >> 13) & 0x3ff));
+    }
+    // 65520 and up round to inf
+    if(a >= 0x477ff000) return (uint16_t)(sign | 0x7c00);
+    if(a >= 0x38800000){
+        // normal: rebias the exponent and round to nearest even
+        a -= 0x38000000;
+        a += 0xfff + ((a >> 13) & 1);
+        return (uint16_t)(sign | (a >> 13));
+    }
+    // below 2**-25 rounds to zero
+    if(a < 0x33000000) return sign;
+    // subnormal: count in units of 2**-24, rounding to nearest even
+    uint32_t m = (a & 0x7fffff) | 0x800000;
+    uint32_t shift = 126 - (a >> 23);
+    uint32_t q = m >> shift;
+    uint32_t rem = m & ((1u << shift) - 1);
+    uint32_t half = 1u << (shift - 1);
+    if(rem > half || (rem == half && (q & 1))) q++;
+    return (uint16_t)(sign | q);
+}
+
+#define SCALAR_KERNEL(name, type, expr) \
+    static void name(char *dst, const char *src, size_t n){ \
+        type *d = (type*)dst; \
+        const type *s = (const type*)src; \
+        for(size_t i = 0; i < n; i++){ \
+            type a = d[i]; \
+            type b = s[i]; \
+            d[i] = (expr); \
+        } \
+    }
+
+// 16-bit floats do their math as f32, then round back
+#define SCALAR_HALF_KERNEL(name, widen, narrow, expr) \
+    static void name(char *dst, const char *src, size_t n){ \
+        uint16_t *d = (uint16_t*)dst; \
+        const uint16_t *s = (const uint16_t*)src; \
+        for(size_t i = 0; i < n; i++){ \
+            float a = widen(d[i]); \
+            float b = widen(s[i]); \
+            d[i] = narrow(expr); \
+        } \
+    }
+#define SCALAR_BF16_KERNEL(name, expr) \
+    SCALAR_HALF_KERNEL(name, bf16_to_f32, f32_to_bf16, expr)
+#define SCALAR_F16_KERNEL(name, expr) \
+    SCALAR_HALF_KERNEL(name, f16_to_f32, f32_to_f16, expr)
+
+// dst[i] = expr, in terms of a = src[i]
+#define SCALAR_CONVERT(name, stype, dtype, expr) \
+    static void name(char *dst, const char *src, size_t n){ \
+        dtype *d = (dtype*)dst; \
+        const stype *s = (const stype*)src; \
+        for(size_t i = 0; i < n; i++){ \
+            stype a = s[i]; \
+            d[i] = (expr); \
+        } \
+    }
+
+SCALAR_KERNEL(sum_f32_scalar, float, S_SUM)
+SCALAR_KERNEL(min_f32_scalar, float, S_MIN)
+SCALAR_KERNEL(max_f32_scalar, float, S_MAX)
+SCALAR_KERNEL(prod_f32_scalar, float, S_PROD)
+SCALAR_KERNEL(sum_f64_scalar, double, S_SUM)
+SCALAR_KERNEL(min_f64_scalar, double, S_MIN)
+SCALAR_KERNEL(max_f64_scalar, double, S_MAX)
+SCALAR_KERNEL(prod_f64_scalar, double, S_PROD)
+SCALAR_KERNEL(sum_i32_scalar, int32_t, S_SUM_I32)
+SCALAR_KERNEL(min_i32_scalar, int32_t, S_MIN)
+SCALAR_KERNEL(max_i32_scalar, int32_t, S_MAX)
+SCALAR_KERNEL(prod_i32_scalar, int32_t, S_PROD_I32)
+SCALAR_KERNEL(sum_i64_scalar, int64_t, S_SUM_I64)
+SCALAR_KERNEL(min_i64_scalar, int64_t, S_MIN)
+SCALAR_KERNEL(max_i64_scalar, int64_t, S_MAX)
+SCALAR_KERNEL(prod_i64_scalar, int64_t, S_PROD_I64)
+SCALAR_BF16_KERNEL(sum_bf16_scalar, S_SUM)
+SCALAR_BF16_KERNEL(min_bf16_scalar, S_MIN)
+SCALAR_BF16_KERNEL(max_bf16_scalar, S_MAX)
+SCALAR_BF16_KERNEL(prod_bf16_scalar, S_PROD)
+SCALAR_F16_KERNEL(sum_f16_scalar, S_SUM)
+SCALAR_F16_KERNEL(min_f16_scalar, S_MIN)
+SCALAR_F16_KERNEL(max_f16_scalar, S_MAX)
+SCALAR_F16_KERNEL(prod_f16_scalar, S_PROD)
+SCALAR_CONVERT(pack_bf16_scalar, float, uint16_t, f32_to_bf16(a))
+SCALAR_CONVERT(unpack_bf16_scalar, uint16_t, float, bf16_to_f32(a))
+SCALAR_CONVERT(pack_f16_scalar, float, uint16_t, f32_to_f16(a))
+SCALAR_CONVERT(unpack_f16_scalar, uint16_t, float, f16_to_f32(a))
+SCALAR_CONVERT(pack_f32_scalar, double, float, (float)a)
+SCALAR_CONVERT(unpack_f32_scalar, float, double, (double)a)
+
+#define SET_KERNELS(dtype, sfx) do { \
+    kernels[dtype][DC_REDUCE_SUM] = sum_ ## sfx; \
+    kernels[dtype][DC_REDUCE_MIN] = min_ ## sfx; \
+    kernels[dtype][DC_REDUCE_MAX] = max_ ## sfx; \
+    kernels[dtype][DC_REDUCE_PROD] = prod_ ## sfx; \
+} while(0)
+
+#define SET_CONVERTS(wire, sfx) do { \
+    packs[wire] = pack_ ## sfx; \
+    unpacks[wire] = unpack_ ## sfx; \
+} while(0)
+
+static void use_scalar(void){
+    SET_KERNELS(DC_DTYPE_F32, f32_scalar);
+    SET_KERNELS(DC_DTYPE_F64, f64_scalar);
+    SET_KERNELS(DC_DTYPE_I32, i32_scalar);
+    SET_KERNELS(DC_DTYPE_I64, i64_scalar);
+    SET_KERNELS(DC_DTYPE_BF16, bf16_scalar);
+    SET_KERNELS(DC_DTYPE_F16, f16_scalar);
+    SET_CONVERTS(WIRE_F32_BF16, bf16_scalar);
+    SET_CONVERTS(WIRE_F32_F16, f16_scalar);
+    SET_CONVERTS(WIRE_F64_F32, f32_scalar);
+    kernels_isa = "scalar";
+}
+
+#ifdef DC_X86
+
+/* VEC_KERNEL builds a kernel for one isa: a vector body over width elements
+   at a time (vexpr, in terms of va and vb) and a scalar tail (sexpr). */
+#define VEC_KERNEL( \
+    name, isa, type, vtype, width, vload, vstore, vexpr, sexpr \
+) \
+    __attribute__((target(isa))) \
+    static void name(char *dst, const char *src, size_t n){ \
+        type *d = (type*)dst; \
+        const type *s = (const type*)src; \
+        size_t i = 0; \
+        for(; i + width <= n; i += width){ \
+            vtype va = vload(d + i); \
+            vtype vb = vload(s + i); \
+            vstore(d + i, vexpr); \
+        } \
+        for(; i < n; i++){ \
+            type a = d[i]; \
+            type b = s[i]; \
+            d[i] = (sexpr); \
+        } \
+    }
+
+/* 16-bit float kernels widen to f32 lanes, so they take their own loader and
+   storer, and the scalar conversions for their tails */
+#define VEC_HALF_KERNEL( \
+    name, isa, vtype, width, vload, vstore, vexpr, widen, narrow, sexpr \
+) \
+    __attribute__((target(isa))) \
+    static void name(char *dst, const char *src, size_t n){ \
+        uint16_t *d = (uint16_t*)dst; \
+        const uint16_t *s = (const uint16_t*)src; \
+        size_t i = 0; \
+        for(; i + width <= n; i += width){ \
+            vtype va = vload(d + i); \
+            vtype vb = vload(s + i); \
+            vstore(d + i, vexpr); \
+        } \
+        for(; i < n; i++){ \
+            float a = widen(d[i]); \
+            float b = widen(s[i]); \
+            d[i] = narrow(sexpr); \
+        } \
+    }
+#define VEC_BF16_KERNEL(name, isa, vtype, width, vload, vstore, vexpr, sexpr) \
+    VEC_HALF_KERNEL(name, isa, vtype, width, vload, vstore, vexpr, \
+            bf16_to_f32, f32_to_bf16, sexpr)
+#define VEC_F16_KERNEL(name, isa, vtype, width, vload, vstore, vexpr, sexpr) \
+    VEC_HALF_KERNEL(name, isa, vtype, width, vload, vstore, vexpr, \
+            f16_to_f32, f32_to_f16, sexpr)
+
+// a conversion is a load of one type and a store of another
+#define VEC_CONVERT(name, isa, stype, dtype, width, vload, vstore, sexpr) \
+    __attribute__((target(isa))) \
+    static void name(char *dst, const char *src, size_t n){ \
+        dtype *d = (dtype*)dst; \
+        const stype *s = (const stype*)src; \
+        size_t i = 0; \
+        for(; i + width <= n; i += width){ \
+            vstore(d + i, vload(s + i)); \
+        } \
+        for(; i < n; i++){ \
+            stype a = s[i]; \
+            d[i] = (sexpr); \
+        } \
+    }
+
+// sse4.2: 128-bit lanes
+
+#define SSE "sse4.2"
+#define SSE_LD_PS(p) _mm_loadu_ps(p)
+#define SSE_ST_PS(p, v) _mm_storeu_ps(p, v)
+#define SSE_LD_PD(p) _mm_loadu_pd(p)
+#define SSE_ST_PD(p, v) _mm_storeu_pd(p, v)
+#define SSE_LD_SI(p) _mm_loadu_si128((const __m128i*)(p))
+#define SSE_ST_SI(p, v) _mm_storeu_si128((__m128i*)(p), v)
+
+VEC_KERNEL(sum_f32_sse, SSE, float, __m128, 4,
+        SSE_LD_PS, SSE_ST_PS, _mm_add_ps(va, vb), S_SUM)
+VEC_KERNEL(min_f32_sse, SSE, float, __m128, 4,
+        SSE_LD_PS, SSE_ST_PS, _mm_min_ps(va, vb), S_MIN)
+VEC_KERNEL(max_f32_sse, SSE, float, __m128, 4,
+        SSE_LD_PS, SSE_ST_PS, _mm_max_ps(va, vb), S_MAX)
+VEC_KERNEL(prod_f32_sse, SSE, float, __m128, 4,
+        SSE_LD_PS, SSE_ST_PS, _mm_mul_ps(va, vb), S_PROD)
+VEC_KERNEL(sum_f64_sse, SSE, double, __m128d, 2,
+        SSE_LD_PD, SSE_ST_PD, _mm_add_pd(va, vb), S_SUM)
+VEC_KERNEL(min_f64_sse, SSE, double, __m128d, 2,
+        SSE_LD_PD, SSE_ST_PD, _mm_min_pd(va, vb), S_MIN)
+VEC_KERNEL(max_f64_sse, SSE, double, __m128d, 2,
+        SSE_LD_PD, SSE_ST_PD, _mm_max_pd(va, vb), S_MAX)
+VEC_KERNEL(prod_f64_sse, SSE, double, __m128d, 2,
+        SSE_LD_PD, SSE_ST_PD, _mm_mul_pd(va, vb), S_PROD)
+VEC_KERNEL(sum_i32_sse, SSE, int32_t, __m128i, 4,
+        SSE_LD_SI, SSE_ST_SI, _mm_add_epi32(va, vb), S_SUM_I32)
+VEC_KERNEL(min_i32_sse, SSE, int32_t, __m128i, 4,
+        SSE_LD_SI, SSE_ST_SI, _mm_min_epi32(va, vb), S_MIN)
+VEC_KERNEL(max_i32_sse, SSE, int32_t, __m128i, 4,
+        SSE_LD_SI, SSE_ST_SI, _mm_max_epi32(va, vb), S_MAX)
+VEC_KERNEL(prod_i32_sse, SSE, int32_t, __m128i, 4,
+        SSE_LD_SI, SSE_ST_SI, _mm_mullo_epi32(va, vb), S_PROD_I32)
+VEC_KERNEL(sum_i64_sse, SSE, int64_t, __m128i, 2,
+        SSE_LD_SI, SSE_ST_SI, _mm_add_epi64(va, vb), S_SUM_I64)
+VEC_KERNEL(min_i64_sse, SSE, int64_t, __m128i, 2,
+        SSE_LD_SI, SSE_ST_SI,
+        _mm_blendv_epi8(va, vb, _mm_cmpgt_epi64(va, vb)), S_MIN)
+VEC_KERNEL(max_i64_sse, SSE, int64_t, __m128i, 2,
+        SSE_LD_SI, SSE_ST_SI,
+        _mm_blendv_epi8(va, vb, _mm_cmpgt_epi64(vb, va)), S_MAX)
+
+// avx2: 256-bit lanes
+
+#define AVX2 "avx2"
+#define AVX2_LD_PS(p) _mm256_loadu_ps(p)
+#define AVX2_ST_PS(p, v) _mm256_storeu_ps(p, v)
+#define AVX2_LD_PD(p) _mm256_loadu_pd(p)
+#define AVX2_ST_PD(p, v) _mm256_storeu_pd(p, v)
+#define AVX2_LD_SI(p) _mm256_loadu_si256((const __m256i*)(p))
+#define AVX2_ST_SI(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+
+__attribute__((target(AVX2)))
+static inline __m256 avx2_ld_bf16(const uint16_t *p){
+    __m128i h = _mm_loadu_si128((const __m128i*)p);
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+}
+
+__attribute__((target(AVX2)))
+static inline void avx2_st_bf16(uint16_t *p, __m256 f){
+    __m256i u = _mm256_castps_si256(f);
+    // round to nearest even
+    __m256i lsb = _mm256_and_si256(
+        _mm256_srli_epi32(u, 16), _mm256_set1_epi32(1)
+    );
+    __m256i bias = _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7fff));
+    __m256i r = _mm256_srli_epi32(_mm256_add_epi32(u, bias), 16);
+    // keep NaNs quiet
+    __m256i quiet = _mm256_or_si256(
+        _mm256_srli_epi32(u, 16), _mm256_set1_epi32(0x40)
+    );
+    __m256 nan = _mm256_cmp_ps(f, f, _CMP_UNORD_Q);
+    r = _mm256_blendv_epi8(r, quiet, _mm256_castps_si256(nan));
+    // packus works within 128-bit halves; gather qwords 0 and 2 at the bottom
+    __m256i packed = _mm256_packus_epi32(r, r);
+    packed = _mm256_permute4x64_epi64(packed, 0x08);
+    _mm_storeu_si128((__m128i*)p, _mm256_castsi256_si128(packed));
+}
+
+// f16 conversions also need f16c, which every avx2 cpu we know of has
+#define AVX2_F16C "avx2,f16c"
+
+__attribute__((target(AVX2_F16C)))
+static inline __m256 avx2_ld_f16(const uint16_t *p){
+    return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)p));
+}
+
+__attribute__((target(AVX2_F16C)))
+static inline void avx2_st_f16(uint16_t *p, __m256 f){
+    __m128i h = _mm256_cvtps_ph(f, _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128((__m128i*)p, h);
+}
+
+#define AVX2_LD_PD_PS(p) _mm256_cvtpd_ps(_mm256_loadu_pd(p))
+#define AVX2_LD_PS_PD(p) _mm256_cvtps_pd(_mm_loadu_ps(p))
+
+VEC_KERNEL(sum_f32_avx2, AVX2, float, __m256, 8,
+        AVX2_LD_PS, AVX2_ST_PS, _mm256_add_ps(va, vb), S_SUM)
+VEC_KERNEL(min_f32_avx2, AVX2, float, __m256, 8,
+        AVX2_LD_PS, AVX2_ST_PS, _mm256_min_ps(va, vb), S_MIN)
+VEC_KERNEL(max_f32_avx2, AVX2, float, __m256, 8,
+        AVX2_LD_PS, AVX2_ST_PS, _mm256_max_ps(va, vb), S_MAX)
+VEC_KERNEL(prod_f32_avx2, AVX2, float, __m256, 8,
+        AVX2_LD_PS, AVX2_ST_PS, _mm256_mul_ps(va, vb), S_PROD)
+VEC_KERNEL(sum_f64_avx2, AVX2, double, __m256d, 4,
+        AVX2_LD_PD, AVX2_ST_PD, _mm256_add_pd(va, vb), S_SUM)
+VEC_KERNEL(min_f64_avx2, AVX2, double, __m256d, 4,
+        AVX2_LD_PD, AVX2_ST_PD, _mm256_min_pd(va, vb), S_MIN)
+VEC_KERNEL(max_f64_avx2, AVX2, double, __m256d, 4,
+        AVX2_LD_PD, AVX2_ST_PD, _mm256_max_pd(va, vb), S_MAX)
+VEC_KERNEL(prod_f64_avx2, AVX2, double, __m256d, 4,
+        AVX2_LD_PD, AVX2_ST_PD, _mm256_mul_pd(va, vb), S_PROD)
+VEC_KERNEL(sum_i32_avx2, AVX2, int32_t, __m256i, 8,
+        AVX2_LD_SI, AVX2_ST_SI, _mm256_add_epi32(va, vb), S_SUM_I32)
+VEC_KERNEL(min_i32_avx2, AVX2, int32_t, __m256i, 8,
+        AVX2_LD_SI, AVX2_ST_SI, _mm256_min_epi32(va, vb), S_MIN)
+VEC_KERNEL(max_i32_avx2, AVX2, int32_t, __m256i, 8,
+        AVX2_LD_SI, AVX2_ST_SI, _mm256_max_epi32(va, vb), S_MAX)
+VEC_KERNEL(prod_i32_avx2, AVX2, int32_t, __m256i, 8,
+        AVX2_LD_SI, AVX2_ST_SI, _mm256_mullo_epi32(va, vb), S_PROD_I32)
+VEC_KERNEL(sum_i64_avx2, AVX2, int64_t, __m256i, 4,
+        AVX2_LD_SI, AVX2_ST_SI, _mm256_add_epi64(va, vb), S_SUM_I64)
+VEC_KERNEL(min_i64_avx2, AVX2, int64_t, __m256i, 4,
+        AVX2_LD_SI, AVX2_ST_SI,
+        _mm256_blendv_epi8(va, vb, _mm256_cmpgt_epi64(va, vb)), S_MIN)
+VEC_KERNEL(max_i64_avx2, AVX2, int64_t, __m256i, 4,
+        AVX2_LD_SI, AVX2_ST_SI,
+        _mm256_blendv_epi8(va, vb, _mm256_cmpgt_epi64(vb, va)), S_MAX)
+VEC_BF16_KERNEL(sum_bf16_avx2, AVX2, __m256, 8,
+        avx2_ld_bf16, avx2_st_bf16, _mm256_add_ps(va, vb), S_SUM)
+VEC_BF16_KERNEL(min_bf16_avx2, AVX2, __m256, 8,
+        avx2_ld_bf16, avx2_st_bf16, _mm256_min_ps(va, vb), S_MIN)
+VEC_BF16_KERNEL(max_bf16_avx2, AVX2, __m256, 8,
+        avx2_ld_bf16, avx2_st_bf16, _mm256_max_ps(va, vb), S_MAX)
+VEC_BF16_KERNEL(prod_bf16_avx2, AVX2, __m256, 8,
+        avx2_ld_bf16, avx2_st_bf16, _mm256_mul_ps(va, vb), S_PROD)
+VEC_F16_KERNEL(sum_f16_avx2, AVX2_F16C, __m256, 8,
+        avx2_ld_f16, avx2_st_f16, _mm256_add_ps(va, vb), S_SUM)
+VEC_F16_KERNEL(min_f16_avx2, AVX2_F16C, __m256, 8,
+        avx2_ld_f16, avx2_st_f16, _mm256_min_ps(va, vb), S_MIN)
+VEC_F16_KERNEL(max_f16_avx2, AVX2_F16C, __m256, 8,
+        avx2_ld_f16, avx2_st_f16, _mm256_max_ps(va, vb), S_MAX)
+VEC_F16_KERNEL(prod_f16_avx2, AVX2_F16C, __m256, 8,
+        avx2_ld_f16, avx2_st_f16, _mm256_mul_ps(va, vb), S_PROD)
+VEC_CONVERT(pack_bf16_avx2, AVX2, float, uint16_t, 8,
+        AVX2_LD_PS, avx2_st_bf16, f32_to_bf16(a))
+VEC_CONVERT(unpack_bf16_avx2, AVX2, uint16_t, float, 8,
+        avx2_ld_bf16, AVX2_ST_PS, bf16_to_f32(a))
+VEC_CONVERT(pack_f16_avx2, AVX2_F16C, float, uint16_t, 8,
+        AVX2_LD_PS, avx2_st_f16, f32_to_f16(a))
+VEC_CONVERT(unpack_f16_avx2, AVX2_F16C, uint16_t, float, 8,
+        avx2_ld_f16, AVX2_ST_PS, f16_to_f32(a))
+VEC_CONVERT(pack_f32_avx2, AVX2, double, float, 4,
+        AVX2_LD_PD_PS, SSE_ST_PS, (float)a)
+VEC_CONVERT(unpack_f32_avx2, AVX2, float, double, 4,
+        AVX2_LD_PS_PD, AVX2_ST_PD, (double)a)
+
+// avx512f: 512-bit lanes
+
+#define AVX512 "avx512f"
+#define AVX512_LD_PS(p) _mm512_loadu_ps(p)
+#define AVX512_ST_PS(p, v) _mm512_storeu_ps(p, v)
+#define AVX512_LD_PD(p) _mm512_loadu_pd(p)
+#define AVX512_ST_PD(p, v) _mm512_storeu_pd(p, v)
+#define AVX512_LD_SI(p) _mm512_loadu_si512((const void*)(p))
+#define AVX512_ST_SI(p, v) _mm512_storeu_si512((void*)(p), v)
+
+__attribute__((target(AVX512)))
+static inline __m512 avx512_ld_bf16(const uint16_t *p){
+    __m256i h = _mm256_loadu_si256((const __m256i*)p);
+    return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(h), 16));
+}
+
+__attribute__((target(AVX512)))
+static inline void avx512_st_bf16(uint16_t *p, __m512 f){
+    __m512i u = _mm512_castps_si512(f);
+    // round to nearest even
+    __m512i lsb = _mm512_and_si512(
+        _mm512_srli_epi32(u, 16), _mm512_set1_epi32(1)
+    );
+    __m512i bias = _mm512_add_epi32(lsb, _mm512_set1_epi32(0x7fff));
+    __m512i r = _mm512_srli_epi32(_mm512_add_epi32(u, bias), 16);
+    // keep NaNs quiet
+    __m512i quiet = _mm512_or_si512(
+        _mm512_srli_epi32(u, 16), _mm512_set1_epi32(0x40)
+    );
+    __mmask16 nan = _mm512_cmp_ps_mask(f, f, _CMP_UNORD_Q);
+    r = _mm512_mask_blend_epi32(nan, r, quiet);
+    _mm256_storeu_si256((__m256i*)p, _mm512_cvtepi32_epi16(r));
+}
+
+__attribute__((target(AVX512)))
+static inline __m512 avx512_ld_f16(const uint16_t *p){
+    return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)p));
+}
+
+__attribute__((target(AVX512)))
+static inline void avx512_st_f16(uint16_t *p, __m512 f){
+    // the unmasked form trips -Wsign-conversion inside gcc's own macro
+    __m256i h = _mm512_mask_cvtps_ph(
+        _mm256_setzero_si256(), 0xFFFF, f, _MM_FROUND_TO_NEAREST_INT
+    );
+    _mm256_storeu_si256((__m256i*)p, h);
+}
+
+#define AVX512_LD_PD_PS(p) _mm512_cvtpd_ps(_mm512_loadu_pd(p))
+#define AVX512_LD_PS_PD(p) _mm512_cvtps_pd(_mm256_loadu_ps(p))
+
+VEC_KERNEL(sum_f32_avx512, AVX512, float, __m512, 16,
+        AVX512_LD_PS, AVX512_ST_PS, _mm512_add_ps(va, vb), S_SUM)
+VEC_KERNEL(min_f32_avx512, AVX512, float, __m512, 16,
+        AVX512_LD_PS, AVX512_ST_PS, _mm512_min_ps(va, vb), S_MIN)
+VEC_KERNEL(max_f32_avx512, AVX512, float, __m512, 16,
+        AVX512_LD_PS, AVX512_ST_PS, _mm512_max_ps(va, vb), S_MAX)
+VEC_KERNEL(prod_f32_avx512, AVX512, float, __m512, 16,
+        AVX512_LD_PS, AVX512_ST_PS, _mm512_mul_ps(va, vb), S_PROD)
+VEC_KERNEL(sum_f64_avx512, AVX512, double, __m512d, 8,
+        AVX512_LD_PD, AVX512_ST_PD, _mm512_add_pd(va, vb), S_SUM)
+VEC_KERNEL(min_f64_avx512, AVX512, double, __m512d, 8,
+        AVX512_LD_PD, AVX512_ST_PD, _mm512_min_pd(va, vb), S_MIN)
+VEC_KERNEL(max_f64_avx512, AVX512, double, __m512d, 8,
+        AVX512_LD_PD, AVX512_ST_PD, _mm512_max_pd(va, vb), S_MAX)
+VEC_KERNEL(prod_f64_avx512, AVX512, double, __m512d, 8,
+        AVX512_LD_PD, AVX512_ST_PD, _mm512_mul_pd(va, vb), S_PROD)
+VEC_KERNEL(sum_i32_avx512, AVX512, int32_t, __m512i, 16,
+        AVX512_LD_SI, AVX512_ST_SI, _mm512_add_epi32(va, vb), S_SUM_I32)
+VEC_KERNEL(min_i32_avx512, AVX512, int32_t, __m512i, 16,
+        AVX512_LD_SI, AVX512_ST_SI, _mm512_min_epi32(va, vb), S_MIN)
+VEC_KERNEL(max_i32_avx512, AVX512, int32_t, __m512i, 16,
+        AVX512_LD_SI, AVX512_ST_SI, _mm512_max_epi32(va, vb), S_MAX)
+VEC_KERNEL(prod_i32_avx512, AVX512, int32_t, __m512i, 16,
+        AVX512_LD_SI, AVX512_ST_SI, _mm512_mullo_epi32(va, vb), S_PROD_I32)
+VEC_KERNEL(sum_i64_avx512, AVX512, int64_t, __m512i, 8,
+        AVX512_LD_SI, AVX512_ST_SI, _mm512_add_epi64(va, vb), S_SUM_I64)
+VEC_KERNEL(min_i64_avx512, AVX512, int64_t, __m512i, 8,
+        AVX512_LD_SI, AVX512_ST_SI, _mm512_min_epi64(va, vb), S_MIN)
+VEC_KERNEL(max_i64_avx512, AVX512, int64_t, __m512i, 8,
+        AVX512_LD_SI, AVX512_ST_SI, _mm512_max_epi64(va, vb), S_MAX)
+VEC_BF16_KERNEL(sum_bf16_avx512, AVX512, __m512, 16,
+        avx512_ld_bf16, avx512_st_bf16, _mm512_add_ps(va, vb), S_SUM)
+VEC_BF16_KERNEL(min_bf16_avx512, AVX512, __m512, 16,
+        avx512_ld_bf16, avx512_st_bf16, _mm512_min_ps(va, vb), S_MIN)
+VEC_BF16_KERNEL(max_bf16_avx512, AVX512, __m512, 16,
+        avx512_ld_bf16, avx512_st_bf16, _mm512_max_ps(va, vb), S_MAX)
+VEC_BF16_KERNEL(prod_bf16_avx512, AVX512, __m512, 16,
+        avx512_ld_bf16, avx512_st_bf16, _mm512_mul_ps(va, vb), S_PROD)
+VEC_F16_KERNEL(sum_f16_avx512, AVX512, __m512, 16,
+        avx512_ld_f16, avx512_st_f16, _mm512_add_ps(va, vb), S_SUM)
+VEC_F16_KERNEL(min_f16_avx512, AVX512, __m512, 16,
+        avx512_ld_f16, avx512_st_f16, _mm512_min_ps(va, vb), S_MIN)
+VEC_F16_KERNEL(max_f16_avx512, AVX512, __m512, 16,
+        avx512_ld_f16, avx512_st_f16, _mm512_max_ps(va, vb), S_MAX)
+VEC_F16_KERNEL(prod_f16_avx512, AVX512, __m512, 16,
+        avx512_ld_f16, avx512_st_f16, _mm512_mul_ps(va, vb), S_PROD)
+VEC_CONVERT(pack_bf16_avx512, AVX512, float, uint16_t, 16,
+        AVX512_LD_PS, avx512_st_bf16, f32_to_bf16(a))
+VEC_CONVERT(unpack_bf16_avx512, AVX512, uint16_t, float, 16,
+        avx512_ld_bf16, AVX512_ST_PS, bf16_to_f32(a))
+VEC_CONVERT(pack_f16_avx512, AVX512, float, uint16_t, 16,
+        AVX512_LD_PS, avx512_st_f16, f32_to_f16(a))
+VEC_CONVERT(unpack_f16_avx512, AVX512, uint16_t, float, 16,
+        avx512_ld_f16, AVX512_ST_PS, f16_to_f32(a))
+VEC_CONVERT(pack_f32_avx512, AVX512, double, float, 8,
+        AVX512_LD_PD_PS, AVX2_ST_PS, (float)a)
+VEC_CONVERT(unpack_f32_avx512, AVX512, float, double, 8,
+        AVX512_LD_PS_PD, AVX512_ST_PD, (double)a)
+
+/* each tier starts from scalar and only replaces the kernels it has; there is
+   no 64-bit integer multiply below avx512dq, so prod_i64 always stays scalar,
+   and bf16, f16 and the wire conversions need at least avx2 */
+static void use_sse(void){
+    use_scalar();
+    SET_KERNELS(DC_DTYPE_F32, f32_sse);
+    SET_KERNELS(DC_DTYPE_F64, f64_sse);
+    SET_KERNELS(DC_DTYPE_I32, i32_sse);
+    kernels[DC_DTYPE_I64][DC_REDUCE_SUM] = sum_i64_sse;
+    kernels[DC_DTYPE_I64][DC_REDUCE_MIN] = min_i64_sse;
+    kernels[DC_DTYPE_I64][DC_REDUCE_MAX] = max_i64_sse;
+    kernels_isa = SSE;
+}
+
+static void use_avx2(void){
+    use_scalar();
+    SET_KERNELS(DC_DTYPE_F32, f32_avx2);
+    SET_KERNELS(DC_DTYPE_F64, f64_avx2);
+    SET_KERNELS(DC_DTYPE_I32, i32_avx2);
+    kernels[DC_DTYPE_I64][DC_REDUCE_SUM] = sum_i64_avx2;
+    kernels[DC_DTYPE_I64][DC_REDUCE_MIN] = min_i64_avx2;
+    kernels[DC_DTYPE_I64][DC_REDUCE_MAX] = max_i64_avx2;
+    SET_KERNELS(DC_DTYPE_BF16, bf16_avx2);
+    SET_CONVERTS(WIRE_F32_BF16, bf16_avx2);
+    SET_CONVERTS(WIRE_F64_F32, f32_avx2);
+    if(__builtin_cpu_supports("f16c")){
+        SET_KERNELS(DC_DTYPE_F16, f16_avx2);
+        SET_CONVERTS(WIRE_F32_F16, f16_avx2);
+    }
+    kernels_isa = AVX2;
+}
+
+static void use_avx512(void){
+    use_scalar();
+    SET_KERNELS(DC_DTYPE_F32, f32_avx512);
+    SET_KERNELS(DC_DTYPE_F64, f64_avx512);
+    SET_KERNELS(DC_DTYPE_I32, i32_avx512);
+    kernels[DC_DTYPE_I64][DC_REDUCE_SUM] = sum_i64_avx512;
+    kernels[DC_DTYPE_I64][DC_REDUCE_MIN] = min_i64_avx512;
+    kernels[DC_DTYPE_I64][DC_REDUCE_MAX] = max_i64_avx512;
+    SET_KERNELS(DC_DTYPE_BF16, bf16_avx512);
+    SET_KERNELS(DC_DTYPE_F16, f16_avx512);
+    SET_CONVERTS(WIRE_F32_BF16, bf16_avx512);
+    SET_CONVERTS(WIRE_F32_F16, f16_avx512);
+    SET_CONVERTS(WIRE_F64_F32, f32_avx512);
+    kernels_isa = AVX512;
+}
+
+#endif // DC_X86
+
+int dc_reduce_use(const char *isa){
+    if(strcmp(isa, "scalar") == 0){
+        use_scalar();
+        return 0;
+    }
+#ifdef DC_X86
+    __builtin_cpu_init();
+    if(strcmp(isa, SSE) == 0 && __builtin_cpu_supports(SSE)){
+        use_sse();
+        return 0;
+    }
+    if(strcmp(isa, AVX2) == 0 && __builtin_cpu_supports(AVX2)){
+        use_avx2();
+        return 0;
+    }
+    if(strcmp(isa, AVX512) == 0 && __builtin_cpu_supports(AVX512)){
+        use_avx512();
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+static void select_kernels(void){
+    // best first
+    if(dc_reduce_use("avx512f") == 0) return;
+    if(dc_reduce_use("avx2") == 0) return;
+    if(dc_reduce_use("sse4.2") == 0) return;
+    dc_reduce_use("scalar");
+}
+
+void dc_reduce_init(void){
+    pthread_once(&kernels_once, select_kernels);
+}
+
+void dc_reduce(
+    dc_dtype_e dtype,
+    dc_reduce_e reduce,
+    char *dst,
+    const char *src,
+    size_t count
+){
+    dc_reduce_init();
+    kernels[dtype][reduce](dst, src, count);
+}
+
+const char *dc_reduce_isa(void){
+    dc_reduce_init();
+    return kernels_isa;
+}
+
+void dc_wire_pack(
+    dc_dtype_e dtype,
+    dc_dtype_e wire,
+    char *dst,
+    const char *src,
+    size_t count
+){
+    dc_reduce_init();
+    packs[wire_pair(dtype, wire)](dst, src, count);
+}
+
+void dc_wire_unpack(
+    dc_dtype_e dtype,
+    dc_dtype_e wire,
+    char *dst,
+    const char *src,
+    size_t count
+){
+    dc_reduce_init();
+    unpacks[wire_pair(dtype, wire)](dst, src, count);
+}
+
+void dc_wire_round(dc_dtype_e dtype, dc_dtype_e wire, char *buf, size_t count){
+    // a stack buffer's worth at a time
+    char tmp[4096];
+    size_t esize = dc_dtype_size(dtype);
+    size_t step = sizeof(tmp) / dc_dtype_size(wire);
+    for(size_t i = 0; i < count; i += step){
+        size_t n = count - i < step ? count - i : step;
+        dc_wire_pack(dtype, wire, tmp, buf + i * esize, n);
+        dc_wire_unpack(dtype, wire, buf + i * esize, tmp, n);
+    }
+}
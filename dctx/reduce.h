@@ -0,0 +1,49 @@
+// elementwise reduction kernels, selected at runtime by cpu feature
+
+bool dc_dtype_valid(int dtype);
+bool dc_reduce_valid(int reduce);
+
+// size of one element of dtype, in bytes
+size_t dc_dtype_size(dc_dtype_e dtype);
+
+// pick the best kernels for this cpu; safe to call more than once
+void dc_reduce_init(void);
+
+// dst[i] = dst[i] (reduce) src[i], for count elements of dtype
+void dc_reduce(
+    dc_dtype_e dtype,
+    dc_reduce_e reduce,
+    char *dst,
+    const char *src,
+    size_t count
+);
+
+/* a dtype may travel on the wire as a narrower one: f32 as bf16 or f16, and
+   f64 as f32.  Packing rounds to nearest even, and unpacking is exact. */
+bool dc_wire_valid(dc_dtype_e dtype, dc_dtype_e wire);
+// dst[i] = src[i] as wire, for count elements of dtype
+void dc_wire_pack(
+    dc_dtype_e dtype,
+    dc_dtype_e wire,
+    char *dst,
+    const char *src,
+    size_t count
+);
+// dst[i] = src[i] as dtype, for count elements of wire
+void dc_wire_unpack(
+    dc_dtype_e dtype,
+    dc_dtype_e wire,
+    char *dst,
+    const char *src,
+    size_t count
+);
+// buf[i] = what buf[i] would be after a trip over the wire
+void dc_wire_round(dc_dtype_e dtype, dc_dtype_e wire, char *buf, size_t count);
+
+// which instruction set dc_reduce is using, for logging and tests
+const char *dc_reduce_isa(void);
+
+/* override the automatic choice with "scalar", "sse4.2", "avx2" or "avx512f";
+   returns 1 if this cpu can't run that isa.  Only meant for tests, which
+   should call dc_reduce_init() first so it doesn't undo the override. */
+int dc_reduce_use(const char *isa);
@@ -7,13 +7,15 @@ dc_conn_t *dc_conn_new(void){
     if(conn){
         *conn = (dc_conn_t){.rank = -1};
         conn->tcp.data = conn;
+        dc_link_init(&conn->state);
     }
     return conn;
 }
 
 static void conn_close_cb(uv_handle_t *handle){
     dc_conn_t *conn = handle->data;
-    unmarshal_free(&conn->unmarshal);
+    dctx_t *dctx = handle->loop->data;
+    dc_link_free(dctx, &conn->state);
     free(conn);
 }
 
@@ -22,12 +24,21 @@ void dc_conn_close(dc_conn_t *conn){
     // remove from the dctx so it cannot be closed twice
     if(conn->rank < 0){
         link_remove(&conn->link);
+    }else if(conn->stripe){
+        stripe_forget(conn->tcp.loop->data, conn);
     }else{
         dctx_t *dctx = conn->tcp.loop->data;
-        dctx->server.peers[conn->rank] = NULL;
+        if(dctx->rank == 0){
+            dctx->server.peers[conn->rank] = NULL;
+        }else{
+            // a worker's ranked connections are direct links to its peers
+            dctx->mesh.conns[conn->rank] = NULL;
+        }
     }
 
     // start the close process
+    tcp_uncork(&conn->tcp);
+    uring_detach(&conn->tcp);
     uv_close((uv_handle_t*)&conn->tcp, conn_close_cb);
 }
 
@@ -80,10 +91,8 @@ static void listener_cb(uv_stream_t *srv, int status){
         goto fail;
     }
 
-    dc_conn_t *conn = malloc(sizeof(*conn));
+    dc_conn_t *conn = dc_conn_new();
     if(!conn) goto fail;
-    *conn = (dc_conn_t){.rank = -1};
-    conn->tcp.data = conn;
 
     int ret = uv_tcp_init(&dctx->loop, &conn->tcp);
     if(ret < 0){
@@ -108,11 +117,8 @@ static void listener_cb(uv_stream_t *srv, int status){
     link_list_append(&dctx->server.preinit, &conn->link);
 
     // start reading from this connection
-    ret = uv_read_start((uv_stream_t*)&conn->tcp, allocator, read_cb);
-    if(ret < 0){
-        uv_perror("uv_read_start", ret);
-        goto fail;
-    }
+    ret = tcp_read_start(&conn->tcp);
+    if(ret) goto fail;
 
     return;
 
@@ -133,7 +139,7 @@ static void on_broken_connection(dctx_t *dctx, uv_stream_t *stream){
         pthread_mutex_unlock(&dctx->mutex);
     }
 
-    if(conn->rank > -1){
+    if(conn->rank > -1 && !conn->stripe){
         // conn has known rank
         dctx->server.peers[conn->rank] = NULL;
     }
@@ -150,40 +156,60 @@ static void on_unmarshal(dc_unmarshal_t *u, void *arg){
     dctx_t *dctx = data->dctx;
     dc_conn_t *conn = data->conn;
 
+    if(conn->rank == -1 && u->type == 'e'){
+        // an extra connection of a worker's link
+        if(stripe_attach(dctx, conn, (int)u->rank, (uint8_t)u->kind)){
+            goto fail;
+        }
+        return;
+    }
+
     if(conn->rank == -1){
-        // preinit connection, only "i"int
-        if(u->type != 'i'){
-            rprintf("got non-init message from preinit connection\n");
+        // preinit connection, only "h"ello
+        if(u->type != 'h'){
+            rprintf("got non-hello message from preinit connection\n");
             goto fail;
         }
-        int i = (int)u->rank;
-        if(i < 0 || i > dctx->size){
-            rprintf("got invalid rank in init message: %d\n", i);
+        if(u->rank < 1 || u->rank >= (uint32_t)dctx->size){
+            rprintf("got invalid rank in hello message: %u\n", u->rank);
             goto fail;
         }
+        int i = (int)u->rank;
         if(dctx->server.peers[i] != NULL){
-            rprintf("got duplicate rank in init message: %d\n", i);
+            rprintf("got duplicate rank in hello message: %d\n", i);
             goto fail;
         }
+        if(tcp_on_hello(&conn->tcp, u)) goto fail;
         // transition from preinit to a ranked peer
         link_remove(&conn->link);
         // store conn as a ranked peer instead
         dctx->server.peers[i] = conn;
         dctx->server.npeers++;
         conn->rank = i;
+        conn->state.unmarshal.slices = stripe_slices(dctx, i);
+        // our hello answers theirs, before anything else we send
+        if(tcp_hello(&conn->tcp, 0)) goto fail;
+        if(mesh_note_peer(dctx, conn, u->port)) goto fail;
+        if(shm_offer(dctx, &conn->tcp, i)) goto fail;
         // rprintf("promoted peer=%d\n", i);
         advance_state(dctx);
         return;
     }
 
+    if(conn->stripe){
+        if(stripe_on_slice(dctx, conn, u)) goto fail;
+        return;
+    }
+
     // rprintf("read: %.*s\n", (int)u->len, u->body);
 
     int rank = conn->rank;
     dc_op_t *op;
+    int ret;
 
     switch(u->type){
-        case 'i':
-            rprintf("got init message from post-init peer: %d\n", conn->rank);
+        case 'h':
+            rprintf("got hello message from post-init peer: %d\n", conn->rank);
             goto fail;
 
         case 'g':
@@ -207,6 +233,20 @@ static void on_unmarshal(dc_unmarshal_t *u, void *arg){
             rprintf("got broadcast message on client\n");
             goto fail;
 
+        case 'x':
+        case 'p':
+            if((int)u->dst != 0){
+                // between two workers without a direct link
+                if(route_relay(dctx, u, rank)) goto fail;
+                break;
+            }
+            if(u->type == 'x'){
+                if(alltoall_recv(dctx, u, rank)) goto fail;
+            }else{
+                if(p2p_recv(dctx, u, rank)) goto fail;
+            }
+            break;
+
         case 'a':
             // find the op or create a new one
             op = get_op_for_recv(
@@ -224,6 +264,78 @@ static void on_unmarshal(dc_unmarshal_t *u, void *arg){
             }
             #undef OP
             break;
+
+        case 'A':
+            if(allgather_chunk_recv(dctx, u, rank)) goto fail;
+            break;
+
+        case 'r':
+        case 's':
+            // find the op or create a new one
+            op = get_op_for_recv(
+                dctx,
+                u->type == 'r' ? DC_OP_ALLREDUCE : DC_OP_REDUCE_SCATTER,
+                u->series,
+                u->slen,
+                conn->rank
+            );
+            if(!op) goto fail;
+
+            pthread_mutex_lock(&dctx->mutex);
+            ret = op_check_type(op, u->dtype, u->reduce);
+            pthread_mutex_unlock(&dctx->mutex);
+            if(ret) goto fail;
+
+            #define OP op->u.allreduce.chief
+            ret = allreduce_contribute(op, rank, u->body, u->len);
+            u->body = NULL;
+            if(ret) goto fail;
+            if(OP.nrecvd == (size_t)dctx->size){
+                // trigger the result broadcast
+                uv_async_send(&dctx->async);
+            }
+            #undef OP
+            break;
+
+        case 'w':
+            // find the op or create a new one
+            op = get_op_for_recv(
+                dctx, DC_OP_BARRIER, u->series, u->slen, conn->rank
+            );
+            if(!op) goto fail;
+
+            #define OP op->u.barrier.chief
+            OP.recvd[rank] = true;
+            if(++OP.nrecvd == dctx->server.npeers){
+                // trigger the release
+                uv_async_send(&dctx->async);
+            }
+            #undef OP
+            break;
+
+        case 'R':
+            if(ring_recv(dctx, u, rank)) goto fail;
+            break;
+
+        case 'G':
+            if(bundle_recv(dctx, u, rank)) goto fail;
+            break;
+
+        case 'M':
+            if(shm_on_offer(dctx, &conn->tcp, u->body, u->len)) goto fail;
+            break;
+
+        case 'm':
+            if(shm_on_ack(dctx, &conn->tcp, u->kind)) goto fail;
+            break;
+
+        case 'd':
+            if(shm_on_bell(dctx, &conn->tcp, on_unmarshal, arg)) goto fail;
+            break;
+
+        default:
+            rprintf("got unexpected message from peer: %c\n", u->type);
+            goto fail;
     }
 
     return;
@@ -240,9 +352,17 @@ static void on_read(
     dc_conn_t *conn = stream->data;
 
     unmarshal_data_t data = {dctx, conn};
-    int ret = unmarshal(&conn->unmarshal, buf, len, on_unmarshal, &data);
+    int ret = unmarshal(&conn->state.unmarshal, buf, len, on_unmarshal, &data);
     if(ret) goto fail;
 
+    dc_conn_t *main = conn->stripe ? dctx->server.peers[conn->rank] : NULL;
+    if(main){
+        // a striped body on the main connection may be whole now
+        data.conn = main;
+        ret = unmarshal(&main->state.unmarshal, NULL, 0, on_unmarshal, &data);
+        if(ret) goto fail;
+    }
+
     return;
 
 fail:
@@ -0,0 +1,388 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "internal.h"
+
+/* Each direction of a shared-memory link is a single-producer,
+   single-consumer ring in a POSIX shm object created by the sender.  The
+   sender offers the object's name over the socket, and if the peer can open
+   it and finds the right cookie inside, then the peer is on our host and
+   every later write goes through the ring.  The socket still carries a
+   one-byte doorbell whenever the receiver might be asleep, so the rings fit
+   into the libuv loop with no extra threads or fds.
+
+   A named object outlives a process that dies between creating it and the
+   peer unlinking it, so before its first offer each process sweeps away the
+   names left behind by dead pids. */
+
+// the shared header of one ring, followed by the ring's data
+typedef struct {
+    uint64_t cookie;
+    uint64_t size;
+    // bytes ever written, only moved by the sender
+    _Alignas(64) _Atomic uint64_t head;
+    // bytes ever read, only moved by the receiver
+    _Alignas(64) _Atomic uint64_t tail;
+    // the sender has rung the doorbell since the receiver's last drain
+    _Alignas(64) _Atomic uint32_t bell;
+    // the sender has writes waiting for the receiver to free some space
+    _Atomic uint32_t want_space;
+} ring_t;
+
+struct dc_shm {
+    // our send ring, which we write to once tx_on is set
+    ring_t *tx;
+    size_t txmap;
+    char txname[64];
+    bool tx_on;
+    // writes that did not fit in the ring yet
+    link_t pending;  // dc_write_t->link
+    // the peer's send ring, which we drain
+    ring_t *rx;
+    size_t rxmap;
+    dc_unmarshal_t unmarshal;
+};
+
+static char *ring_data(ring_t *r){
+    return (char*)r + sizeof(*r);
+}
+
+static size_t ring_space(ring_t *r){
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint64_t tail = atomic_load(&r->tail);
+    return (size_t)(r->size - (head - tail));
+}
+
+// returns how much of buf fit
+static size_t ring_push(ring_t *r, const char *buf, size_t len){
+    size_t space = ring_space(r);
+    size_t n = len < space ? len : space;
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t off = (size_t)(head % r->size);
+    size_t first = n < r->size - off ? n : (size_t)(r->size - off);
+    memcpy(ring_data(r) + off, buf, first);
+    memcpy(ring_data(r), buf + first, n - first);
+    atomic_store_explicit(&r->head, head + n, memory_order_release);
+    return n;
+}
+
+static dc_shm_t *shm_get(uv_tcp_t *tcp){
+    dctx_t *dctx = tcp->loop->data;
+    dc_link_t *link = tcp_link(tcp);
+    if(!link->shm){
+        link->shm = malloc(sizeof(*link->shm));
+        if(!link->shm){
+            perror("malloc");
+            return NULL;
+        }
+        *link->shm = (dc_shm_t){0};
+        // frames in the ring share the series ids and limits of the socket
+        link->shm->unmarshal.names = &link->series_rx;
+        link->shm->unmarshal.len_max = dctx->cfg.frame_max;
+    }
+    return link->shm;
+}
+
+static int ring_bell(uv_tcp_t *tcp){
+    return tcp_write_raw(tcp, "d", 1, NULL, 0, NULL);
+}
+
+static uint64_t new_cookie(void){
+    uint64_t cookie;
+    if(getrandom(&cookie, sizeof(cookie), 0) == (ssize_t)sizeof(cookie)){
+        return cookie;
+    }
+    return uv_hrtime() ^ ((uint64_t)getpid() << 32);
+}
+
+static pthread_once_t sweep_once = PTHREAD_ONCE_INIT;
+
+// unlink the objects of every dead process; shm_open names live in /dev/shm
+static void sweep_stale(void){
+    DIR *dir = opendir("/dev/shm");
+    if(!dir) return;
+    struct dirent *ent;
+    while((ent = readdir(dir))){
+        int pid;
+        if(sscanf(ent->d_name, "dctx-%d-", &pid) != 1 || pid <= 0) continue;
+        // EPERM means it is alive, just not ours
+        if(kill(pid, 0) == 0 || errno != ESRCH) continue;
+        char name[sizeof(ent->d_name) + 1];
+        snprintf(name, sizeof(name), "/%s", ent->d_name);
+        shm_unlink(name);
+    }
+    closedir(dir);
+}
+
+int shm_offer(dctx_t *dctx, uv_tcp_t *tcp, int peer){
+    if(!dctx->cfg.shm || dctx->cfg.shm_ring_bytes == 0) return 0;
+    dc_shm_t *shm = shm_get(tcp);
+    if(!shm) return 1;
+    if(shm->tx) return 0;
+
+    pthread_once(&sweep_once, sweep_stale);
+    uint64_t cookie = new_cookie();
+    snprintf(
+        shm->txname,
+        sizeof(shm->txname),
+        "/dctx-%d-%d-%d-%016llx",
+        (int)getpid(),
+        dctx->rank,
+        peer,
+        (unsigned long long)cookie
+    );
+
+    // any failure here just leaves the link on the socket
+    int fd = shm_open(shm->txname, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0){
+        perror("shm_open");
+        shm->txname[0] = '\0';
+        return 0;
+    }
+    size_t mapsize = sizeof(ring_t) + dctx->cfg.shm_ring_bytes;
+    // reserve it now, so a full /dev/shm fails here instead of with SIGBUS
+    int ret = posix_fallocate(fd, 0, (off_t)mapsize);
+    if(ret){
+        errno = ret;
+        perror("posix_fallocate");
+        goto fail_fd;
+    }
+    void *map = mmap(
+        NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0
+    );
+    if(map == MAP_FAILED){
+        perror("mmap");
+        goto fail_fd;
+    }
+    close(fd);
+
+    // fallocate zeroed head, tail, and the flags
+    ring_t *ring = map;
+    ring->cookie = cookie;
+    ring->size = dctx->cfg.shm_ring_bytes;
+    shm->tx = ring;
+    shm->txmap = mapsize;
+
+    // the offer is the cookie, then the name
+    char body[8 + sizeof(shm->txname)];
+    for(size_t i = 0; i < 8; i++){
+        body[i] = (char)(0xFF & (cookie >> (56 - 8 * i)));
+    }
+    size_t namelen = strlen(shm->txname);
+    memcpy(&body[8], shm->txname, namelen);
+
+    char hdr[SHM_OFFER_MSG_HDR_SIZE];
+    size_t buflen = marshal_shm_offer(hdr, 8 + namelen);
+    ret = tcp_write_copy(tcp, hdr, buflen);
+    if(ret) return 1;
+    return tcp_write_copy(tcp, body, 8 + namelen);
+
+fail_fd:
+    close(fd);
+    shm_unlink(shm->txname);
+    shm->txname[0] = '\0';
+    return 0;
+}
+
+int shm_on_offer(dctx_t *dctx, uv_tcp_t *tcp, const char *body, size_t len){
+    dc_shm_t *shm = shm_get(tcp);
+    if(!shm) return 1;
+    if(shm->rx){
+        rprintf("got a second shm offer on one link\n");
+        return 1;
+    }
+    char name[64];
+    if(len <= 8 || len - 8 >= sizeof(name)){
+        rprintf("got a bad shm offer of %zu bytes\n", len);
+        return 1;
+    }
+    const unsigned char *ubody = (const unsigned char*)body;
+    uint64_t cookie = 0;
+    for(size_t i = 0; i < 8; i++) cookie = (cookie << 8) | ubody[i];
+    memcpy(name, &body[8], len - 8);
+    name[len - 8] = '\0';
+
+    // if we can't open it, the peer is probably on another host
+    char ok = 'n';
+    char buf[SHM_ACK_MSG_SIZE];
+    size_t buflen;
+    int fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0) goto ack;
+    struct stat st;
+    if(fstat(fd, &st) || (size_t)st.st_size <= sizeof(ring_t)){
+        goto ack_fd;
+    }
+    size_t mapsize = (size_t)st.st_size;
+    void *map = mmap(
+        NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0
+    );
+    if(map == MAP_FAILED) goto ack_fd;
+    ring_t *ring = map;
+    if(ring->cookie != cookie || ring->size + sizeof(ring_t) != mapsize){
+        // same name, different object
+        munmap(map, mapsize);
+        goto ack_fd;
+    }
+    shm->rx = ring;
+    shm->rxmap = mapsize;
+    // we hold the only other mapping, so the name can go
+    shm_unlink(name);
+    ok = 'y';
+
+ack_fd:
+    close(fd);
+ack:
+    buflen = marshal_shm_ack(buf, ok);
+    return tcp_write_copy(tcp, buf, buflen);
+}
+
+int shm_on_ack(dctx_t *dctx, uv_tcp_t *tcp, char ok){
+    dc_shm_t *shm = tcp_link(tcp)->shm;
+    if(!shm || !shm->tx || shm->tx_on){
+        rprintf("got an unexpected shm ack\n");
+        return 1;
+    }
+    if(ok == 'y'){
+        // the peer already unlinked the name
+        shm->txname[0] = '\0';
+        shm->tx_on = true;
+        return 0;
+    }
+    shm_unlink(shm->txname);
+    shm->txname[0] = '\0';
+    munmap(shm->tx, shm->txmap);
+    shm->tx = NULL;
+    return 0;
+}
+
+// push the rest of one write; returns true if it is all in the ring
+static bool shm_push(ring_t *tx, dc_write_t *w, bool *pushed){
+    if(w->off < w->hdrlen){
+        size_t n = ring_push(tx, w->hdr + w->off, w->hdrlen - w->off);
+        *pushed |= n > 0;
+        w->off += n;
+        if(w->off < w->hdrlen) return false;
+    }
+    size_t boff = w->off - w->hdrlen;
+    if(boff == w->len) return true;
+    size_t n = ring_push(tx, w->base + boff, w->len - boff);
+    *pushed |= n > 0;
+    w->off += n;
+    return w->off == w->hdrlen + w->len;
+}
+
+// push as many pending writes as fit, and ring the doorbell if needed
+static int shm_flush(uv_tcp_t *tcp, dc_shm_t *shm){
+    dctx_t *dctx = tcp->loop->data;
+    ring_t *tx = shm->tx;
+    bool pushed = false;
+    int retval = 0;
+
+    link_t *link;
+    while((link = link_list_pop_first(&shm->pending))){
+        dc_write_t *w = CONTAINER_OF(link, dc_write_t, link);
+        if(!shm_push(tx, w, &pushed)){
+            link_list_prepend(&shm->pending, &w->link);
+            atomic_store(&tx->want_space, 1);
+            // the receiver may have emptied the ring before seeing want_space
+            if(ring_space(tx) > 0) continue;
+            break;
+        }
+        // our caller may hold dctx->mutex, so callbacks wait for async_cb
+        dc_write_done(dctx, w);
+    }
+
+    if(pushed && !atomic_exchange(&tx->bell, 1)){
+        retval = ring_bell(tcp);
+    }
+    return retval;
+}
+
+bool shm_active(uv_tcp_t *tcp){
+    dc_shm_t *shm = tcp_link(tcp)->shm;
+    return shm && shm->tx_on;
+}
+
+int shm_write(uv_tcp_t *tcp, dc_write_t *w){
+    dc_shm_t *shm = tcp_link(tcp)->shm;
+    link_list_append(&shm->pending, &w->link);
+
+    if(shm_flush(tcp, shm)){
+        // the write is queued, so our caller must not clean it up
+        dctx_t *dctx = tcp->loop->data;
+        dctx->failed = true;
+        close_everything(dctx);
+    }
+    return 0;
+}
+
+int shm_on_bell(
+    dctx_t *dctx,
+    uv_tcp_t *tcp,
+    void (*on_unmarshal)(dc_unmarshal_t*, void*),
+    void *arg
+){
+    dc_shm_t *shm = tcp_link(tcp)->shm;
+    if(!shm){
+        rprintf("got a doorbell on a link without shared memory\n");
+        return 1;
+    }
+
+    ring_t *rx = shm->rx;
+    if(rx){
+        // any push after this rings again
+        atomic_store(&rx->bell, 0);
+        while(!dctx->closed){
+            uint64_t tail = atomic_load_explicit(
+                &rx->tail, memory_order_relaxed
+            );
+            uint64_t head = atomic_load_explicit(
+                &rx->head, memory_order_acquire
+            );
+            if(head == tail) break;
+            size_t off = (size_t)(tail % rx->size);
+            size_t n = (size_t)(head - tail);
+            if(n > rx->size - off) n = (size_t)(rx->size - off);
+
+            // unmarshal straight out of the ring, then release the space
+            char *buf = ring_data(rx) + off;
+            int ret = unmarshal(&shm->unmarshal, buf, n, on_unmarshal, arg);
+            if(ret) return 1;
+            atomic_store(&rx->tail, tail + n);
+        }
+        // the sender may be waiting on the space we just freed
+        if(atomic_exchange(&rx->want_space, 0)){
+            if(ring_bell(tcp)) return 1;
+        }
+    }
+
+    if(shm->tx_on) return shm_flush(tcp, shm);
+    return 0;
+}
+
+void shm_free(dctx_t *dctx, dc_shm_t *shm){
+    if(!shm) return;
+    // nothing will drain these now, but their buffers must still be released
+    link_t *link;
+    while((link = link_list_pop_first(&shm->pending))){
+        dc_write_t *w = CONTAINER_OF(link, dc_write_t, link);
+        dc_write_cb_run(dctx, w->cb);
+        dc_write_put(dctx, w);
+    }
+    if(shm->tx){
+        if(shm->txname[0]) shm_unlink(shm->txname);
+        munmap(shm->tx, shm->txmap);
+    }
+    if(shm->rx) munmap(shm->rx, shm->rxmap);
+    unmarshal_free(&shm->unmarshal);
+    free(shm);
+}
@@ -0,0 +1,83 @@
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "internal.h"
+
+/* Buffers that live and die on the loop thread (write records, callbacks, read
+   buffers) cycle through here instead of malloc, so a warm loop stays out of
+   the glibc arenas that the application's own threads are contending for.
+   Not thread-safe: only the loop thread may touch a dctx's slab. */
+
+// blocks of no size class
+#define SLAB_BIG SLAB_NCLASSES
+
+// every block starts with one of these, which keeps the payload aligned
+typedef union {
+    size_t cls;
+    max_align_t align;
+} slab_hdr_t;
+
+// an idle block reuses its payload for the free list
+typedef struct {
+    slab_hdr_t hdr;
+    link_t link;
+} slab_block_t;
+DEF_CONTAINER_OF(slab_block_t, link, link_t)
+
+static size_t slab_class(size_t size){
+    size_t cls = 0;
+    while(cls < SLAB_NCLASSES && size > (size_t)1 << (SLAB_MIN_SHIFT + cls)){
+        cls++;
+    }
+    return cls;
+}
+
+static size_t slab_class_size(size_t cls){
+    return (size_t)1 << (SLAB_MIN_SHIFT + cls);
+}
+
+void *slab_alloc(dc_slab_t *slab, size_t size){
+    size_t cls = slab_class(size);
+    if(cls < SLAB_NCLASSES){
+        link_t *link = link_list_pop_first(&slab->free[cls]);
+        if(link){
+            slab->nfree[cls]--;
+            return &CONTAINER_OF(link, slab_block_t, link)->hdr + 1;
+        }
+        size = slab_class_size(cls);
+    }
+    slab_hdr_t *hdr = malloc(sizeof(*hdr) + size);
+    if(!hdr) return NULL;
+    hdr->cls = cls;
+    return hdr + 1;
+}
+
+void slab_free(dc_slab_t *slab, void *ptr){
+    if(!ptr) return;
+    slab_hdr_t *hdr = (slab_hdr_t*)ptr - 1;
+    size_t cls = hdr->cls;
+    if(cls == SLAB_BIG){
+        free(hdr);
+        return;
+    }
+    size_t keep = SLAB_KEEP_BYTES / slab_class_size(cls);
+    if(keep < SLAB_KEEP_MIN) keep = SLAB_KEEP_MIN;
+    if(slab->nfree[cls] >= keep){
+        free(hdr);
+        return;
+    }
+    slab_block_t *block = (slab_block_t*)hdr;
+    // recently freed blocks are the likeliest to still be in cache
+    link_list_prepend(&slab->free[cls], &block->link);
+    slab->nfree[cls]++;
+}
+
+void slab_release(dc_slab_t *slab){
+    for(size_t cls = 0; cls < SLAB_NCLASSES; cls++){
+        link_t *link;
+        while((link = link_list_pop_first(&slab->free[cls]))){
+            free(CONTAINER_OF(link, slab_block_t, link));
+        }
+        slab->nfree[cls] = 0;
+    }
+}
@@ -0,0 +1,21 @@
+// a per-loop allocator for short-lived buffers, see slab.c
+
+// size classes are powers of two, from 1 << SLAB_MIN_SHIFT to 1 << 20
+#define SLAB_MIN_SHIFT 6
+#define SLAB_NCLASSES 15
+// idle bytes kept per size class (though always room for SLAB_KEEP_MIN)
+#define SLAB_KEEP_BYTES (1024 * 1024)
+#define SLAB_KEEP_MIN 4
+
+typedef struct {
+    // idle blocks of each size class
+    link_t free[SLAB_NCLASSES];
+    size_t nfree[SLAB_NCLASSES];
+} dc_slab_t;
+
+// like malloc; anything too big for a size class comes straight from malloc
+void *slab_alloc(dc_slab_t *slab, size_t size);
+// like free, for anything from slab_alloc
+void slab_free(dc_slab_t *slab, void *ptr);
+// release every idle block
+void slab_release(dc_slab_t *slab);
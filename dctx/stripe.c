@@ -0,0 +1,263 @@
+#include <stdlib.h>
+
+#include "internal.h"
+
+int stripe_init(dctx_t *dctx){
+    if(dctx->cfg.stripes < 2) return 0;
+    // the chief has a link to every rank, and a worker only to the chief
+    size_t nlinks = dctx->rank == 0 ? (size_t)dctx->size : 1;
+    dctx->stripe.links = calloc(nlinks, sizeof(*dctx->stripe.links));
+    if(!dctx->stripe.links){
+        perror("calloc");
+        return 1;
+    }
+    size_t npeers = dctx->rank == 0 ? nlinks - 1 : 1;
+    dctx->stripe.nwanted = npeers * (dctx->cfg.stripes - 1);
+    if(dctx->rank > 0){
+        dctx->client.state.unmarshal.slices = &dctx->stripe.links[0].slices;
+    }
+    return 0;
+}
+
+// after stripe_close and after the loop has stopped
+void stripe_free(dctx_t *dctx){
+    if(!dctx->stripe.links) return;
+    size_t nlinks = dctx->rank == 0 ? (size_t)dctx->size : 1;
+    for(size_t i = 0; i < nlinks; i++){
+        slices_free(&dctx->stripe.links[i].slices);
+    }
+    free(dctx->stripe.links);
+}
+
+void stripe_close(dctx_t *dctx){
+    if(!dctx->stripe.links) return;
+    size_t nlinks = dctx->rank == 0 ? (size_t)dctx->size : 1;
+    for(size_t i = 0; i < nlinks; i++){
+        for(size_t k = 1; k < STRIPES_MAX; k++){
+            dc_conn_close(dctx->stripe.links[i].conns[k]);
+        }
+    }
+}
+
+void stripe_forget(dctx_t *dctx, dc_conn_t *conn){
+    dc_stripes_t *s = &dctx->stripe.links[conn->rank];
+    s->conns[conn->stripe] = NULL;
+    s->nconns--;
+}
+
+bool stripe_ready(dctx_t *dctx){
+    return dctx->stripe.nlinked == dctx->stripe.nwanted;
+}
+
+dc_slices_t *stripe_slices(dctx_t *dctx, int rank){
+    if(!dctx->stripe.links) return NULL;
+    return &dctx->stripe.links[rank].slices;
+}
+
+static void stripe_conn_cb(uv_connect_t *req, int status){
+    dc_conn_t *conn = req->data;
+    dctx_t *dctx = conn->tcp.loop->data;
+    if(dctx->closed) return;
+
+    if(status < 0){
+        uv_perror("uv_tcp_connect(stripe)", status);
+        goto fail;
+    }
+
+    int ret = tcp_read_start(&conn->tcp);
+    if(ret) goto fail;
+
+    // say which link we belong to, and which slices we carry
+    char buf[EXTRA_MSG_SIZE];
+    size_t buflen = marshal_extra(buf, dctx->rank, conn->stripe);
+    ret = tcp_write_copy(&conn->tcp, buf, buflen);
+    if(ret) goto fail;
+
+    dctx->stripe.links[0].nconns++;
+    dctx->stripe.nlinked++;
+    advance_state(dctx);
+    return;
+
+fail:
+    dctx->failed = true;
+    close_everything(dctx);
+}
+
+int stripe_dial(dctx_t *dctx){
+    if(!dctx->stripe.links) return 0;
+
+    // wherever the main connection went
+    struct sockaddr_storage ss;
+    int namelen = sizeof(ss);
+    int ret = uv_tcp_getpeername(
+        &dctx->tcp, (struct sockaddr*)&ss, &namelen
+    );
+    if(ret < 0){
+        uv_perror("uv_tcp_getpeername", ret);
+        return 1;
+    }
+
+    for(size_t k = 1; k < dctx->cfg.stripes; k++){
+        dc_conn_t *conn = dc_conn_new();
+        if(!conn){
+            perror("malloc");
+            return 1;
+        }
+
+        ret = uv_tcp_init(&dctx->loop, &conn->tcp);
+        if(ret < 0){
+            uv_perror("uv_tcp_init", ret);
+            free(conn);
+            return 1;
+        }
+        conn->rank = 0;
+        conn->stripe = k;
+        dctx->stripe.links[0].conns[k] = conn;
+
+        ret = uv_tcp_nodelay(&conn->tcp, 1);
+        if(ret < 0) uv_perror("warning: uv_tcp_nodelay failed", ret);
+
+        conn->connect_req.data = conn;
+        ret = uv_tcp_connect(
+            &conn->connect_req,
+            &conn->tcp,
+            (struct sockaddr*)&ss,
+            stripe_conn_cb
+        );
+        if(ret < 0){
+            uv_perror("uv_tcp_connect", ret);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int stripe_attach(dctx_t *dctx, dc_conn_t *conn, int rank, size_t k){
+    if(!dctx->stripe.links){
+        rprintf("got an extra connection, but DCTX_STRIPES is off\n");
+        return 1;
+    }
+    if(rank < 1 || rank >= dctx->size || k < 1 || k >= dctx->cfg.stripes){
+        rprintf("got invalid extra connection: %d/%zu\n", rank, k);
+        return 1;
+    }
+    dc_stripes_t *s = &dctx->stripe.links[rank];
+    if(s->conns[k] != NULL){
+        rprintf("got duplicate extra connection: %d/%zu\n", rank, k);
+        return 1;
+    }
+    link_remove(&conn->link);
+    conn->rank = rank;
+    conn->stripe = k;
+    s->conns[k] = conn;
+    s->nconns++;
+    dctx->stripe.nlinked++;
+    advance_state(dctx);
+    return 0;
+}
+
+int stripe_on_slice(dctx_t *dctx, dc_conn_t *conn, dc_unmarshal_t *u){
+    if(u->type != 'S'){
+        rprintf("got unexpected message on extra link: %c\n", u->type);
+        return 1;
+    }
+    dc_slices_t *slices = &dctx->stripe.links[conn->rank].slices;
+    char *body = u->body;
+    u->body = NULL;
+    return slices_push(slices, conn->stripe, body, (size_t)u->len);
+}
+
+static void stripe_on_unmarshal(dc_unmarshal_t *u, void *arg){
+    dc_conn_t *conn = arg;
+    dctx_t *dctx = conn->tcp.loop->data;
+
+    if(stripe_on_slice(dctx, conn, u)){
+        dctx->failed = true;
+        close_everything(dctx);
+    }
+}
+
+void stripe_on_read(dctx_t *dctx, dc_conn_t *conn, char *buf, size_t len){
+    int ret = unmarshal(
+        &conn->state.unmarshal, buf, len, stripe_on_unmarshal, conn
+    );
+    if(ret){
+        dctx->failed = true;
+        close_everything(dctx);
+    }
+}
+
+// the stripes of the link behind tcp, if it has any
+static dc_stripes_t *tcp_stripes(dctx_t *dctx, uv_tcp_t *tcp){
+    if(dctx->rank > 0){
+        return tcp == &dctx->tcp ? &dctx->stripe.links[0] : NULL;
+    }
+    dc_conn_t *conn = tcp->data;
+    if(conn->stripe || conn->rank < 1) return NULL;
+    return &dctx->stripe.links[conn->rank];
+}
+
+size_t stripe_count(uv_tcp_t *tcp, size_t len){
+    dctx_t *dctx = tcp->loop->data;
+    size_t n = dctx->cfg.stripes;
+    if(!dctx->stripe.links || len < dctx->cfg.stripe_min_bytes || len < n){
+        return 1;
+    }
+    // shared memory is not a socket, and would gain nothing
+    if(shm_active(tcp)) return 1;
+    dc_stripes_t *s = tcp_stripes(dctx, tcp);
+    if(!s || s->nconns + 1 < n) return 1;
+    return n;
+}
+
+int stripe_write(
+    uv_tcp_t *tcp,
+    char *hdr,
+    size_t hdrlen,
+    char *base,
+    size_t len,
+    size_t n,
+    dc_write_cb_t *cb
+){
+    dctx_t *dctx = tcp->loop->data;
+    dc_stripes_t *s = tcp_stripes(dctx, tcp);
+
+    // cb waits for every slice
+    dc_write_cb_t *jcb = slab_alloc(&dctx->slab, sizeof(*jcb));
+    if(!jcb){
+        perror("malloc");
+        return 1;
+    }
+    *jcb = (dc_write_cb_t){
+        .type = WRITE_CB_JOIN,
+        .u = { .join = n },
+        .next = cb,
+    };
+
+    marshal_striped(hdr, hdrlen, n);
+    size_t off;
+    size_t slen = stripe_slice(len, n, 0, &off);
+    int ret = tcp_write_hdr(tcp, hdr, hdrlen, base, slen, jcb);
+    if(ret){
+        slab_free(&dctx->slab, jcb);
+        return 1;
+    }
+
+    for(size_t k = 1; k < n; k++){
+        char shdr[SLICE_MSG_HDR_SIZE];
+        slen = stripe_slice(len, n, k, &off);
+        size_t shdrlen = marshal_slice(shdr, slen);
+        ret = tcp_write_hdr(
+            &s->conns[k]->tcp, shdr, shdrlen, base + off, slen, jcb
+        );
+        if(ret){
+            /* the slices already queued still need base, so cb must wait for
+               them; the link is no good without the rest anyway */
+            jcb->u.join -= n - k;
+            dctx->failed = true;
+            close_everything(dctx);
+            return 0;
+        }
+    }
+    return 0;
+}
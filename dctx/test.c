@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <poll.h>
 
 #include "internal.h"
 
@@ -29,6 +30,7 @@ struct test_case {
     char type;
     char *series;
     uint32_t rank;
+    uint16_t port;
     char *body;
 };
 
@@ -47,8 +49,12 @@ static void on_unmarshal(dc_unmarshal_t *u, void *arg){
     ASSERT(data->nexpect > data->nchecked);
     ASSERT(u->type == tc.type);
     switch(u->type){
-        case 'i':
+        case 'h':
+            ASSERT(u->version == PROTOCOL_VERSION);
             ASSERT(u->rank == tc.rank);
+            ASSERT(u->port == tc.port);
+            ASSERT(u->features == (FEAT_INTERN | FEAT_LEN64));
+            ASSERT(u->frame_max == FRAME_MAX);
             break;
 
         case 'g':
@@ -80,6 +86,7 @@ static int test_unmarshal(void){
     #define FEED_BUFFER(buffer) do { \
         uv_buf_t buf = mkbuf(buffer); \
         int ret = unmarshal(&u, buf.base, buf.len, on_unmarshal, &data); \
+        free(buf.base); \
         ASSERT(ret == 0); \
     }while(0)
 
@@ -92,7 +99,9 @@ static int test_unmarshal(void){
             .nexpect = 1,
         };
 
-        FEED_BUFFER("g" "\x03" "ser" "\x00\x00\x00\x04" "abcd");
+        FEED_BUFFER(
+            "g" "\x03" "ser" "\x00\x00\x00\x00\x00\x00\x00\x04" "abcd"
+        );
 
         ASSERT(data.nchecked == data.nexpect);
         ASSERT(!data.fail);
@@ -120,7 +129,8 @@ static int test_unmarshal(void){
         FEED_BUFFER("er");
         FEED_BUFFER("i");
         FEED_BUFFER("\x00");
-        FEED_BUFFER("\x00");
+        FEED_BUFFER("\x00\x00\x00");
+        FEED_BUFFER("\x00\x00");
         FEED_BUFFER("\x00");
         FEED_BUFFER("\x04");
         FEED_BUFFER("a");
@@ -149,8 +159,8 @@ static int test_unmarshal(void){
         };
 
         FEED_BUFFER(
-            "g" "\x03" "ser" "\x00\x00\x00\x04" "abcd"
-            "g" "\x03" "ser" "\x00\x00\x00\x03" "efg"
+            "g" "\x03" "ser" "\x00\x00\x00\x00\x00\x00\x00\x04" "abcd"
+            "g" "\x03" "ser" "\x00\x00\x00\x00\x00\x00\x00\x03" "efg"
         );
 
         ASSERT(data.nchecked == data.nexpect);
@@ -164,27 +174,492 @@ static int test_unmarshal(void){
     ASSERT(u.len == 0);
     ASSERT(u.body == NULL);
 
-    // one init, and one gather
+    // a body read straight into place
+    {
+        struct unmarshal_test data = {
+            .cases = {
+                { .type = 'g', .series = "ser", .body = "abcdefgh" },
+            },
+            .nexpect = 1,
+        };
+
+        size_t len;
+        FEED_BUFFER("g" "\x03" "ser" "\x00\x00\x00\x00\x00\x00\x00\x08" "ab");
+        char *space = unmarshal_body_space(&u, 4, &len);
+        ASSERT(space == u.body + 2);
+        ASSERT(len == 6);
+        memcpy(space, "cd", 2);
+        ASSERT(unmarshal_landed(&u, space, 2));
+        ASSERT(unmarshal(&u, space + 2, 0, on_unmarshal, &data) == 0);
+        ASSERT(data.nchecked == 0);
+        // too little left to be worth a direct read
+        ASSERT(!unmarshal_body_space(&u, 5, &len));
+        FEED_BUFFER("ef");
+        space = unmarshal_body_space(&u, 2, &len);
+        ASSERT(space && len == 2);
+        memcpy(space, "gh", 2);
+        ASSERT(unmarshal_landed(&u, space, 2));
+        ASSERT(unmarshal(&u, space + 2, 0, on_unmarshal, &data) == 0);
+
+        ASSERT(data.nchecked == data.nexpect);
+        ASSERT(!data.fail);
+    }
+
+    ASSERT(u.type == 0);
+    ASSERT(u.body == NULL);
+
+    // one hello, and one gather
     {
         struct unmarshal_test data = {
             .cases = {
-                { .type = 'i', .rank = 2 },
+                { .type = 'h', .rank = 0x01020304, .port = 0x1234 },
                 { .type = 'g', .series = "ser", .body = "abcd" },
             },
             .nexpect = 2,
         };
 
+        // the whole rank makes it, not just its low byte
+        FEED_BUFFER(
+            "h" "\x00\x02" "\x01\x02\x03\x04" "\x12\x34"
+            "\x00\x00\x00\x0c" "\x00\xff\xff\xff\xff\xff\xff\xff"
+            "g" "\x03" "ser" "\x00\x00\x00\x00\x00\x00\x00\x04" "abcd"
+        );
+
+        ASSERT(data.nchecked == data.nexpect);
+        ASSERT(!data.fail);
+
+        char msg[HELLO_MSG_SIZE];
+        size_t n = marshal_hello(
+            msg, 0x01020304, 0x1234, FEAT_INTERN | FEAT_LEN64, FRAME_MAX
+        );
+        ASSERT(n == HELLO_MSG_SIZE);
+        data.nchecked = 0;
+        data.nexpect = 1;
+        ASSERT(unmarshal(&u, msg, n, on_unmarshal, &data) == 0);
+        ASSERT(data.nchecked == 1);
+        ASSERT(!data.fail);
+    }
+
+    // the init message of older versions is refused, not misparsed
+    {
+        struct unmarshal_test data = { .nexpect = 0 };
+        char msg[] = "i" "\x00\x00\x00\x02" "\x12\x34";
+        int ret = unmarshal(&u, msg, sizeof(msg) - 1, on_unmarshal, &data);
+        unmarshal_free(&u);
+        ASSERT(ret != 0);
+    }
+
+    // an unknown dtype or reduce op is refused before it indexes any table
+    {
+        struct unmarshal_test data = { .nexpect = 0 };
+        const char *bad[] = {
+            // reduce = 99
+            "r" "\x03" "ser" "\x00" "\x63" "\x00",
+            // dtype = 99
+            "r" "\x03" "ser" "\x63" "\x00" "\x63",
+            // the same for a reduce-scatter
+            "s" "\x03" "ser" "\x00" "\x63" "\x00",
+            "s" "\x03" "ser" "\x63" "\x00" "\x63",
+        };
+        for(size_t i = 0; i < sizeof(bad) / sizeof(*bad); i++){
+            char msg[8];
+            memcpy(msg, bad[i], sizeof(msg));
+            int ret = unmarshal(&u, msg, sizeof(msg), on_unmarshal, &data);
+            unmarshal_free(&u);
+            ASSERT(ret != 0);
+        }
+        ASSERT(data.nchecked == 0);
+    }
+
+    // bodies bigger than we said we take are refused
+    {
+        struct unmarshal_test data = { .nexpect = 0 };
+        dc_unmarshal_t u2 = { .len_max = 3 };
+        char msg[] = "g" "\x03" "ser" "\x00\x00\x00\x00\x00\x00\x00\x04";
+        int ret = unmarshal(&u2, msg, sizeof(msg) - 1, on_unmarshal, &data);
+        unmarshal_free(&u2);
+        ASSERT(ret != 0);
+    }
+
+    // lengths past 2**32 survive the trip
+    {
+        char hdr[GATHER_MSG_HDR_MAXSIZE];
+        size_t big = ((size_t)1 << 32) + 4;
+        size_t n = marshal_gather(hdr, "ser", 3, big);
+        ASSERT(n == 1 + 1 + 3 + 8);
+        ASSERT(memcmp(&hdr[5], "\x00\x00\x00\x01\x00\x00\x00\x04", 8) == 0);
+
+        char rec[BUNDLE_RECORD_HDR_SIZE];
+        marshal_bundle_record(rec, 7, big);
+        uint32_t rank;
+        size_t len;
+        // the record claims more data than the buffer has
+        ASSERT(unmarshal_bundle_record(rec, sizeof(rec), &rank, &len) == 0);
+        ASSERT(
+            unmarshal_bundle_record(rec, SIZE_MAX, &rank, &len)
+            == BUNDLE_RECORD_HDR_SIZE
+        );
+        ASSERT(rank == 7);
+        ASSERT(len == big);
+    }
+
+done:
+    unmarshal_free(&u);
+    return retval;
+}
+
+static int test_intern(void){
+    int retval = 0;
+    dc_intern_t tx = {0};
+    dc_intern_t rx = {0};
+    dc_unmarshal_t u = { .names = &rx };
+
+    // ids go out in order, and a known series keeps its id
+    bool fresh;
+    ASSERT(intern_tx(&tx, "ser", 3, &fresh) == 0 && fresh);
+    ASSERT(intern_tx(&tx, "other", 5, &fresh) == 1 && fresh);
+    ASSERT(intern_tx(&tx, "ser", 3, &fresh) == 0 && !fresh);
+    // enough to rebuild the index a few times
+    for(int i = 0; i < 1000; i++){
+        char buf[16];
+        int n = snprintf(buf, sizeof(buf), "s%d", i);
+        ASSERT(intern_tx(&tx, buf, (size_t)n, &fresh) == i + 2 && fresh);
+    }
+    ASSERT(intern_tx(&tx, "s500", 4, &fresh) == 502 && !fresh);
+    ASSERT(intern_tx(&tx, "other", 5, &fresh) == 1 && !fresh);
+
+    {
+        struct unmarshal_test data = {
+            .cases = {
+                { .type = 'g', .series = "ser", .body = "abcd" },
+                { .type = 'g', .series = "ser", .body = "efg" },
+                { .type = 'b', .series = "ser", .body = "h" },
+            },
+            .nexpect = 3,
+        };
+
+        // define id 0, then use it twice
         FEED_BUFFER(
-            "i" "\x00\x00\x00\x02"
-            "g" "\x03" "ser" "\x00\x00\x00\x04" "abcd"
+            "g" "\xfe\x00\x00\x00\x03" "ser" "\x00\x00\x00\x00\x00\x00\x00\x04"
+            "abcd"
+            "g" "\xff\x00"
         );
+        FEED_BUFFER(
+            "\x00" "\x00\x00\x00\x00\x00\x00\x00\x03" "efg"
+            "b" "\xff\x00\x00" "\x00\x00\x00\x00\x00\x00\x00\x01" "h"
+        );
+
+        ASSERT(data.nchecked == data.nexpect);
+        ASSERT(!data.fail);
+        ASSERT(rx.n == 1);
+        ASSERT(u.names == &rx);
+    }
+
+    // ids must be defined in order, and known before they are used
+    {
+        struct unmarshal_test data = { .nexpect = 0 };
+        dc_unmarshal_t u2 = { .names = &rx };
+        char msg[] = "g" "\xfe\x00\x05\x00\x01" "x";
+        int ret = unmarshal(&u2, msg, sizeof(msg) - 1, on_unmarshal, &data);
+        ASSERT(ret != 0);
+        unmarshal_free(&u2);
+        char msg2[] = "g" "\xff\x00\x01";
+        ret = unmarshal(&u2, msg2, sizeof(msg2) - 1, on_unmarshal, &data);
+        ASSERT(ret != 0);
+        unmarshal_free(&u2);
+    }
 
+    // long names go by name, even on a plain link, up to the longest of all
+    for(size_t slen = 254; slen <= 256; slen++){
+        char series[257];
+        memset(series, 'z', slen);
+        series[slen] = '\0';
+        struct unmarshal_test data = {
+            .cases = { { .type = 'g', .series = series, .body = "ab" } },
+            .nexpect = 1,
+        };
+        char msg[GATHER_MSG_HDR_MAXSIZE + 2];
+        size_t n = marshal_gather(msg, series, slen, 2);
+        ASSERT(n == 1 + 5 + slen + 8);
+        memcpy(&msg[n], "ab", 2);
+        dc_unmarshal_t u2 = {0};
+        int ret = unmarshal(&u2, msg, n + 2, on_unmarshal, &data);
+        unmarshal_free(&u2);
+        ASSERT(ret == 0);
         ASSERT(data.nchecked == data.nexpect);
         ASSERT(!data.fail);
     }
 
+    // but no longer than that
+    {
+        struct unmarshal_test data = { .nexpect = 0 };
+        dc_unmarshal_t u2 = {0};
+        char msg[] = "g" "\xfe\xff\xff\x01\x01" "x";
+        int ret = unmarshal(&u2, msg, sizeof(msg) - 1, on_unmarshal, &data);
+        unmarshal_free(&u2);
+        ASSERT(ret != 0);
+    }
+
 done:
     unmarshal_free(&u);
+    intern_free(&tx);
+    intern_free(&rx);
+    return retval;
+}
+
+static int test_slab(void){
+    int retval = 0;
+    dc_slab_t slab = {0};
+
+    // a freed block comes back for any size in its class
+    char *a = slab_alloc(&slab, 100);
+    ASSERT(a);
+    memset(a, 'a', 100);
+    slab_free(&slab, a);
+    char *b = slab_alloc(&slab, 128);
+    ASSERT(b == a);
+    memset(b, 'b', 128);
+
+    // but not for a bigger class
+    char *c = slab_alloc(&slab, 129);
+    ASSERT(c && c != b);
+    memset(c, 'c', 129);
+
+    // too big for any class, and still freeable
+    size_t big = ((size_t)1 << (SLAB_MIN_SHIFT + SLAB_NCLASSES)) + 1;
+    char *d = slab_alloc(&slab, big);
+    ASSERT(d);
+    memset(d, 'd', big);
+    slab_free(&slab, d);
+
+    // idle blocks are capped
+    char *e[SLAB_KEEP_MIN + 2];
+    for(size_t i = 0; i < SLAB_KEEP_MIN + 2; i++){
+        e[i] = slab_alloc(&slab, 1024 * 1024);
+        ASSERT(e[i]);
+    }
+    for(size_t i = 0; i < SLAB_KEEP_MIN + 2; i++) slab_free(&slab, e[i]);
+    ASSERT(slab.nfree[SLAB_NCLASSES - 1] == SLAB_KEEP_MIN);
+
+    slab_free(&slab, b);
+    slab_free(&slab, c);
+    slab_free(&slab, NULL);
+
+done:
+    slab_release(&slab);
+    return retval;
+}
+
+static int test_reduce(void){
+    int retval = 0;
+    const char *best = dc_reduce_isa();
+    const char *isas[] = {"scalar", "sse4.2", "avx2", "avx512f"};
+    #define N 37  // odd, to exercise the scalar tails
+
+    // some hand-checked scalar results
+    ASSERT(dc_reduce_use("scalar") == 0);
+    {
+        float d[2] = {1.5f, -1.0f};
+        float s[2] = {2.25f, 4.0f};
+        dc_reduce(DC_DTYPE_F32, DC_REDUCE_SUM, (char*)d, (char*)s, 2);
+        ASSERT(d[0] == 3.75f && d[1] == 3.0f);
+    }
+    {
+        int32_t d[2] = {INT32_MAX, -7};
+        int32_t s[2] = {1, 3};
+        dc_reduce(DC_DTYPE_I32, DC_REDUCE_SUM, (char*)d, (char*)s, 2);
+        ASSERT(d[0] == INT32_MIN && d[1] == -4);
+    }
+    {
+        // bf16 1.0 + 1.0 = 2.0; 1.0 * 3.0 = 3.0
+        uint16_t d[2] = {0x3f80, 0x3f80};
+        uint16_t s[2] = {0x3f80, 0x4040};
+        dc_reduce(DC_DTYPE_BF16, DC_REDUCE_SUM, (char*)d, (char*)s, 1);
+        dc_reduce(DC_DTYPE_BF16, DC_REDUCE_PROD, (char*)&d[1], (char*)&s[1], 1);
+        ASSERT(d[0] == 0x4000 && d[1] == 0x4040);
+    }
+    {
+        // f16 1.0 + 1.0 = 2.0; 65504 + 16 rounds to inf
+        uint16_t d[2] = {0x3c00, 0x7bff};
+        uint16_t s[2] = {0x3c00, 0x4c00};
+        dc_reduce(DC_DTYPE_F16, DC_REDUCE_SUM, (char*)d, (char*)s, 2);
+        ASSERT(d[0] == 0x4000 && d[1] == 0x7c00);
+    }
+
+    // every isa must agree bitwise with the scalar kernels
+    for(int dtype = 0; dtype < 6; dtype++){
+        size_t esize = dc_dtype_size((dc_dtype_e)dtype);
+        for(int reduce = 0; reduce < 4; reduce++){
+            char a[N*8], b[N*8], want[N*8], got[N*8];
+            for(size_t i = 0; i < N; i++){
+                // small mixed-sign values, valid for every dtype
+                int x = (int)(i * 7 % 11) - 5;
+                int y = (int)(i * 3 % 13) - 6;
+                switch((dc_dtype_e)dtype){
+                    case DC_DTYPE_F32:
+                        ((float*)a)[i] = (float)x * 0.5f;
+                        ((float*)b)[i] = (float)y * 0.25f;
+                        break;
+                    case DC_DTYPE_F64:
+                        ((double*)a)[i] = (double)x * 0.5;
+                        ((double*)b)[i] = (double)y * 0.25;
+                        break;
+                    case DC_DTYPE_I32:
+                        ((int32_t*)a)[i] = x * 1000003;
+                        ((int32_t*)b)[i] = y * 999983;
+                        break;
+                    case DC_DTYPE_I64:
+                        ((int64_t*)a)[i] = (int64_t)x * ((int64_t)1 << 40);
+                        ((int64_t*)b)[i] = (int64_t)y * ((int64_t)1 << 33);
+                        break;
+                    case DC_DTYPE_BF16:
+                        // a few bf16 values with low mantissa bits set
+                        ((uint16_t*)a)[i] = (uint16_t)(0x3f81 + x * 0x23);
+                        ((uint16_t*)b)[i] = (uint16_t)(0xbf83 + y * 0x11);
+                        break;
+                    case DC_DTYPE_F16:
+                        // and f16 values, some of them subnormal
+                        ((uint16_t*)a)[i] = (uint16_t)(0x3c01 + x * 0x231);
+                        ((uint16_t*)b)[i] = (uint16_t)(0x8203 + y * 0x47);
+                        break;
+                }
+            }
+            ASSERT(dc_reduce_use("scalar") == 0);
+            memcpy(want, a, N * esize);
+            dc_reduce(dtype, reduce, want, b, N);
+            for(size_t k = 1; k < sizeof(isas)/sizeof(*isas); k++){
+                // skip what this cpu can't run
+                if(dc_reduce_use(isas[k])) continue;
+                memcpy(got, a, N * esize);
+                dc_reduce(dtype, reduce, got, b, N);
+                if(memcmp(got, want, N * esize) != 0){
+                    printf(
+                        "%s disagrees with scalar: dtype=%d reduce=%d\n",
+                        isas[k], dtype, reduce
+                    );
+                    retval = 1;
+                }
+            }
+        }
+    }
+
+    #undef N
+done:
+    dc_reduce_use(best);
+    return retval;
+}
+
+static int test_wire(void){
+    int retval = 0;
+    const char *best = dc_reduce_isa();
+    const char *isas[] = {"scalar", "sse4.2", "avx2", "avx512f"};
+    #define N 41
+
+    ASSERT(dc_wire_valid(DC_DTYPE_F32, DC_DTYPE_BF16));
+    ASSERT(dc_wire_valid(DC_DTYPE_F32, DC_DTYPE_F16));
+    ASSERT(dc_wire_valid(DC_DTYPE_F64, DC_DTYPE_F32));
+    ASSERT(!dc_wire_valid(DC_DTYPE_F32, DC_DTYPE_F32));
+    ASSERT(!dc_wire_valid(DC_DTYPE_I32, DC_DTYPE_F16));
+    ASSERT(!dc_wire_valid(DC_DTYPE_F64, DC_DTYPE_BF16));
+
+    // some hand-checked f16 roundings
+    ASSERT(dc_reduce_use("scalar") == 0);
+    {
+        float f[8] = {
+            1.0f, -2.5f, 65504.0f, 65520.0f,
+            // the smallest subnormal, a tie that rounds to zero, and a tie
+            // between subnormals that rounds to even
+            0x1p-24f, 0x1p-25f, 0x3p-25f, 1.0f + 0x1p-11f,
+        };
+        uint16_t want[8] = {
+            0x3c00, 0xc100, 0x7bff, 0x7c00, 0x0001, 0x0000, 0x0002, 0x3c00,
+        };
+        uint16_t h[8];
+        dc_wire_pack(DC_DTYPE_F32, DC_DTYPE_F16, (char*)h, (char*)f, 8);
+        ASSERT(memcmp(h, want, sizeof(h)) == 0);
+        float back[8];
+        dc_wire_unpack(DC_DTYPE_F32, DC_DTYPE_F16, (char*)back, (char*)h, 8);
+        ASSERT(back[0] == 1.0f && back[4] == 0x1p-24f && back[6] == 0x1p-23f);
+    }
+
+    // every isa must agree bitwise with the scalar conversions
+    dc_dtype_e pairs[3][2] = {
+        {DC_DTYPE_F32, DC_DTYPE_BF16},
+        {DC_DTYPE_F32, DC_DTYPE_F16},
+        {DC_DTYPE_F64, DC_DTYPE_F32},
+    };
+    for(size_t p = 0; p < 3; p++){
+        dc_dtype_e dtype = pairs[p][0];
+        dc_dtype_e wire = pairs[p][1];
+        size_t esize = dc_dtype_size(dtype);
+        size_t wsize = dc_dtype_size(wire);
+        char src[N*8], want[N*8], got[N*8], wback[N*8], gback[N*8];
+        for(size_t i = 0; i < N; i++){
+            // a spread of magnitudes, with low mantissa bits set
+            double x = ((double)i - 20.0) * 1.2345678901 * (double)(1 << i % 9);
+            if(i % 5 == 0) x *= 1e-6;
+            if(i == 3) x = 1e300;
+            if(dtype == DC_DTYPE_F32) ((float*)src)[i] = (float)x;
+            else ((double*)src)[i] = x;
+        }
+        ASSERT(dc_reduce_use("scalar") == 0);
+        dc_wire_pack(dtype, wire, want, src, N);
+        dc_wire_unpack(dtype, wire, wback, want, N);
+        for(size_t k = 1; k < sizeof(isas)/sizeof(*isas); k++){
+            if(dc_reduce_use(isas[k])) continue;
+            dc_wire_pack(dtype, wire, got, src, N);
+            dc_wire_unpack(dtype, wire, gback, got, N);
+            if(
+                memcmp(got, want, N * wsize) != 0
+                || memcmp(gback, wback, N * esize) != 0
+            ){
+                printf(
+                    "%s disagrees with scalar: dtype=%d wire=%d\n",
+                    isas[k], (int)dtype, (int)wire
+                );
+                retval = 1;
+            }
+        }
+        // and a round trip is what the far side would see
+        memcpy(got, src, N * esize);
+        dc_wire_round(dtype, wire, got, N);
+        ASSERT(memcmp(got, wback, N * esize) == 0);
+    }
+
+    #undef N
+done:
+    dc_reduce_use(best);
+    return retval;
+}
+
+static int test_config(void){
+    int retval = 0;
+    dc_config_t cfg;
+
+    // negative, overflowing or oversized values keep the default
+    setenv("DCTX_CHUNK_BYTES", "-1", 1);
+    setenv("DCTX_RING_MIN_BYTES", "99999999999999999999999", 1);
+    setenv("DCTX_CORK_BYTES", " 5", 1);
+    setenv("DCTX_FEATURES", "4294967296", 1);
+    dc_config_load(&cfg);
+    ASSERT(cfg.chunk_bytes == 256 * 1024);
+    ASSERT(cfg.ring_min_bytes == 64 * 1024);
+    ASSERT(cfg.cork_bytes == 64 * 1024);
+    ASSERT(cfg.features == FEAT_ALL);
+
+    unsetenv("DCTX_RING_MIN_BYTES");
+    unsetenv("DCTX_CORK_BYTES");
+    setenv("DCTX_CHUNK_BYTES", "0", 1);
+    setenv("DCTX_FEATURES", "4294967295", 1);
+    dc_config_load(&cfg);
+    ASSERT(cfg.chunk_bytes == 0);
+    ASSERT(cfg.features == FEAT_ALL);
+
+done:
+    unsetenv("DCTX_CHUNK_BYTES");
+    unsetenv("DCTX_RING_MIN_BYTES");
+    unsetenv("DCTX_CORK_BYTES");
+    unsetenv("DCTX_FEATURES");
     return retval;
 }
 
@@ -356,15 +831,1524 @@ done:
     return retval;
 }
 
-int main(void){
-    signal(SIGPIPE, SIG_IGN);
+// every rank reads its DCTX_* settings in dctx_open
+static int run_allreduce(const char *svc){
+    int retval = 0;
+    dc_result_t *r0 = NULL;
+    dc_result_t *r1 = NULL;
+    dc_result_t *r2 = NULL;
+    dc_result_t *rm0 = NULL;
+    dc_result_t *rm1 = NULL;
+    dc_result_t *rm2 = NULL;
+    dctx_t *chief = NULL;
+    dctx_t *worker1 = NULL;
+    dctx_t *worker2 = NULL;
+    int ret;
+
+    // big enough to need more than one read
+    #define N 100000
+    float *in[3];
+    for(int r = 0; r < 3; r++){
+        in[r] = malloc(N * sizeof(float));
+        if(!in[r]) exit(2);
+        for(size_t i = 0; i < N; i++) in[r][i] = (float)((int)i % 100 + r);
+    }
+
+    ret = dctx_open(&chief, 0, 3, 0, 0, 0, 0, "localhost", svc);
+    if(ret) return 1;
+    ret = dctx_open(&worker1, 1, 3, 1, 0, 0, 0, "localhost", svc);
+    if(ret) return 1;
+    ret = dctx_open(&worker2, 2, 3, 2, 0, 0, 0, "localhost", svc);
+    if(ret) return 1;
+
+    size_t len = N * sizeof(float);
+    int32_t m0[3] = {1, 50, -3};
+    int32_t m1[3] = {7, 2, -9};
+    int32_t m2[3] = {4, 60, -1};
+
+    // workers may submit before the chief, and ops are matched per-series
+    dc_op_t *a1 = dctx_allreduce_nofree(
+        worker1, "g", 1, (char*)in[1], len, DC_DTYPE_F32, DC_REDUCE_SUM
+    );
+    dc_op_t *m1op = dctx_allreduce_copy(
+        worker1, "m", 1, (char*)m1, sizeof(m1), DC_DTYPE_I32, DC_REDUCE_MAX
+    );
+    dc_op_t *a0 = dctx_allreduce_nofree(
+        chief, "g", 1, (char*)in[0], len, DC_DTYPE_F32, DC_REDUCE_SUM
+    );
+    dc_op_t *m0op = dctx_allreduce_copy(
+        chief, "m", 1, (char*)m0, sizeof(m0), DC_DTYPE_I32, DC_REDUCE_MAX
+    );
+    dc_op_t *m2op = dctx_allreduce_copy(
+        worker2, "m", 1, (char*)m2, sizeof(m2), DC_DTYPE_I32, DC_REDUCE_MAX
+    );
+    dc_op_t *a2 = dctx_allreduce_nofree(
+        worker2, "g", 1, (char*)in[2], len, DC_DTYPE_F32, DC_REDUCE_SUM
+    );
+    ASSERT(dc_op_ok(a0));
+    ASSERT(dc_op_ok(a1));
+    ASSERT(dc_op_ok(a2));
+    ASSERT(dc_op_ok(m0op));
+    ASSERT(dc_op_ok(m1op));
+    ASSERT(dc_op_ok(m2op));
+
+    // a length that isn't a whole number of elements is rejected up front
+    ASSERT(!dc_op_ok(dctx_allreduce_copy(
+        worker1, "bad", 3, "abc", 3, DC_DTYPE_F32, DC_REDUCE_SUM
+    )));
+
+    r0 = dc_op_await(a0);
+    r1 = dc_op_await(a1);
+    r2 = dc_op_await(a2);
+    dc_result_t *rs[3] = {r0, r1, r2};
+    for(int r = 0; r < 3; r++){
+        ASSERT(dc_result_ok(rs[r]));
+        ASSERT(dc_result_count(rs[r]) == 1);
+        ASSERT(dc_result_len(rs[r], 0) == len);
+        const float *out = (const float*)dc_result_peek(rs[r], 0);
+        for(size_t i = 0; i < N; i++){
+            float want = (float)(3 * ((int)i % 100) + 3);
+            ASSERT(out[i] == want);
+        }
+    }
+
+    rm0 = dc_op_await(m0op);
+    rm1 = dc_op_await(m1op);
+    rm2 = dc_op_await(m2op);
+    dc_result_t *rms[3] = {rm0, rm1, rm2};
+    for(int r = 0; r < 3; r++){
+        ASSERT(dc_result_ok(rms[r]));
+        ASSERT(dc_result_count(rms[r]) == 1);
+        ASSERT(dc_result_len(rms[r], 0) == sizeof(m0));
+        const int32_t *out = (const int32_t*)dc_result_peek(rms[r], 0);
+        ASSERT(out[0] == 7 && out[1] == 60 && out[2] == -1);
+    }
+
+    #undef N
+done:
+    dc_result_free(&r0);
+    dc_result_free(&r1);
+    dc_result_free(&r2);
+    dc_result_free(&rm0);
+    dc_result_free(&rm1);
+    dc_result_free(&rm2);
+    dctx_close(&chief);
+    dctx_close(&worker1);
+    dctx_close(&worker2);
+    for(int r = 0; r < 3; r++) free(in[r]);
+    return retval;
+}
+
+static int test_allreduce(void){
+    int retval = 0;
+
+    // everything through the chief
+    setenv("DCTX_RING", "0", 1);
+    ASSERT(run_allreduce("1235") == 0);
+    unsetenv("DCTX_RING");
+
+    // the default: big allreduces around the ring, small ones through the chief
+    ASSERT(run_allreduce("1236") == 0);
+
+    // everything around the ring, even chunks of a single element
+    setenv("DCTX_RING_MIN_BYTES", "0", 1);
+    ASSERT(run_allreduce("1237") == 0);
+    unsetenv("DCTX_RING_MIN_BYTES");
+
+    // the default again, over shared-memory rings that keep filling up
+    setenv("DCTX_SHM_RING_BYTES", "4096", 1);
+    ASSERT(run_allreduce("1245") == 0);
+
+done:
+    unsetenv("DCTX_RING");
+    unsetenv("DCTX_RING_MIN_BYTES");
+    unsetenv("DCTX_SHM_RING_BYTES");
+    return retval;
+}
+
+static int run_wire(const char *svc){
+    int retval = 0;
+    dc_result_t *rs[4] = {0};
+    dc_result_t *rd[4] = {0};
+    dctx_t *dctx[4] = {0};
+    float *in[4] = {0};
+    double *din[4] = {0};
+    int ret;
+
+    #define N 30000
+    for(int r = 0; r < 4; r++){
+        ret = dctx_open(&dctx[r], r, 4, r, 0, 0, 0, "localhost", svc);
+        if(ret) return 1;
+        ASSERT(dctx_wire_dtype(dctx[r], "w", 1, DC_DTYPE_BF16) == 0);
+        ASSERT(dctx_wire_dtype(dctx[r], "d", 1, DC_DTYPE_F32) == 0);
+        // f64 has no bf16 form, so this series stays exact
+        ASSERT(dctx_wire_dtype(dctx[r], "x", 1, DC_DTYPE_BF16) == 0);
+    }
+    ASSERT(dctx_wire_dtype(dctx[0], "bad", 3, (dc_dtype_e)99) != 0);
+    for(int r = 0; r < 4; r++){
+        // nothing here survives the trip to bf16 unrounded
+        in[r] = malloc(N * sizeof(float));
+        din[r] = malloc(N * sizeof(double));
+        ASSERT(in[r] && din[r]);
+        for(size_t i = 0; i < N; i++){
+            in[r][i] = 1.0f + (float)i * 0.001f + (float)r * 0.0001f;
+            din[r][i] = 1.0 + (double)i * 1e-9 + (double)r * 1e-12;
+        }
+    }
+
+    // f32 as bf16: an allreduce
+    dc_op_t *ops[4];
+    for(int r = 0; r < 4; r++){
+        ops[r] = dctx_allreduce_nofree(
+            dctx[r], "w", 1, (char*)in[r], N * sizeof(float),
+            DC_DTYPE_F32, DC_REDUCE_SUM
+        );
+        ASSERT(dc_op_ok(ops[r]));
+    }
+    for(int r = 0; r < 4; r++){
+        rs[r] = dc_op_await(ops[r]);
+        ASSERT(dc_result_ok(rs[r]));
+        ASSERT(dc_result_len(rs[r], 0) == N * sizeof(float));
+    }
+    const float *out = (const float*)dc_result_peek(rs[0], 0);
+    for(int r = 1; r < 4; r++){
+        // every rank ends up with the same bits
+        const void *other = dc_result_peek(rs[r], 0);
+        ASSERT(memcmp(other, out, N * sizeof(float)) == 0);
+    }
+    for(size_t i = 0; i < N; i++){
+        float want = 0;
+        for(int r = 0; r < 4; r++) want += in[r][i];
+        // a few bf16 roundings, with 8 bits of mantissa each
+        float err = out[i] - want;
+        ASSERT(err <= want * 0x1p-6f && -err <= want * 0x1p-6f);
+        // and the result is what came over the wire
+        uint16_t h;
+        float back;
+        dc_wire_pack(
+            DC_DTYPE_F32, DC_DTYPE_BF16, (char*)&h, (const char*)&out[i], 1
+        );
+        dc_wire_unpack(
+            DC_DTYPE_F32, DC_DTYPE_BF16, (char*)&back, (char*)&h, 1
+        );
+        ASSERT(back == out[i]);
+    }
+
+    // f64 as f32: a reduce-scatter, then an allreduce that stays exact
+    for(int r = 0; r < 4; r++){
+        ops[r] = dctx_reduce_scatter_nofree(
+            dctx[r], "d", 1, (char*)din[r], N * sizeof(double),
+            DC_DTYPE_F64, DC_REDUCE_SUM
+        );
+        ASSERT(dc_op_ok(ops[r]));
+    }
+    for(int r = 0; r < 4; r++){
+        rd[r] = dc_op_await(ops[r]);
+        ASSERT(dc_result_ok(rd[r]));
+        ASSERT(dc_result_len(rd[r], 0) == N / 4 * sizeof(double));
+        const double *dout = (const double*)dc_result_peek(rd[r], 0);
+        for(size_t i = 0; i < N / 4; i++){
+            size_t j = (size_t)r * (N / 4) + i;
+            double want = 0;
+            for(int k = 0; k < 4; k++) want += din[k][j];
+            double err = dout[i] - want;
+            ASSERT(err <= want * 0x1p-20 && -err <= want * 0x1p-20);
+        }
+        dc_result_free(&rd[r]);
+    }
+    for(int r = 0; r < 4; r++){
+        ops[r] = dctx_allreduce_nofree(
+            dctx[r], "x", 1, (char*)din[r], N * sizeof(double),
+            DC_DTYPE_F64, DC_REDUCE_MAX
+        );
+        ASSERT(dc_op_ok(ops[r]));
+    }
+    for(int r = 0; r < 4; r++){
+        rd[r] = dc_op_await(ops[r]);
+        ASSERT(dc_result_ok(rd[r]));
+        const double *dout = (const double*)dc_result_peek(rd[r], 0);
+        for(size_t i = 0; i < N; i++) ASSERT(dout[i] == din[3][i]);
+    }
+
+    #undef N
+done:
+    for(int r = 0; r < 4; r++){
+        dc_result_free(&rs[r]);
+        dc_result_free(&rd[r]);
+        dctx_close(&dctx[r]);
+        free(in[r]);
+        free(din[r]);
+    }
+    return retval;
+}
+
+static int test_wire_dtype(void){
+    int retval = 0;
+
+    // through the chief
+    setenv("DCTX_RING", "0", 1);
+    ASSERT(run_wire("1257") == 0);
+    unsetenv("DCTX_RING");
+
+    // around the ring
+    setenv("DCTX_RING_MIN_BYTES", "0", 1);
+    ASSERT(run_wire("1258") == 0);
+
+done:
+    unsetenv("DCTX_RING");
+    unsetenv("DCTX_RING_MIN_BYTES");
+    return retval;
+}
+
+static int run_reduce_scatter(const char *svc){
+    int retval = 0;
+    dc_result_t *rs[3] = {0};
+    dctx_t *dctx[3] = {0};
+    int ret;
+
+    // 3 ranks, each getting a chunk of K floats
+    #define K 1000
+    float in[3][3 * K];
+    for(int r = 0; r < 3; r++){
+        for(size_t i = 0; i < 3 * K; i++){
+            in[r][i] = (float)(r * 10000 + (int)i);
+        }
+    }
+
+    for(int r = 0; r < 3; r++){
+        ret = dctx_open(&dctx[r], r, 3, r, 0, 0, 0, "localhost", svc);
+        if(ret) return 1;
+    }
+
+    // every length must split into whole elements per rank
+    ASSERT(!dc_op_ok(dctx_reduce_scatter_copy(
+        dctx[1], "bad", 3, (char*)in[1], 8, DC_DTYPE_F32, DC_REDUCE_SUM
+    )));
+
+    // workers may submit before the chief
+    dc_op_t *ops[3];
+    size_t len = sizeof(in[0]);
+    ops[2] = dctx_reduce_scatter_nofree(
+        dctx[2], "rs", 2, (char*)in[2], len, DC_DTYPE_F32, DC_REDUCE_SUM
+    );
+    ops[0] = dctx_reduce_scatter_copy(
+        dctx[0], "rs", 2, (char*)in[0], len, DC_DTYPE_F32, DC_REDUCE_SUM
+    );
+    ops[1] = dctx_reduce_scatter_nofree(
+        dctx[1], "rs", 2, (char*)in[1], len, DC_DTYPE_F32, DC_REDUCE_SUM
+    );
+    for(int r = 0; r < 3; r++) ASSERT(dc_op_ok(ops[r]));
+
+    for(int r = 0; r < 3; r++){
+        rs[r] = dc_op_await(ops[r]);
+        ASSERT(dc_result_ok(rs[r]));
+        ASSERT(dc_result_count(rs[r]) == 1);
+        ASSERT(dc_result_len(rs[r], 0) == K * sizeof(float));
+        const float *out = (const float*)dc_result_peek(rs[r], 0);
+        for(size_t i = 0; i < K; i++){
+            float want = (float)(30000 + 3 * (r * K + (int)i));
+            ASSERT(out[i] == want);
+        }
+    }
+
+    #undef K
+done:
+    for(int r = 0; r < 3; r++){
+        dc_result_free(&rs[r]);
+        dctx_close(&dctx[r]);
+    }
+    return retval;
+}
+
+static int test_reduce_scatter(void){
+    int retval = 0;
+
+    // through the chief
+    setenv("DCTX_RING", "0", 1);
+    ASSERT(run_reduce_scatter("1238") == 0);
+    unsetenv("DCTX_RING");
+
+    // around the ring
+    setenv("DCTX_RING_MIN_BYTES", "0", 1);
+    ASSERT(run_reduce_scatter("1239") == 0);
+
+done:
+    unsetenv("DCTX_RING");
+    unsetenv("DCTX_RING_MIN_BYTES");
+    return retval;
+}
+
+static int test_scatter(void){
+    int retval = 0;
+    dc_result_t *rs[3] = {0};
+    dctx_t *dctx[3] = {0};
+    int ret;
+
+    for(int r = 0; r < 3; r++){
+        ret = dctx_open(&dctx[r], r, 3, r, 0, 0, 0, "localhost", "1240");
+        if(ret) return 1;
+    }
+
+    const char *bufs[3] = {"slice0", "slice one", ""};
+    size_t lens[3] = {6, 9, 0};
+
+    // a worker may call before the chief has sent anything
+    dc_op_t *op1 = dctx_scatter(dctx[1], "s", 1, NULL, NULL);
+    dc_op_t *op0 = dctx_scatter_copy(dctx[0], "s", 1, bufs, lens);
+    dc_op_t *op2 = dctx_scatter(dctx[2], "s", 1, NULL, NULL);
+    ASSERT(dc_op_ok(op0));
+    ASSERT(dc_op_ok(op1));
+    ASSERT(dc_op_ok(op2));
+
+    // the chief has to say what goes where
+    ASSERT(!dc_op_ok(dctx_scatter(dctx[0], "bad", 3, NULL, NULL)));
+
+    rs[0] = dc_op_await(op0);
+    rs[1] = dc_op_await(op1);
+    rs[2] = dc_op_await(op2);
+    for(int r = 0; r < 3; r++){
+        ASSERT(dc_result_ok(rs[r]));
+        ASSERT(dc_result_count(rs[r]) == 1);
+        ASSERT(dc_result_len(rs[r], 0) == lens[r]);
+        ASSERT(memcmp(dc_result_peek(rs[r], 0), bufs[r], lens[r]) == 0);
+    }
+
+done:
+    for(int r = 0; r < 3; r++){
+        dc_result_free(&rs[r]);
+        dctx_close(&dctx[r]);
+    }
+    return retval;
+}
+
+static bool op_is_ready(dctx_t *dctx, dc_op_t *op){
+    pthread_mutex_lock(&dctx->mutex);
+    bool out = op->ready;
+    pthread_mutex_unlock(&dctx->mutex);
+    return out;
+}
+
+static int test_barrier(void){
+    int retval = 0;
+    dctx_t *dctx[3] = {0};
+    int ret;
+
+    for(int r = 0; r < 3; r++){
+        ret = dctx_open(&dctx[r], r, 3, r, 0, 0, 0, "localhost", "1241");
+        if(ret) return 1;
+    }
+
+    // nobody gets through until the last rank arrives
+    dc_op_t *b1 = dctx_barrier(dctx[1], "step", 4);
+    dc_op_t *b0 = dctx_barrier(dctx[0], "step", 4);
+    ASSERT(dc_op_ok(b0));
+    ASSERT(dc_op_ok(b1));
+    usleep(50000);
+    ASSERT(!op_is_ready(dctx[0], b0));
+    ASSERT(!op_is_ready(dctx[1], b1));
+    dc_op_t *b2 = dctx_barrier(dctx[2], "step", 4);
+    ASSERT(dc_op_ok(b2));
+
+    ASSERT(dc_op_await(b0) == &DC_RESULT_EMPTY);
+    ASSERT(dc_op_await(b1) == &DC_RESULT_EMPTY);
+    ASSERT(dc_op_await(b2) == &DC_RESULT_EMPTY);
 
+    // the same series can be reused right away, in any order
+    for(int i = 0; i < 3; i++){
+        dc_op_t *ops[3];
+        for(int r = 2; r >= 0; r--){
+            ops[r] = dctx_barrier(dctx[r], "step", 4);
+            ASSERT(dc_op_ok(ops[r]));
+        }
+        for(int r = 0; r < 3; r++){
+            ASSERT(dc_op_await(ops[r]) == &DC_RESULT_EMPTY);
+        }
+    }
+
+done:
+    for(int r = 0; r < 3; r++) dctx_close(&dctx[r]);
+    return retval;
+}
+
+static int run_tree_broadcast(const char *svc){
     int retval = 0;
-    #define RUN(fn) do{if(fn()){printf(#fn " failed\n"); retval = 1;}}while(0)
+    dc_result_t *rs[5] = {0};
+    dctx_t *dctx[5] = {0};
+    char *big = NULL;
+    int ret;
+
+    for(int r = 0; r < 5; r++){
+        ret = dctx_open(&dctx[r], r, 5, r, 0, 0, 0, "localhost", svc);
+        if(ret) return 1;
+    }
+
+    // big enough to go down the tree
+    size_t len = 300000;
+    big = malloc(len);
+    ASSERT(big);
+    for(size_t i = 0; i < len; i++) big[i] = (char)(i * 7);
+
+    // round 0: some workers call first; round 1: the chief calls first
+    for(int round = 0; round < 2; round++){
+        dc_op_t *ops[5];
+        int split = round == 0 ? 3 : 1;
+        for(int r = 1; r < split; r++){
+            ops[r] = dctx_broadcast(dctx[r], "t", 1, NULL, 0);
+        }
+        ops[0] = dctx_broadcast_copy(dctx[0], "t", 1, big, len);
+        for(int r = split; r < 5; r++){
+            ops[r] = dctx_broadcast(dctx[r], "t", 1, NULL, 0);
+        }
+        for(int r = 0; r < 5; r++){
+            ASSERT(dc_op_ok(ops[r]));
+        }
+        for(int r = 0; r < 5; r++){
+            rs[r] = dc_op_await(ops[r]);
+            ASSERT(dc_result_ok(rs[r]));
+            ASSERT(dc_result_count(rs[r]) == 1);
+            ASSERT(dc_result_len(rs[r], 0) == len);
+            ASSERT(memcmp(dc_result_peek(rs[r], 0), big, len) == 0);
+            dc_result_free(&rs[r]);
+        }
+    }
+
+    // small payloads still go straight from the chief
+    dc_op_t *ops[5];
+    for(int r = 0; r < 5; r++){
+        ops[r] = dctx_broadcast_copy(dctx[r], "t", 1, "tiny", 4);
+        ASSERT(dc_op_ok(ops[r]));
+    }
+    for(int r = 0; r < 5; r++){
+        rs[r] = dc_op_await(ops[r]);
+        ASSERT(dc_result_ok(rs[r]));
+        ASSERT(dc_result_len(rs[r], 0) == 4);
+        ASSERT(memcmp(dc_result_peek(rs[r], 0), "tiny", 4) == 0);
+        dc_result_free(&rs[r]);
+    }
+
+done:
+    for(int r = 0; r < 5; r++){
+        dc_result_free(&rs[r]);
+        dctx_close(&dctx[r]);
+    }
+    if(big) free(big);
+    return retval;
+}
+
+static int test_tree_broadcast(void){
+    return run_tree_broadcast("1242");
+}
+
+// 3 nodes of 4 ranks each, laid out node by node
+#define HIER_LS 4
+#define HIER_CS 3
+#define HIER_N (HIER_LS * HIER_CS)
+
+static int run_hier(const char *svc){
+    int retval = 0;
+    dc_result_t *rs[HIER_N] = {0};
+    dctx_t *dctx[HIER_N] = {0};
+    dc_op_t *ops[HIER_N];
+    char mine[HIER_N][16];
+    size_t minelen[HIER_N];
+    int ret;
+
+    for(int r = 0; r < HIER_N; r++){
+        ret = dctx_open(
+            &dctx[r],
+            r,
+            HIER_N,
+            r % HIER_LS,
+            HIER_LS,
+            r / HIER_LS,
+            HIER_CS,
+            "localhost",
+            svc
+        );
+        if(ret) return 1;
+        int n = snprintf(mine[r], sizeof(mine[r]), "rank %d", r * 7);
+        minelen[r] = (size_t)n;
+    }
+    for(int r = 0; r < HIER_N; r++){
+        ASSERT(dctx[r]->hier);
+    }
+
+    // gather: leaders and members call both before and after their node
+    for(int round = 0; round < 2; round++){
+        for(int i = 0; i < HIER_N; i++){
+            int r = round == 0 ? i : HIER_N - 1 - i;
+            ops[r] = dctx_gather_nofree(dctx[r], "g", 1, mine[r], minelen[r]);
+            ASSERT(dc_op_ok(ops[r]));
+        }
+        rs[0] = dc_op_await(ops[0]);
+        ASSERT(dc_result_ok(rs[0]));
+        ASSERT(dc_result_count(rs[0]) == HIER_N);
+        for(int r = 0; r < HIER_N; r++){
+            ASSERT(dc_result_len(rs[0], (size_t)r) == minelen[r]);
+            ASSERT(
+                memcmp(dc_result_peek(rs[0], (size_t)r), mine[r], minelen[r])
+                == 0
+            );
+        }
+        dc_result_free(&rs[0]);
+        for(int r = 1; r < HIER_N; r++){
+            ASSERT(dc_op_await(ops[r]) == &DC_RESULT_EMPTY);
+        }
+    }
+
+    // allgather: every rank sees every rank's data
+    for(int round = 0; round < 2; round++){
+        for(int i = 0; i < HIER_N; i++){
+            int r = round == 0 ? i : HIER_N - 1 - i;
+            ops[r] = dctx_allgather_copy(
+                dctx[r], "a", 1, mine[r], minelen[r]
+            );
+            ASSERT(dc_op_ok(ops[r]));
+        }
+        for(int r = 0; r < HIER_N; r++){
+            rs[r] = dc_op_await(ops[r]);
+            ASSERT(dc_result_ok(rs[r]));
+            ASSERT(dc_result_count(rs[r]) == HIER_N);
+            for(int j = 0; j < HIER_N; j++){
+                ASSERT(dc_result_len(rs[r], (size_t)j) == minelen[j]);
+                const char *got = dc_result_peek(rs[r], (size_t)j);
+                ASSERT(memcmp(got, mine[j], minelen[j]) == 0);
+            }
+            dc_result_free(&rs[r]);
+        }
+    }
+
+    // broadcast: even small ones go one copy per node
+    for(int r = HIER_N - 1; r >= 0; r--){
+        ops[r] = dctx_broadcast_copy(dctx[r], "b", 1, "hello", 5);
+        ASSERT(dc_op_ok(ops[r]));
+    }
+    for(int r = 0; r < HIER_N; r++){
+        rs[r] = dc_op_await(ops[r]);
+        ASSERT(dc_result_ok(rs[r]));
+        ASSERT(dc_result_len(rs[r], 0) == 5);
+        ASSERT(memcmp(dc_result_peek(rs[r], 0), "hello", 5) == 0);
+        dc_result_free(&rs[r]);
+    }
+
+done:
+    for(int r = 0; r < HIER_N; r++){
+        dc_result_free(&rs[r]);
+        dctx_close(&dctx[r]);
+    }
+    return retval;
+}
+
+static int test_hier(void){
+    setenv("DCTX_HIER", "1", 1);
+    int retval = run_hier("1243");
+    unsetenv("DCTX_HIER");
+    return retval;
+}
+
+static int test_shm(void){
+    int retval = 0;
+    dc_result_t *rs[3] = {0};
+    dctx_t *dctx[3] = {0};
+    char *big[3] = {0};
+    int ret;
+
+    // rings much smaller than one message, so writers must wait for readers
+    setenv("DCTX_SHM", "1", 1);
+    setenv("DCTX_SHM_RING_BYTES", "4096", 1);
+    for(int r = 0; r < 3; r++){
+        ret = dctx_open(&dctx[r], r, 3, r, 0, 0, 0, "localhost", "1244");
+        if(ret) return 1;
+    }
+
+    size_t len = 100000;
+    for(int r = 0; r < 3; r++){
+        big[r] = malloc(len);
+        ASSERT(big[r]);
+        for(size_t i = 0; i < len; i++) big[r][i] = (char)(i * 3 + (size_t)r);
+    }
+
+    dc_op_t *ops[3];
+    for(int r = 2; r >= 0; r--){
+        ops[r] = dctx_allgather_nofree(dctx[r], "a", 1, big[r], len);
+        ASSERT(dc_op_ok(ops[r]));
+    }
+    for(int r = 0; r < 3; r++){
+        rs[r] = dc_op_await(ops[r]);
+        ASSERT(dc_result_ok(rs[r]));
+        ASSERT(dc_result_count(rs[r]) == 3);
+        for(int j = 0; j < 3; j++){
+            ASSERT(dc_result_len(rs[r], (size_t)j) == len);
+            ASSERT(memcmp(dc_result_peek(rs[r], (size_t)j), big[j], len) == 0);
+        }
+        dc_result_free(&rs[r]);
+    }
+
+    // every link to the chief switched over before the results came back
+    for(int r = 1; r < 3; r++){
+        ASSERT(shm_active(&dctx[r]->tcp));
+        ASSERT(shm_active(&dctx[0]->server.peers[r]->tcp));
+    }
+
+done:
+    unsetenv("DCTX_SHM");
+    unsetenv("DCTX_SHM_RING_BYTES");
+    for(int r = 0; r < 3; r++){
+        dc_result_free(&rs[r]);
+        dctx_close(&dctx[r]);
+        if(big[r]) free(big[r]);
+    }
+    return retval;
+}
+
+static int run_alltoall(const char *svc){
+    int retval = 0;
+    dc_result_t *rs[4] = {0};
+    dctx_t *dctx[4] = {0};
+    int ret;
+
+    for(int r = 0; r < 4; r++){
+        ret = dctx_open(&dctx[r], r, 4, r, 0, 0, 0, "localhost", svc);
+        if(ret) return 1;
+    }
+
+    // rank r sends "r->j" to rank j, except that 2->1 is empty
+    char text[4][4][8];
+    const char *bufs[4][4];
+    size_t lens[4][4];
+    for(int r = 0; r < 4; r++){
+        for(int j = 0; j < 4; j++){
+            int n = snprintf(text[r][j], sizeof(text[r][j]), "%d->%d", r, j);
+            bufs[r][j] = text[r][j];
+            lens[r][j] = r == 2 && j == 1 ? 0 : (size_t)n;
+        }
+    }
+
+    // two rounds on one series, called in a different order each time
+    for(int round = 0; round < 2; round++){
+        dc_op_t *ops[4];
+        for(int i = 0; i < 4; i++){
+            int r = round == 0 ? 3 - i : i;
+            ops[r] = dctx_alltoall_copy(dctx[r], "x", 1, bufs[r], lens[r]);
+            ASSERT(dc_op_ok(ops[r]));
+        }
+        for(int r = 0; r < 4; r++){
+            rs[r] = dc_op_await(ops[r]);
+            ASSERT(dc_result_ok(rs[r]));
+            ASSERT(dc_result_count(rs[r]) == 4);
+            for(int i = 0; i < 4; i++){
+                ASSERT(dc_result_len(rs[r], (size_t)i) == lens[i][r]);
+                const char *got = dc_result_peek(rs[r], (size_t)i);
+                ASSERT(memcmp(got, bufs[i][r], lens[i][r]) == 0);
+            }
+            dc_result_free(&rs[r]);
+        }
+    }
+
+    // every rank has to say what goes where
+    ASSERT(!dc_op_ok(dctx_alltoall(dctx[1], "bad", 3, NULL, NULL)));
+
+done:
+    for(int r = 0; r < 4; r++){
+        dc_result_free(&rs[r]);
+        dctx_close(&dctx[r]);
+    }
+    return retval;
+}
+
+static int test_alltoall(void){
+    int retval = 0;
+
+    // every pair of ranks has a direct link
+    ASSERT(run_alltoall("1246") == 0);
+
+    // only ring links, so the chief passes 1->3 and 3->1 on
+    setenv("DCTX_P2P", "0", 1);
+    setenv("DCTX_TREE", "0", 1);
+    ASSERT(run_alltoall("1247") == 0);
+
+done:
+    unsetenv("DCTX_P2P");
+    unsetenv("DCTX_TREE");
+    return retval;
+}
+
+static int run_send_recv(const char *svc){
+    int retval = 0;
+    dc_result_t *rs[4] = {0};
+    dctx_t *dctx[4] = {0};
+    int ret;
+
+    for(int r = 0; r < 4; r++){
+        ret = dctx_open(&dctx[r], r, 4, r, 0, 0, 0, "localhost", svc);
+        if(ret) return 1;
+    }
+
+    // a pipeline 0 -> 1 -> 2 -> 3 -> 0, where 1 and 3 recv before the send
+    dc_op_t *recv1 = dctx_recv(dctx[1], 0, "act", 3);
+    dc_op_t *recv3 = dctx_recv(dctx[3], 2, "act", 3);
+    dc_op_t *sends[4];
+    for(int r = 0; r < 4; r++){
+        char msg[16];
+        int n = snprintf(msg, sizeof(msg), "stage %d", r);
+        sends[r] = dctx_send_copy(
+            dctx[r], (r + 1) % 4, "act", 3, msg, (size_t)n
+        );
+        ASSERT(dc_op_ok(sends[r]));
+    }
+    dc_op_t *recv2 = dctx_recv(dctx[2], 1, "act", 3);
+    dc_op_t *recv0 = dctx_recv(dctx[0], 3, "act", 3);
+    dc_op_t *recvs[4] = {recv0, recv1, recv2, recv3};
+    for(int r = 0; r < 4; r++){
+        ASSERT(dc_op_ok(recvs[r]));
+        rs[r] = dc_op_await(recvs[r]);
+        ASSERT(dc_result_ok(rs[r]));
+        ASSERT(dc_result_count(rs[r]) == 1);
+        char want[16];
+        int n = snprintf(want, sizeof(want), "stage %d", (r + 3) % 4);
+        ASSERT(dc_result_len(rs[r], 0) == (size_t)n);
+        ASSERT(memcmp(dc_result_peek(rs[r], 0), want, (size_t)n) == 0);
+        dc_result_free(&rs[r]);
+    }
+    for(int r = 0; r < 4; r++){
+        rs[r] = dc_op_await(sends[r]);
+        ASSERT(dc_result_ok(rs[r]));
+        ASSERT(dc_result_count(rs[r]) == 0);
+        dc_result_free(&rs[r]);
+    }
+
+    /* 3 -> 1 is not a ring link: three messages, where tags keep their own
+       order and an empty message is still a message */
+    dc_op_t *s[3];
+    s[0] = dctx_send_nofree(dctx[3], 1, "a", 1, "first", 5);
+    s[1] = dctx_send_copy(dctx[3], 1, "b", 1, "", 0);
+    s[2] = dctx_send_copy(dctx[3], 1, "a", 1, "second", 6);
+    for(int i = 0; i < 3; i++) ASSERT(dc_op_ok(s[i]));
+    dc_op_t *rb = dctx_recv(dctx[1], 3, "b", 1);
+    dc_op_t *ra1 = dctx_recv(dctx[1], 3, "a", 1);
+    dc_op_t *ra2 = dctx_recv(dctx[1], 3, "a", 1);
+    rs[0] = dc_op_await(ra1);
+    ASSERT(dc_result_ok(rs[0]));
+    ASSERT(zstrneq(dc_result_peek(rs[0], 0), 5, "first", 5));
+    rs[1] = dc_op_await(ra2);
+    ASSERT(dc_result_ok(rs[1]));
+    ASSERT(zstrneq(dc_result_peek(rs[1], 0), 6, "second", 6));
+    rs[2] = dc_op_await(rb);
+    ASSERT(dc_result_ok(rs[2]));
+    ASSERT(dc_result_len(rs[2], 0) == 0);
+    for(int i = 0; i < 3; i++){
+        dc_result_free(&rs[i]);
+        rs[i] = dc_op_await(s[i]);
+        ASSERT(dc_result_ok(rs[i]));
+        dc_result_free(&rs[i]);
+    }
+
+    // nobody talks to themselves or to ranks that don't exist
+    ASSERT(!dc_op_ok(dctx_send_copy(dctx[1], 1, "x", 1, "x", 1)));
+    ASSERT(!dc_op_ok(dctx_send_copy(dctx[1], 4, "x", 1, "x", 1)));
+    ASSERT(!dc_op_ok(dctx_recv(dctx[1], -1, "x", 1)));
+
+done:
+    for(int r = 0; r < 4; r++){
+        dc_result_free(&rs[r]);
+        dctx_close(&dctx[r]);
+    }
+    return retval;
+}
+
+static int test_send_recv(void){
+    int retval = 0;
+
+    // every pair of ranks has a direct link
+    ASSERT(run_send_recv("1248") == 0);
+
+    // only ring links, so the chief passes 3->1 on
+    setenv("DCTX_P2P", "0", 1);
+    setenv("DCTX_TREE", "0", 1);
+    ASSERT(run_send_recv("1249") == 0);
+
+done:
+    unsetenv("DCTX_P2P");
+    unsetenv("DCTX_TREE");
+    return retval;
+}
+
+// allgather contributions of mixed sizes, some too big to send whole
+static int run_chunked_allgather(const char *svc){
+    int retval = 0;
+    dc_result_t *rs[4] = {0};
+    dctx_t *dctx[4] = {0};
+    char *data[4] = {0};
+    size_t lens[4] = {50000, 20000, 100, 30001};
+    int ret;
+
+    for(int r = 0; r < 4; r++){
+        ret = dctx_open(&dctx[r], r, 4, r, 0, 0, 0, "localhost", svc);
+        if(ret) return 1;
+    }
+    for(int r = 0; r < 4; r++){
+        data[r] = malloc(lens[r]);
+        ASSERT(data[r]);
+        for(size_t i = 0; i < lens[r]; i++){
+            data[r][i] = (char)(i * 5 + (size_t)r);
+        }
+    }
+
+    // round 0: the chief calls last; round 1: the chief calls first
+    for(int round = 0; round < 2; round++){
+        dc_op_t *ops[4];
+        for(int i = 0; i < 4; i++){
+            int r = round == 0 ? 3 - i : i;
+            ops[r] = dctx_allgather_nofree(dctx[r], "a", 1, data[r], lens[r]);
+            ASSERT(dc_op_ok(ops[r]));
+        }
+        for(int r = 0; r < 4; r++){
+            rs[r] = dc_op_await(ops[r]);
+            ASSERT(dc_result_ok(rs[r]));
+            ASSERT(dc_result_count(rs[r]) == 4);
+            for(int j = 0; j < 4; j++){
+                ASSERT(dc_result_len(rs[r], (size_t)j) == lens[j]);
+                const char *got = dc_result_peek(rs[r], (size_t)j);
+                ASSERT(memcmp(got, data[j], lens[j]) == 0);
+            }
+            dc_result_free(&rs[r]);
+        }
+    }
+
+done:
+    for(int r = 0; r < 4; r++){
+        dc_result_free(&rs[r]);
+        dctx_close(&dctx[r]);
+        if(data[r]) free(data[r]);
+    }
+    return retval;
+}
+
+static int test_chunks(void){
+    int retval = 0;
+
+    // every tree broadcast is dozens of chunks
+    setenv("DCTX_HIER", "1", 1);
+    setenv("DCTX_CHUNK_BYTES", "4096", 1);
+    ASSERT(run_tree_broadcast("1250") == 0);
+    ASSERT(run_chunked_allgather("1251") == 0);
+
+    // even the hier allgather results are chunked on their way down
+    setenv("DCTX_CHUNK_BYTES", "64", 1);
+    ASSERT(run_hier("1252") == 0);
+
+done:
+    unsetenv("DCTX_HIER");
+    unsetenv("DCTX_CHUNK_BYTES");
+    return retval;
+}
+
+static int test_lz(void){
+    int retval = 0;
+    size_t n = 100000;
+    char *src = malloc(n);
+    char *z = malloc(n);
+    char *out = malloc(n);
+    ASSERT(src && z && out);
+
+    // empty and tiny inputs are all literals
+    size_t zlen = lz_compress("", 0, z, 16);
+    ASSERT(zlen == 1);
+    ASSERT(lz_decompress(z, zlen, out, 0) == 0);
+    zlen = lz_compress("abc", 3, z, 16);
+    ASSERT(zlen == 4);
+    ASSERT(lz_decompress(z, zlen, out, 3) == 0);
+    ASSERT(memcmp(out, "abc", 3) == 0);
+    // but do not fit in less than that
+    ASSERT(lz_compress("abc", 3, z, 3) == 0);
+
+    // repetitive data shrinks a lot, including overlapping matches
+    for(size_t i = 0; i < n; i++) src[i] = (char)(i % 1000 < 500 ? 'a' : i);
+    zlen = lz_compress(src, n, z, n - n / 8);
+    ASSERT(zlen > 0 && zlen < n / 10);
+    ASSERT(lz_decompress(z, zlen, out, n) == 0);
+    ASSERT(memcmp(out, src, n) == 0);
+    // the wrong len is an error
+    ASSERT(lz_decompress(z, zlen, out, n - 1) != 0);
+
+    // random data does not, so it is not worth sending compressed
+    srand(7);
+    for(size_t i = 0; i < n; i++) src[i] = (char)rand();
+    ASSERT(lz_compress(src, n, z, n - n / 8) == 0);
+
+    // a corrupt block is rejected, not followed
+    char bad[] = "\x00\x10\x00";
+    ASSERT(lz_decompress(bad, 3, out, 8) != 0);
+    char far[] = "\x10x\x05\x00";
+    ASSERT(lz_decompress(far, 4, out, 5) != 0);
+
+done:
+    free(src);
+    free(z);
+    free(out);
+    return retval;
+}
+
+static int run_compress_gather(const char *svc){
+    int retval = 0;
+    dc_result_t *rs[3] = {0};
+    dctx_t *dctx[3] = {0};
+    char *data[3] = {0};
+    size_t len = 50000;
+    int ret;
+
+    for(int r = 0; r < 3; r++){
+        ret = dctx_open(&dctx[r], r, 3, r, 0, 0, 0, "localhost", svc);
+        if(ret) return 1;
+    }
+    // rank 1 compresses "g" and rank 2 does not
+    ASSERT(dctx_compress(dctx[1], "g", 1, true) == 0);
+    ASSERT(dctx_compress(dctx[2], "g", 1, false) == 0);
+    ASSERT(dctx_compress(dctx[2], "other", 5, true) == 0);
+    ASSERT(dctx_compress(dctx[2], "g", 1, false) == 0);
+
+    // rank 1's data compresses, rank 2's does not
+    srand(11);
+    for(int r = 0; r < 3; r++){
+        data[r] = malloc(len);
+        ASSERT(data[r]);
+        for(size_t i = 0; i < len; i++){
+            data[r][i] = r == 2 ? (char)rand() : (char)(i / 100);
+        }
+    }
+
+    dc_op_t *ops[3];
+    for(int r = 0; r < 3; r++){
+        ops[r] = dctx_gather_nofree(dctx[r], "g", 1, data[r], len);
+        ASSERT(dc_op_ok(ops[r]));
+    }
+    ASSERT(ops[1]->compress);
+    ASSERT(!ops[2]->compress);
+    for(int r = 0; r < 3; r++){
+        rs[r] = dc_op_await(ops[r]);
+        ASSERT(dc_result_ok(rs[r]));
+    }
+    ASSERT(dc_result_count(rs[0]) == 3);
+    for(int j = 0; j < 3; j++){
+        ASSERT(dc_result_len(rs[0], (size_t)j) == len);
+        ASSERT(memcmp(dc_result_peek(rs[0], (size_t)j), data[j], len) == 0);
+    }
+
+done:
+    for(int r = 0; r < 3; r++){
+        dc_result_free(&rs[r]);
+        dctx_close(&dctx[r]);
+        if(data[r]) free(data[r]);
+    }
+    return retval;
+}
+
+static int test_compress(void){
+    int retval = 0;
+
+    // a compressed gather, fed a byte at a time
+    {
+        struct unmarshal_test data = {
+            .cases = { { .type = 'g', .series = "ser", .body = "aaaaaaaaaa" } },
+            .nexpect = 1,
+        };
+        char msg[GATHER_MSG_HDR_MAXSIZE + ZBODY_HDR_SIZE + 16];
+        size_t n = marshal_gather(msg, "ser", 3, 10);
+        size_t zlen = lz_compress(
+            "aaaaaaaaaa", 10, &msg[n + ZBODY_HDR_SIZE], 16
+        );
+        ASSERT(zlen > 0);
+        marshal_compressed(msg, n, &msg[n], 10, zlen);
+        dc_unmarshal_t u = {0};
+        for(size_t i = 0; i < n + ZBODY_HDR_SIZE + zlen; i++){
+            int ret = unmarshal(&u, &msg[i], 1, on_unmarshal, &data);
+            if(ret) unmarshal_free(&u);
+            ASSERT(ret == 0);
+        }
+        unmarshal_free(&u);
+        ASSERT(data.nchecked == data.nexpect);
+        ASSERT(!data.fail);
+
+        // a body that claims to inflate too far is rejected
+        marshal_compressed(msg, n, &msg[n], 1 << 30, zlen);
+        int ret = unmarshal(
+            &u, msg, n + ZBODY_HDR_SIZE + zlen, on_unmarshal, &data
+        );
+        unmarshal_free(&u);
+        ASSERT(ret != 0);
+    }
+
+    // the shared-memory links would not compress anything
+    setenv("DCTX_SHM", "0", 1);
+    ASSERT(run_compress_gather("1253") == 0);
+
+    setenv("DCTX_COMPRESS", "1", 1);
+    setenv("DCTX_COMPRESS_MIN_BYTES", "64", 1);
+    ASSERT(run_tree_broadcast("1254") == 0);
+    ASSERT(run_allreduce("1255") == 0);
+    // compressed chunks, forwarded as they land
+    setenv("DCTX_CHUNK_BYTES", "4096", 1);
+    ASSERT(run_chunked_allgather("1256") == 0);
+
+done:
+    unsetenv("DCTX_SHM");
+    unsetenv("DCTX_COMPRESS");
+    unsetenv("DCTX_COMPRESS_MIN_BYTES");
+    unsetenv("DCTX_CHUNK_BYTES");
+    return retval;
+}
+
+static int test_stripes(void){
+    int retval = 0;
+
+    // a gather striped three ways, then a plain one behind it
+    {
+        struct unmarshal_test data = {
+            .cases = {
+                { .type = 'g', .series = "ser", .body = "abcdefghij" },
+                { .type = 'g', .series = "ser", .body = "xyz" },
+            },
+            .nexpect = 2,
+        };
+        const char *body = "abcdefghij";
+        char msg[2 * GATHER_MSG_HDR_MAXSIZE + 16];
+        size_t n = marshal_gather(msg, "ser", 3, 10);
+        marshal_striped(msg, n, 3);
+        size_t off[3];
+        size_t slen[3];
+        for(size_t k = 0; k < 3; k++){
+            slen[k] = stripe_slice(10, 3, k, &off[k]);
+        }
+        ASSERT(off[0] == 0 && off[1] + slen[1] == off[2]);
+        ASSERT(off[2] + slen[2] == 10);
+        memcpy(&msg[n], body, slen[0]);
+        n += slen[0];
+        n += marshal_gather(&msg[n], "ser", 3, 3);
+        memcpy(&msg[n], "xyz", 3);
+        n += 3;
+
+        dc_slices_t slices = {0};
+        dc_unmarshal_t u = { .slices = &slices };
+        // everything waits for the missing slices, a byte at a time or not
+        for(size_t i = 0; i < 5; i++){
+            ASSERT(unmarshal(&u, &msg[i], 1, on_unmarshal, &data) == 0);
+        }
+        ASSERT(unmarshal(&u, &msg[5], n - 5, on_unmarshal, &data) == 0);
+        ASSERT(data.nchecked == 0);
+        ASSERT(unmarshal_body_space(&u, 0, &n) == NULL);
+        // slices may land in any order
+        char *copy = bytesdup(&body[off[2]], slen[2]);
+        ASSERT(copy);
+        ASSERT(slices_push(&slices, 2, copy, slen[2]) == 0);
+        ASSERT(unmarshal(&u, NULL, 0, on_unmarshal, &data) == 0);
+        ASSERT(data.nchecked == 0);
+        copy = bytesdup(&body[off[1]], slen[1]);
+        ASSERT(copy);
+        ASSERT(slices_push(&slices, 1, copy, slen[1]) == 0);
+        ASSERT(unmarshal(&u, NULL, 0, on_unmarshal, &data) == 0);
+        ASSERT(data.nchecked == 2);
+        ASSERT(!data.fail);
+        ASSERT(u.held.end == 0);
+
+        // a slice of the wrong size is rejected
+        n = marshal_gather(msg, "ser", 3, 10);
+        marshal_striped(msg, n, 2);
+        memcpy(&msg[n], body, 5);
+        copy = bytesdup(body, 4);
+        ASSERT(copy);
+        ASSERT(slices_push(&slices, 1, copy, 4) == 0);
+        int ret = unmarshal(&u, msg, n + 5, on_unmarshal, &data);
+        unmarshal_free(&u);
+        slices_free(&slices);
+        ASSERT(ret != 0);
+
+        // and so is any striped body on a link without extra connections
+        u.slices = NULL;
+        ret = unmarshal(&u, msg, n + 5, on_unmarshal, &data);
+        unmarshal_free(&u);
+        ASSERT(ret != 0);
+    }
+
+    // no shared memory, so every link to the chief goes over the stripes
+    setenv("DCTX_SHM", "0", 1);
+    setenv("DCTX_STRIPES", "3", 1);
+    setenv("DCTX_STRIPE_MIN_BYTES", "1000", 1);
+    ASSERT(run_tree_broadcast("1259") == 0);
+    ASSERT(run_allreduce("1260") == 0);
+    // chunks are striped as they go
+    setenv("DCTX_CHUNK_BYTES", "4096", 1);
+    ASSERT(run_chunked_allgather("1261") == 0);
+    // and compressed bodies are striped after compression
+    setenv("DCTX_COMPRESS", "1", 1);
+    setenv("DCTX_COMPRESS_MIN_BYTES", "64", 1);
+    ASSERT(run_compress_gather("1262") == 0);
+
+done:
+    unsetenv("DCTX_SHM");
+    unsetenv("DCTX_STRIPES");
+    unsetenv("DCTX_STRIPE_MIN_BYTES");
+    unsetenv("DCTX_CHUNK_BYTES");
+    unsetenv("DCTX_COMPRESS");
+    unsetenv("DCTX_COMPRESS_MIN_BYTES");
+    return retval;
+}
+
+static int test_io_uring(void){
+    int retval = 0;
+
+    // on a kernel without io_uring, these just run over libuv again
+    setenv("DCTX_IO_URING", "1", 1);
+    ASSERT(run_allreduce("1263") == 0);
+    // many small writes batch up, and big ones are sent a piece at a time
+    setenv("DCTX_CHUNK_BYTES", "4096", 1);
+    ASSERT(run_chunked_allgather("1264") == 0);
+    unsetenv("DCTX_CHUNK_BYTES");
+    // a ring only carries doorbells for shared-memory links
+    ASSERT(run_tree_broadcast("1265") == 0);
+    // and extra connections read and write through it too
+    setenv("DCTX_SHM", "0", 1);
+    setenv("DCTX_STRIPES", "3", 1);
+    setenv("DCTX_STRIPE_MIN_BYTES", "1000", 1);
+    ASSERT(run_allreduce("1266") == 0);
+
+done:
+    unsetenv("DCTX_IO_URING");
+    unsetenv("DCTX_CHUNK_BYTES");
+    unsetenv("DCTX_SHM");
+    unsetenv("DCTX_STRIPES");
+    unsetenv("DCTX_STRIPE_MIN_BYTES");
+    return retval;
+}
+
+// many small sends queued back to back, which must arrive in order
+static int run_many_sends(const char *svc){
+    int retval = 0;
+    dc_result_t *r = NULL;
+    dctx_t *dctx[4] = {0};
+    dc_op_t *sends[4][200];
+    int ret;
+
+    for(int i = 0; i < 4; i++){
+        ret = dctx_open(&dctx[i], i, 4, i, 0, 0, 0, "localhost", svc);
+        if(ret) return 1;
+    }
+
+    // more than fit in a cork at once, to every rank's neighbor
+    for(int k = 0; k < 200; k++){
+        for(int i = 0; i < 4; i++){
+            char msg[16];
+            int n = snprintf(msg, sizeof(msg), "%d:%d", i, k);
+            sends[i][k] = dctx_send_copy(
+                dctx[i], (i + 1) % 4, "m", 1, msg, (size_t)n
+            );
+            ASSERT(dc_op_ok(sends[i][k]));
+        }
+    }
+    for(int k = 0; k < 200; k++){
+        for(int i = 0; i < 4; i++){
+            int from = (i + 3) % 4;
+            r = dc_op_await(dctx_recv(dctx[i], from, "m", 1));
+            ASSERT(dc_result_ok(r));
+            char want[16];
+            int n = snprintf(want, sizeof(want), "%d:%d", from, k);
+            const char *got = dc_result_peek(r, 0);
+            ASSERT(zstrneq(got, dc_result_len(r, 0), want, (size_t)n));
+            dc_result_free(&r);
+        }
+    }
+    for(int k = 0; k < 200; k++){
+        for(int i = 0; i < 4; i++){
+            r = dc_op_await(sends[i][k]);
+            ASSERT(dc_result_ok(r));
+            dc_result_free(&r);
+        }
+    }
+
+done:
+    dc_result_free(&r);
+    for(int i = 0; i < 4; i++) dctx_close(&dctx[i]);
+    return retval;
+}
+
+static int test_cork(void){
+    int retval = 0;
+
+    ASSERT(run_many_sends("1267") == 0);
+    // a cork that fills at every write
+    setenv("DCTX_CORK_BYTES", "8", 1);
+    ASSERT(run_many_sends("1268") == 0);
+    // and none at all
+    setenv("DCTX_CORK_BYTES", "0", 1);
+    ASSERT(run_many_sends("1269") == 0);
+    // corked frames on a link that also forwards big bodies in chunks
+    setenv("DCTX_CORK_BYTES", "65536", 1);
+    setenv("DCTX_CHUNK_BYTES", "4096", 1);
+    ASSERT(run_chunked_allgather("1270") == 0);
+
+done:
+    unsetenv("DCTX_CORK_BYTES");
+    unsetenv("DCTX_CHUNK_BYTES");
+    return retval;
+}
+
+// rank 2 offers less than the others, so its links do without
+static int run_mixed_features(const char *svc){
+    int retval = 0;
+    dc_result_t *rs[3] = {0};
+    dctx_t *dctx[3] = {0};
+    char *data = NULL;
+    size_t len = 50000;
+    int ret;
+
+    setenv("DCTX_COMPRESS", "1", 1);
+    setenv("DCTX_COMPRESS_MIN_BYTES", "64", 1);
+    for(int r = 0; r < 3; r++){
+        if(r == 2){
+            char buf[16];
+            snprintf(buf, sizeof(buf), "%u", FEAT_CHUNKS | FEAT_LEN64);
+            setenv("DCTX_FEATURES", buf, 1);
+            setenv("DCTX_FRAME_MAX", "100000", 1);
+        }
+        ret = dctx_open(&dctx[r], r, 3, r, 0, 0, 0, "localhost", svc);
+        if(ret) goto done;
+    }
+
+    data = malloc(len);
+    ASSERT(data);
+    for(size_t i = 0; i < len; i++) data[i] = (char)(i / 100);
+
+    // twice, so the second round would go by series id
+    for(int round = 0; round < 2; round++){
+        dc_op_t *ops[3];
+        for(int r = 0; r < 3; r++){
+            ops[r] = dctx_gather_nofree(dctx[r], "g", 1, data, len);
+            ASSERT(dc_op_ok(ops[r]));
+        }
+        for(int r = 0; r < 3; r++){
+            rs[r] = dc_op_await(ops[r]);
+            ASSERT(dc_result_ok(rs[r]));
+        }
+        ASSERT(dc_result_count(rs[0]) == 3);
+        for(int j = 0; j < 3; j++){
+            ASSERT(dc_result_len(rs[0], (size_t)j) == len);
+            ASSERT(memcmp(dc_result_peek(rs[0], (size_t)j), data, len) == 0);
+        }
+        for(int r = 0; r < 3; r++) dc_result_free(&rs[r]);
+    }
+
+    // both ends of each link settled on the same thing
+    uint32_t full = FEAT_ALL;
+    uint32_t less = FEAT_CHUNKS | FEAT_LEN64;
+    ASSERT(dctx[0]->server.peers[1]->state.caps.features == full);
+    ASSERT(dctx[0]->server.peers[2]->state.caps.features == less);
+    ASSERT(dctx[1]->client.state.caps.features == full);
+    ASSERT(dctx[2]->client.state.caps.features == less);
+    ASSERT(dctx[2]->client.state.caps.frame_max == FRAME_MAX);
+    // and the chief holds itself to rank 2's frame size
+    uv_tcp_t *tcp2 = &dctx[0]->server.peers[2]->tcp;
+    ASSERT(dctx[0]->server.peers[2]->state.caps.frame_max == 100000);
+    ASSERT(tcp_frame_check(tcp2, 100000) == 0);
+    ASSERT(tcp_frame_check(tcp2, 100001) != 0);
+    ASSERT(dctx[2]->client.state.unmarshal.len_max == 100000);
+
+done:
+    unsetenv("DCTX_COMPRESS");
+    unsetenv("DCTX_COMPRESS_MIN_BYTES");
+    unsetenv("DCTX_FEATURES");
+    unsetenv("DCTX_FRAME_MAX");
+    for(int r = 0; r < 3; r++){
+        dc_result_free(&rs[r]);
+        dctx_close(&dctx[r]);
+    }
+    if(data) free(data);
+    return retval;
+}
+
+static int test_hello(void){
+    int retval = 0;
+
+    ASSERT(run_mixed_features("1271") == 0);
+
+done:
+    return retval;
+}
+
+static int test_op_test(void){
+    int retval = 0;
+    dc_result_t *rs[2] = {0};
+    dctx_t *dctx[2] = {0};
+    int ret;
+
+    for(int r = 0; r < 2; r++){
+        ret = dctx_open(&dctx[r], r, 2, r, 0, 0, 0, "localhost", "1272");
+        if(ret) return 1;
+    }
+    int fd = dctx_fileno(dctx[0]);
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+    // the chief's gather waits for rank 1, and so does its fd
+    dc_op_t *op0 = dctx_gather_copy(dctx[0], "g", 1, "a", 1);
+    ASSERT(dc_op_ok(op0));
+    usleep(10000);
+    ASSERT(!dc_op_test(op0));
+    ASSERT(poll(&pfd, 1, 0) == 0);
+
+    dc_op_t *op1 = dctx_gather_copy(dctx[1], "g", 1, "b", 1);
+    ASSERT(dc_op_ok(op1));
+    ASSERT(poll(&pfd, 1, 5000) == 1);
+    uint64_t count;
+    ASSERT(read(fd, &count, sizeof(count)) == sizeof(count));
+    ASSERT(count >= 1);
+    ASSERT(dc_op_test(op0));
+    // reading cleared it
+    ASSERT(poll(&pfd, 1, 0) == 0);
+
+    rs[0] = dc_op_await(op0);
+    ASSERT(dc_result_ok(rs[0]));
+    ASSERT(dc_result_count(rs[0]) == 2);
+    rs[1] = dc_op_await(op1);
+    ASSERT(dc_result_ok(rs[1]));
+
+    // an op that failed to start is done already
+    ASSERT(dc_op_test(dctx_send_copy(dctx[1], 1, "x", 1, "x", 1)));
+
+done:
+    for(int r = 0; r < 2; r++){
+        dc_result_free(&rs[r]);
+        dctx_close(&dctx[r]);
+    }
+    return retval;
+}
+
+static int test_long_series(void){
+    int retval = 0;
+    dc_result_t *rs[3] = {0};
+    dctx_t *dctx[3] = {0};
+    dc_op_t *ops[3];
+    int ret;
+
+    for(int r = 0; r < 3; r++){
+        ret = dctx_open(&dctx[r], r, 3, r, 0, 0, 0, "localhost", "1273");
+        if(ret) return 1;
+    }
+
+    // the longest names there are, twice each so interned links reuse them
+    char series[257];
+    for(size_t slen = 255; slen <= 256; slen++){
+        memset(series, (int)('a' + slen % 26), slen);
+        series[slen] = '\0';
+        for(int round = 0; round < 2; round++){
+            for(int r = 0; r < 3; r++){
+                ops[r] = dctx_allgather_copy(dctx[r], series, slen, "x", 1);
+                ASSERT(dc_op_ok(ops[r]));
+            }
+            for(int r = 0; r < 3; r++){
+                rs[r] = dc_op_await(ops[r]);
+                ASSERT(dc_result_ok(rs[r]));
+                ASSERT(dc_result_count(rs[r]) == 3);
+                dc_result_free(&rs[r]);
+            }
+        }
+    }
+
+    // the chief's fan-out goes through the same write path as everything else
+    if(dctx[0]->cfg.intern){
+        dc_intern_t *tx = &dctx[0]->server.peers[1]->state.series_tx;
+        ASSERT(intern_find(tx, series, 256) != INTERN_NOID);
+    }
+
+done:
+    for(int r = 0; r < 3; r++){
+        dc_result_free(&rs[r]);
+        dctx_close(&dctx[r]);
+    }
+    return retval;
+}
+
+extern char **environ;
+
+// the DCTX_* settings ./test was run with, which every test gets back
+static char **env_saved;
+static size_t env_nsaved;
+
+static bool is_dctx_env(const char *entry){
+    return strncmp(entry, "DCTX_", 5) == 0;
+}
+
+static void env_save(void){
+    for(char **e = environ; *e; e++) env_nsaved += is_dctx_env(*e);
+    env_saved = calloc(env_nsaved + 1, sizeof(*env_saved));
+    if(!env_saved) exit(2);
+    size_t n = 0;
+    for(char **e = environ; *e; e++){
+        if(is_dctx_env(*e) && !(env_saved[n++] = strdup(*e))) exit(2);
+    }
+}
+
+// undo whatever settings a test pinned
+static void env_restore(void){
+    char name[256];
+    bool again = true;
+    while(again){
+        // unsetenv reshuffles environ, so start over after each one
+        again = false;
+        for(char **e = environ; *e; e++){
+            if(!is_dctx_env(*e)) continue;
+            size_t n = strcspn(*e, "=");
+            if(n >= sizeof(name)) continue;
+            memcpy(name, *e, n);
+            name[n] = '\0';
+            unsetenv(name);
+            again = true;
+            break;
+        }
+    }
+    for(size_t i = 0; i < env_nsaved; i++){
+        size_t n = strcspn(env_saved[i], "=");
+        if(n >= sizeof(name)) continue;
+        memcpy(name, env_saved[i], n);
+        name[n] = '\0';
+        setenv(name, env_saved[i] + n + 1, 1);
+    }
+}
+
+int main(void){
+    signal(SIGPIPE, SIG_IGN);
+    env_save();
+
+    int retval = 0;
+    #define RUN(fn) do{ \
+        if(fn()){printf(#fn " failed\n"); retval = 1;} \
+        env_restore(); \
+    }while(0)
 
     RUN(test_links);
     RUN(test_unmarshal);
+    RUN(test_slab);
+    RUN(test_intern);
+    RUN(test_reduce);
+    RUN(test_wire);
+    RUN(test_config);
     RUN(test_dctx);
+    RUN(test_allreduce);
+    RUN(test_wire_dtype);
+    RUN(test_reduce_scatter);
+    RUN(test_scatter);
+    RUN(test_barrier);
+    RUN(test_tree_broadcast);
+    RUN(test_hier);
+    RUN(test_shm);
+    RUN(test_alltoall);
+    RUN(test_send_recv);
+    RUN(test_chunks);
+    RUN(test_lz);
+    RUN(test_compress);
+    RUN(test_stripes);
+    RUN(test_io_uring);
+    RUN(test_cork);
+    RUN(test_hello);
+    RUN(test_op_test);
+    RUN(test_long_series);
 
     #undef RUN
     printf("%s\n", retval ? "FAIL" : "PASS");
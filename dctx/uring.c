@@ -0,0 +1,669 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+/* An io_uring moves the bytes of every established socket, while libuv keeps
+   everything else: connecting, accepting, timers, asyncs and closing.  The
+   ring's fd sits in the libuv loop as a uv_poll_t, so completions are handled
+   like any other event, and the submissions of one loop iteration go to the
+   kernel together, from a uv_prepare_t, just before the loop would block.
+
+   Each socket keeps one multishot recv armed, which picks its buffers from a
+   ring of buffers registered with the kernel, so reading costs no syscalls at
+   all.  Writes queue up per socket, and whenever none is in flight, the whole
+   queue goes out as a single sendmsg.
+
+   Without io_uring (or with DCTX_IO_URING unset), libuv does it all. */
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_ASYNC_CANCEL_ANY)
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define URING_ENTRIES 256
+// the registered buffers which receives land in
+#define URING_NBUFS 64
+#define URING_BUF_SIZE RBUF_MIN
+// no sendmsg gathers more than this many buffers
+#define URING_IOV_MAX 64
+
+// the low bit of a user_data says what the socket was doing
+#define TAG_RECV 0
+#define TAG_WRITE 1
+
+struct dc_usock {
+    // NULL once detached, which happens before libuv closes the socket
+    uv_tcp_t *tcp;
+    int fd;
+    bool reading;
+    bool writing;
+    // queued writes, the first of which may be partly written
+    link_t writes;  // dc_write_t->link
+    // the sendmsg in flight
+    struct msghdr msg;
+    struct iovec iov[URING_IOV_MAX];
+    link_t link;  // dc_uring_t->socks
+};
+DEF_CONTAINER_OF(dc_usock_t, link, link_t)
+
+struct dc_uring {
+    int fd;
+    uv_poll_t poll;
+    uv_prepare_t prepare;
+    bool handles_open;
+    // the submission queue
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_tail;
+    _Atomic unsigned *sq_flags;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries;
+    unsigned unsubmitted;
+    // the completion queue
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    // the mappings behind both queues
+    void *sq_map;
+    size_t sq_maplen;
+    void *cq_map;
+    size_t cq_maplen;
+    size_t sqes_maplen;
+    // the registered buffer ring, and the buffers in it
+    struct io_uring_buf_ring *br;
+    size_t br_maplen;
+    unsigned br_tail;
+    char *bufs;
+    // kernels before 6.0 have no multishot recv
+    bool no_multishot;
+    // requests the kernel has yet to finish
+    size_t inflight;
+    link_t socks;  // dc_usock_t->link
+};
+
+static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags){
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+// hand every queued sqe to the kernel
+static int uring_flush(dc_uring_t *ring){
+    while(ring->unsubmitted){
+        int ret = sys_enter(ring->fd, ring->unsubmitted, 0, 0);
+        if(ret < 0){
+            if(errno == EINTR) continue;
+            perror("io_uring_enter");
+            return 1;
+        }
+        if(ret == 0) break;
+        ring->unsubmitted -= (unsigned)ret;
+    }
+    return 0;
+}
+
+static struct io_uring_sqe *get_sqe(dc_uring_t *ring){
+    unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+    if(tail - head == ring->sq_entries){
+        // full, so submit early
+        if(uring_flush(ring)) return NULL;
+        head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+        if(tail - head == ring->sq_entries){
+            fprintf(stderr, "io_uring submission queue is stuck\n");
+            return NULL;
+        }
+    }
+    struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[tail & ring->sq_mask] = tail & ring->sq_mask;
+    return sqe;
+}
+
+// make the sqe from the last get_sqe visible to the kernel
+static void put_sqe(dc_uring_t *ring){
+    unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+    atomic_store_explicit(ring->sq_tail, tail + 1, memory_order_release);
+    ring->unsubmitted++;
+}
+
+static void buf_recycle(dc_uring_t *ring, unsigned bid){
+    struct io_uring_buf *buf = &ring->br->bufs[ring->br_tail & (URING_NBUFS-1)];
+    buf->addr = (uint64_t)(uintptr_t)&ring->bufs[(size_t)bid * URING_BUF_SIZE];
+    buf->len = URING_BUF_SIZE;
+    buf->bid = (uint16_t)bid;
+    ring->br_tail++;
+    atomic_store_explicit(
+        (_Atomic uint16_t*)&ring->br->tail,
+        (uint16_t)ring->br_tail,
+        memory_order_release
+    );
+}
+
+static int arm_recv(dc_uring_t *ring, dc_usock_t *s){
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if(!sqe) return 1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = s->fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    if(!ring->no_multishot) sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = (uint64_t)(uintptr_t)s | TAG_RECV;
+    put_sqe(ring);
+    s->reading = true;
+    ring->inflight++;
+    return 0;
+}
+
+// one sendmsg of as much of the queue as fits in s->iov
+static int submit_write(dc_uring_t *ring, dc_usock_t *s){
+    unsigned n = 0;
+    dc_write_t *w;
+    LINK_FOR_EACH(w, &s->writes, dc_write_t, link){
+        if(n + 2 > URING_IOV_MAX) break;
+        size_t off = w->off;
+        if(off < w->hdrlen){
+            s->iov[n++] = (struct iovec){ w->hdr + off, w->hdrlen - off };
+            off = 0;
+        }else{
+            off -= w->hdrlen;
+        }
+        if(w->len > off){
+            s->iov[n++] = (struct iovec){ w->base + off, w->len - off };
+        }
+    }
+
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if(!sqe) return 1;
+    s->msg = (struct msghdr){ .msg_iov = s->iov, .msg_iovlen = n };
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = s->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&s->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uint64_t)(uintptr_t)s | TAG_WRITE;
+    put_sqe(ring);
+    s->writing = true;
+    ring->inflight++;
+    return 0;
+}
+
+static void usock_maybe_free(dc_uring_t *ring, dc_usock_t *s){
+    if(s->tcp || s->reading || s->writing) return;
+    link_remove(&s->link);
+    (void)ring;
+    free(s);
+}
+
+// run the callbacks of every queued write, whether it was written or not
+static void fail_writes(dctx_t *dctx, dc_usock_t *s){
+    link_t *link;
+    while((link = link_list_pop_first(&s->writes))){
+        dc_write_t *w = CONTAINER_OF(link, dc_write_t, link);
+        dc_write_cb_run(dctx, w->cb);
+        dc_write_put(dctx, w);
+    }
+}
+
+static void on_write_done(dctx_t *dctx, dc_usock_t *s, int res){
+    dc_uring_t *ring = dctx->uring;
+    s->writing = false;
+    ring->inflight--;
+
+    // finish every write this covered
+    size_t n = res > 0 ? (size_t)res : 0;
+    while(n && !link_list_isempty(&s->writes)){
+        link_t *link = s->writes.next;
+        dc_write_t *w = CONTAINER_OF(link, dc_write_t, link);
+        size_t left = w->hdrlen + w->len - w->off;
+        if(n < left){
+            w->off += n;
+            break;
+        }
+        n -= left;
+        link_remove(link);
+        dc_write_cb_run(dctx, w->cb);
+        dc_write_put(dctx, w);
+    }
+
+    if(!s->tcp || dctx->closed){
+        fail_writes(dctx, s);
+        usock_maybe_free(ring, s);
+        return;
+    }
+
+    if(res <= 0){
+        fprintf(stderr, "write_cb: %s\n", strerror(res ? -res : EPIPE));
+        fail_writes(dctx, s);
+        // this may detach s, which is then gone
+        dctx->on_broken_connection(dctx, (uv_stream_t*)s->tcp);
+        dctx->failed = true;
+        close_everything(dctx);
+        return;
+    }
+
+    if(!link_list_isempty(&s->writes) && submit_write(ring, s)){
+        dctx->failed = true;
+        close_everything(dctx);
+    }
+}
+
+static void on_recv(dctx_t *dctx, dc_usock_t *s, struct io_uring_cqe *cqe){
+    dc_uring_t *ring = dctx->uring;
+    int res = cqe->res;
+
+    // s->reading stays set until after on_read, so a detach cannot free s
+    if(cqe->flags & IORING_CQE_F_BUFFER){
+        unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if(res > 0 && s->tcp && !dctx->closed){
+            char *buf = &ring->bufs[(size_t)bid * URING_BUF_SIZE];
+            dctx->on_read(dctx, (uv_stream_t*)s->tcp, buf, (size_t)res);
+        }
+        buf_recycle(ring, bid);
+    }
+
+    if(!(cqe->flags & IORING_CQE_F_MORE)){
+        // the kernel is done with this recv
+        s->reading = false;
+        ring->inflight--;
+    }
+
+    if(!s->tcp || dctx->closed){
+        usock_maybe_free(ring, s);
+        return;
+    }
+
+    if(res == 0 || res == -ECONNRESET){
+        // socket is closed
+        dctx->on_broken_connection(dctx, (uv_stream_t*)s->tcp);
+        return;
+    }
+    if(res == -EINVAL && !ring->no_multishot){
+        // an older kernel, so one recv at a time
+        ring->no_multishot = true;
+    }else if(res < 0 && res != -ENOBUFS){
+        fprintf(stderr, "read_cb: %s\n", strerror(-res));
+        dctx->failed = true;
+        close_everything(dctx);
+        return;
+    }
+
+    // rearm, unless the multishot recv is still armed
+    if(!s->reading && arm_recv(ring, s)){
+        dctx->failed = true;
+        close_everything(dctx);
+    }
+}
+
+static void dispatch(dctx_t *dctx, struct io_uring_cqe *cqe){
+    // cancellations have no user_data
+    if(!cqe->user_data) return;
+    dc_usock_t *s = (dc_usock_t*)(uintptr_t)(cqe->user_data & ~(uint64_t)1);
+    if(cqe->user_data & TAG_WRITE){
+        on_write_done(dctx, s, cqe->res);
+    }else{
+        on_recv(dctx, s, cqe);
+    }
+}
+
+static void uring_drain(dctx_t *dctx){
+    dc_uring_t *ring = dctx->uring;
+    while(true){
+        unsigned head = atomic_load_explicit(
+            ring->cq_head, memory_order_relaxed
+        );
+        unsigned tail = atomic_load_explicit(
+            ring->cq_tail, memory_order_acquire
+        );
+        if(head == tail){
+            // completions which overflowed the queue are flushed by an enter
+            unsigned flags = atomic_load_explicit(
+                ring->sq_flags, memory_order_relaxed
+            );
+            if(!(flags & IORING_SQ_CQ_OVERFLOW)) return;
+            if(sys_enter(ring->fd, 0, 0, IORING_ENTER_GETEVENTS) < 0){
+                perror("io_uring_enter");
+                return;
+            }
+            continue;
+        }
+        // copy it out first, since handling it may submit more
+        struct io_uring_cqe cqe = ring->cqes[head & ring->cq_mask];
+        atomic_store_explicit(ring->cq_head, head + 1, memory_order_release);
+        dispatch(dctx, &cqe);
+    }
+}
+
+static void uring_poll_cb(uv_poll_t *handle, int status, int events){
+    (void)events;
+    dctx_t *dctx = handle->loop->data;
+    if(status < 0){
+        uv_perror("uv_poll(io_uring)", status);
+        dctx->failed = true;
+        close_everything(dctx);
+        return;
+    }
+    uring_drain(dctx);
+}
+
+static void uring_prepare_cb(uv_prepare_t *handle){
+    dctx_t *dctx = handle->loop->data;
+    if(uring_flush(dctx->uring)){
+        dctx->failed = true;
+        close_everything(dctx);
+    }
+}
+
+static void uring_unmap(dc_uring_t *ring){
+    if(ring->bufs) free(ring->bufs);
+    if(ring->br) munmap(ring->br, ring->br_maplen);
+    if(ring->sqes) munmap(ring->sqes, ring->sqes_maplen);
+    if(ring->cq_map && ring->cq_map != ring->sq_map){
+        munmap(ring->cq_map, ring->cq_maplen);
+    }
+    if(ring->sq_map) munmap(ring->sq_map, ring->sq_maplen);
+    if(ring->fd >= 0) close(ring->fd);
+    free(ring);
+}
+
+// NULL if this kernel cannot give us a ring
+static dc_uring_t *uring_setup(void){
+    dc_uring_t *ring = malloc(sizeof(*ring));
+    if(!ring){
+        perror("malloc");
+        return NULL;
+    }
+    *ring = (dc_uring_t){ .fd = -1 };
+
+    struct io_uring_params p = {0};
+    ring->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if(ring->fd < 0){
+        perror("io_uring_setup");
+        goto fail;
+    }
+
+    ring->sq_maplen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_maplen = p.cq_off.cqes
+                      + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single && ring->cq_maplen > ring->sq_maplen){
+        ring->sq_maplen = ring->cq_maplen;
+    }
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_SHARED | MAP_POPULATE;
+    void *sq = mmap(
+        NULL, ring->sq_maplen, prot, flags, ring->fd, IORING_OFF_SQ_RING
+    );
+    if(sq == MAP_FAILED){
+        perror("mmap(io_uring)");
+        goto fail;
+    }
+    ring->sq_map = sq;
+    void *cq = sq;
+    if(!single){
+        cq = mmap(
+            NULL, ring->cq_maplen, prot, flags, ring->fd, IORING_OFF_CQ_RING
+        );
+        if(cq == MAP_FAILED){
+            perror("mmap(io_uring)");
+            goto fail;
+        }
+    }
+    ring->cq_map = cq;
+    ring->sqes_maplen = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(
+        NULL, ring->sqes_maplen, prot, flags, ring->fd, IORING_OFF_SQES
+    );
+    if(sqes == MAP_FAILED){
+        perror("mmap(io_uring)");
+        goto fail;
+    }
+    ring->sqes = sqes;
+
+    char *sqb = sq;
+    char *cqb = cq;
+    ring->sq_head = (_Atomic unsigned*)(sqb + p.sq_off.head);
+    ring->sq_tail = (_Atomic unsigned*)(sqb + p.sq_off.tail);
+    ring->sq_flags = (_Atomic unsigned*)(sqb + p.sq_off.flags);
+    ring->sq_mask = *(unsigned*)(sqb + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sqb + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->cq_head = (_Atomic unsigned*)(cqb + p.cq_off.head);
+    ring->cq_tail = (_Atomic unsigned*)(cqb + p.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(cqb + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cqb + p.cq_off.cqes);
+
+    // register a ring of receive buffers, then fill it
+    ring->br_maplen = URING_NBUFS * sizeof(struct io_uring_buf);
+    void *br = mmap(
+        NULL, ring->br_maplen, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    );
+    if(br == MAP_FAILED){
+        perror("mmap");
+        goto fail;
+    }
+    ring->br = br;
+    ring->bufs = malloc((size_t)URING_NBUFS * URING_BUF_SIZE);
+    if(!ring->bufs){
+        perror("malloc");
+        goto fail;
+    }
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uint64_t)(uintptr_t)br,
+        .ring_entries = URING_NBUFS,
+        .bgid = 0,
+    };
+    int ret = (int)syscall(
+        __NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1
+    );
+    if(ret < 0){
+        perror("io_uring_register(IORING_REGISTER_PBUF_RING)");
+        goto fail;
+    }
+    for(unsigned i = 0; i < URING_NBUFS; i++) buf_recycle(ring, i);
+
+    return ring;
+
+fail:
+    uring_unmap(ring);
+    return NULL;
+}
+
+int uring_init(dctx_t *dctx){
+    if(!dctx->cfg.io_uring) return 0;
+    dc_uring_t *ring = uring_setup();
+    if(!ring){
+        rprintf("io_uring is unavailable, using libuv for socket IO\n");
+        return 0;
+    }
+
+    int ret = uv_poll_init(&dctx->loop, &ring->poll, ring->fd);
+    if(ret < 0){
+        uv_perror("uv_poll_init", ret);
+        uring_unmap(ring);
+        return 1;
+    }
+    ret = uv_prepare_init(&dctx->loop, &ring->prepare);
+    if(ret < 0){
+        uv_perror("uv_prepare_init", ret);
+        uv_close((uv_handle_t*)&ring->poll, NULL);
+        uring_unmap(ring);
+        return 1;
+    }
+    ring->handles_open = true;
+    dctx->uring = ring;
+
+    ret = uv_poll_start(&ring->poll, UV_READABLE, uring_poll_cb);
+    if(ret < 0){
+        uv_perror("uv_poll_start", ret);
+        return 1;
+    }
+    ret = uv_prepare_start(&ring->prepare, uring_prepare_cb);
+    if(ret < 0){
+        uv_perror("uv_prepare_start", ret);
+        return 1;
+    }
+    return 0;
+}
+
+void uring_close(dctx_t *dctx){
+    dc_uring_t *ring = dctx->uring;
+    if(!ring || !ring->handles_open) return;
+    uv_close((uv_handle_t*)&ring->poll, noop_handle_closer);
+    uv_close((uv_handle_t*)&ring->prepare, noop_handle_closer);
+    ring->handles_open = false;
+}
+
+// after uring_close and after the loop has stopped
+void uring_free(dctx_t *dctx){
+    dc_uring_t *ring = dctx->uring;
+    if(!ring) return;
+
+    // whatever is still in flight can only end one way now
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if(sqe){
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+        put_sqe(ring);
+    }
+    if(uring_flush(ring)) ring->inflight = 0;
+    while(ring->inflight){
+        int ret = sys_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+        if(ret < 0 && errno != EINTR){
+            perror("io_uring_enter");
+            break;
+        }
+        uring_drain(dctx);
+    }
+
+    // sockets which were never detached
+    link_t *link;
+    while((link = link_list_pop_first(&ring->socks))){
+        dc_usock_t *s = CONTAINER_OF(link, dc_usock_t, link);
+        fail_writes(dctx, s);
+        free(s);
+    }
+    uring_unmap(ring);
+    dctx->uring = NULL;
+}
+
+bool uring_owns(uv_tcp_t *tcp){
+    dctx_t *dctx = tcp->loop->data;
+    return dctx->uring && tcp_link(tcp)->usock;
+}
+
+int uring_read_start(uv_tcp_t *tcp){
+    dctx_t *dctx = tcp->loop->data;
+    dc_uring_t *ring = dctx->uring;
+    dc_usock_t **slot = &tcp_link(tcp)->usock;
+    if(*slot){
+        RBUG("socket is already reading through io_uring");
+        return 1;
+    }
+
+    uv_os_fd_t fd;
+    int ret = uv_fileno((uv_handle_t*)tcp, &fd);
+    if(ret < 0){
+        uv_perror("uv_fileno", ret);
+        return 1;
+    }
+
+    dc_usock_t *s = malloc(sizeof(*s));
+    if(!s){
+        perror("malloc");
+        return 1;
+    }
+    *s = (dc_usock_t){ .tcp = tcp, .fd = fd };
+    link_list_append(&ring->socks, &s->link);
+    *slot = s;
+
+    return arm_recv(ring, s);
+}
+
+int uring_write(uv_tcp_t *tcp, dc_write_t *w){
+    dctx_t *dctx = tcp->loop->data;
+    dc_usock_t *s = tcp_link(tcp)->usock;
+    w->off = 0;
+    link_list_append(&s->writes, &w->link);
+    if(s->writing) return 0;
+    if(submit_write(dctx->uring, s)){
+        // the write is queued, so our caller must not clean it up
+        dctx->failed = true;
+        close_everything(dctx);
+    }
+    return 0;
+}
+
+void uring_detach(uv_tcp_t *tcp){
+    dctx_t *dctx = tcp->loop->data;
+    dc_uring_t *ring = dctx->uring;
+    if(!ring) return;
+    dc_usock_t **slot = &tcp_link(tcp)->usock;
+    dc_usock_t *s = *slot;
+    if(!s) return;
+    *slot = NULL;
+    s->tcp = NULL;
+
+    // cancel what is in flight right away, while s->fd is still this socket
+    if(s->reading || s->writing){
+        struct io_uring_sqe *sqe = get_sqe(ring);
+        if(sqe){
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = s->fd;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD
+                                | IORING_ASYNC_CANCEL_ALL;
+            put_sqe(ring);
+        }
+        if(uring_flush(ring)) dctx->failed = true;
+    }
+    usock_maybe_free(ring, s);
+}
+
+#else // no io_uring
+
+int uring_init(dctx_t *dctx){
+    if(dctx->cfg.io_uring){
+        rprintf("built without io_uring, using libuv for socket IO\n");
+    }
+    return 0;
+}
+
+void uring_close(dctx_t *dctx){
+    (void)dctx;
+}
+
+void uring_free(dctx_t *dctx){
+    (void)dctx;
+}
+
+bool uring_owns(uv_tcp_t *tcp){
+    (void)tcp;
+    return false;
+}
+
+int uring_read_start(uv_tcp_t *tcp){
+    (void)tcp;
+    return 1;
+}
+
+int uring_write(uv_tcp_t *tcp, dc_write_t *w){
+    (void)tcp;
+    (void)w;
+    return 1;
+}
+
+void uring_detach(uv_tcp_t *tcp){
+    (void)tcp;
+}
+
+#endif